@@ -11,9 +11,10 @@
 #include <stdexcept>
 using namespace std; // BAD PRACTICE
 
-template <typename Key>
-typename AVLTree<Key>::AVLNode* 
-AVLTree<Key>::search(typename AVLTree<Key>::AVLNode* node, Key key) 
+template <typename Key, typename Summary, typename Balance, typename Order>
+typename AVLTree<Key, Summary, Balance, Order>::AVLNode* 
+AVLTree<Key, Summary, Balance, Order>::search(AVLNode* node, const Key& key,
+                                              avl_generic_search)
 {
     while (node != NULL && node->key != key) {
         if (key < node->key) node = node->left;
@@ -22,235 +23,291 @@ AVLTree<Key>::search(typename AVLTree<Key>::AVLNode* node, Key key)
     return node;
 }
 
-template <typename Key>
-bool AVLTree<Key>::insert(Key key) {
-    AVLNode* p   = NULL;
-    AVLNode* cur = root_;
+template <typename Key, typename Summary, typename Balance, typename Order>
+typename AVLTree<Key, Summary, Balance, Order>::AVLNode* 
+AVLTree<Key, Summary, Balance, Order>::search(AVLNode* node, const Key& key,
+                                              avl_branchless_search)
+{
+    while (node != NULL) {
+        if (node->key == key) return node; // taken once, predicts well
+        // child[key > node->key] without going through memory: spelled as
+        // an array GCC spills it to the stack, spelled as a select it
+        // becomes a cmov
+        node = (node->key < key) ? node->right : node->left;
+    }
+    return NULL;
+}
+
+/**
+ * -----------------------------------------------------------------------------
+ * the filter goes first: the keys it turns away are never cached anyway.
+ * A key that gets past it is looked up in the cache, then in the tree; if
+ * the tree doesn't have it either, the filter gave a false positive
+ * -----------------------------------------------------------------------------
+ */
+template <typename Key, typename Summary, typename Balance, typename Order>
+bool AVLTree<Key, Summary, Balance, Order>::accelerated_find(const Key& key)
+{
+    if (bloom_ != NULL) {
+        if (bloom_->drifted()) rebuild_bloom(2 * size_);
+        if (!bloom_->may_contain(avl_bloom_filter::hash(key))) return false;
+    }
+    if (cache_ != NULL && cache_->lookup(key) != NULL) return true;
+    AVLNode* node = search(root_, key);
+    if (node == NULL || node->dead()) {
+        if (bloom_ != NULL) bloom_->count_false_positive();
+        return false;
+    }
+    // the node's own key: the one looked up may be a view of the caller's
+    if (cache_ != NULL) cache_->remember(node->key, node);
+    return true;
+}
+
+template <typename Key, typename Summary, typename Balance, typename Order>
+void AVLTree<Key, Summary, Balance, Order>::rebuild_bloom(size_t n)
+{
+    bloom_->reset(n);
+    auto add = [this](const Key& key) {
+        bloom_->add(avl_bloom_filter::hash(key));
+    };
+    inorder_walk(root_, add);
+}
+
+template <typename Key, typename Summary, typename Balance, typename Order>
+void AVLTree<Key, Summary, Balance, Order>::forget_subtree(AVLNode* node)
+{
+    if (cache_ == NULL) return;
+    auto forget = [this](const Key& key) { cache_->forget(key); };
+    inorder_walk(node, forget);
+}
+
+template <typename Key, typename Summary, typename Balance, typename Order>
+typename AVLTree<Key, Summary, Balance, Order>::AVLNode* 
+AVLTree<Key, Summary, Balance, Order>::find_slot(AVLNode* from, const Key& key,
+                                                 AVLNode*& parent,
+                                                 bool& go_right,
+                                                 avl_generic_search)
+{
+    AVLNode* cur = from;
+    parent = NULL;
+    go_right = false;
     while (cur != NULL) {
-        p = cur;
-        if (key < cur->key) 
+        parent = cur;
+        if (key < cur->key) {
             cur = cur->left;
-        else if (key > cur->key)
+            go_right = false;
+        } else if (key > cur->key) {
             cur = cur->right;
-        else
-            return false; // key found, no insertion, this is why we don't know
-                          // whether to adjust the balance field moving down
+            go_right = true;
+        } else {
+            return cur;
+        }
+    }
+    return NULL;
+}
+
+template <typename Key, typename Summary, typename Balance, typename Order>
+typename AVLTree<Key, Summary, Balance, Order>::AVLNode* 
+AVLTree<Key, Summary, Balance, Order>::find_slot(AVLNode* from, const Key& key,
+                                                 AVLNode*& parent,
+                                                 bool& go_right,
+                                                 avl_branchless_search)
+{
+    AVLNode* cur = from;
+    parent = NULL;
+    go_right = false;
+    while (cur != NULL) {
+        if (cur->key == key) return cur;
+        parent = cur;
+        go_right = cur->key < key;
+        cur = go_right ? cur->right : cur->left;
+    }
+    return NULL;
+}
+
+template <typename Key, typename Summary, typename Balance, typename Order>
+typename AVLTree<Key, Summary, Balance, Order>::AVLNode*
+AVLTree<Key, Summary, Balance, Order>::successor(AVLNode* node) {
+    if (node->right != NULL) {
+        node = node->right;
+        while (node->left != NULL) node = node->left;
+        return node;
+    }
+    while (node->parent != NULL && node->parent->right == node) 
+        node = node->parent;
+    return node->parent;
+}
+
+template <typename Key, typename Summary, typename Balance, typename Order>
+typename AVLTree<Key, Summary, Balance, Order>::AVLNode*
+AVLTree<Key, Summary, Balance, Order>::predecessor(AVLNode* node) {
+    if (node->left != NULL) {
+        node = node->left;
+        while (node->right != NULL) node = node->right;
+        return node;
+    }
+    while (node->parent != NULL && node->parent->left == node) 
+        node = node->parent;
+    return node->parent;
+}
+
+template <typename Key, typename Summary, typename Balance, typename Order>
+template <typename Func>
+size_t AVLTree<Key, Summary, Balance, Order>::for_range(const Key& lo,
+                                                        const Key& hi, Func f) {
+    AVLNode* first = NULL;
+    for (AVLNode* node = root_; node != NULL; ) {
+        if (node->key < lo) {
+            node = node->right;
+        } else {
+            first = node;
+            node = node->left;
+        }
+    }
+    size_t count = 0;
+    for (AVLNode* node = first; node != NULL && !(hi < node->key);
+         node = successor(node)) {
+        if (node->dead()) continue;
+        f(node->key);
+        ++count;
     }
+    return count;
+}
+
+// the tombstones at this end go for good on the way, as in pop_min, so that
+// every one is stepped over once, however often the minimum is asked for
+template <typename Key, typename Summary, typename Balance, typename Order>
+const Key& AVLTree<Key, Summary, Balance, Order>::minimum() {
+    while (min_ != NULL && min_->dead()) drop(min_);
+    if (min_ == NULL) throw runtime_error("minimum() of an empty tree");
+    return min_->key;
+}
+
+template <typename Key, typename Summary, typename Balance, typename Order>
+const Key& AVLTree<Key, Summary, Balance, Order>::maximum() {
+    while (max_ != NULL && max_->dead()) drop(max_);
+    if (max_ == NULL) throw runtime_error("maximum() of an empty tree");
+    return max_->key;
+}
+
+template <typename Key, typename Summary, typename Balance, typename Order>
+void AVLTree<Key, Summary, Balance, Order>::reset_extremes() {
+    min_ = max_ = root_;
+    if (root_ == NULL) return;
+    while (min_->left != NULL) min_ = min_->left;
+    while (max_->right != NULL) max_ = max_->right;
+}
+
+template <typename Key, typename Summary, typename Balance, typename Order>
+bool AVLTree<Key, Summary, Balance, Order>::insert(Key key) {
+    bool created;
+    insert_from(root_, key, created);
+    if (!graveyard_.empty()) compact_some();
+    if (bound_.on) enforce_capacity();
+    if (created) mutated(1);
+    return created;
+}
 
+template <typename Key, typename Summary, typename Balance, typename Order>
+typename AVLTree<Key, Summary, Balance, Order>::AVLNode* 
+AVLTree<Key, Summary, Balance, Order>::insert_from(AVLNode* from,
+                                                   const Key& key,
+                                                   bool& created) {
+    AVLNode* p;
+    bool go_right;
+    AVLNode* found = find_slot(from, key, p, go_right, 
+                               typename avl_key_traits<Key>::search_tag());
+    if (found != NULL) {
+        created = found->dead();
+        if (created) revive(found);
+        return found; // key found, no insertion, this is why we don't know
+                      // whether to adjust the balance field moving down
+    }
+    created = true;
+    return insert_at(p, go_right, key);
+}
+
+template <typename Key, typename Summary, typename Balance, typename Order>
+typename AVLTree<Key, Summary, Balance, Order>::AVLNode* 
+AVLTree<Key, Summary, Balance, Order>::insert_at(AVLNode* p, bool go_right,
+                                                 const Key& key) {
     // insert new node at a leaf position
     AVLNode* node = new AVLNode(key);
     node->parent = p;
     if (p == NULL) // empty tree to start with
         root_ = node; 
-    else if (node->key < p->key)
+    else if (!go_right)
         p->left = node;
     else
         p->right = node;
+    ++size_;
+    track(node);
+    update_path(p);
 
-    // go up and find the first node which is not balanced, then balance it
-    // also adjust the balance field of all nodes up to that point
-    rebalance_after_insertion(node);
-    return true;
+    if (bloom_ != NULL) bloom_->add(avl_bloom_filter::hash(key));
+
+    // a new leaf can only be a new extreme as a child of the old one; the
+    // rotations below never change which node is leftmost or rightmost
+    if (p == NULL) min_ = max_ = node;
+    else if (p == min_ && p->left == node) min_ = node;
+    else if (p == max_ && p->right == node) max_ = node;
+
+    // restore the balance invariant going up; for AVL that is finding the
+    // first node which is not balanced and balancing it, adjusting the
+    // balance field of all nodes up to that point
+    Balance::after_insert(*this, node);
+    return node;
 }
 
-template <typename Key>
-void AVLTree<Key>::left_rotate(AVLNode*& node) {
+// the pointer work is shared with StaticAVLTree, see AVLbalance.h
+template <typename Key, typename Summary, typename Balance, typename Order>
+void AVLTree<Key, Summary, Balance, Order>::left_rotate(AVLNode*& node) {
     if (node == NULL || node->right == NULL) return;
-
     AVLNode* c = node;
-    AVLNode* b = c->right;
-    AVLNode* p = c->parent;
-
-    // first, adjust all 3 parent pointers of b, c, and the left child's of b
-    b->parent = p;
-    c->parent = b;
-    if (b->left != NULL) b->left->parent = c;
-
-    // second, adjust other downward pointers
-    if (p != NULL) {    
-        if (p->right == c) p->right = b;
-        else p->left = b;
-    }
-    c->right = b->left;
-    b->left  = c;
-
-    node = b;                  // new local root
-    if (root_ == c) root_ = b; // new root if necessary
+    avl_link_left_rotate(root_, node);
+    update(c);                 // c is below node now
+    update(node);
+    ++rotations_;
 }
 
-
-template <typename Key>
-void AVLTree<Key>::right_rotate(AVLNode*& node) {
+template <typename Key, typename Summary, typename Balance, typename Order>
+void AVLTree<Key, Summary, Balance, Order>::right_rotate(AVLNode*& node) {
     if (node == NULL || node->left == NULL) return;
-
     AVLNode* c = node;
-    AVLNode* b = c->left;
-    AVLNode* p = c->parent;
-
-    // first, adjust all 3 parent pointers of b, c, and the right child's of b
-    b->parent = p;
-    c->parent = b;
-    if (b->right != NULL) b->right->parent = c;
-
-    // second, adjust other downward pointers
-    if (p != NULL) {
-        if (p->right == c) p->right = b;
-        else p->left = b;
-    }
-    c->left  = b->right;
-    b->right = c;
-
-    node = b;                  // new local root
-    if (root_ == c) root_ = b; // new root if necessary
+    avl_link_right_rotate(root_, node);
+    update(c);                 // c is below node now
+    update(node);
+    ++rotations_;
 }
 
-template <typename Key>
-void AVLTree<Key>::rebalance_after_insertion(AVLNode* node) {
-    if (node == NULL) return;
-    AVLNode* p = node->parent;
-
-    while (p != NULL) {
-        // first, recompute 'balance' of the parent; node got a height increase
-        if (p->left == node) 
-            p->balance++;
-        else 
-            p->balance--;
-
-        // if there's no grandparent or if the parent is balanced then we're done
-        AVLNode* gp = p->parent; // the grand parent
-        if (gp == NULL || p->balance == AVLNode::BALANCED) break;
-
-        // if we get here then the parent p just got a height increase
-        // next, see if the grand parent is unbalanced
-        if (node == p->left) {
-            if (p == gp->left) {
-                if (gp->balance == AVLNode::LEFT_HEAVY) { 
-                    // this is the LL case
-                    //        gp(+2)          p (0)
-                    //       /   \.          /  \.
-                    //      p(+1) B  -->   node  gp (0)
-                    //     / \.                 / \.
-                    //   node A                A   B
-                    p->balance = gp->balance = AVLNode::BALANCED;
-                    right_rotate(gp);
-                    break;
-                }
-            } else { // p == gp->right
-                if (gp->balance == AVLNode::RIGHT_HEAVY) { // the RL case
-                    // this is the RL case
-                    //        gp(-2)               node(0)
-                    //       /   \.                /   \.
-                    //      A    p(+1)    -->     gp(x) p(y)
-                    //           / \.             /\.  / \.
-                    //         node D            A  B C   D
-                    //         / \.
-                    //        B   C
-                    //  computing the new balance is a little trickier, depending on
-                    //  which of B & C is heavier
-                    switch (node->balance) {
-                        case AVLNode::LEFT_HEAVY:
-                            p->balance  = AVLNode::RIGHT_HEAVY;
-                            gp->balance = AVLNode::BALANCED;
-                            break;
-                        case AVLNode::BALANCED: // only happens if B & C are NULL
-                            p->balance  = AVLNode::BALANCED;   // A & D are NULL too
-                            gp->balance = AVLNode::BALANCED;;
-                            break;
-                        case AVLNode::RIGHT_HEAVY:
-                            p->balance  = AVLNode::BALANCED;;
-                            gp->balance = AVLNode::LEFT_HEAVY;
-                            break;
-                    }
-                    node->balance = AVLNode::BALANCED;
-                    right_rotate(p);
-                    left_rotate(gp);
-                    break;
-                }
-            }
-        } else { // node == p->right
-            if (p == gp->right) {
-                if (gp->balance == AVLNode::RIGHT_HEAVY) {
-                    // this is the RR case
-                    //        gp(-2)              p(0)
-                    //       /   \.              /  \.
-                    //      A   p(-1)    -->  gp(0) node
-                    //           / \.         / \.  / \.
-                    //          B  node      A   B
-                    p->balance = gp->balance = AVLNode::BALANCED;
-                    left_rotate(gp);
-                    break;
-                } 
-            } else { // p == gp->left
-                if (gp->balance == AVLNode::LEFT_HEAVY) {
-                    // this is the LR case
-                    //        gp(+2)          node(0)
-                    //       /   \.           /   \.
-                    //     p(-1)  D   -->   p(x)   gp(y)
-                    //     /  \.            /\.    / \.
-                    //    A    node        A  B   C   D
-                    //         / \.
-                    //        B   C
-                    //  computing the new balance is a little trickier, depending on
-                    //  with of B & C is heavier
-                    switch (node->balance) {
-                        case AVLNode::LEFT_HEAVY:
-                            p->balance  = AVLNode::BALANCED;
-                            gp->balance = AVLNode::RIGHT_HEAVY;
-                            break;
-                        case AVLNode::BALANCED: // only happens if B & C are NULL
-                            p->balance  = AVLNode::BALANCED;
-                            gp->balance = AVLNode::BALANCED;;
-                            break;
-                        case AVLNode::RIGHT_HEAVY:
-                            p->balance  = AVLNode::LEFT_HEAVY;
-                            gp->balance = AVLNode::BALANCED;;
-                            break;
-                    }
-                    node->balance = AVLNode::BALANCED;
-                    left_rotate(p);
-                    right_rotate(gp);
-                    break;
-                } 
-            }
-        }
-        node = p; // move up the tree
-        p = gp;
-    } // end while (p!= NULL)
+// the fix-ups are done by avl_balance, see AVLbalance.h
+template <typename Key, typename Summary, typename Balance, typename Order>
+void
+AVLTree<Key, Summary, Balance, Order>::rebalance_after_insertion(
+    AVLNode* node) {
+    avl_balance::rebalance_after_insertion(*this, node);
 }
 
-template <typename Key>
-vector<string> AVLTree<Key>::inorder_sequence(AVLNode* node) 
+template <typename Key, typename Summary, typename Balance, typename Order>
+vector<string>
+AVLTree<Key, Summary, Balance, Order>::inorder_sequence(AVLNode* node)
 {
-    vector<string> v, tmp;
-    if (node != NULL) {
-        v = inorder_sequence(node->left); 
-        v.push_back(node->to_string());
-        tmp = inorder_sequence(node->right);
-        v.insert(v.end(), tmp.begin(), tmp.end());
-    }
+    vector<string> v;
+    bt_inorder(node, [&v](AVLNode* n) { v.push_back(n->to_string()); });
     return v;
 }
 
-template <typename Key>
-vector<string> AVLTree<Key>::preorder_sequence(AVLNode* node) 
+template <typename Key, typename Summary, typename Balance, typename Order>
+vector<string>
+AVLTree<Key, Summary, Balance, Order>::preorder_sequence(AVLNode* node)
 {
-    vector<string> v, tmp;
-    if (node != NULL) {
-        v.push_back(node->to_string());
-        tmp = preorder_sequence(node->left); 
-        v.insert(v.end(), tmp.begin(), tmp.end());
-        tmp = preorder_sequence(node->right);
-        v.insert(v.end(), tmp.begin(), tmp.end());
-    }
+    vector<string> v;
+    bt_preorder(node, [&v](AVLNode* n) { v.push_back(n->to_string()); });
     return v;
 }
 
-template <typename Key>
-void AVLTree<Key>::clear(AVLNode*& node) {
-    if (node != NULL) {
-        clear(node->left);
-        clear(node->right);
-        delete node;
-        node = NULL;
-    }
+template <typename Key, typename Summary, typename Balance, typename Order>
+void AVLTree<Key, Summary, Balance, Order>::clear(AVLNode*& node) {
+    // no recursion, see BTree.h
+    clear_tree(node, [this](AVLNode* gone) { release(gone); });
 }
@@ -12,11 +12,203 @@
 #include <vector>
 #include <string>
 
+#include "BTree.h"
+#include "AVLsummary.h"
+#include "AVLbalance.h"
+#include "AVLcache.h"
+#include "AVLbloom.h"
+#include "AVLexport.h"
+#include "AVLingest.h"
+#include "ThreadPool.h"
+
+// -----------------------------------------------------------------------------
+// how the tree descends for a given key type
+// + avl_generic_search: the textbook loop, one branch per comparison; the
+//   default for every key
+// + avl_branchless_search: the child is selected by the comparison result
+//   with a conditional move instead of a branch. It only makes sense when a
+//   comparison is a single instruction; specialize avl_key_traits to opt
+//   such a key in. It is not the default even for the integral types: a
+//   branchy descent speculates into the next level for free, which the
+//   select cannot. Against it on random lookups (half misses), medians of
+//   nine with the two trees built in either order, it came out x0.92-0.99
+//   at 10K int keys, x0.98-1.05 at 1M and x0.89-1.07 at 4M; prefetching
+//   both children as well made it x0.79-0.94. Measure with "avlbench search"
+// -----------------------------------------------------------------------------
+struct avl_generic_search {};
+struct avl_branchless_search {};
+
+template <typename Key>
+struct avl_key_traits {
+    typedef avl_generic_search search_tag;
+};
+
+// -----------------------------------------------------------------------------
+// the bytes a key holds outside its node, for the byte budget of the bounded
+// mode: none by default; a std::string's buffer unless the string is short
+// enough to live inside the object. Specialize it for keys that own memory
+// -----------------------------------------------------------------------------
 template <typename Key>
+struct avl_key_bytes {
+    static size_t of(const Key&) { return 0; }
+};
+
+template <>
+struct avl_key_bytes<std::string> {
+    static size_t of(const std::string& key) {
+        const char* data = key.data();
+        bool inside = data >= (const char*)&key &&
+                      data < (const char*)(&key + 1);
+        return inside ? 0 : key.capacity() + 1;
+    }
+};
+
+// which key the bounded mode evicts, see AVLTree::set_capacity
+enum avl_evict_policy { AVL_EVICT_MIN, AVL_EVICT_MAX, AVL_EVICT_OLDEST };
+
+// -----------------------------------------------------------------------------
+// whether the nodes remember the order they were inserted in, which only
+// AVL_EVICT_OLDEST needs: it costs every node two pointers, so a tree pays
+// for it only when its Order is avl_insertion_order
+// -----------------------------------------------------------------------------
+struct avl_no_insertion_order { static const bool enabled = false; };
+struct avl_insertion_order    { static const bool enabled = true; };
+
+// -----------------------------------------------------------------------------
+// the links of the insertion order in a node; AVLNode derives from this so
+// that a tree without them takes no space (empty base), and goes through
+// these members, which then do nothing, so that the tree's code is the same
+// either way. The list runs from oldest to newest
+// -----------------------------------------------------------------------------
+template <typename Node, bool enabled>
+struct avl_order_slot {
+    Node* older;
+    Node* newer;
+    avl_order_slot() : older(NULL), newer(NULL) {}
+
+    Node* older_node() const { return older; }
+    Node* newer_node() const { return newer; }
+
+    // append the node at the newest end of the list
+    void link(Node*& oldest, Node*& newest) {
+        Node* self = static_cast<Node*>(this);
+        older = newest;
+        newer = NULL;
+        if (newest != NULL) newest->newer = self;
+        else oldest = self;
+        newest = self;
+    }
+    void unlink(Node*& oldest, Node*& newest) {
+        if (older != NULL) older->newer = newer;
+        else oldest = newer;
+        if (newer != NULL) newer->older = older;
+        else newest = older;
+        older = newer = NULL;
+    }
+    // the node and its neighbours were copied elsewhere; moved(p) is where
+    // p went
+    template <typename Moved>
+    void relocate(Moved moved) {
+        older = moved(older);
+        newer = moved(newer);
+    }
+};
+
+template <typename Node>
+struct avl_order_slot<Node, false> {
+    Node* older_node() const { return NULL; }
+    Node* newer_node() const { return NULL; }
+    void link(Node*&, Node*&) {}
+    void unlink(Node*&, Node*&) {}
+    template <typename Moved>
+    void relocate(Moved) {}
+};
+
+struct avl_bound_stats {
+    size_t nodes;      // in the tree now, tombstones included
+    size_t bytes;      // nodes and what their keys own, see avl_key_bytes
+    size_t peak_nodes; // the high-water marks since the bounds were set,
+    size_t peak_bytes; // including what was inserted only to be evicted
+    size_t evictions;
+    avl_bound_stats()
+    : nodes(0), bytes(0), peak_nodes(0), peak_bytes(0), evictions(0) {}
+};
+
+// the most descents AVLTree::find_batch keeps in flight
+const size_t AVL_FIND_GROUP = 64;
+
+#if defined(__GNUC__)
+#  define AVL_PREFETCH(addr) __builtin_prefetch(addr)
+#else
+#  define AVL_PREFETCH(addr) ((void)0)
+#endif
+
+// -----------------------------------------------------------------------------
+// Summary: what every node caches about its subtree, see AVLsummary.h; the
+// default caches nothing
+// Balance: how the tree keeps itself balanced, see AVLbalance.h; the default
+// is AVL, rb_balance and wavl_balance are the alternatives. The name of the
+// class stays for history's sake
+// Order: avl_insertion_order for a tree that is to evict its oldest keys,
+// see set_capacity; the default keeps no order
+// -----------------------------------------------------------------------------
+template <typename Key, typename Summary = avl_no_summary<Key>,
+          typename Balance = avl_balance,
+          typename Order = avl_no_insertion_order>
 class AVLTree {
+    friend Balance;
+    friend struct avl_balance; // the AVL fix-ups are also used by join
 public:
-    AVLTree() : root_(NULL) { }
-    virtual ~AVLTree() { clear(root_); }
+    typedef typename Summary::value_type summary_type;
+
+    AVLTree() 
+    : root_(NULL), size_(0), min_(NULL), max_(NULL), rotations_(0),
+      cache_(NULL), bloom_(NULL), lazy_delete_(false), max_tomb_ratio_(0.25),
+      compact_step_(2), tombstones_(0), detached_(0) { }
+    virtual ~AVLTree() {
+        drop_graveyard(); clear(root_); delete cache_; delete bloom_;
+    }
+
+    // trees own their nodes; they can be moved but not copied
+    AVLTree(AVLTree&& other) 
+    : root_(other.root_), size_(other.size_), min_(other.min_), 
+      max_(other.max_), rotations_(other.rotations_), cache_(other.cache_),
+      bloom_(other.bloom_), lazy_delete_(other.lazy_delete_),
+      max_tomb_ratio_(other.max_tomb_ratio_),
+      compact_step_(other.compact_step_), tombstones_(other.tombstones_),
+      detached_(other.detached_), bound_(other.bound_),
+      layout_(other.layout_) {
+        graveyard_.swap(other.graveyard_);
+        other.root_ = other.min_ = other.max_ = NULL;
+        other.size_ = other.tombstones_ = other.detached_ = 0;
+        other.cache_ = NULL;
+        other.bloom_ = NULL;
+        other.bound_ = Bound();
+        other.layout_ = Layout();
+    }
+    AVLTree& operator=(AVLTree&& other) {
+        if (this != &other) {
+            clear();
+            root_ = other.root_; other.root_ = NULL;
+            size_ = other.size_; other.size_ = 0;
+            min_  = other.min_;  other.min_  = NULL;
+            max_  = other.max_;  other.max_  = NULL;
+            rotations_ = other.rotations_;
+            delete cache_;
+            cache_ = other.cache_; other.cache_ = NULL;
+            delete bloom_;
+            bloom_ = other.bloom_; other.bloom_ = NULL;
+            lazy_delete_ = other.lazy_delete_;
+            max_tomb_ratio_ = other.max_tomb_ratio_;
+            compact_step_ = other.compact_step_;
+            tombstones_ = other.tombstones_; other.tombstones_ = 0;
+            detached_ = other.detached_; other.detached_ = 0;
+            graveyard_.swap(other.graveyard_);
+            bound_ = other.bound_; other.bound_ = Bound();
+            layout_ = other.layout_; other.layout_ = Layout();
+        }
+        return *this;
+    }
 
     // -----------------------------------------------------------------------
     // insert returns true if a new node was created, false if a node with the
@@ -33,36 +225,342 @@ public:
     // -----------------------------------------------------------------------
     // returns whether key is found in the tree or not
     // -----------------------------------------------------------------------
-    bool find(Key key) { return search(root_, key) != NULL; }
+    bool find(Key key) {
+        if (cache_ != NULL || bloom_ != NULL) return accelerated_find(key);
+        AVLNode* node = search(root_, key);
+        return node != NULL && !node->dead();
+    }
+
+    // -----------------------------------------------------------------------
+    // lazy deletion, for bursts of removals that must not wait for the
+    // rebalancing: once on, remove only marks the node as a tombstone, one
+    // descent and no restructuring (the summaries on the path are updated).
+    // Tombstones are invisible: find, for_each, the extremes, size() and
+    // the aggregates skip them, and inserting the key again revives the
+    // node. They are physically removed by compaction
+    // + compact(max_nodes) unlinks up to max_nodes tombstones and returns
+    //   how many are left; call it with a small budget when there is time
+    //   to spare, it can be stopped after any number of nodes
+    // + while more than max_ratio of the nodes are tombstones, every insert
+    //   and remove also unlinks 'step' of them. That puts the unlinks back
+    //   on the updates, so the default, step 0, leaves compaction to the
+    //   caller, to be done when idle or on another thread
+    // + the bulk operations work around the tombstones instead: pop_min
+    //   and pop_max unlink the dead extremes they come across, a batch
+    //   rebuild leaves the dead nodes out, the finger paths and the ranges
+    //   treat them as absent, and a range takes them out of the tree with
+    //   the live keys. A tombstone taken out this way stays listed on the
+    //   graveyard until compaction gets to it and frees it
+    // turning lazy deletion off compacts everything, and so does relayout.
+    // Off by default
+    // -----------------------------------------------------------------------
+    void set_lazy_delete(bool on, double max_ratio = 0.25, size_t step = 0);
+    size_t compact(size_t max_nodes = size_t(-1));
+    size_t tombstones() const { return tombstones_; }
+
+    // -----------------------------------------------------------------------
+    // bounded mode, for an ordered cache: once the tree holds more than
+    // max_nodes nodes, or more than max_bytes bytes (the nodes and what
+    // their keys own, see avl_key_bytes), an insertion evicts keys until
+    // the tree is back within bounds
+    // + AVL_EVICT_MIN, AVL_EVICT_MAX: the smallest or largest key, at hand
+    //   as the cached extremes
+    // + AVL_EVICT_OLDEST: the key inserted longest ago, the head of a list
+    //   threaded through the nodes in insertion order; the keys already in
+    //   the tree when it is bounded join the list in key order, and so do
+    //   those of a batch. Only for a tree whose Order is
+    //   avl_insertion_order, which is then the default; on any other tree
+    //   it throws runtime_error, and the default is AVL_EVICT_MIN
+    // each eviction is one unlink, O(log n) rebalancing and no search; the
+    // bulk insertions evict once they are done. The key just inserted may
+    // be the one to go, insert still returns true. Tombstones count as
+    // nodes; only as many as it takes are compacted, and a live key is
+    // evicted only once none are left. A bound of 0 is no bound, and with
+    // both 0 the tree is unbounded again
+    // -----------------------------------------------------------------------
+    void set_capacity(size_t max_nodes, size_t max_bytes = 0,
+                      avl_evict_policy policy = Order::enabled
+                                                ? AVL_EVICT_OLDEST
+                                                : AVL_EVICT_MIN);
+    avl_bound_stats bound_stats() const;
+
+    // -----------------------------------------------------------------------
+    // relayout moves every node into one block, in van Emde Boas order: the
+    // top half of the levels first, then each subtree hanging below them,
+    // each laid out the same way down to single nodes. A search then touches
+    // O(log_B n) cache lines or pages for any block size B, where nodes
+    // allocated one by one end up in insertion order and a search misses at
+    // almost every level. The shape of the tree is kept, only the addresses
+    // change, O(n log log n); the find cache is emptied, tombstones are
+    // compacted first.
+    // The tree stays fully mutable: new nodes come from the heap as usual,
+    // and a removed node's slot in the block stays unused until the next
+    // relayout, the block is freed once all its nodes are gone.
+    // set_relayout_interval(n) relays the tree out after every n insertions
+    // and removals, counting each key of a batch or range; 0, the default,
+    // leaves it to the caller. block_nodes() is how many nodes are still in
+    // the block
+    // -----------------------------------------------------------------------
+    void relayout();
+    void set_relayout_interval(size_t mutations) {
+        layout_.interval = mutations;
+        layout_.mutations = 0;
+    }
+    size_t block_nodes() const { return layout_.live; }
+
+    // -----------------------------------------------------------------------
+    // optional front cache for find, for skewed lookups: a small
+    // set-associative table (see AVLcache.h) mapping recently found keys to
+    // their nodes, so that a hot key is answered without descending the
+    // tree. The tree itself is left alone; every operation that takes a
+    // node out of the tree drops its entry. Off by default
+    // -----------------------------------------------------------------------
+    void enable_find_cache(size_t entries = 1024) {
+        delete cache_;
+        cache_ = new avl_hot_cache<Key, AVLNode>(entries);
+    }
+    void disable_find_cache() { delete cache_; cache_ = NULL; }
+    avl_cache_stats find_cache_stats() const {
+        return cache_ == NULL ? avl_cache_stats() : cache_->stats();
+    }
+
+    // -----------------------------------------------------------------------
+    // optional Bloom filter for find, for lookups that mostly miss: a
+    // blocked Bloom filter (see AVLbloom.h) of the keys, kept up to date by
+    // the insertions, which answers most lookups of absent keys with one
+    // cache line instead of a descent. Removed keys linger in the filter;
+    // find rebuilds it from the tree, with room for twice the keys then
+    // present, once its false positive rate has drifted to twice what it was
+    // sized for. bits_per_key sizes it for the keys there now; 10 is about
+    // 1% false positives. Off by default
+    // -----------------------------------------------------------------------
+    void enable_bloom_filter(double bits_per_key = 10) {
+        delete bloom_;
+        bloom_ = new avl_bloom_filter(bits_per_key);
+        rebuild_bloom(size_);
+    }
+    void disable_bloom_filter() { delete bloom_; bloom_ = NULL; }
+    avl_bloom_stats bloom_filter_stats() const {
+        return bloom_ == NULL ? avl_bloom_stats() : bloom_->stats();
+    }
 
     // -----------------------------------------------------------------------
     // the minimum key and maixmum key; later on it might make sense to
     // implement an iterator for the tree
+    // both are O(1): the tree keeps pointers to its leftmost and rightmost
+    // nodes. With lazy deletion, tombstones found at that end are unlinked
+    // for good, as pop_min and pop_max do, so each costs one unlink once.
+    // They throw runtime_error on an empty tree
     // -----------------------------------------------------------------------
     const Key& minimum();
     const Key& maximum();
-    void  clear() { clear(root_); }
+    void  clear() {
+        drop_graveyard(); clear(root_); size_ = 0; min_ = max_ = NULL;
+        tombstones_ = 0;
+        if (cache_ != NULL) cache_->clear();
+        if (bloom_ != NULL) bloom_->reset(0);
+        bound_.oldest = bound_.newest = NULL;
+        bound_.bytes = 0;
+    }
+    size_t size() const { return size_ - tombstones_; }
+    bool  empty() const { return size_ == tombstones_; }
+
+    // -----------------------------------------------------------------------
+    // for comparing the balancing policies: the height of the tree (0 when
+    // empty; O(log n) for AVL, a full traversal otherwise) and the number of
+    // single rotations done since the tree was created
+    // -----------------------------------------------------------------------
+    int    height() const { return Balance::height(root_); }
+    size_t rotations() const { return rotations_; }
+
+    // -----------------------------------------------------------------------
+    // validate walks the whole tree and throws runtime_error, naming the
+    // first node found wrong, unless
+    // + every child points back at its parent and the keys increase in order
+    // + every node keeps the invariant of the balancing policy, checked
+    //   against its subtrees (see audit in AVLbalance.h)
+    // + the size, the tombstone count and the extremes match the nodes
+    // + the graveyard lists every tombstone and revived node once, and the
+    //   detached nodes are counted right
+    // + in bounded mode, the insertion list holds every node once and the
+    //   byte count is right
+    // O(n log n) at most, for the tests (see avlcheck.cpp)
+    // -----------------------------------------------------------------------
+    void validate() const;
+
+    // -----------------------------------------------------------------------
+    // priority queue operations: remove and return the minimum (maximum)
+    // key. The extreme node has at most one child so it is spliced out
+    // directly, and the new extreme is found from its neighborhood in
+    // amortized O(1); the rest is the usual rebalancing on the way up.
+    // Both throw runtime_error on an empty tree
+    // -----------------------------------------------------------------------
+    Key pop_min();
+    Key pop_max();
+
+    // -----------------------------------------------------------------------
+    // batched updates: the batch is sorted first and then applied in a single
+    // pass. The i'th entry of the returned bitmap tells whether keys[i] was
+    // inserted (resp. removed); a key repeated within the batch only counts
+    // for its first occurrence.
+    // + a batch at least as large as the tree is merged with the in-order
+    //   node list and the tree is rebuilt perfectly balanced, so all
+    //   rebalancing is deferred to one O(n + k) rebuild
+    // + a smaller batch locates its keys a group at a time with the
+    //   lockstep descents of find_batch, whose prefetches overlap the cache
+    //   misses, and applies the group while those paths are still in
+    //   cache, with no second descent: erase_batch unlinks the nodes found,
+    //   insert_batch links the keys not found in as new leaves where their
+    //   descents ended, or next to them, see AVLbatch.cpp
+    // -----------------------------------------------------------------------
+    std::vector<bool> insert_batch(const std::vector<Key>& keys);
+    std::vector<bool> erase_batch(const std::vector<Key>& keys);
+
+    // -----------------------------------------------------------------------
+    // batched lookups: results[i] tells whether keys[i] is in the tree. A
+    // single find waits on a cache miss at almost every level of a tree
+    // that is out of cache; here up to AVL_FIND_GROUP descents go down in
+    // lockstep, one level per round, and each prefetches its next node,
+    // so their misses overlap instead of queuing up. Longer batches go in
+    // groups of that many. The Bloom filter, if on, turns keys away before
+    // their descent; the find cache is neither read nor filled
+    // -----------------------------------------------------------------------
+    void find_batch(const std::vector<Key>& keys, std::vector<bool>& results);
+
+    // -----------------------------------------------------------------------
+    // range removal: all keys k with lo <= k <= hi are taken out of the tree.
+    // The tree is split around the range and the two outer parts are joined
+    // back, so the restructuring is O(log n) however large the range is.
+    // + erase_range frees the removed nodes and returns how many there were
+    // + extract_range hands them back as a tree of their own
+    // split and join are AVL specific; under the other balancing policies
+    // the range is found in O(log n) but its k nodes are unlinked one by
+    // one, O(k log n)
+    // -----------------------------------------------------------------------
+    size_t  erase_range(const Key& lo, const Key& hi);
+    AVLTree extract_range(const Key& lo, const Key& hi);
+
+    // -----------------------------------------------------------------------
+    // range aggregates over the cached subtree summaries: the combination,
+    // in key order, of lift(k) over all keys lo <= k <= hi. One walk down to
+    // where the paths to lo and hi split, then one walk down each side,
+    // taking whole subtrees as we go: O(log n)
+    // total() is the summary of the whole tree, O(1)
+    // -----------------------------------------------------------------------
+    summary_type aggregate(const Key& lo, const Key& hi);
+    summary_type total() const { return summary_of(root_); }
+
+    // -----------------------------------------------------------------------
+    // calls f(key) once per key in increasing order, without recursion;
+    // tombstones are skipped
+    // -----------------------------------------------------------------------
+    template <typename Func>
+    void for_each(Func f) { inorder_walk(root_, f); }
+
+    // -----------------------------------------------------------------------
+    // replaces every key, tombstones included, by f(key), in increasing
+    // order and in place: the nodes, the shape and the settings stay as they
+    // are. f must return a key equal to the one it is given, a copy of it
+    // kept elsewhere say (see AVLStringTree::compact); the find cache, which
+    // holds keys, is emptied
+    // -----------------------------------------------------------------------
+    template <typename Func>
+    void rebind_keys(Func f) {
+        bt_inorder(root_, [&f](AVLNode* node) { node->key = f(node->key); });
+        if (cache_ != NULL) cache_->clear();
+    }
+
+    // -----------------------------------------------------------------------
+    // calls f(key) for the keys lo <= key <= hi in increasing order and
+    // returns how many there were: one descent to the first of them, then
+    // successor steps, O(log n + k)
+    // -----------------------------------------------------------------------
+    template <typename Func>
+    size_t for_range(const Key& lo, const Key& hi, Func f);
+
+    // -----------------------------------------------------------------------
+    // parallel traversal: the tree is cut into pieces at the nodes near the
+    // root (whole subtrees plus the single nodes above them) and the pieces
+    // are handed to a work-stealing pool.
+    // + parallel_for_each calls f(key) once per key, in no particular order;
+    //   f must be safe to call concurrently
+    // + parallel_reduce maps every key to a T and folds the results with
+    //   combine, which must be associative with identity as its unit; the
+    //   pieces are combined left to right so the fold sees the keys in
+    //   in-order even when combine is not commutative
+    // the tree must not be modified while either one runs
+    // -----------------------------------------------------------------------
+    template <typename Func>
+    void parallel_for_each(Func f, ThreadPool& pool = ThreadPool::shared());
+
+    template <typename T, typename Map, typename Combine>
+    T parallel_reduce(T identity, Map map, Combine combine,
+                      ThreadPool& pool = ThreadPool::shared());
+
+    // -----------------------------------------------------------------------
+    // loading from many threads: each one fills a buffer of its own (see
+    // AVLingest.h) with no locking and no shared tree, and ingest then
+    // merges all of them and the keys already in the tree into one
+    // perfectly balanced tree, on the pool
+    // + the buffers are sorted and deduplicated in parallel
+    // + splitters sampled from all the runs cut the key space into about
+    //   eight ranges per thread; each range is k-way merged on its own,
+    //   reusing the nodes already in the tree and creating the others
+    // + the top levels of the new tree are linked in parallel too
+    // so besides the sorts it is O(n + m) work for n keys in the tree and m
+    // buffered. Returns how many keys were new, and leaves the buffers
+    // empty; the tree must not be used while it runs
+    // -----------------------------------------------------------------------
+    size_t ingest(avl_ingest_buffers<Key>& buffers,
+                  ThreadPool& pool = ThreadPool::shared());
+
+    // -----------------------------------------------------------------------
+    // streaming exports, for looking at trees too big for symmetric_print:
+    // + export_dot writes a Graphviz digraph, to be laid out by dot
+    // + export_svg lays the tree out itself, one column per key in order
+    //   and one row per level
+    // each node shows its key and its balance field (the AVL balance, the
+    // red-black color or the WAVL rank), and the size of its subtree if
+    // sizes is set; tombstones are dashed and nodes that break the
+    // balancing policy's invariant are red. One walk along the parent
+    // pointers through a fixed-size buffer (see AVLexport.h): no copy of
+    // the tree, and O(height) memory besides the buffer
+    // -----------------------------------------------------------------------
+    void export_dot(std::ostream& out, bool sizes = false) const;
+    void export_svg(std::ostream& out, bool sizes = false) const;
 
 private:
     // The node is similar to a BSTNode; use parent pointer to simplify codes
     // A tree is simply a pointer to a AVLNode, we will assume that variables of
     // type Key are comparable using <, <=, ==, >=, and >
     // we do not allow default keys
-    struct AVLNode {
+    // the insertion order is kept in bounded mode only
+    struct AVLNode : avl_summary_slot<Key, Summary>,
+                     avl_order_slot<AVLNode, Order::enabled> {
         enum { LEFT_HEAVY = 1, BALANCED = 0, RIGHT_HEAVY = -1};
-        int balance; // height(left) - height(right)
+        // for lazy deletion: a REVIVED node is live but still listed on the
+        // graveyard, see bury(); a DETACHED one is a tombstone which is no
+        // longer in the tree but still listed, see drop()
+        enum { LIVE = 0, TOMBSTONE = 1, REVIVED = 2, DETACHED = 3 };
+        int balance; // height(left) - height(right), or Balance's meaning
         Key key;
         AVLNode* left;
         AVLNode* right;
         AVLNode* parent;
+        unsigned char state;
 
         AVLNode(const Key& k)
-        : balance(BALANCED), key(k), left(NULL), right(NULL), parent(NULL) {}
+        : avl_summary_slot<Key, Summary>(k), 
+          balance(BALANCED), key(k), left(NULL), right(NULL), parent(NULL),
+          state(LIVE) {}
+
+        bool dead() const { return state == TOMBSTONE; }
 
-        // assumes << is implemented for the Key type
+        // assumes << is implemented for the Key type; a tombstone gets a ~
         std::string to_string() const {
             std::ostringstream oss;
             oss << key << "(" << balance << ")";
+            if (dead()) oss << "~";
             return oss.str();
         }
     };
@@ -70,11 +568,136 @@ private:
     AVLNode* successor(AVLNode* node);
     AVLNode* predecessor(AVLNode* node);
 
+    // -----------------------------------------------------------------------
+    // where shape_walk found a node: its in-order rank among all the nodes,
+    // tombstones included, its depth, the size of its subtree and the ranks
+    // of its children (NONE when missing). f(node, place) is called once per
+    // node, after both of its subtrees; see AVLexport.cpp
+    // -----------------------------------------------------------------------
+    struct Place {
+        static const size_t NONE = size_t(-1);
+        size_t rank, depth, size, left, right;
+    };
+    template <typename Func>
+    void shape_walk(Func f) const;
+
     // -----------------------------------------------------------------------
     // return the pointer to an AVLNode under subtree rooted at node with the
     // given key. NULL is returned if not found
+    // the work is done by one of the overloads below, picked at compile time
+    // from avl_key_traits<Key>::search_tag
+    // -----------------------------------------------------------------------
+    AVLNode* search(AVLNode* node, Key key) {
+        return search(node, key, typename avl_key_traits<Key>::search_tag());
+    }
+    AVLNode* search(AVLNode* node, const Key& key, avl_generic_search);
+    AVLNode* search(AVLNode* node, const Key& key, avl_branchless_search);
+
+    // find through the Bloom filter and the front cache, whichever are on
+    bool accelerated_find(const Key& key);
+
+    // refill the Bloom filter from the keys in the tree, sized for n keys
+    void rebuild_bloom(size_t n);
+
+    // drop the cache entries of the keys under node, which is leaving
+    void forget_subtree(AVLNode* node);
+
+    // -----------------------------------------------------------------------
+    // bounded mode, see set_capacity; track and untrack are to be called on
+    // every node that joins or leaves the tree, and do nothing unbounded
+    // + enforce_capacity records the high-water marks and evicts what is
+    //   over the bounds
+    // -----------------------------------------------------------------------
+    struct Bound {
+        bool     on;
+        size_t   max_nodes;
+        size_t   max_bytes;
+        avl_evict_policy policy;
+        size_t   bytes;
+        size_t   peak_nodes;
+        size_t   peak_bytes;
+        size_t   evictions;
+        AVLNode* oldest;
+        AVLNode* newest;
+        Bound()
+        : on(false), max_nodes(0), max_bytes(0), policy(AVL_EVICT_OLDEST),
+          bytes(0), peak_nodes(0), peak_bytes(0), evictions(0),
+          oldest(NULL), newest(NULL) {}
+    };
+
+    void track(AVLNode* node) {
+        if (!bound_.on) return;
+        node->link(bound_.oldest, bound_.newest);
+        bound_.bytes += sizeof(AVLNode) + avl_key_bytes<Key>::of(node->key);
+    }
+    void untrack(AVLNode* node) {
+        if (!bound_.on) return;
+        node->unlink(bound_.oldest, bound_.newest);
+        bound_.bytes -= sizeof(AVLNode) + avl_key_bytes<Key>::of(node->key);
+    }
+    void enforce_capacity();
+
+    // -----------------------------------------------------------------------
+    // the block of relayout; release frees a node wherever it was allocated,
+    // and mutated counts changes towards the next automatic relayout
+    // -----------------------------------------------------------------------
+    struct Layout {
+        AVLNode* block;
+        size_t   slots;
+        size_t   live;      // nodes of the block still in use
+        size_t   interval;
+        size_t   mutations;
+        Layout()
+        : block(NULL), slots(0), live(0), interval(0), mutations(0) {}
+    };
+
+    bool in_block(const AVLNode* node) const {
+        return node >= layout_.block && node < layout_.block + layout_.slots;
+    }
+    void release(AVLNode* node) {
+        if (layout_.block == NULL || !in_block(node)) {
+            delete node;
+            return;
+        }
+        node->~AVLNode();
+        if (--layout_.live == 0) free_block(layout_);
+    }
+    void mutated(size_t changes) {
+        if (layout_.interval == 0 || changes == 0) return;
+        layout_.mutations += changes;
+        if (layout_.mutations >= layout_.interval) relayout();
+    }
+    static void free_block(Layout& layout);
+
+    // -----------------------------------------------------------------------
+    // lazy deletion, see set_lazy_delete
+    // + bury turns a live node into a tombstone and lists it on the
+    //   graveyard_ (unless it is still listed from an earlier burial)
+    // + revive brings a tombstone back, for an insert of its key
+    // + compact_some is the compaction step for 'mutations' mutations
+    // + drop takes a node out of the tree for good, and discard gets rid
+    //   of one already out of it: released, unless the graveyard still
+    //   lists it, in which case it is left DETACHED for compaction to free
+    // + drop_graveyard frees the DETACHED nodes and empties the graveyard,
+    //   for the operations that go through every node anyway; the revived
+    //   nodes are left to the caller, to be made LIVE again
     // -----------------------------------------------------------------------
-    AVLNode* search(AVLNode* node, Key key);
+    void bury(AVLNode* node);
+    void revive(AVLNode* node);
+    void compact_some(size_t mutations = 1);
+    void drop(AVLNode* node);
+    void discard(AVLNode* node);
+    void drop_graveyard();
+
+    // -----------------------------------------------------------------------
+    // find where key is or would be under 'from': returns the node holding
+    // key, or NULL and sets parent to the node under which key would hang
+    // (on the left iff go_right is false). Same two flavors as search
+    // -----------------------------------------------------------------------
+    AVLNode* find_slot(AVLNode* from, const Key& key, AVLNode*& parent,
+                       bool& go_right, avl_generic_search);
+    AVLNode* find_slot(AVLNode* from, const Key& key, AVLNode*& parent,
+                       bool& go_right, avl_branchless_search);
 
     // -----------------------------------------------------------------------
     // node points to the root of a sub-tree which just had a height increase
@@ -112,9 +735,47 @@ private:
     //              and p = gp, move up.
     //       (b.1.) If gp does violate it: fix it with the single/double
     //       rotations
+    // the fix-ups here and below are done by avl_balance in AVLbalance.h,
+    // which StaticAVLTree shares
     // -----------------------------------------------------------------------
     void rebalance_after_insertion(AVLNode* node);
 
+    // -----------------------------------------------------------------------
+    // descend from 'from' (which must be root_ or lie on the search path of
+    // key) and insert key as a new leaf if it is not there yet. Returns the
+    // node holding key; created tells whether it is a new node.
+    // insert_at is the second half: key goes in as a new leaf under p (on
+    // the right iff go_right), which must be its place, and is rebalanced
+    // -----------------------------------------------------------------------
+    AVLNode* insert_from(AVLNode* from, const Key& key, bool& created);
+    AVLNode* insert_at(AVLNode* p, bool go_right, const Key& key);
+
+    // -----------------------------------------------------------------------
+    // take node out of the tree without deleting it. A node with two children
+    // first trades places with its predecessor (the nodes themselves move,
+    // not the keys, so pointers to other nodes stay valid); then it has at
+    // most one child and is spliced out
+    // -----------------------------------------------------------------------
+    void unlink(AVLNode* node);
+    void swap_with_predecessor(AVLNode* node, AVLNode* pred);
+
+    // -----------------------------------------------------------------------
+    // p just lost height on its left (left_shrank) or right side. Fix the
+    // balance fields going up, rotating where a node becomes +2/-2, until a
+    // subtree's height stays the same. Unlike insertion, a removal may need
+    // a rotation at every level
+    // -----------------------------------------------------------------------
+    void rebalance_after_removal(AVLNode* p, bool left_shrank);
+
+    // -----------------------------------------------------------------------
+    // node has balance +2 or -2 and both its subtrees are valid AVL trees;
+    // do the single or double rotation and set the balance fields. Returns
+    // the new root of the subtree. The child on the heavy side may be
+    // balanced here (this never happens after an insertion but does after a
+    // removal); in that case the subtree keeps its height
+    // -----------------------------------------------------------------------
+    AVLNode* rotate_fix(AVLNode* node);
+
     // -----------------------------------------------------------------------
     // right rotate around node c. *Does not* adjust the balance field.
     //                      p              p
@@ -161,10 +822,126 @@ private:
     // -----------------------------------------------------------------------
     void left_rotate(AVLNode*&);
 
+    // -----------------------------------------------------------------------
+    // keeping the summaries up to date; all three compile to nothing when
+    // Summary is disabled
+    // + update recomputes node's summary from its children's
+    // + update_path does that for node and every ancestor of it, after a
+    //   node was linked or unlinked below node
+    // the rotations call update on the two nodes they move, and they do not
+    // change the summary of the subtree as a whole
+    // -----------------------------------------------------------------------
+    static summary_type summary_of(AVLNode* node) {
+        return node == NULL ? Summary::identity() : node->get_summary();
+    }
+    static summary_type lift_of(AVLNode* node) {
+        return node->dead() ? Summary::identity() : Summary::lift(node->key);
+    }
+    static void update(AVLNode* node);
+    static void update_path(AVLNode* node);
+
     // clean up
     void clear(AVLNode*&);
 
+    // -----------------------------------------------------------------------
+    // split and join work on detached trees, i.e. a root with a NULL parent
+    // which is not root_; rotations still work since they only touch root_
+    // when it is the node being rotated
+    // + height is computed from the balance fields along one path
+    // + join links l < mid < r into one AVL tree; if the heights of l and r
+    //   differ by more than one, mid is hung off the spine of the taller
+    //   tree at a node whose height matches the shorter one and the height
+    //   increase is propagated up. O(|height(l) - height(r)| + 1)
+    // + join2 is join without a middle node: the maximum of l is taken out
+    //   and used as the middle
+    // + split cuts t into l (keys < key, or <= key if inclusive) and r (the
+    //   rest); the joins along the search path telescope to O(log n)
+    // + rebalance_after_join propagates the height increase of the subtree
+    //   under node and returns the root of the whole (detached) tree
+    // -----------------------------------------------------------------------
+    static int height(AVLNode* node);
+    static AVLNode* root_of(AVLNode* node);
+    AVLNode* join(AVLNode* l, AVLNode* mid, AVLNode* r);
+    AVLNode* join2(AVLNode* l, AVLNode* r);
+    void split(AVLNode* t, const Key& key, bool inclusive,
+               AVLNode*& l, AVLNode*& r);
+    AVLNode* rebalance_after_join(AVLNode* node);
+
+    // -----------------------------------------------------------------------
+    // take the nodes with keys in [lo, hi] out of the tree, tombstones
+    // included, fix size_, tombstones_ and the extremes, and append the
+    // nodes to out in in-order
+    // -----------------------------------------------------------------------
+    void cut_range(const Key& lo, const Key& hi, std::vector<AVLNode*>& out);
+
+    // -----------------------------------------------------------------------
+    // helpers for the bulk operations
+    // + flatten appends the nodes under node to out in in-order
+    // + build_balanced links nodes[0..n-1] (in order) into a perfectly
+    //   balanced detached tree, sets the balance fields, and returns its
+    //   root. The recursive overload builds the subtree at 'depth' of a tree
+    //   whose deepest level is 'last'; height receives the height of the
+    //   result (0 for an empty tree)
+    // -----------------------------------------------------------------------
+    void flatten(AVLNode* node, std::vector<AVLNode*>& out);
+
+    // -----------------------------------------------------------------------
+    // the lockstep descents of find_batch, for n <= AVL_FIND_GROUP keys:
+    // nodes[i] receives the node holding key(i), tombstones included, or
+    // else the node under which key(i) would hang, NULL only if the tree is
+    // empty. locate runs them for the group keys[order[first..]], at most
+    // AVL_FIND_GROUP long
+    // -----------------------------------------------------------------------
+    template <typename KeyAt>
+    void descend_group(KeyAt key, size_t n, AVLNode** nodes);
+    void locate(const std::vector<Key>& keys, const std::vector<size_t>& order,
+                size_t first, AVLNode** nodes);
+    AVLNode* build_balanced(AVLNode** nodes, size_t n);
+    AVLNode* build_balanced(AVLNode** nodes, size_t n, AVLNode* parent,
+                            int depth, int last, int& height);
+    AVLNode* build_balanced(AVLNode** nodes, size_t n, AVLNode* parent,
+                            int depth, int last, int& height,
+                            ThreadPool& pool); // the two sides in parallel
+
+    // -----------------------------------------------------------------------
+    // a piece of the tree for the parallel algorithms: either the whole
+    // subtree under node, or node on its own
+    // -----------------------------------------------------------------------
+    struct Piece {
+        AVLNode* node;
+        bool     whole;
+        Piece(AVLNode* n, bool w) : node(n), whole(w) {}
+    };
+
+    // cut the tree into pieces, listed in in-order, about 'depth' levels deep
+    void split_pieces(AVLNode* node, int depth, std::vector<Piece>& pieces);
+
+    // call f(key) on the subtree under node in in-order without recursion,
+    // skipping tombstones
+    template <typename Func>
+    void inorder_walk(AVLNode* node, Func& f);
+
     AVLNode* root_;
+    size_t   size_;  // number of keys in the tree
+    AVLNode* min_;   // leftmost node, NULL iff the tree is empty
+    AVLNode* max_;   // rightmost node, NULL iff the tree is empty
+    size_t   rotations_; // single rotations so far, see rotations()
+    avl_hot_cache<Key, AVLNode>* cache_; // NULL unless enable_find_cache
+    avl_bloom_filter* bloom_;            // NULL unless enable_bloom_filter
+
+    // lazy deletion; size_ counts the tombstones too
+    bool   lazy_delete_;
+    double max_tomb_ratio_;
+    size_t compact_step_;
+    size_t tombstones_;
+    size_t detached_;  // listed on the graveyard, no longer in the tree
+    std::vector<AVLNode*> graveyard_; // the tombstones, and revived nodes
+    Bound bound_;
+    Layout layout_;
+
+    // recompute min_ and max_ by walking down from root_, O(log n); used
+    // after the bulk operations, the single-key ones keep them up to date
+    void reset_extremes();
 
     // -----------------------------------------------------------------------
     // the following are for testing purposes only, they should be removed
@@ -189,5 +966,15 @@ public:
 
 #include "AVLTree.cpp"   // only done for template classes
 #include "AVLremove.cpp" // only done for template classes
+#include "AVLparallel.cpp" // only done for template classes
+#include "AVLbatch.cpp"    // only done for template classes
+#include "AVLsplit.cpp"    // only done for template classes
+#include "AVLsummary.cpp"  // only done for template classes
+#include "AVLtombstone.cpp" // only done for template classes
+#include "AVLexport.cpp"    // only done for template classes
+#include "AVLingest.cpp"    // only done for template classes
+#include "AVLbounded.cpp"   // only done for template classes
+#include "AVLlayout.cpp"    // only done for template classes
+#include "AVLvalidate.cpp"  // only done for template classes
 
 #endif
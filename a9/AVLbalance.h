@@ -0,0 +1,791 @@
+// =============================================================================
+// AVLbalance.h
+// ~~~~~~~~~~~~
+// description : balancing policies for AVLTree and StaticAVLTree. The tree
+//               shares search, iteration, rotations and splicing between all
+//               of them; a policy only decides what the 'balance' field of a
+//               node means and how to restore its invariant after a change
+// =============================================================================
+#ifndef AVLBALANCE_H_
+#define AVLBALANCE_H_
+
+#include <cstddef>
+#include <vector>
+
+// -----------------------------------------------------------------------------
+// A balancing policy B provides
+//   static const bool supports_join;   // O(log n) split/join available
+//   template <class Tree>
+//   static void after_insert(Tree& t, Node* node);
+//       node is a new leaf with balance == 0
+//   template <class Tree>
+//   static void after_unlink(Tree& t, Node* p, bool left_side, Node* gone);
+//       'gone' was just spliced out from under p (on its left iff
+//       left_side); it had at most one child, which took its place. gone's
+//       balance field is the one of the position it left
+//   template <class Node>
+//   static void on_build(Node* node, int lh, int rh, int depth, int last);
+//       set the field of a node of a freshly built, perfectly balanced tree:
+//       its subtrees have heights lh and rh, it sits at 'depth' and the
+//       deepest level of the tree is 'last'
+//   template <class Node>
+//   static int height(Node* root);
+//   template <class Node>
+//   static int audit(Node* node, int left, int right);
+//       for AVLTree::validate, bottom up: left and right are what audit
+//       returned for node's subtrees, 0 for an empty one. Returns node's
+//       own (at least 0), or -1 if node breaks the invariant
+// A Tree is a friend of its policy and exposes its node type AVLNode (with
+// balance, left, right and parent), its root pointer root_, and the two
+// rotations left_rotate(AVLNode*&) and right_rotate(AVLNode*&); AVLTree's
+// rotations also keep the subtree summaries and the rotation counter up to
+// date. The fix-ups are constexpr so that StaticAVLTree can run them at
+// compile time.
+// -----------------------------------------------------------------------------
+
+// -----------------------------------------------------------------------------
+// the pointer work of a rotation at node, shared by the trees; see the
+// pictures at AVLTree::right_rotate and AVLTree::left_rotate. node becomes
+// the new local root, and root the new root if it was node. Nothing happens
+// when the child that would come up is NULL
+// -----------------------------------------------------------------------------
+template <class Node>
+constexpr void avl_link_left_rotate(Node*& root, Node*& node)
+{
+    if (node == NULL || node->right == NULL) return;
+    Node* c = node;
+    Node* b = c->right;
+    Node* p = c->parent;
+
+    b->parent = p;
+    c->parent = b;
+    if (b->left != NULL) b->left->parent = c;
+    if (p != NULL) {
+        if (p->right == c) p->right = b;
+        else p->left = b;
+    }
+    c->right = b->left;
+    b->left  = c;
+
+    node = b;
+    if (root == c) root = b;
+}
+
+template <class Node>
+constexpr void avl_link_right_rotate(Node*& root, Node*& node)
+{
+    if (node == NULL || node->left == NULL) return;
+    Node* c = node;
+    Node* b = c->left;
+    Node* p = c->parent;
+
+    b->parent = p;
+    c->parent = b;
+    if (b->right != NULL) b->right->parent = c;
+    if (p != NULL) {
+        if (p->right == c) p->right = b;
+        else p->left = b;
+    }
+    c->left  = b->right;
+    b->right = c;
+
+    node = b;
+    if (root == c) root = b;
+}
+
+namespace avl_balance_detail {
+    // height by a full traversal, for the policies that don't track it
+    template <class Node>
+    int traverse_height(Node* root) {
+        int h = 0;
+        std::vector<std::pair<Node*, int> > stack;
+        if (root != NULL) stack.push_back(std::make_pair(root, 1));
+        while (!stack.empty()) {
+            Node* node = stack.back().first;
+            int d = stack.back().second;
+            stack.pop_back();
+            if (d > h) h = d;
+            if (node->left != NULL) stack.push_back(std::make_pair(node->left, d+1));
+            if (node->right != NULL) stack.push_back(std::make_pair(node->right, d+1));
+        }
+        return h;
+    }
+}
+
+// -----------------------------------------------------------------------------
+// AVL: balance = height(left) - height(right), in {-1, 0, 1}. The fix-ups are
+// the ones documented in AVLTree.h; they live here so that every tree built
+// on the same kind of node (AVLTree, StaticAVLTree) shares them
+// -----------------------------------------------------------------------------
+struct avl_balance {
+    static const bool supports_join = true;
+
+    template <class Tree>
+    static constexpr void after_insert(Tree& t, typename Tree::AVLNode* node) {
+        rebalance_after_insertion(t, node);
+    }
+
+    template <class Tree>
+    static constexpr void after_unlink(Tree& t, typename Tree::AVLNode* p,
+                                       bool left_side,
+                                       typename Tree::AVLNode*) {
+        rebalance_after_removal(t, p, left_side);
+    }
+
+    template <class Node>
+    static constexpr void on_build(Node* node, int lh, int rh, int, int) {
+        node->balance = lh - rh;
+    }
+
+    // whether the node breaks the invariant, as far as it can tell by
+    // itself; the exports flag such nodes
+    template <class Node>
+    static constexpr bool broken(Node* node) {
+        return node->balance < -1 || node->balance > 1;
+    }
+
+    // audit works with heights, and checks the field against them
+    template <class Node>
+    static constexpr int audit(Node* node, int left, int right) {
+        if (broken(node) || node->balance != left - right) return -1;
+        return (left > right ? left : right) + 1;
+    }
+
+    // follow the taller side down: O(log n)
+    template <class Node>
+    static constexpr int height(Node* node) {
+        int h = 0;
+        while (node != NULL) {
+            ++h;
+            node = (node->balance < 0) ? node->right : node->left;
+        }
+        return h;
+    }
+
+    template <class Tree>
+    static constexpr void rebalance_after_insertion(
+        Tree& t, typename Tree::AVLNode* node);
+    template <class Tree>
+    static constexpr void rebalance_after_removal(
+        Tree& t, typename Tree::AVLNode* p, bool left_shrank);
+    template <class Tree>
+    static constexpr typename Tree::AVLNode* rotate_fix(
+        Tree& t, typename Tree::AVLNode* node);
+};
+
+// -----------------------------------------------------------------------------
+// red-black: balance is the color. Every path from a node down to a NULL has
+// the same number of black nodes and a red node has no red child. Height is
+// within 2 log(n); at most 2 rotations per insertion and 3 per removal
+// -----------------------------------------------------------------------------
+struct rb_balance {
+    enum { RED = 0, BLACK = 1 };
+    static const bool supports_join = false;
+
+    template <class Node>
+    static constexpr bool is_black(Node* node) {
+        return node == NULL || node->balance == BLACK;
+    }
+
+    template <class Tree>
+    static constexpr void after_insert(Tree& t, typename Tree::AVLNode* x);
+
+    template <class Tree>
+    static constexpr void after_unlink(Tree& t, typename Tree::AVLNode* xp,
+                                       bool left_side,
+                                       typename Tree::AVLNode* gone);
+
+    // a red node with a red parent
+    template <class Node>
+    static constexpr bool broken(Node* node) {
+        return node->balance == RED && node->parent != NULL &&
+               node->parent->balance == RED;
+    }
+
+    // audit works with black heights, the NULLs not counted
+    template <class Node>
+    static constexpr int audit(Node* node, int left, int right) {
+        if (node->balance != RED && node->balance != BLACK) return -1;
+        if (broken(node) || left != right) return -1;
+        return left + (node->balance == BLACK ? 1 : 0);
+    }
+
+    // perfectly balanced: everything black except an incomplete last level
+    template <class Node>
+    static constexpr void on_build(Node* node, int, int, int depth, int last) {
+        node->balance = (depth == last && depth > 0) ? RED : BLACK;
+    }
+
+    template <class Node>
+    static int height(Node* root) {
+        return avl_balance_detail::traverse_height(root);
+    }
+};
+
+// -----------------------------------------------------------------------------
+// weak AVL (Haeupler, Sen & Tarjan): balance is a rank, with rank(NULL) = -1.
+// Every rank difference between a parent and a child is 1 or 2 and leaves
+// have rank 0. With insertions only it is exactly an AVL tree; a removal does
+// at most 2 rotations (AVL may need one per level)
+// -----------------------------------------------------------------------------
+struct wavl_balance {
+    static const bool supports_join = false;
+
+    template <class Node>
+    static constexpr int rank(Node* node) {
+        return node == NULL ? -1 : node->balance;
+    }
+
+    template <class Tree>
+    static constexpr void after_insert(Tree& t, typename Tree::AVLNode* x);
+
+    template <class Tree>
+    static constexpr void after_unlink(Tree& t, typename Tree::AVLNode* p,
+                                       bool left_side,
+                                       typename Tree::AVLNode* gone);
+
+    template <class Node>
+    static constexpr void on_build(Node* node, int lh, int rh, int, int) {
+        node->balance = (lh > rh ? lh : rh); // rank = height - 1
+    }
+
+    // a rank difference to the parent other than 1 or 2, or a leaf of
+    // nonzero rank
+    template <class Node>
+    static constexpr bool broken(Node* node) {
+        int diff = rank(node->parent) - node->balance;
+        if (node->parent != NULL && (diff < 1 || diff > 2)) return true;
+        return node->left == NULL && node->right == NULL && node->balance != 0;
+    }
+
+    // audit works with ranks plus one, so that NULL's is 0
+    template <class Node>
+    static constexpr int audit(Node* node, int left, int right) {
+        int r = node->balance + 1;
+        if (r - left < 1 || r - left > 2 || r - right < 1 || r - right > 2)
+            return -1;
+        if (left == 0 && right == 0 && r != 1) return -1;
+        return r;
+    }
+
+    template <class Node>
+    static int height(Node* root) {
+        return avl_balance_detail::traverse_height(root);
+    }
+};
+
+// -----------------------------------------------------------------------------
+// the AVL fix-ups; see AVLTree.h for the insertion and removal cases
+// -----------------------------------------------------------------------------
+template <class Tree>
+constexpr void avl_balance::rebalance_after_insertion(
+    Tree& t, typename Tree::AVLNode* node)
+{
+    typedef typename Tree::AVLNode AVLNode;
+    if (node == NULL) return;
+    AVLNode* p = node->parent;
+
+    while (p != NULL) {
+        // first, recompute 'balance' of the parent; node got a height increase
+        if (p->left == node) 
+            p->balance++;
+        else 
+            p->balance--;
+
+        // if there's no grandparent or if the parent is balanced then we're done
+        AVLNode* gp = p->parent; // the grand parent
+        if (gp == NULL || p->balance == AVLNode::BALANCED) break;
+
+        // if we get here then the parent p just got a height increase
+        // next, see if the grand parent is unbalanced
+        if (node == p->left) {
+            if (p == gp->left) {
+                if (gp->balance == AVLNode::LEFT_HEAVY) { 
+                    // this is the LL case
+                    //        gp(+2)          p (0)
+                    //       /   \.          /  \.
+                    //      p(+1) B  -->   node  gp (0)
+                    //     / \.                 / \.
+                    //   node A                A   B
+                    p->balance = gp->balance = AVLNode::BALANCED;
+                    t.right_rotate(gp);
+                    break;
+                }
+            } else { // p == gp->right
+                if (gp->balance == AVLNode::RIGHT_HEAVY) { // the RL case
+                    // this is the RL case
+                    //        gp(-2)               node(0)
+                    //       /   \.                /   \.
+                    //      A    p(+1)    -->     gp(x) p(y)
+                    //           / \.             /\.  / \.
+                    //         node D            A  B C   D
+                    //         / \.
+                    //        B   C
+                    //  computing the new balance is a little trickier, depending on
+                    //  which of B & C is heavier
+                    switch (node->balance) {
+                        case AVLNode::LEFT_HEAVY:
+                            p->balance  = AVLNode::RIGHT_HEAVY;
+                            gp->balance = AVLNode::BALANCED;
+                            break;
+                        case AVLNode::BALANCED: // only happens if B & C are NULL
+                            p->balance  = AVLNode::BALANCED;   // A & D are NULL too
+                            gp->balance = AVLNode::BALANCED;;
+                            break;
+                        case AVLNode::RIGHT_HEAVY:
+                            p->balance  = AVLNode::BALANCED;;
+                            gp->balance = AVLNode::LEFT_HEAVY;
+                            break;
+                    }
+                    node->balance = AVLNode::BALANCED;
+                    t.right_rotate(p);
+                    t.left_rotate(gp);
+                    break;
+                }
+            }
+        } else { // node == p->right
+            if (p == gp->right) {
+                if (gp->balance == AVLNode::RIGHT_HEAVY) {
+                    // this is the RR case
+                    //        gp(-2)              p(0)
+                    //       /   \.              /  \.
+                    //      A   p(-1)    -->  gp(0) node
+                    //           / \.         / \.  / \.
+                    //          B  node      A   B
+                    p->balance = gp->balance = AVLNode::BALANCED;
+                    t.left_rotate(gp);
+                    break;
+                } 
+            } else { // p == gp->left
+                if (gp->balance == AVLNode::LEFT_HEAVY) {
+                    // this is the LR case
+                    //        gp(+2)          node(0)
+                    //       /   \.           /   \.
+                    //     p(-1)  D   -->   p(x)   gp(y)
+                    //     /  \.            /\.    / \.
+                    //    A    node        A  B   C   D
+                    //         / \.
+                    //        B   C
+                    //  computing the new balance is a little trickier, depending on
+                    //  with of B & C is heavier
+                    switch (node->balance) {
+                        case AVLNode::LEFT_HEAVY:
+                            p->balance  = AVLNode::BALANCED;
+                            gp->balance = AVLNode::RIGHT_HEAVY;
+                            break;
+                        case AVLNode::BALANCED: // only happens if B & C are NULL
+                            p->balance  = AVLNode::BALANCED;
+                            gp->balance = AVLNode::BALANCED;;
+                            break;
+                        case AVLNode::RIGHT_HEAVY:
+                            p->balance  = AVLNode::LEFT_HEAVY;
+                            gp->balance = AVLNode::BALANCED;;
+                            break;
+                    }
+                    node->balance = AVLNode::BALANCED;
+                    t.left_rotate(p);
+                    t.right_rotate(gp);
+                    break;
+                } 
+            }
+        }
+        node = p; // move up the tree
+        p = gp;
+    } // end while (p!= NULL)
+}
+
+template <class Tree>
+constexpr void avl_balance::rebalance_after_removal(
+    Tree& t, typename Tree::AVLNode* p, bool left_shrank)
+{
+    typedef typename Tree::AVLNode AVLNode;
+    while (p != NULL) {
+        if (left_shrank) {
+            p->balance--;
+        } else {
+            p->balance++;
+        }
+        AVLNode* node = p;
+        if ((p->balance == 2) || (p->balance == -2)) {
+            node = rotate_fix(t, p);
+        }
+        // the subtree under node lost height iff node is balanced now;
+        // otherwise nothing changes further up
+        if (node->balance != AVLNode::BALANCED) {
+            break;
+        }
+        p = node->parent;
+        if (p != NULL) {
+            left_shrank = (p->left == node);
+        }
+    }
+}
+
+/**
+ * -----------------------------------------------------------------------------
+ * the left heavy case (the right heavy case is symmetric), c is the child on
+ * the heavy side
+ *   - c is left heavy or balanced: right rotate at node
+ *          node(+2)           c
+ *          /   \.           / \.
+ *         c     D   -->    A   node
+ *        / \.                  /  \.
+ *       A   B                 B    D
+ *     node and c become balanced if c was left heavy; if c was balanced
+ *     node becomes left heavy and c becomes right heavy
+ *   - c is right heavy: the double rotation, exactly as in the LR case of
+ *     rebalance_after_insertion except that b's children may be non-empty
+ * -----------------------------------------------------------------------------
+ */
+template <class Tree>
+constexpr typename Tree::AVLNode* avl_balance::rotate_fix(
+    Tree& t, typename Tree::AVLNode* node)
+{
+    typedef typename Tree::AVLNode AVLNode;
+    AVLNode* top = node;
+    if (node->balance > 0) {
+        AVLNode* c = node->left;
+        if (c->balance >= AVLNode::BALANCED) {
+            if (c->balance == AVLNode::BALANCED) {
+                node->balance = AVLNode::LEFT_HEAVY;
+                c->balance = AVLNode::RIGHT_HEAVY;
+            } else {
+                node->balance = c->balance = AVLNode::BALANCED;
+            }
+            t.right_rotate(top);
+        } else {
+            AVLNode* b = c->right;
+            switch (b->balance) {
+                case AVLNode::LEFT_HEAVY:
+                    c->balance = AVLNode::BALANCED;
+                    node->balance = AVLNode::RIGHT_HEAVY;
+                    break;
+                case AVLNode::BALANCED:
+                    c->balance = node->balance = AVLNode::BALANCED;
+                    break;
+                case AVLNode::RIGHT_HEAVY:
+                    c->balance = AVLNode::LEFT_HEAVY;
+                    node->balance = AVLNode::BALANCED;
+                    break;
+            }
+            b->balance = AVLNode::BALANCED;
+            t.left_rotate(c);
+            t.right_rotate(top);
+        }
+    } else {
+        AVLNode* c = node->right;
+        if (c->balance <= AVLNode::BALANCED) {
+            if (c->balance == AVLNode::BALANCED) {
+                node->balance = AVLNode::RIGHT_HEAVY;
+                c->balance = AVLNode::LEFT_HEAVY;
+            } else {
+                node->balance = c->balance = AVLNode::BALANCED;
+            }
+            t.left_rotate(top);
+        } else {
+            AVLNode* b = c->left;
+            switch (b->balance) {
+                case AVLNode::LEFT_HEAVY:
+                    node->balance = AVLNode::BALANCED;
+                    c->balance = AVLNode::RIGHT_HEAVY;
+                    break;
+                case AVLNode::BALANCED:
+                    c->balance = node->balance = AVLNode::BALANCED;
+                    break;
+                case AVLNode::RIGHT_HEAVY:
+                    node->balance = AVLNode::LEFT_HEAVY;
+                    c->balance = AVLNode::BALANCED;
+                    break;
+            }
+            b->balance = AVLNode::BALANCED;
+            t.right_rotate(c);
+            t.left_rotate(top);
+        }
+    }
+    return top;
+}
+
+/**
+ * -----------------------------------------------------------------------------
+ * red-black insertion, as in CLRS: x is red; while its parent p is red too,
+ * - if the uncle is red, recolor and move the problem up to the grandparent
+ * - otherwise one or two rotations at the grandparent finish the job
+ * -----------------------------------------------------------------------------
+ */
+template <class Tree>
+constexpr void rb_balance::after_insert(Tree& t, typename Tree::AVLNode* x)
+{
+    typedef typename Tree::AVLNode Node;
+    x->balance = RED;
+    while (x->parent != NULL && x->parent->balance == RED) {
+        Node* p = x->parent;
+        Node* g = p->parent; // p is red so it is not the root
+        Node* top = NULL;
+        if (p == g->left) {
+            Node* u = g->right;
+            if (!is_black(u)) {
+                p->balance = u->balance = BLACK;
+                g->balance = RED;
+                x = g;
+                continue;
+            }
+            if (x == p->right) { // make it the outer case
+                top = p;
+                t.left_rotate(top);
+                x = p;
+                p = top;
+            }
+            p->balance = BLACK;
+            g->balance = RED;
+            top = g;
+            t.right_rotate(top);
+        } else {
+            Node* u = g->left;
+            if (!is_black(u)) {
+                p->balance = u->balance = BLACK;
+                g->balance = RED;
+                x = g;
+                continue;
+            }
+            if (x == p->left) {
+                top = p;
+                t.right_rotate(top);
+                x = p;
+                p = top;
+            }
+            p->balance = BLACK;
+            g->balance = RED;
+            top = g;
+            t.left_rotate(top);
+        }
+        break;
+    }
+    t.root_->balance = BLACK;
+}
+
+/**
+ * -----------------------------------------------------------------------------
+ * red-black removal: removing a red node changes nothing. Otherwise the child
+ * x that took its place carries an extra black; a red x just turns black, a
+ * black (or NULL) x pushes the extra black up or gets rid of it with at most
+ * three rotations, as in CLRS. x may be NULL, so its parent xp and its side
+ * are tracked separately
+ * -----------------------------------------------------------------------------
+ */
+template <class Tree>
+constexpr void rb_balance::after_unlink(Tree& t, typename Tree::AVLNode* xp,
+                              bool left_side, typename Tree::AVLNode* gone)
+{
+    typedef typename Tree::AVLNode Node;
+    if (gone->balance == RED) return;
+    Node* x = (xp == NULL) ? t.root_ : (left_side ? xp->left : xp->right);
+    Node* top = NULL;
+    while (x != t.root_ && is_black(x)) {
+        if (left_side) {
+            Node* w = xp->right; // not NULL, it has black height >= 1
+            if (w->balance == RED) {
+                w->balance = BLACK;
+                xp->balance = RED;
+                top = xp;
+                t.left_rotate(top);
+                w = xp->right;
+            }
+            if (is_black(w->left) && is_black(w->right)) {
+                w->balance = RED;
+                x = xp;
+                xp = x->parent;
+                if (xp != NULL) left_side = (xp->left == x);
+                continue;
+            }
+            if (is_black(w->right)) {
+                w->left->balance = BLACK;
+                w->balance = RED;
+                top = w;
+                t.right_rotate(top);
+                w = xp->right;
+            }
+            w->balance = xp->balance;
+            xp->balance = BLACK;
+            w->right->balance = BLACK;
+            top = xp;
+            t.left_rotate(top);
+        } else {
+            Node* w = xp->left;
+            if (w->balance == RED) {
+                w->balance = BLACK;
+                xp->balance = RED;
+                top = xp;
+                t.right_rotate(top);
+                w = xp->left;
+            }
+            if (is_black(w->left) && is_black(w->right)) {
+                w->balance = RED;
+                x = xp;
+                xp = x->parent;
+                if (xp != NULL) left_side = (xp->left == x);
+                continue;
+            }
+            if (is_black(w->left)) {
+                w->right->balance = BLACK;
+                w->balance = RED;
+                top = w;
+                t.left_rotate(top);
+                w = xp->left;
+            }
+            w->balance = xp->balance;
+            xp->balance = BLACK;
+            w->left->balance = BLACK;
+            top = xp;
+            t.right_rotate(top);
+        }
+        x = t.root_;
+        break;
+    }
+    if (x != NULL) x->balance = BLACK;
+}
+
+/**
+ * -----------------------------------------------------------------------------
+ * WAVL insertion: the new leaf x has rank 0, so it may be a 0-child.
+ * - while x is a 0-child and its sibling a 1-child, promote the parent and
+ *   move up
+ * - if x is a 0-child and its sibling a 2-child, rotate: a single rotation
+ *   if x's inner child is missing or a 2-child, else a double rotation
+ * -----------------------------------------------------------------------------
+ */
+template <class Tree>
+constexpr void wavl_balance::after_insert(Tree& t, typename Tree::AVLNode* x)
+{
+    typedef typename Tree::AVLNode Node;
+    x->balance = 0;
+    Node* p = x->parent;
+    while (p != NULL && rank(p) == rank(x)) {
+        Node* s = (p->left == x) ? p->right : p->left;
+        if (rank(p) - rank(s) == 1) {
+            p->balance++;
+            x = p;
+            p = p->parent;
+            continue;
+        }
+        Node* top = NULL;
+        if (p->left == x) {
+            Node* y = x->right;
+            if (y == NULL || rank(x) - rank(y) == 2) {
+                top = p;
+                t.right_rotate(top);
+                p->balance--;
+            } else {
+                top = x;
+                t.left_rotate(top);
+                top = p;
+                t.right_rotate(top);
+                y->balance++;
+                x->balance--;
+                p->balance--;
+            }
+        } else {
+            Node* y = x->left;
+            if (y == NULL || rank(x) - rank(y) == 2) {
+                top = p;
+                t.left_rotate(top);
+                p->balance--;
+            } else {
+                top = x;
+                t.right_rotate(top);
+                top = p;
+                t.left_rotate(top);
+                y->balance++;
+                x->balance--;
+                p->balance--;
+            }
+        }
+        break;
+    }
+}
+
+/**
+ * -----------------------------------------------------------------------------
+ * WAVL removal: the child x that took gone's place is a 2- or 3-child of p.
+ * - a leaf p left with rank 1 is a 2,2 leaf; demote it (x becomes p)
+ * - while x is a 3-child: if its sibling y is a 2-child, demote p; if y is
+ *   a 2,2 node, demote both; either way move up
+ * - otherwise y is a 1-child that is not 2,2; rotate y up (promote y, demote
+ *   p, and once more if p ended up a leaf) if y's outer child is a 1-child,
+ *   else do a double rotation bringing y's inner child w up (w gains two
+ *   ranks, y loses one, p loses two)
+ * -----------------------------------------------------------------------------
+ */
+template <class Tree>
+constexpr void wavl_balance::after_unlink(Tree& t, typename Tree::AVLNode* p,
+                                bool left_side, typename Tree::AVLNode*)
+{
+    typedef typename Tree::AVLNode Node;
+    if (p == NULL) return;
+    Node* x = left_side ? p->left : p->right;
+
+    if (p->left == NULL && p->right == NULL && p->balance == 1) {
+        p->balance = 0;
+        x = p;
+        p = p->parent;
+        if (p != NULL) left_side = (p->left == x);
+    }
+    while (p != NULL && rank(p) - rank(x) == 3) {
+        Node* y = left_side ? p->right : p->left;
+        if (rank(p) - rank(y) == 2) {
+            p->balance--;
+        } else if (rank(y) - rank(y->left) == 2 &&
+                   rank(y) - rank(y->right) == 2) {
+            p->balance--;
+            y->balance--;
+        } else {
+            break;
+        }
+        x = p;
+        p = p->parent;
+        if (p != NULL) left_side = (p->left == x);
+    }
+    if (p == NULL || rank(p) - rank(x) != 3) return;
+
+    Node* top = NULL;
+    if (left_side) {
+        Node* y = p->right;
+        Node* z = y->right;
+        Node* w = y->left;
+        if (rank(y) - rank(z) == 1) {
+            top = p;
+            t.left_rotate(top);
+            y->balance++;
+            p->balance--;
+            if (p->left == NULL && p->right == NULL) p->balance--;
+        } else {
+            top = y;
+            t.right_rotate(top);
+            top = p;
+            t.left_rotate(top);
+            w->balance += 2;
+            y->balance--;
+            p->balance -= 2;
+        }
+    } else {
+        Node* y = p->left;
+        Node* z = y->left;
+        Node* w = y->right;
+        if (rank(y) - rank(z) == 1) {
+            top = p;
+            t.right_rotate(top);
+            y->balance++;
+            p->balance--;
+            if (p->left == NULL && p->right == NULL) p->balance--;
+        } else {
+            top = y;
+            t.left_rotate(top);
+            top = p;
+            t.right_rotate(top);
+            w->balance += 2;
+            y->balance--;
+            p->balance -= 2;
+        }
+    }
+}
+
+#endif // AVLBALANCE_H_
@@ -0,0 +1,165 @@
+// =============================================================================
+// AVLbloom.h
+// ~~~~~~~~~~
+// description : a blocked Bloom filter in front of AVLTree::find, so that
+//               most lookups of absent keys never touch the tree
+// =============================================================================
+#ifndef AVLBLOOM_H_
+#define AVLBLOOM_H_
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "AVLcache.h" // avl_key_hash
+
+struct avl_bloom_stats {
+    size_t skips;           // lookups the filter answered "absent"
+    size_t false_positives; // the filter said "maybe", the tree said no
+    size_t rebuilds;        // how often the filter was rebuilt
+    size_t bits;            // current size of the filter
+    double estimated_fpr;   // from the current load of the filter
+    avl_bloom_stats()
+    : skips(0), false_positives(0), rebuilds(0), bits(0), estimated_fpr(0) {}
+
+    // the measured false positive rate among lookups of absent keys
+    double observed_fpr() const {
+        size_t absent = skips + false_positives;
+        return absent == 0 ? 0.0 : double(false_positives) / absent;
+    }
+};
+
+// -----------------------------------------------------------------------------
+// the filter is an array of 512-bit blocks, one cache line each; a key sets
+// (and a lookup tests) k bits in the one block its hash picks, so a test
+// costs a single cache miss. That is a little less accurate than spreading
+// the bits over the whole array, which the estimate below ignores.
+// Bits can't be cleared, so the rate drifts up two ways: every key added
+// past what the filter was sized for raises it, and every removed key stays
+// in the filter, a false positive for whoever looks for it again. drifted()
+// watches both: the estimate from the keys added, and the rate actually
+// observed over a window of absent lookups (long enough for a rebuild to pay
+// for itself). Either at twice the rate the filter was sized for means it is
+// time for the owner to rebuild it from the keys that are left
+// -----------------------------------------------------------------------------
+class avl_bloom_filter {
+public:
+    enum { BLOCK_BITS = 512, BLOCK_WORDS = BLOCK_BITS / 64 };
+
+    // bits_per_key: space per key the filter is sized for; 10 gives about
+    // 1% false positives
+    explicit avl_bloom_filter(double bits_per_key)
+    : bits_per_key_(bits_per_key < 1 ? 1 : bits_per_key), k_(1), added_(0),
+      limit_(0), target_(1), window_(0), window_fp_(0), min_window_(0),
+      resets_(0) {
+        k_ = int(bits_per_key_ * 0.693 + 0.5); // ln 2 * bits per key
+        if (k_ < 1) k_ = 1;
+        if (k_ > 16) k_ = 16;
+    }
+
+    // empty the filter and size it for n keys
+    void reset(size_t n) {
+        if (resets_++ > 0) ++stats_.rebuilds;
+        if (n < 64) n = 64;
+        size_t blocks = size_t(n * bits_per_key_ / BLOCK_BITS) + 1;
+        words_.assign(blocks * BLOCK_WORDS, 0);
+        added_ = 0;
+        window_ = window_fp_ = 0;
+        min_window_ = n / 8 < 4096 ? 4096 : n / 8;
+        target_ = fpr_at(double(n));
+        // the load at which the estimated rate is twice the target
+        double twice = 2 * target_;
+        if (twice >= 1) { limit_ = size_t(-1); return; }
+        double m = double(words_.size() * 64);
+        limit_ = size_t(-m / k_ * std::log(1 - std::pow(twice, 1.0 / k_)));
+    }
+
+    void add(uint64_t h) {
+        uint64_t* block = &words_[block_of(h)];
+        uint32_t a = uint32_t(h), b = stride_of(h);
+        for (int i = 0; i < k_; i++, a += b)
+            block[(a % BLOCK_BITS) / 64] |= uint64_t(1) << (a % 64);
+        ++added_;
+    }
+
+    // false means the key is certainly not there (and counts as a skip)
+    bool may_contain(uint64_t h) {
+        const uint64_t* block = &words_[block_of(h)];
+        uint32_t a = uint32_t(h), b = stride_of(h);
+        for (int i = 0; i < k_; i++, a += b) {
+            if (!(block[(a % BLOCK_BITS) / 64] & (uint64_t(1) << (a % 64)))) {
+                ++stats_.skips;
+                ++window_;
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // the owner found that a "maybe" was wrong
+    void count_false_positive() {
+        ++stats_.false_positives;
+        ++window_;
+        ++window_fp_;
+    }
+
+    bool drifted() {
+        if (added_ > limit_) return true;
+        if (window_ < min_window_) return false;
+        if (window_fp_ > 2 * target_ * window_) return true;
+        window_ = window_fp_ = 0;  // fine so far, start a new window
+        return false;
+    }
+
+    avl_bloom_stats stats() const {
+        avl_bloom_stats st = stats_;
+        st.bits = words_.size() * 64;
+        st.estimated_fpr = fpr_at(double(added_));
+        return st;
+    }
+
+    // the key's hash, mixed (splitmix64) since std::hash of an integer is
+    // the integer itself
+    template <typename Key>
+    static uint64_t hash(const Key& key) {
+        uint64_t z = uint64_t(avl_key_hash<Key>()(key));
+        z += 0x9E3779B97F4A7C15ull;
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        return z ^ (z >> 31);
+    }
+
+private:
+    // the top half of the hash picks the block (by a multiplication rather
+    // than a modulo), the bottom half and a remix of the whole give the
+    // start and the stride of the k bit positions in it
+    size_t block_of(uint64_t h) const {
+        uint64_t blocks = words_.size() / BLOCK_WORDS;
+        return size_t(((h >> 32) * blocks) >> 32) * BLOCK_WORDS;
+    }
+    static uint32_t stride_of(uint64_t h) {
+        return uint32_t((h * 0xFF51AFD7ED558CCDull) >> 32) | 1;
+    }
+
+    // (1 - e^(-kn/m))^k, the classic estimate
+    double fpr_at(double n) const {
+        double m = double(words_.size() * 64);
+        if (m == 0) return 1;
+        return std::pow(1 - std::exp(-k_ * n / m), k_);
+    }
+
+    std::vector<uint64_t> words_;
+    double bits_per_key_;
+    int    k_;      // bits per key
+    size_t added_;  // keys added since the last reset, removed ones included
+    size_t limit_;  // drifted() once added_ passes this
+    double target_; // the estimated rate right after the last reset
+    size_t window_; // absent lookups in the current window
+    size_t window_fp_;  // false positives among them
+    size_t min_window_; // lookups before the observed rate is trusted
+    size_t resets_;
+    avl_bloom_stats stats_;
+};
+
+#endif // AVLBLOOM_H_
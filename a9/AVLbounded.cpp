@@ -0,0 +1,95 @@
+// =============================================================================
+// AVLbounded.cpp
+// ~~~~~~~~~~~~~~
+// description : capacity-bounded mode: evicting the smallest, largest or
+//               oldest keys once the tree outgrows its node or byte budget
+// =============================================================================
+
+#include <stdexcept>
+#include <vector>
+#include "AVLTree.h"
+using namespace std; // BAD PRACTICE
+
+/**
+ * -----------------------------------------------------------------------------
+ * bounding an unbounded tree threads the keys already there into the
+ * insertion list in key order, if the tree keeps one, and counts their
+ * bytes; after that the list and the byte count are kept up to date by
+ * track and untrack
+ * -----------------------------------------------------------------------------
+ */
+template <typename Key, typename Summary, typename Balance, typename Order>
+void
+AVLTree<Key, Summary, Balance, Order>::set_capacity(size_t max_nodes,
+                                                    size_t max_bytes,
+                                                    avl_evict_policy policy)
+{
+    if (policy == AVL_EVICT_OLDEST && !Order::enabled)
+        throw runtime_error("set_capacity: AVL_EVICT_OLDEST needs a tree "
+                            "with avl_insertion_order");
+    bool on = max_nodes > 0 || max_bytes > 0;
+    if (on && !bound_.on) {
+        vector<AVLNode*> nodes;
+        nodes.reserve(size_);
+        flatten(root_, nodes);
+        bound_.on = true;
+        bound_.oldest = bound_.newest = NULL;
+        bound_.bytes = 0;
+        for (size_t i = 0; i < nodes.size(); i++) track(nodes[i]);
+        bound_.peak_nodes = size_;
+        bound_.peak_bytes = bound_.bytes;
+        bound_.evictions = 0;
+    } else if (!on && bound_.on) {
+        while (bound_.oldest != NULL) untrack(bound_.oldest);
+        bound_ = Bound();
+    }
+    bound_.max_nodes = max_nodes;
+    bound_.max_bytes = max_bytes;
+    bound_.policy = policy;
+    if (on) enforce_capacity();
+}
+
+template <typename Key, typename Summary, typename Balance, typename Order>
+avl_bound_stats AVLTree<Key, Summary, Balance, Order>::bound_stats() const
+{
+    avl_bound_stats stats;
+    stats.nodes = size_;
+    stats.bytes = bound_.bytes;
+    stats.peak_nodes = bound_.peak_nodes;
+    stats.peak_bytes = bound_.peak_bytes;
+    stats.evictions = bound_.evictions;
+    return stats;
+}
+
+/**
+ * -----------------------------------------------------------------------------
+ * the victim is at hand whatever the policy: min_ and max_ are cached, the
+ * oldest node heads the list. Tombstones go first, one at a time and only
+ * as many as it takes to get back under the bound; live keys are evicted
+ * only if the bound is still exceeded once there are none left, so the
+ * victim is then always a live key
+ * -----------------------------------------------------------------------------
+ */
+template <typename Key, typename Summary, typename Balance, typename Order>
+void AVLTree<Key, Summary, Balance, Order>::enforce_capacity()
+{
+    if (size_ > bound_.peak_nodes) bound_.peak_nodes = size_;
+    if (bound_.bytes > bound_.peak_bytes) bound_.peak_bytes = bound_.bytes;
+    auto over = [this]() {
+        return (bound_.max_nodes > 0 && size_ > bound_.max_nodes) ||
+               (bound_.max_bytes > 0 && bound_.bytes > bound_.max_bytes);
+    };
+    if (!over()) return;
+    while (over() && !graveyard_.empty()) compact(1);
+    while (size_ > 0 && over()) {
+        AVLNode* victim;
+        switch (bound_.policy) {
+        case AVL_EVICT_MIN: victim = min_; break;
+        case AVL_EVICT_MAX: victim = max_; break;
+        default:            victim = bound_.oldest; break;
+        }
+        unlink(victim);
+        release(victim);
+        ++bound_.evictions;
+    }
+}
@@ -0,0 +1,127 @@
+// =============================================================================
+// AVLcache.h
+// ~~~~~~~~~~
+// description : a small set-associative cache in front of AVLTree::find,
+//               mapping recently found keys to their nodes
+// =============================================================================
+#ifndef AVLCACHE_H_
+#define AVLCACHE_H_
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <utility>
+#include <vector>
+
+struct avl_cache_stats {
+    size_t hits;          // answered by the cache
+    size_t misses;        // went down the tree
+    size_t invalidations; // entries dropped because their key was removed
+    avl_cache_stats() : hits(0), misses(0), invalidations(0) {}
+};
+
+// -----------------------------------------------------------------------------
+// the hash of a key for the lookup accelerators (this cache and the Bloom
+// filter): std::hash when Key has one. Otherwise every key hashes the same,
+// which is correct but leaves the cache a single set and the filter useless;
+// give such a key type a std::hash specialization
+// -----------------------------------------------------------------------------
+template <typename Key, typename = void>
+struct avl_key_hash {
+    size_t operator()(const Key&) const { return 0; }
+};
+
+template <typename Key>
+struct avl_key_hash<Key,
+    decltype(void(std::hash<Key>()(std::declval<const Key&>())))>
+: std::hash<Key> {};
+
+// -----------------------------------------------------------------------------
+// the cache is an array of sets of WAYS entries; a key can only live in the
+// set its hash picks. Within a set the entries are kept most recently used
+// first, so a hit moves its entry to the front and a new entry pushes out
+// the last one; the entries are rotated with swaps, so a key that owns
+// memory is never copied to move it. A set is WAYS * (key + pointer), one
+// cache line for small keys, and a lookup touches that line only
+// -----------------------------------------------------------------------------
+template <typename Key, typename Node>
+class avl_hot_cache {
+public:
+    enum { WAYS = 4 };
+
+    // room for about 'entries' keys, rounded up to a power-of-two number of
+    // sets
+    explicit avl_hot_cache(size_t entries) : shift_(64) {
+        size_t sets = 1;
+        while (sets * WAYS < entries) sets *= 2;
+        for (size_t s = sets; s > 1; s /= 2) --shift_;
+        entries_.resize(sets * WAYS);
+    }
+
+    size_t capacity() const { return entries_.size(); }
+    const avl_cache_stats& stats() const { return stats_; }
+
+    // the node cached for key, NULL if it is not cached
+    Node* lookup(const Key& key) {
+        Entry* set = set_of(key);
+        for (size_t w = 0; w < WAYS; w++) {
+            if (set[w].node != NULL && set[w].key == key) {
+                std::rotate(set, set + w, set + w + 1);
+                ++stats_.hits;
+                return set[0].node;
+            }
+        }
+        ++stats_.misses;
+        return NULL;
+    }
+
+    // cache node for key, which lookup just missed; the last entry is
+    // reused, and with it whatever memory its key holds
+    void remember(const Key& key, Node* node) {
+        Entry* set = set_of(key);
+        std::rotate(set, set + WAYS - 1, set + WAYS);
+        set[0].key = key;
+        set[0].node = node;
+    }
+
+    // key's node is going away
+    void forget(const Key& key) {
+        Entry* set = set_of(key);
+        for (size_t w = 0; w < WAYS; w++) {
+            if (set[w].node != NULL && set[w].key == key) {
+                std::rotate(set + w, set + w + 1, set + WAYS);
+                set[WAYS-1].node = NULL;
+                ++stats_.invalidations;
+                return;
+            }
+        }
+    }
+
+    // every node is going away
+    void clear() {
+        for (size_t i = 0; i < entries_.size(); i++) entries_[i].node = NULL;
+    }
+
+private:
+    struct Entry {
+        Key   key;
+        Node* node; // NULL: the entry is empty
+        Entry() : key(), node(NULL) {}
+    };
+
+    // Fibonacci hashing on top of avl_key_hash, since std::hash is the
+    // identity for the integral types
+    Entry* set_of(const Key& key) {
+        uint64_t h = uint64_t(avl_key_hash<Key>()(key));
+        h *= 0x9E3779B97F4A7C15ull;
+        size_t set = (shift_ == 64) ? 0 : size_t(h >> shift_);
+        return &entries_[set * WAYS];
+    }
+
+    std::vector<Entry> entries_;
+    int                shift_; // 64 - log2(number of sets)
+    avl_cache_stats    stats_;
+};
+
+#endif // AVLCACHE_H_
@@ -0,0 +1,170 @@
+// =============================================================================
+// AVLexport.cpp
+// ~~~~~~~~~~~~~
+// description : streaming DOT and SVG exports of the tree's shape, see
+//               AVLTree.h
+// =============================================================================
+
+/**
+ * -----------------------------------------------------------------------------
+ * one in-order walk along the parent pointers, reporting each node as it is
+ * left for the last time, after both of its subtrees. Three facts make the
+ * places come out of a single pass with one slot per level:
+ * + a subtree's nodes get consecutive ranks, so its size is the number of
+ *   ranks handed out between entering and leaving its root
+ * + the left child is the only node of the left subtree at its depth, so it
+ *   is the last node given a rank at that depth before its parent is; the
+ *   same goes for the right child before its parent is left
+ * -----------------------------------------------------------------------------
+ */
+template <typename Key, typename Summary, typename Balance, typename Order>
+template <typename Func>
+void AVLTree<Key, Summary, Balance, Order>::shape_walk(Func f) const
+{
+    std::vector<size_t> entered, ranked, left_ranked; // one slot per level
+    enum { ENTER, VISIT, LEAVE } step = ENTER;
+    AVLNode* node = root_;
+    size_t depth = 0, rank = 0;
+    while (node != NULL) {
+        switch (step) {
+        case ENTER:
+            if (depth == entered.size()) {
+                entered.push_back(0);
+                ranked.push_back(0);
+                left_ranked.push_back(0);
+            }
+            entered[depth] = rank;
+            if (node->left != NULL) {
+                node = node->left;
+                ++depth;
+                continue;
+            }
+            // fall through
+        case VISIT:
+            left_ranked[depth] = (node->left != NULL) ? ranked[depth + 1]
+                                                      : Place::NONE;
+            ranked[depth] = rank++;
+            if (node->right != NULL) {
+                node = node->right;
+                ++depth;
+                step = ENTER;
+                continue;
+            }
+            // fall through
+        case LEAVE: {
+            Place p;
+            p.rank  = ranked[depth];
+            p.depth = depth;
+            p.size  = rank - entered[depth];
+            p.left  = left_ranked[depth];
+            p.right = (node->right != NULL) ? ranked[depth + 1] : Place::NONE;
+            f(node, p);
+
+            AVLNode* child = node;
+            node = node->parent;
+            if (node == NULL) break;
+            --depth;
+            step = (child == node->left) ? VISIT : LEAVE;
+            break;
+        }
+        }
+    }
+}
+
+/**
+ * -----------------------------------------------------------------------------
+ * nodes are named by their in-order rank. A node with a single child gets an
+ * invisible sibling for it, otherwise dot would draw a lone left child and
+ * a lone right child the same way
+ * -----------------------------------------------------------------------------
+ */
+template <typename Key, typename Summary, typename Balance, typename Order>
+void AVLTree<Key, Summary, Balance, Order>::export_dot(std::ostream& out,
+                                                       bool sizes) const
+{
+    avl_export_buffer buf(out, avl_export_buffer::DOT);
+    buf.put("digraph avl {\n  graph [ordering=out];\n"
+            "  node [shape=ellipse, fontname=\"monospace\"];\n");
+    shape_walk([&](AVLNode* node, const Place& p) {
+        buf.put("  n").put(p.rank).put(" [label=\"").put_key(node->key)
+           .put("\\nb=").put(node->balance);
+        if (sizes) buf.put(" n=").put(p.size);
+        buf.put('"');
+        if (node->dead()) buf.put(", style=dashed");
+        if (Balance::broken(node)) buf.put(", color=red, fontcolor=red");
+        buf.put("];\n");
+
+        if (p.left == Place::NONE && p.right == Place::NONE) return;
+        size_t kids[2] = {p.left, p.right};
+        for (int i = 0; i < 2; ++i) {
+            buf.put("  n").put(p.rank).put(" -> n");
+            if (kids[i] != Place::NONE) {
+                buf.put(kids[i]).put(";\n");
+            } else {
+                buf.put(p.rank).put(i == 0 ? "l" : "r")
+                   .put(" [style=invis];\n  n").put(p.rank)
+                   .put(i == 0 ? "l" : "r").put(" [style=invis];\n");
+            }
+        }
+    });
+    buf.put("}\n");
+}
+
+/**
+ * -----------------------------------------------------------------------------
+ * the layout: column = in-order rank, row = depth, so no two nodes overlap
+ * and every edge goes down to the next row. The edges are drawn from circle
+ * to circle, not center to center, since a parent comes out after its
+ * children and would otherwise draw its edges over them
+ * -----------------------------------------------------------------------------
+ */
+template <typename Key, typename Summary, typename Balance, typename Order>
+void AVLTree<Key, Summary, Balance, Order>::export_svg(std::ostream& out,
+                                                       bool sizes) const
+{
+    const long DX = 40, DY = 56, R = 15, MARGIN = 24;
+    avl_export_buffer buf(out, avl_export_buffer::SVG);
+    long rows = this->height();
+    long width  = 2 * MARGIN + long(size_ > 0 ? size_ - 1 : 0) * DX;
+    long height = 2 * MARGIN + (rows > 0 ? rows - 1 : 0) * DY + R;
+    buf.put("<svg xmlns=\"http://www.w3.org/2000/svg\" width=\"").put(width)
+       .put("\" height=\"").put(height).put("\">\n<style>"
+            "circle{fill:#fff;stroke:#000}"
+            "circle.dead{stroke-dasharray:3 2}"
+            "circle.bad{stroke:red;stroke-width:2}"
+            "line{stroke:#888}"
+            "text{font:10px monospace;text-anchor:middle}"
+            "text.b{font-size:8px;fill:#666}</style>\n");
+
+    // an edge between two centers, shortened by R at both ends; the rows
+    // are DY apart so the length is never 0
+    auto edge = [&](long x1, long y1, long x2, long y2) {
+        double dx = x2 - x1, dy = y2 - y1;
+        double len = std::sqrt(dx * dx + dy * dy);
+        long ox = std::lround(dx * R / len), oy = std::lround(dy * R / len);
+        buf.put("<line x1=\"").put(x1 + ox).put("\" y1=\"").put(y1 + oy)
+           .put("\" x2=\"").put(x2 - ox).put("\" y2=\"").put(y2 - oy)
+           .put("\"/>\n");
+    };
+    shape_walk([&](AVLNode* node, const Place& p) {
+        long x = MARGIN + long(p.rank) * DX, y = MARGIN + long(p.depth) * DY;
+        if (p.left != Place::NONE)
+            edge(x, y, MARGIN + long(p.left) * DX, y + DY);
+        if (p.right != Place::NONE)
+            edge(x, y, MARGIN + long(p.right) * DX, y + DY);
+
+        buf.put("<g><title>").put_key(node->key).put(": balance ")
+           .put(node->balance);
+        if (sizes) buf.put(", size ").put(p.size);
+        buf.put("</title><circle cx=\"").put(x).put("\" cy=\"").put(y)
+           .put("\" r=\"").put(R).put('"');
+        if (Balance::broken(node)) buf.put(" class=\"bad\"");
+        else if (node->dead()) buf.put(" class=\"dead\"");
+        buf.put("/><text x=\"").put(x).put("\" y=\"").put(y + 3).put("\">")
+           .put_key(node->key).put("</text><text class=\"b\" x=\"").put(x)
+           .put("\" y=\"").put(y + R + 9).put("\">").put(node->balance);
+        if (sizes) buf.put('/').put(p.size);
+        buf.put("</text></g>\n");
+    });
+    buf.put("</svg>\n");
+}
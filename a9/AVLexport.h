@@ -0,0 +1,122 @@
+// =============================================================================
+// AVLexport.h
+// ~~~~~~~~~~~
+// description : the fixed-size output buffer behind AVLTree's DOT and SVG
+//               exports, and the escaping of keys for either format
+// =============================================================================
+#ifndef AVLEXPORT_H_
+#define AVLEXPORT_H_
+
+#include <charconv>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+// -----------------------------------------------------------------------------
+// characters are gathered in a buffer of CAPACITY bytes which is handed to
+// the stream with one write() whenever it fills up, so an export costs the
+// same memory for ten nodes as for ten million. Keys go through put_key,
+// escaped for the format: a Graphviz quoted string, or XML text. Integral
+// keys and strings are formatted in place; any other key through its <<
+// -----------------------------------------------------------------------------
+class avl_export_buffer {
+public:
+    enum { CAPACITY = 1 << 16 };
+    enum format_t { DOT, SVG };
+
+    // nothing is read before it is written; the first byte is set only for
+    // GCC, which otherwise warns at -O1 and up that flush() may write
+    // uninitialized bytes
+    avl_export_buffer(std::ostream& out, format_t format)
+    : out_(out), format_(format), used_(0) { buf_[0] = 0; }
+    ~avl_export_buffer() { flush(); }
+
+    void flush() {
+        if (used_ > 0) out_.write(buf_, used_);
+        used_ = 0;
+    }
+
+    avl_export_buffer& put(std::string_view s) {
+        if (s.size() > CAPACITY - used_) {
+            flush();
+            if (s.size() > CAPACITY) {
+                out_.write(s.data(), s.size());
+                return *this;
+            }
+        }
+        std::memcpy(buf_ + used_, s.data(), s.size());
+        used_ += s.size();
+        return *this;
+    }
+
+    avl_export_buffer& put(char c) {
+        if (used_ == CAPACITY) flush();
+        buf_[used_++] = c;
+        return *this;
+    }
+
+    template <typename Int>
+    typename std::enable_if<std::is_integral<Int>::value,
+                            avl_export_buffer&>::type
+    put(Int v) {
+        char digits[24];
+        std::to_chars_result r = std::to_chars(digits, digits + 24, v);
+        return put(std::string_view(digits, r.ptr - digits));
+    }
+
+    // the key, escaped
+    avl_export_buffer& put_key(std::string_view s) {
+        for (size_t i = 0; i < s.size(); ++i) put_escaped(s[i]);
+        return *this;
+    }
+    avl_export_buffer& put_key(const std::string& s) {
+        return put_key(std::string_view(s));
+    }
+    template <typename Key>
+    avl_export_buffer& put_key(const Key& key) {
+        return put_key_impl(key, std::is_integral<Key>());
+    }
+
+private:
+    template <typename Key>
+    avl_export_buffer& put_key_impl(const Key& key, std::true_type) {
+        return put(key);
+    }
+    template <typename Key>
+    avl_export_buffer& put_key_impl(const Key& key, std::false_type) {
+        std::ostringstream oss;
+        oss << key;
+        return put_key(std::string_view(oss.str()));
+    }
+
+    void put_escaped(char c) {
+        if (format_ == DOT) {
+            if (c == '"' || c == '\\') put('\\');
+            if (c == '\n') { put("\\n"); return; }
+            put(c);
+            return;
+        }
+        switch (c) {
+        case '<': put("&lt;");   break;
+        case '>': put("&gt;");   break;
+        case '&': put("&amp;");  break;
+        case '"': put("&quot;"); break;
+        default:  put(c);
+        }
+    }
+
+    std::ostream& out_;
+    format_t      format_;
+    size_t        used_;
+    char          buf_[CAPACITY];
+
+    avl_export_buffer(const avl_export_buffer&);
+    avl_export_buffer& operator=(const avl_export_buffer&);
+};
+
+#endif // AVLEXPORT_H_
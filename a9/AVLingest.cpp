@@ -0,0 +1,199 @@
+// =============================================================================
+// AVLingest.cpp
+// ~~~~~~~~~~~~~
+// description : merging per-thread buffers into an AVLTree in parallel
+// =============================================================================
+
+#include <algorithm>
+#include <vector>
+#include "AVLTree.h"
+using namespace std; // BAD PRACTICE
+
+namespace avl_ingest_detail {
+    // below this many nodes a subtree is built by one thread
+    const size_t BUILD_GRAIN = 1 << 14;
+
+    // sort a buffer and drop its repeats
+    template <typename Key>
+    void sort_unique(vector<Key>& keys) {
+        sort(keys.begin(), keys.end());
+        keys.erase(unique(keys.begin(), keys.end(),
+                          [](const Key& a, const Key& b) {
+                              return !(a < b) && !(b < a);
+                          }),
+                   keys.end());
+    }
+}
+
+template <typename Key, typename Summary, typename Balance, typename Order>
+typename AVLTree<Key, Summary, Balance, Order>::AVLNode*
+AVLTree<Key, Summary, Balance, Order>::build_balanced(AVLNode** nodes, size_t n,
+                                                      AVLNode* parent,
+                                                      int depth, int last,
+                                                      int& height,
+                                                      ThreadPool& pool)
+{
+    if (n < avl_ingest_detail::BUILD_GRAIN || pool.size() == 1)
+        return build_balanced(nodes, n, parent, depth, last, height);
+    size_t mid = n / 2;
+    AVLNode* node = nodes[mid];
+    int h[2];
+    node->parent = parent;
+    pool.parallel_for(2, [&](size_t side) {
+        if (side == 0)
+            node->left = build_balanced(nodes, mid, node, depth+1, last,
+                                        h[0], pool);
+        else
+            node->right = build_balanced(nodes + mid + 1, n - mid - 1, node,
+                                         depth+1, last, h[1], pool);
+    });
+    Balance::on_build(node, h[0], h[1], depth, last);
+    update(node);
+    height = max(h[0], h[1]) + 1;
+    return node;
+}
+
+/**
+ * -----------------------------------------------------------------------------
+ * source 0 is the tree's own nodes, in in-order, sources 1..k the sorted
+ * buffers. A range is merged with a heap of the sources ordered by (key,
+ * source), so of equal keys the tree's node, or else the first buffer's
+ * key, comes out first and the others are skipped. The ranges are cut at
+ * the same splitters in every source, so no key straddles two of them, and
+ * they are concatenated in order afterwards
+ * -----------------------------------------------------------------------------
+ */
+template <typename Key, typename Summary, typename Balance, typename Order>
+size_t
+AVLTree<Key, Summary, Balance, Order>::ingest(avl_ingest_buffers<Key>& buffers,
+                                              ThreadPool& pool)
+{
+    size_t k = buffers.threads();
+    pool.parallel_for(k, [&](size_t t) {
+        avl_ingest_detail::sort_unique(buffers.buffer(t));
+    });
+
+    vector<AVLNode*> old;
+    old.reserve(size_);
+    flatten(root_, old);
+
+    size_t nsrc = k + 1, total = old.size();
+    vector<size_t> ends(nsrc);
+    ends[0] = old.size();
+    for (size_t s = 1; s < nsrc; s++) {
+        ends[s] = buffers.buffer(s-1).size();
+        total += ends[s];
+    }
+    auto key_at = [&](size_t s, size_t i) -> const Key& {
+        return s == 0 ? old[i]->key : buffers.buffer(s-1)[i];
+    };
+
+    // the splitters: evenly spaced keys of a sample of every source
+    size_t pieces = total < 4096 ? 1 : 8 * pool.size();
+    vector<Key> sample, splitters;
+    for (size_t s = 0; s < nsrc && pieces > 1; s++) {
+        size_t step = ends[s] / (4 * pieces) + 1;
+        for (size_t i = step / 2; i < ends[s]; i += step)
+            sample.push_back(key_at(s, i));
+    }
+    sort(sample.begin(), sample.end());
+    for (size_t p = 1; p < pieces && !sample.empty(); p++)
+        splitters.push_back(sample[p * sample.size() / pieces]);
+    pieces = splitters.size() + 1;
+
+    // bounds[p * nsrc + s]: where range p starts in source s
+    vector<size_t> bounds((pieces + 1) * nsrc);
+    for (size_t s = 0; s < nsrc; s++) {
+        bounds[s] = 0;
+        bounds[pieces * nsrc + s] = ends[s];
+        for (size_t p = 1; p < pieces; p++) {
+            size_t lo = bounds[(p-1) * nsrc + s], hi = ends[s];
+            while (lo < hi) {
+                size_t mid = lo + (hi - lo) / 2;
+                if (key_at(s, mid) < splitters[p-1]) lo = mid + 1;
+                else hi = mid;
+            }
+            bounds[p * nsrc + s] = lo;
+        }
+    }
+
+    vector<vector<AVLNode*> > merged(pieces);
+    pool.parallel_for(pieces, [&](size_t p) {
+        vector<size_t> pos(bounds.begin() + p * nsrc,
+                           bounds.begin() + (p+1) * nsrc);
+        const size_t* stop = &bounds[(p+1) * nsrc];
+        // a min-heap: 'later' says which of two sources comes out last
+        auto later = [&](size_t a, size_t b) {
+            const Key& ka = key_at(a, pos[a]);
+            const Key& kb = key_at(b, pos[b]);
+            return kb < ka || (!(ka < kb) && b < a);
+        };
+        vector<size_t> heap;
+        size_t count = 0;
+        for (size_t s = 0; s < nsrc; s++) {
+            count += stop[s] - pos[s];
+            if (pos[s] < stop[s]) heap.push_back(s);
+        }
+        make_heap(heap.begin(), heap.end(), later);
+
+        vector<AVLNode*>& out = merged[p];
+        out.reserve(count);
+        while (!heap.empty()) {
+            pop_heap(heap.begin(), heap.end(), later);
+            size_t s = heap.back();
+            const Key& key = key_at(s, pos[s]);
+            if (out.empty() || out.back()->key < key) {
+                // a tombstone is left out, a buffer's key then takes its
+                // place
+                if (s != 0) out.push_back(new AVLNode(key));
+                else if (!old[pos[s]]->dead()) out.push_back(old[pos[s]]);
+            }
+            if (++pos[s] < stop[s]) push_heap(heap.begin(), heap.end(), later);
+            else heap.pop_back();
+        }
+    });
+
+    vector<size_t> offset(pieces + 1, 0);
+    for (size_t p = 0; p < pieces; p++)
+        offset[p+1] = offset[p] + merged[p].size();
+    vector<AVLNode*> nodes(offset[pieces]);
+    pool.parallel_for(pieces, [&](size_t p) {
+        copy(merged[p].begin(), merged[p].end(), nodes.begin() + offset[p]);
+        vector<AVLNode*>().swap(merged[p]);
+    });
+    buffers.clear();
+    if (!graveyard_.empty()) {
+        // free the tombstones left out, and keep 'old' to the nodes kept
+        drop_graveyard();
+        size_t kept = 0;
+        for (size_t i = 0; i < old.size(); i++) {
+            if (old[i]->dead()) {
+                untrack(old[i]);
+                release(old[i]);
+            } else {
+                old[i]->state = AVLNode::LIVE;
+                old[kept++] = old[i];
+            }
+        }
+        old.resize(kept);
+        tombstones_ = 0;
+    }
+
+    size_t n = nodes.size(), new_keys = n - old.size();
+    int last = -1, height;
+    while ((size_t(1) << (last+1)) <= n) ++last; // floor(log2(n))
+    root_ = build_balanced(nodes.data(), n, NULL, 0, last, height, pool);
+    size_ = n;
+    reset_extremes();
+    if (bloom_ != NULL && new_keys > 0) rebuild_bloom(2 * size_);
+    if (bound_.on) {
+        // the new nodes are the ones not in 'old', which is a subsequence
+        for (size_t i = 0, j = 0; i < n; i++) {
+            if (j < old.size() && nodes[i] == old[j]) j++;
+            else track(nodes[i]);
+        }
+        enforce_capacity();
+    }
+    mutated(new_keys);
+    return new_keys;
+}
@@ -0,0 +1,52 @@
+// =============================================================================
+// AVLingest.h
+// ~~~~~~~~~~~
+// description : per-thread key buffers for loading an AVLTree from many
+//               threads at once, see AVLTree::ingest
+// =============================================================================
+#ifndef AVLINGEST_H_
+#define AVLINGEST_H_
+
+#include <cstddef>
+#include <vector>
+
+// -----------------------------------------------------------------------------
+// one buffer per producer: buffer t is only ever touched by whoever fills
+// it, so adding a key is a push_back with no locking and no shared cache
+// line (each buffer sits on a line of its own). Keys may come in any order
+// and may repeat, within a buffer or across buffers. Hand the buffers to
+// AVLTree::ingest once every producer is done; they come back empty and
+// can be filled again
+// -----------------------------------------------------------------------------
+template <typename Key>
+class avl_ingest_buffers {
+public:
+    explicit avl_ingest_buffers(size_t nthreads)
+    : buffers_(nthreads == 0 ? 1 : nthreads) {}
+
+    size_t threads() const { return buffers_.size(); }
+
+    void add(size_t t, const Key& key) { buffers_[t].keys.push_back(key); }
+    std::vector<Key>& buffer(size_t t) { return buffers_[t].keys; }
+
+    // keys buffered so far, repeats included; not while producers run
+    size_t size() const {
+        size_t n = 0;
+        for (size_t t = 0; t < buffers_.size(); t++)
+            n += buffers_[t].keys.size();
+        return n;
+    }
+
+    void clear() {
+        for (size_t t = 0; t < buffers_.size(); t++)
+            std::vector<Key>().swap(buffers_[t].keys);
+    }
+
+private:
+    struct alignas(64) Buffer {
+        std::vector<Key> keys;
+    };
+    std::vector<Buffer> buffers_;
+};
+
+#endif // AVLINGEST_H_
@@ -0,0 +1,114 @@
+// =============================================================================
+// AVLlayout.cpp
+// ~~~~~~~~~~~~~
+// description : relaying the nodes out in van Emde Boas order, in one block
+// =============================================================================
+
+#include <new>
+#include <utility>
+#include <vector>
+#include "AVLTree.h"
+using namespace std; // BAD PRACTICE
+
+namespace avl_layout {
+    // the block starts on a cache line
+    const size_t ALIGN = 64;
+
+    // the nodes exactly 'depth' levels below root, from left to right
+    template <typename Node>
+    void level_below(Node* root, int depth, vector<Node*>& out) {
+        vector<pair<Node*, int> > stack(1, make_pair(root, 0));
+        while (!stack.empty()) {
+            Node* node = stack.back().first;
+            int d = stack.back().second;
+            stack.pop_back();
+            if (d == depth) {
+                out.push_back(node);
+                continue;
+            }
+            if (node->right != NULL)
+                stack.push_back(make_pair(node->right, d+1));
+            if (node->left != NULL)
+                stack.push_back(make_pair(node->left, d+1));
+        }
+    }
+
+    // the first 'height' levels of the subtree at root, in van Emde Boas
+    // order: the upper half of them, then every subtree hanging from the
+    // upper half, each of these laid out the same way. The recursion is
+    // O(log height) deep
+    template <typename Node>
+    void veb_order(Node* root, int height, vector<Node*>& out) {
+        if (height == 1) {
+            out.push_back(root);
+            return;
+        }
+        int top = height / 2;
+        veb_order(root, top, out);
+        vector<Node*> below;
+        level_below(root, top, below);
+        for (size_t i = 0; i < below.size(); i++)
+            veb_order(below[i], height - top, out);
+    }
+}
+
+/**
+ * -----------------------------------------------------------------------------
+ * every node is moved into its slot of the new block, and the old node, no
+ * longer needed, then points at its copy through its parent pointer; that
+ * is how the links of the copies are mapped to the new addresses, with no
+ * table on the side. The old nodes go afterwards, and with them the old
+ * block if there was one
+ * -----------------------------------------------------------------------------
+ */
+template <typename Key, typename Summary, typename Balance, typename Order>
+void AVLTree<Key, Summary, Balance, Order>::relayout()
+{
+    if (!graveyard_.empty()) compact();
+    layout_.mutations = 0;
+    if (root_ == NULL) return;
+
+    vector<AVLNode*> order;
+    order.reserve(size_);
+    avl_layout::veb_order(root_, Balance::height(root_), order);
+    size_t n = order.size();
+    AVLNode* block = static_cast<AVLNode*>(
+        ::operator new(n * sizeof(AVLNode), align_val_t(avl_layout::ALIGN)));
+
+    for (size_t i = 0; i < n; i++)
+        new (block + i) AVLNode(std::move(*order[i]));
+    for (size_t i = 0; i < n; i++) order[i]->parent = block + i;
+    auto moved = [](AVLNode* node) {
+        return node == NULL ? NULL : node->parent;
+    };
+    for (size_t i = 0; i < n; i++) {
+        AVLNode& node = block[i];
+        node.left   = moved(node.left);
+        node.right  = moved(node.right);
+        node.parent = moved(node.parent);
+        node.relocate(moved);
+    }
+    root_ = moved(root_);
+    min_  = moved(min_);
+    max_  = moved(max_);
+    bound_.oldest = moved(bound_.oldest);
+    bound_.newest = moved(bound_.newest);
+    if (cache_ != NULL) cache_->clear();
+
+    for (size_t i = 0; i < n; i++) {
+        if (in_block(order[i])) order[i]->~AVLNode();
+        else delete order[i];
+    }
+    free_block(layout_);
+    layout_.block = block;
+    layout_.slots = layout_.live = n;
+}
+
+template <typename Key, typename Summary, typename Balance, typename Order>
+void AVLTree<Key, Summary, Balance, Order>::free_block(Layout& layout)
+{
+    if (layout.block != NULL)
+        ::operator delete(layout.block, align_val_t(avl_layout::ALIGN));
+    layout.block = NULL;
+    layout.slots = layout.live = 0;
+}
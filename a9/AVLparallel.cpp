@@ -0,0 +1,105 @@
+// =============================================================================
+// AVLparallel.cpp
+// ~~~~~~~~~~~~~~~
+// description : parallel traversal and reduction over an AVLTree
+// =============================================================================
+
+#include <vector>
+#include "AVLTree.h"
+using namespace std; // BAD PRACTICE
+
+/**
+ * -----------------------------------------------------------------------------
+ * the pieces come out in in-order: the pieces of the left subtree, the node
+ * itself, then the pieces of the right subtree. The height of an AVL tree is
+ * within 1.44 log(n) so cutting at a fixed depth gives pieces of comparable
+ * size, give or take a factor of two or so, which work stealing absorbs
+ * -----------------------------------------------------------------------------
+ */
+template <typename Key, typename Summary, typename Balance, typename Order>
+void AVLTree<Key, Summary, Balance, Order>::split_pieces(AVLNode* node,
+                                                         int depth,
+                                                         vector<Piece>& pieces)
+{
+    if (node == NULL) return;
+    if (depth == 0) {
+        pieces.push_back(Piece(node, true));
+        return;
+    }
+    split_pieces(node->left, depth-1, pieces);
+    pieces.push_back(Piece(node, false));
+    split_pieces(node->right, depth-1, pieces);
+}
+
+/**
+ * -----------------------------------------------------------------------------
+ * stackless in-order walk using the parent pointers; we never climb above
+ * 'node', so this is safe to run on disjoint subtrees from several threads
+ * -----------------------------------------------------------------------------
+ */
+template <typename Key, typename Summary, typename Balance, typename Order>
+template <typename Func>
+void AVLTree<Key, Summary, Balance, Order>::inorder_walk(AVLNode* node, Func& f)
+{
+    if (node == NULL) return;
+    AVLNode* top = node;
+    AVLNode* cur = node;
+    while (cur->left != NULL) cur = cur->left;
+    for (;;) {
+        if (!cur->dead()) f(cur->key);
+        if (cur->right != NULL) {
+            cur = cur->right;
+            while (cur->left != NULL) cur = cur->left;
+        } else {
+            // climb until we come up from a left child, stop at the top
+            while (cur != top && cur->parent->right == cur) cur = cur->parent;
+            if (cur == top) return;
+            cur = cur->parent;
+        }
+    }
+}
+
+template <typename Key, typename Summary, typename Balance, typename Order>
+template <typename Func>
+void AVLTree<Key, Summary, Balance, Order>::parallel_for_each(Func f,
+                                                              ThreadPool& pool)
+{
+    // about eight pieces per thread leaves room for stealing
+    int depth = 0;
+    while ((size_t(1) << depth) < 8 * pool.size()) ++depth;
+
+    vector<Piece> pieces;
+    split_pieces(root_, depth, pieces);
+    pool.parallel_for(pieces.size(), [&](size_t i) {
+        Func g = f; // a private copy per task, f may carry state
+        if (pieces[i].whole) inorder_walk(pieces[i].node, g);
+        else if (!pieces[i].node->dead()) g(pieces[i].node->key);
+    });
+}
+
+template <typename Key, typename Summary, typename Balance, typename Order>
+template <typename T, typename Map, typename Combine>
+T AVLTree<Key, Summary, Balance, Order>::parallel_reduce(T identity, Map map,
+                                                         Combine combine,
+                                                         ThreadPool& pool)
+{
+    int depth = 0;
+    while ((size_t(1) << depth) < 8 * pool.size()) ++depth;
+
+    vector<Piece> pieces;
+    split_pieces(root_, depth, pieces);
+    vector<T> partial(pieces.size(), identity);
+    pool.parallel_for(pieces.size(), [&](size_t i) {
+        T acc = identity;
+        auto step = [&](const Key& key) { acc = combine(acc, map(key)); };
+        if (pieces[i].whole) inorder_walk(pieces[i].node, step);
+        else if (!pieces[i].node->dead()) step(pieces[i].node->key);
+        partial[i] = acc;
+    });
+
+    // the pieces are in in-order, so folding left to right keeps the order
+    T result = identity;
+    for (size_t i = 0; i < partial.size(); ++i)
+        result = combine(result, partial[i]);
+    return result;
+}
@@ -39,45 +39,165 @@ const string usage_msg = "AVL Tree Driver. Version 0.2\n"
  * - false if the key does not exist
  * -----------------------------------------------------------------------------
  */
-template <typename Key>
-bool AVLTree<Key>::remove(Key key) {
+template <typename Key, typename Summary, typename Balance, typename Order>
+bool AVLTree<Key, Summary, Balance, Order>::remove(Key key) {
 	AVLNode* node_to_delete = search(root_, key);
-	if(node_to_delete == NULL){
+	if(node_to_delete == NULL || node_to_delete->dead()){
 		return false;
 	}
-	AVLNode* node_value;
-	if((node_to_delete->left == NULL) || (node_to_delete->right == NULL)){
-		if(node_to_delete->left == NULL){
-			node_value = node_to_delete->right;
-		}else{
-			node_value = node_to_delete->left;
-		}
-	}else{
-		node_value = node_to_delete->left;
-		while(node_value->right != NULL){
-			node_value = node_value->right;
+	if(lazy_delete_){
+		bury(node_to_delete);
+		compact_some();
+		mutated(1);
+		return true;
+	}
+	unlink(node_to_delete);
+	release(node_to_delete);
+	mutated(1);
+	return true;
+}
+
+template <typename Key, typename Summary, typename Balance, typename Order>
+Key AVLTree<Key, Summary, Balance, Order>::pop_min() {
+	// the tombstones at this end go for good on the way, so that every one
+	// is stepped over once, however many pops follow
+	while(min_ != NULL && min_->dead()){
+		drop(min_);
+	}
+	if(min_ == NULL){
+		throw runtime_error("pop_min() on an empty tree");
+	}
+	Key key = min_->key;
+	drop(min_);
+	mutated(1);
+	return key;
+}
+
+template <typename Key, typename Summary, typename Balance, typename Order>
+Key AVLTree<Key, Summary, Balance, Order>::pop_max() {
+	// the tombstones at this end go for good on the way, so that every one
+	// is stepped over once, however many pops follow
+	while(max_ != NULL && max_->dead()){
+		drop(max_);
+	}
+	if(max_ == NULL){
+		throw runtime_error("pop_max() on an empty tree");
+	}
+	Key key = max_->key;
+	drop(max_);
+	mutated(1);
+	return key;
+}
+
+template <typename Key, typename Summary, typename Balance, typename Order>
+void AVLTree<Key, Summary, Balance, Order>::unlink(AVLNode* node) {
+	if(cache_ != NULL){
+		cache_->forget(node->key);
+	}
+	untrack(node);
+	// the extremes have at most one child, so successor() and predecessor()
+	// below only take a step or two in the amortized sense
+	if(node == min_){
+		min_ = successor(node);
+	}
+	if(node == max_){
+		max_ = predecessor(node);
+	}
+	if((node->left != NULL) && (node->right != NULL)){
+		AVLNode* pred = node->left;
+		while(pred->right != NULL){
+			pred = pred->right;
 		}
-		node_to_delete->key = node_value->key;
-		node_to_delete = node_value;
-		node_value = node_value->right;
+		swap_with_predecessor(node, pred);
+	}
+
+	// node has at most one child now, splice it out
+	AVLNode* child = (node->left != NULL) ? node->left : node->right;
+	AVLNode* node_par = node->parent;
+	bool left_side = (node_par != NULL) && (node_par->left == node);
+	if(child != NULL){
+		child->parent = node_par;
 	}
-	AVLNode* node_par = node_to_delete->parent;
 	if(node_par == NULL){
-		root_ = node_value;
+		root_ = child;
+	}else if(left_side){
+		node_par->left = child;
 	}else{
-		if(node_par->right == node_to_delete){
-			node_par->right = node_value;
-		}else{
-			node_par->left = node_value;
-		}
+		node_par->right = child;
 	}
-	delete node_to_delete;
-	if(node_value != NULL){
-		node_value->parent = node_par;
+	node->left = node->right = node->parent = NULL;
+	--size_;
+	update_path(node_par);
+	Balance::after_unlink(*this, node_par, left_side, node);
+}
+
+/**
+ * -----------------------------------------------------------------------------
+ * pred is the rightmost node of node->left. Afterwards pred sits where node
+ * was (with node's balance field) and node sits where pred was, holding pred's
+ * old left subtree
+ *                p                      p
+ *                |                      |
+ *              node                   pred
+ *              /  \.                  /  \.
+ *             l    r       -->        l    r
+ *              \.                      \.
+ *               pp                      pp
+ *                \.                      \.
+ *                pred                    node
+ *                /                       /
+ *               pl                      pl
+ * when pred == l the two nodes are adjacent and pred->left becomes node
+ * -----------------------------------------------------------------------------
+ */
+template <typename Key, typename Summary, typename Balance, typename Order>
+void
+AVLTree<Key, Summary, Balance, Order>::swap_with_predecessor(AVLNode* node,
+                                                             AVLNode* pred) {
+	AVLNode* p  = node->parent;
+	AVLNode* l  = node->left;
+	AVLNode* r  = node->right;
+	AVLNode* pp = pred->parent;
+	AVLNode* pl = pred->left;
+	int tmp = node->balance;
+	node->balance = pred->balance;
+	pred->balance = tmp;
+
+	pred->parent = p;
+	if(p == NULL){
+		root_ = pred;
+	}else if(p->left == node){
+		p->left = pred;
+	}else{
+		p->right = pred;
 	}
-	if(node_par == NULL){
-		return true;
+	pred->right = r;
+	r->parent = pred;
+	if(l == pred){
+		pred->left = node;
+		node->parent = pred;
+	}else{
+		pred->left = l;
+		l->parent = pred;
+		pp->right = node;
+		node->parent = pp;
 	}
-	rebalance_after_insertion(root_);
-	return true;
+	node->left = pl;
+	node->right = NULL;
+	if(pl != NULL){
+		pl->parent = node;
+	}
+}
+
+template <typename Key, typename Summary, typename Balance, typename Order>
+void
+AVLTree<Key, Summary, Balance, Order>::rebalance_after_removal(
+    AVLNode* p, bool left_shrank) {
+	avl_balance::rebalance_after_removal(*this, p, left_shrank);
+}
+
+template <typename Key, typename Summary, typename Balance, typename Order>
+typename AVLTree<Key, Summary, Balance, Order>::AVLNode*
+AVLTree<Key, Summary, Balance, Order>::rotate_fix(AVLNode* node) {
+	return avl_balance::rotate_fix(*this, node);
 }
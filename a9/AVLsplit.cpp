@@ -0,0 +1,289 @@
+// =============================================================================
+// AVLsplit.cpp
+// ~~~~~~~~~~~~
+// description : split and join of AVL trees, and the range removals built on
+//               top of them
+// =============================================================================
+
+#include <vector>
+#include "AVLTree.h"
+using namespace std; // BAD PRACTICE
+
+template <typename Key, typename Summary, typename Balance, typename Order>
+int AVLTree<Key, Summary, Balance, Order>::height(AVLNode* node)
+{
+    int h = 0;
+    while (node != NULL) {
+        ++h;
+        node = (node->balance == AVLNode::RIGHT_HEAVY) ? node->right : node->left;
+    }
+    return h;
+}
+
+template <typename Key, typename Summary, typename Balance, typename Order>
+typename AVLTree<Key, Summary, Balance, Order>::AVLNode*
+AVLTree<Key, Summary, Balance, Order>::root_of(AVLNode* node)
+{
+    if (node == NULL) return NULL;
+    while (node->parent != NULL) node = node->parent;
+    return node;
+}
+
+/**
+ * -----------------------------------------------------------------------------
+ * same idea as rebalance_after_insertion, but the subtree that just grew may
+ * have children and its parent may already be heavy on that side, so the
+ * violation can show up at the parent itself. rotate_fix handles all cases:
+ * if the new local root is balanced the subtree is back to its old height and
+ * we're done, otherwise it is one taller and we keep going up
+ * -----------------------------------------------------------------------------
+ */
+template <typename Key, typename Summary, typename Balance, typename Order>
+typename AVLTree<Key, Summary, Balance, Order>::AVLNode*
+AVLTree<Key, Summary, Balance, Order>::rebalance_after_join(AVLNode* node)
+{
+    AVLNode* p = node->parent;
+    while (p != NULL) {
+        if (p->left == node) p->balance++;
+        else p->balance--;
+        if (p->balance == AVLNode::BALANCED) break;
+        if (p->balance == 2 || p->balance == -2) {
+            node = rotate_fix(p);
+            if (node->balance == AVLNode::BALANCED) break;
+        } else {
+            node = p;
+        }
+        p = node->parent;
+    }
+    return root_of(node);
+}
+
+/**
+ * -----------------------------------------------------------------------------
+ * the case height(l) > height(r) + 1 (the other case is symmetric)
+ *              l
+ *               \.
+ *                ...
+ *                 \.
+ *                  p                    p
+ *                   \.                   \.
+ *                    c      -->          mid
+ *                                       /   \.
+ *                                      c     r
+ * walk down the right spine of l keeping track of the height, until the
+ * subtree c has height at most height(r) + 1. The node above c had height at
+ * least height(r) + 2, so c has height height(r) or height(r) + 1 and mid is
+ * a valid AVL node one taller than c
+ * -----------------------------------------------------------------------------
+ */
+template <typename Key, typename Summary, typename Balance, typename Order>
+typename AVLTree<Key, Summary, Balance, Order>::AVLNode*
+AVLTree<Key, Summary, Balance, Order>::join(AVLNode* l, AVLNode* mid,
+                                            AVLNode* r)
+{
+    if (l != NULL) l->parent = NULL;
+    if (r != NULL) r->parent = NULL;
+    mid->parent = NULL;
+    int hl = height(l), hr = height(r);
+
+    if (hl > hr + 1) {
+        AVLNode* p = NULL;
+        AVLNode* c = l;
+        int hc = hl;
+        while (hc > hr + 1) {
+            hc -= (c->balance == AVLNode::LEFT_HEAVY) ? 2 : 1;
+            p = c;
+            c = c->right;
+        }
+        mid->left = c;   if (c != NULL) c->parent = mid;
+        mid->right = r;  if (r != NULL) r->parent = mid;
+        mid->balance = hc - hr;
+        p->right = mid;
+        mid->parent = p;
+        update_path(mid);
+        return rebalance_after_join(mid);
+    }
+    if (hr > hl + 1) {
+        AVLNode* p = NULL;
+        AVLNode* c = r;
+        int hc = hr;
+        while (hc > hl + 1) {
+            hc -= (c->balance == AVLNode::RIGHT_HEAVY) ? 2 : 1;
+            p = c;
+            c = c->left;
+        }
+        mid->left = l;   if (l != NULL) l->parent = mid;
+        mid->right = c;  if (c != NULL) c->parent = mid;
+        mid->balance = hl - hc;
+        p->left = mid;
+        mid->parent = p;
+        update_path(mid);
+        return rebalance_after_join(mid);
+    }
+
+    mid->left = l;   if (l != NULL) l->parent = mid;
+    mid->right = r;  if (r != NULL) r->parent = mid;
+    mid->balance = hl - hr;
+    update(mid);
+    return mid;
+}
+
+template <typename Key, typename Summary, typename Balance, typename Order>
+typename AVLTree<Key, Summary, Balance, Order>::AVLNode*
+AVLTree<Key, Summary, Balance, Order>::join2(AVLNode* l, AVLNode* r)
+{
+    if (l == NULL) { if (r != NULL) r->parent = NULL; return r; }
+    if (r == NULL) { l->parent = NULL; return l; }
+
+    // splice the maximum of l out, it has no right child
+    AVLNode* m = l;
+    while (m->right != NULL) m = m->right;
+    AVLNode* p = m->parent;
+    AVLNode* c = m->left;
+    if (c != NULL) c->parent = p;
+    if (p == NULL) {
+        l = c;
+    } else {
+        p->right = c;
+        update_path(p);
+        rebalance_after_removal(p, false);
+        l = root_of(p);
+    }
+    m->left = m->parent = NULL;
+    return join(l, m, r);
+}
+
+template <typename Key, typename Summary, typename Balance, typename Order>
+void AVLTree<Key, Summary, Balance, Order>::split(AVLNode* t, const Key& key,
+                                                  bool inclusive, AVLNode*& l,
+                                                  AVLNode*& r)
+{
+    if (t == NULL) { l = r = NULL; return; }
+
+    AVLNode* tl = t->left;
+    AVLNode* tr = t->right;
+    t->left = t->right = t->parent = NULL;
+    if (tl != NULL) tl->parent = NULL;
+    if (tr != NULL) tr->parent = NULL;
+
+    bool goes_left = inclusive ? !(key < t->key) : (t->key < key);
+    AVLNode* a;
+    AVLNode* b;
+    if (goes_left) {        // t and everything on its left belong to l
+        split(tr, key, inclusive, a, b);
+        l = join(tl, t, a);
+        r = b;
+    } else {                // t and everything on its right belong to r
+        split(tl, key, inclusive, a, b);
+        l = a;
+        r = join(b, t, tr);
+    }
+}
+
+/**
+ * -----------------------------------------------------------------------------
+ * for AVL: split around the range and join the outer parts back; root_ is
+ * parked at NULL meanwhile so that the rotations never mistake a detached
+ * root for the tree's root
+ * for the other policies: collect the nodes in range, walking from the first
+ * one with successor, and unlink them one by one (which keeps the extremes)
+ * the tombstones in range go with the rest; the callers see that the ones
+ * still listed on the graveyard are left for compaction to free
+ * -----------------------------------------------------------------------------
+ */
+template <typename Key, typename Summary, typename Balance, typename Order>
+void AVLTree<Key, Summary, Balance, Order>::cut_range(const Key& lo,
+                                                      const Key& hi,
+                                                      vector<AVLNode*>& out)
+{
+    if (hi < lo || root_ == NULL) return;
+    size_t first_out = out.size();
+
+    if (!Balance::supports_join) {
+        AVLNode* first = NULL;
+        for (AVLNode* node = root_; node != NULL; ) {
+            if (node->key < lo) {
+                node = node->right;
+            } else {
+                first = node;
+                node = node->left;
+            }
+        }
+        for (AVLNode* node = first; node != NULL && !(hi < node->key);
+             node = successor(node))
+            out.push_back(node);
+        for (size_t i = first_out; i < out.size(); i++) {
+            unlink(out[i]);
+            if (out[i]->dead()) --tombstones_;
+        }
+        return;
+    }
+
+    AVLNode* t = root_;
+    root_ = NULL;
+
+    AVLNode *below, *rest, *mid, *above;
+    split(t, lo, false, below, rest);    // below < lo <= rest
+    split(rest, hi, true, mid, above);   // mid <= hi < above
+    root_ = join2(below, above);
+    reset_extremes();
+    flatten(mid, out);
+    forget_subtree(mid);
+    for (size_t i = first_out; i < out.size(); i++) {
+        if (bound_.on) untrack(out[i]);
+        if (out[i]->dead()) --tombstones_;
+    }
+    size_ -= out.size() - first_out;
+}
+
+template <typename Key, typename Summary, typename Balance, typename Order>
+size_t AVLTree<Key, Summary, Balance, Order>::erase_range(const Key& lo,
+                                                          const Key& hi)
+{
+    vector<AVLNode*> nodes;
+    cut_range(lo, hi, nodes);
+    size_t count = 0;
+    for (size_t i = 0; i < nodes.size(); i++) {
+        if (!nodes[i]->dead()) ++count;
+        discard(nodes[i]);
+    }
+    mutated(count);
+    return count;
+}
+
+/**
+ * -----------------------------------------------------------------------------
+ * the live nodes are rebuilt into the other tree. The ones it could not
+ * own are copied to the heap: those from the block, which it can't free
+ * where they are, and the revived ones, still listed on this graveyard
+ * -----------------------------------------------------------------------------
+ */
+template <typename Key, typename Summary, typename Balance, typename Order>
+AVLTree<Key, Summary, Balance, Order>
+AVLTree<Key, Summary, Balance, Order>::extract_range(const Key& lo,
+                                                     const Key& hi)
+{
+    AVLTree<Key, Summary, Balance, Order> out;
+    vector<AVLNode*> nodes;
+    cut_range(lo, hi, nodes);
+    size_t live = 0;
+    for (size_t i = 0; i < nodes.size(); i++) {
+        AVLNode* node = nodes[i];
+        if (node->dead()) {
+            discard(node);
+            continue;
+        }
+        if (node->state == AVLNode::REVIVED || in_block(node)) {
+            AVLNode* copy = new AVLNode(std::move(*node));
+            copy->state = AVLNode::LIVE;
+            discard(node);
+            node = copy;
+        }
+        nodes[live++] = node;
+    }
+    out.root_ = out.build_balanced(nodes.data(), live);
+    out.size_ = live;
+    out.reset_extremes();
+    mutated(live);
+    return out;
+}
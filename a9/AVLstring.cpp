@@ -0,0 +1,83 @@
+// =============================================================================
+// AVLstring.cpp
+// ~~~~~~~~~~~~~
+// description : the arena-backed string tree
+// =============================================================================
+
+#include <vector>
+#include "AVLstring.h"
+using namespace std; // BAD PRACTICE
+
+// the key is stored optimistically, which saves a second descent; when it
+// was already there the copy is handed back and its bytes are reused
+template <typename Summary, typename Balance>
+bool AVLStringTree<Summary, Balance>::insert(string_view key)
+{
+    string_view copy = arena_.store(key);
+    if (tree_.insert(copy)) return true;
+    arena_.unstore(copy);
+    return false;
+}
+
+template <typename Summary, typename Balance>
+bool AVLStringTree<Summary, Balance>::remove(string_view key)
+{
+    if (!tree_.remove(key)) return false;
+    arena_.release(key);
+    maybe_compact();
+    return true;
+}
+
+// the copies that were not needed are handed back last first, so that those
+// at the end of the arena are reused
+template <typename Summary, typename Balance>
+vector<bool>
+AVLStringTree<Summary, Balance>::insert_batch(const vector<string_view>& keys)
+{
+    vector<string_view> copies(keys.size());
+    for (size_t i = 0; i < keys.size(); i++) copies[i] = arena_.store(keys[i]);
+    vector<bool> inserted = tree_.insert_batch(copies);
+    for (size_t i = keys.size(); i-- > 0; )
+        if (!inserted[i]) arena_.unstore(copies[i]);
+    return inserted;
+}
+
+template <typename Summary, typename Balance>
+vector<bool>
+AVLStringTree<Summary, Balance>::erase_batch(const vector<string_view>& keys)
+{
+    vector<bool> removed = tree_.erase_batch(keys);
+    for (size_t i = 0; i < keys.size(); i++)
+        if (removed[i]) arena_.release(keys[i]);
+    maybe_compact();
+    return removed;
+}
+
+template <typename Summary, typename Balance>
+void AVLStringTree<Summary, Balance>::maybe_compact()
+{
+    size_t dead = arena_.dead_bytes();
+    if (compact_ratio_ > 0 && dead >= arena_.chunk_size() &&
+        dead > compact_ratio_ * arena_.live_bytes())
+        compact();
+}
+
+/**
+ * -----------------------------------------------------------------------------
+ * the nodes are first moved into one block by relayout, so that clear()
+ * after a compaction is one walk over the block rather than a free() per
+ * node scattered over the heap; then the keys come out of the tree in order,
+ * so the copies are laid out in key order in the new arena, and each node is
+ * pointed at its copy where it stands. The tree keeps its shape and whatever
+ * was set on it
+ * -----------------------------------------------------------------------------
+ */
+template <typename Summary, typename Balance>
+void AVLStringTree<Summary, Balance>::compact()
+{
+    StringArena fresh(arena_.chunk_size());
+    tree_.relayout();
+    tree_.rebind_keys([&fresh](string_view key) { return fresh.store(key); });
+    arena_.swap(fresh);
+    ++compactions_;
+}
@@ -0,0 +1,110 @@
+// =============================================================================
+// AVLstring.h
+// ~~~~~~~~~~~
+// description : an AVLTree for string keys whose bytes live in a StringArena;
+//               the nodes only hold a string_view into the arena
+// =============================================================================
+#ifndef AVLSTRING_H_
+#define AVLSTRING_H_
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "AVLTree.h"
+#include "StringArena.h"
+
+// -----------------------------------------------------------------------------
+// compared to AVLTree<std::string>, a node is 16 bytes smaller, no key ever
+// needs a heap allocation of its own, the keys of neighboring insertions sit
+// next to each other, and clear() frees the key bytes a chunk at a time.
+// The bytes of a removed key are not reused; once the dead bytes exceed
+// compact_ratio times the live ones (and a chunk's worth), the live keys are
+// copied into a fresh arena and the nodes, moved into one block, are pointed
+// at the copies, O(n)
+// -----------------------------------------------------------------------------
+template <typename Summary = avl_no_summary<std::string_view>,
+          typename Balance = avl_balance>
+class AVLStringTree {
+public:
+    typedef AVLTree<std::string_view, Summary, Balance> tree_type;
+    typedef typename tree_type::summary_type summary_type;
+
+    explicit AVLStringTree(size_t chunk_size = StringArena::DEFAULT_CHUNK)
+    : arena_(chunk_size), compact_ratio_(1.0), compactions_(0) { }
+
+    // same meaning as in AVLTree; the views returned point into the arena
+    // and are valid until the key is removed or the tree is compacted
+    bool insert(std::string_view key);
+    bool remove(std::string_view key);
+    bool find(std::string_view key) { return tree_.find(key); }
+
+    // see AVLTree; the keys of a batch are copied into the arena up front
+    std::vector<bool> insert_batch(const std::vector<std::string_view>& keys);
+    std::vector<bool> erase_batch(const std::vector<std::string_view>& keys);
+
+    std::string_view minimum() { return tree_.minimum(); }
+    std::string_view maximum() { return tree_.maximum(); }
+    size_t size() const { return tree_.size(); }
+    bool   empty() const { return tree_.empty(); }
+    void   clear() { tree_.clear(); arena_.clear(); }
+
+    template <typename Func>
+    void for_each(Func f) { tree_.for_each(f); }
+    template <typename Func>
+    size_t for_range(std::string_view lo, std::string_view hi, Func f) {
+        return tree_.for_range(lo, hi, f);
+    }
+
+    // -----------------------------------------------------------------------
+    // compaction: compact() runs it now; remove() runs it when the dead bytes
+    // pass the ratio, a ratio <= 0 turns the automatic runs off
+    // -----------------------------------------------------------------------
+    void   compact();
+    void   set_compact_ratio(double r) { compact_ratio_ = r; }
+    size_t compactions() const { return compactions_; }
+
+    // -----------------------------------------------------------------------
+    // the settings of AVLTree that leave the keys alone, see there. Lazy
+    // deletion and bounded mode are not offered: a revived or evicted key
+    // would not go through the arena, so the tree is only handed out const
+    // -----------------------------------------------------------------------
+    void enable_find_cache(size_t entries = 1024) {
+        tree_.enable_find_cache(entries);
+    }
+    void disable_find_cache() { tree_.disable_find_cache(); }
+    void enable_bloom_filter(double bits_per_key = 10) {
+        tree_.enable_bloom_filter(bits_per_key);
+    }
+    void disable_bloom_filter() { tree_.disable_bloom_filter(); }
+    void relayout() { tree_.relayout(); }
+    void set_relayout_interval(size_t mutations) {
+        tree_.set_relayout_interval(mutations);
+    }
+
+    const StringArena& arena() const { return arena_; }
+    const tree_type& tree() const { return tree_; }
+
+    // for the driver, see AVLTree
+    std::vector<std::string> preorder_sequence() {
+        return tree_.preorder_sequence();
+    }
+    std::vector<std::string> inorder_sequence() {
+        return tree_.inorder_sequence();
+    }
+
+private:
+    // compact if the dead bytes have passed the ratio
+    void maybe_compact();
+
+    // the tree goes first so that it is destroyed after the arena; it does
+    // not look at the keys while being destroyed, so either order works
+    tree_type   tree_;
+    StringArena arena_;
+    double      compact_ratio_;
+    size_t      compactions_;
+};
+
+#include "AVLstring.cpp" // only done for template classes
+
+#endif // AVLSTRING_H_
@@ -0,0 +1,77 @@
+// =============================================================================
+// AVLsummary.cpp
+// ~~~~~~~~~~~~~~
+// description : maintenance of the cached subtree summaries and the range
+//               aggregate query on top of them
+// =============================================================================
+
+#include "AVLTree.h"
+using namespace std; // BAD PRACTICE
+
+template <typename Key, typename Summary, typename Balance, typename Order>
+void AVLTree<Key, Summary, Balance, Order>::update(AVLNode* node)
+{
+    if (!Summary::enabled) return;
+    node->set_summary(Summary::combine(
+        Summary::combine(summary_of(node->left), lift_of(node)),
+        summary_of(node->right)));
+}
+
+template <typename Key, typename Summary, typename Balance, typename Order>
+void AVLTree<Key, Summary, Balance, Order>::update_path(AVLNode* node)
+{
+    if (!Summary::enabled) return;
+    for (; node != NULL; node = node->parent) update(node);
+}
+
+/**
+ * -----------------------------------------------------------------------------
+ * first find 'top', the highest node with lo <= key <= hi; the paths to lo and
+ * to hi split there. Then
+ * - walk from top->left towards lo: a node >= lo is in range together with
+ *   its whole right subtree, and everything found further down comes before
+ *   it, so it is prepended; a node < lo is skipped to the right
+ * - walk from top->right towards hi symmetrically, appending
+ * the answer is (left part) + top + (right part)
+ * -----------------------------------------------------------------------------
+ */
+template <typename Key, typename Summary, typename Balance, typename Order>
+typename AVLTree<Key, Summary, Balance, Order>::summary_type
+AVLTree<Key, Summary, Balance, Order>::aggregate(const Key& lo, const Key& hi)
+{
+    if (hi < lo) return Summary::identity();
+
+    AVLNode* top = root_;
+    while (top != NULL && (top->key < lo || hi < top->key))
+        top = (top->key < lo) ? top->right : top->left;
+    if (top == NULL) return Summary::identity();
+
+    summary_type left_part = Summary::identity();
+    for (AVLNode* node = top->left; node != NULL; ) {
+        if (node->key < lo) {
+            node = node->right;
+        } else {
+            left_part = Summary::combine(
+                Summary::combine(lift_of(node),
+                                 summary_of(node->right)),
+                left_part);
+            node = node->left;
+        }
+    }
+
+    summary_type right_part = Summary::identity();
+    for (AVLNode* node = top->right; node != NULL; ) {
+        if (hi < node->key) {
+            node = node->left;
+        } else {
+            right_part = Summary::combine(
+                right_part,
+                Summary::combine(summary_of(node->left),
+                                 lift_of(node)));
+            node = node->right;
+        }
+    }
+
+    return Summary::combine(
+        Summary::combine(left_part, lift_of(top)), right_part);
+}
@@ -0,0 +1,107 @@
+// =============================================================================
+// AVLsummary.h
+// ~~~~~~~~~~~~
+// description : subtree summaries (monoids) that an AVLTree can keep in every
+//               node, and the few summaries that come with the tree
+// =============================================================================
+#ifndef AVLSUMMARY_H_
+#define AVLSUMMARY_H_
+
+#include <cstddef>
+#include <limits>
+
+// -----------------------------------------------------------------------------
+// A summary policy S tells the tree what to cache in every node:
+//   typedef ... value_type;                   // what is cached
+//   static const bool enabled;                // false: cache nothing at all
+//   static value_type identity();             // the unit of combine
+//   static value_type lift(const Key&);       // the summary of one key
+//   static value_type combine(const value_type& a, const value_type& b);
+// combine must be associative; it need not be commutative since the tree
+// always combines in key order: left subtree, node, right subtree.
+// The summary of a node covers its whole subtree and is kept up to date by
+// every operation that changes the tree, rotations included, which is what
+// makes AVLTree::aggregate(lo, hi) O(log n).
+// To build an interval tree, for example, use pairs (low, high) as keys and
+// cache the maximum 'high' of each subtree.
+// -----------------------------------------------------------------------------
+template <typename Key>
+struct avl_no_summary {
+    struct value_type {};
+    static const bool enabled = false;
+    static value_type identity() { return value_type(); }
+    static value_type lift(const Key&) { return value_type(); }
+    static value_type combine(const value_type&, const value_type&) {
+        return value_type();
+    }
+};
+
+// number of keys; lift ignores the key
+template <typename Key>
+struct avl_count_summary {
+    typedef size_t value_type;
+    static const bool enabled = true;
+    static value_type identity() { return 0; }
+    static value_type lift(const Key&) { return 1; }
+    static value_type combine(const value_type& a, const value_type& b) {
+        return a + b;
+    }
+};
+
+// sum of the keys, accumulated in Value
+template <typename Key, typename Value = Key>
+struct avl_sum_summary {
+    typedef Value value_type;
+    static const bool enabled = true;
+    static value_type identity() { return Value(); }
+    static value_type lift(const Key& k) { return Value(k); }
+    static value_type combine(const value_type& a, const value_type& b) {
+        return a + b;
+    }
+};
+
+// smallest and largest key; Key must have std::numeric_limits
+template <typename Key>
+struct avl_min_summary {
+    typedef Key value_type;
+    static const bool enabled = true;
+    static value_type identity() { return std::numeric_limits<Key>::max(); }
+    static value_type lift(const Key& k) { return k; }
+    static value_type combine(const value_type& a, const value_type& b) {
+        return b < a ? b : a;
+    }
+};
+
+template <typename Key>
+struct avl_max_summary {
+    typedef Key value_type;
+    static const bool enabled = true;
+    static value_type identity() { return std::numeric_limits<Key>::lowest(); }
+    static value_type lift(const Key& k) { return k; }
+    static value_type combine(const value_type& a, const value_type& b) {
+        return a < b ? b : a;
+    }
+};
+
+// -----------------------------------------------------------------------------
+// the storage for the summary in a node; AVLNode derives from this so that a
+// disabled summary takes no space (empty base)
+// -----------------------------------------------------------------------------
+template <typename Key, typename Summary, bool enabled = Summary::enabled>
+struct avl_summary_slot {
+    typedef typename Summary::value_type value_type;
+    value_type summary;
+    avl_summary_slot(const Key& k) : summary(Summary::lift(k)) {}
+    const value_type& get_summary() const { return summary; }
+    void set_summary(const value_type& v) { summary = v; }
+};
+
+template <typename Key, typename Summary>
+struct avl_summary_slot<Key, Summary, false> {
+    typedef typename Summary::value_type value_type;
+    avl_summary_slot(const Key&) {}
+    value_type get_summary() const { return value_type(); }
+    void set_summary(const value_type&) {}
+};
+
+#endif // AVLSUMMARY_H_
@@ -0,0 +1,117 @@
+// =============================================================================
+// AVLtombstone.cpp
+// ~~~~~~~~~~~~~~~~
+// description : lazy deletion: remove marks the node as a tombstone, and an
+//               incremental compaction takes the tombstones out later
+// =============================================================================
+
+#include <vector>
+#include "AVLTree.h"
+using namespace std; // BAD PRACTICE
+
+template <typename Key, typename Summary, typename Balance, typename Order>
+void AVLTree<Key, Summary, Balance, Order>::set_lazy_delete(bool on,
+                                                            double max_ratio,
+                                                            size_t step)
+{
+    if (!on && !graveyard_.empty()) compact();
+    lazy_delete_ = on;
+    max_tomb_ratio_ = max_ratio;
+    compact_step_ = step;
+}
+
+/**
+ * -----------------------------------------------------------------------------
+ * the node stays where it is; only the summaries above it change, since a
+ * tombstone counts for nothing. A node which is on the graveyard already
+ * (it was buried before, then revived) is not listed twice
+ * -----------------------------------------------------------------------------
+ */
+template <typename Key, typename Summary, typename Balance, typename Order>
+void AVLTree<Key, Summary, Balance, Order>::bury(AVLNode* node)
+{
+    if (cache_ != NULL) cache_->forget(node->key);
+    if (node->state == AVLNode::LIVE) graveyard_.push_back(node);
+    node->state = AVLNode::TOMBSTONE;
+    ++tombstones_;
+    update_path(node);
+}
+
+template <typename Key, typename Summary, typename Balance, typename Order>
+void AVLTree<Key, Summary, Balance, Order>::revive(AVLNode* node)
+{
+    node->state = AVLNode::REVIVED;
+    --tombstones_;
+    untrack(node); // inserted again: the newest
+    track(node);
+    update_path(node);
+    if (bloom_ != NULL) bloom_->add(avl_bloom_filter::hash(node->key));
+}
+
+/**
+ * -----------------------------------------------------------------------------
+ * the graveyard is worked from the back; a revived node only needs to be
+ * taken off it, and a detached one, already out of the tree, to be freed.
+ * Each tombstone costs one ordinary unlink, so a call is O(max_nodes log n)
+ * and the tree is consistent between any two calls
+ * -----------------------------------------------------------------------------
+ */
+template <typename Key, typename Summary, typename Balance, typename Order>
+size_t AVLTree<Key, Summary, Balance, Order>::compact(size_t max_nodes)
+{
+    for (size_t done = 0; done < max_nodes && !graveyard_.empty(); ++done) {
+        AVLNode* node = graveyard_.back();
+        graveyard_.pop_back();
+        if (node->state == AVLNode::REVIVED) {
+            node->state = AVLNode::LIVE;
+            continue;
+        }
+        if (node->state == AVLNode::DETACHED) {
+            --detached_;
+            release(node);
+            continue;
+        }
+        unlink(node);
+        --tombstones_;
+        release(node);
+    }
+    return tombstones_;
+}
+
+// a bit of compaction work per mutation while there are too many; the
+// detached nodes count, they hold memory until compaction gets to them
+template <typename Key, typename Summary, typename Balance, typename Order>
+void AVLTree<Key, Summary, Balance, Order>::compact_some(size_t mutations)
+{
+    if (compact_step_ > 0 &&
+        tombstones_ + detached_ > max_tomb_ratio_ * size_)
+        compact(compact_step_ * mutations);
+}
+
+template <typename Key, typename Summary, typename Balance, typename Order>
+void AVLTree<Key, Summary, Balance, Order>::drop(AVLNode* node)
+{
+    unlink(node);
+    if (node->dead()) --tombstones_;
+    discard(node);
+}
+
+template <typename Key, typename Summary, typename Balance, typename Order>
+void AVLTree<Key, Summary, Balance, Order>::discard(AVLNode* node)
+{
+    if (node->state == AVLNode::LIVE) {
+        release(node);
+        return;
+    }
+    node->state = AVLNode::DETACHED;
+    ++detached_;
+}
+
+template <typename Key, typename Summary, typename Balance, typename Order>
+void AVLTree<Key, Summary, Balance, Order>::drop_graveyard()
+{
+    for (size_t i = 0; i < graveyard_.size(); i++)
+        if (graveyard_[i]->state == AVLNode::DETACHED) release(graveyard_[i]);
+    graveyard_.clear();
+    detached_ = 0;
+}
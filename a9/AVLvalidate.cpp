@@ -0,0 +1,158 @@
+// =============================================================================
+// AVLvalidate.cpp
+// ~~~~~~~~~~~~~~~
+// description : a full consistency check of the tree and of what it keeps
+//               about its nodes, for the tests, see AVLTree.h
+// =============================================================================
+
+#include <algorithm>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+#include "AVLTree.h"
+using namespace std; // BAD PRACTICE
+
+namespace avl_validate {
+    template <typename Node>
+    void fail(const char* what, const Node* node) {
+        ostringstream oss;
+        oss << "validate(): " << what;
+        if (node != NULL) oss << " at " << node->to_string();
+        throw runtime_error(oss.str());
+    }
+
+    // whether node is in v, which is sorted
+    template <typename Node>
+    bool listed(const vector<const Node*>& v, const Node* node) {
+        return binary_search(v.begin(), v.end(), node);
+    }
+
+    // sorts v, and fails on a node listed twice
+    template <typename Node>
+    void sort_once(vector<const Node*>& v, const char* what) {
+        sort(v.begin(), v.end());
+        if (adjacent_find(v.begin(), v.end()) != v.end())
+            fail(what, *adjacent_find(v.begin(), v.end()));
+    }
+}
+
+/**
+ * -----------------------------------------------------------------------------
+ * one walk in post-order down the child pointers, on a stack of its own, so
+ * that a broken tree can't send it astray: the parent pointers are only
+ * compared, and it gives up once it has seen more nodes than size_, which
+ * a cycle would make it do. A subtree comes back as what Balance::audit made
+ * of it and its first and last nodes in order; a node is then checked
+ * against the last node of its left subtree and the first of its right one.
+ * The graveyard and the insertion list are sorted copies, looked up per node,
+ * and a bounded tree's byte count is summed up on the way
+ * -----------------------------------------------------------------------------
+ */
+template <typename Key, typename Summary, typename Balance, typename Order>
+void AVLTree<Key, Summary, Balance, Order>::validate() const
+{
+    typedef const AVLNode* Ptr;
+    using avl_validate::fail;
+    using avl_validate::listed;
+
+    vector<Ptr> graveyard(graveyard_.begin(), graveyard_.end());
+    avl_validate::sort_once(graveyard, "listed twice on the graveyard");
+    size_t detached = 0;
+    for (size_t i = 0; i < graveyard.size(); i++) {
+        if (graveyard[i]->state == AVLNode::LIVE)
+            fail("a live node on the graveyard", graveyard[i]);
+        if (graveyard[i]->state == AVLNode::DETACHED) ++detached;
+    }
+    if (detached != detached_) fail("wrong count of detached nodes", (Ptr)NULL);
+
+    vector<Ptr> inserted;
+    bool listing = bound_.on && Order::enabled;
+    if (listing) {
+        Ptr older = NULL;
+        for (Ptr node = bound_.oldest; node != NULL;
+             node = node->newer_node()) {
+            if (node->older_node() != older)
+                fail("insertion list broken", node);
+            if (inserted.size() == size_) fail("insertion list too long", node);
+            inserted.push_back(node);
+            older = node;
+        }
+        if (bound_.newest != older) fail("wrong newest node", bound_.newest);
+        avl_validate::sort_once(inserted, "listed twice in insertion order");
+    } else if (bound_.oldest != NULL || bound_.newest != NULL) {
+        fail("an insertion list without insertion order", bound_.oldest);
+    }
+
+    struct Frame {
+        Ptr  node;
+        bool right;  // the left subtree is done, the right one under way
+        int  left;   // what audit made of the left subtree
+        Ptr  first;  // the first node of the subtree in order
+    };
+    vector<Frame> stack;
+    size_t nodes = 0, dead = 0, in_graveyard = 0, bytes = 0;
+    int measure = 0;        // of the subtree just done
+    Ptr first = NULL, last = NULL;
+    bool done = false;
+    Ptr node = root_;
+    if (root_ != NULL && root_->parent != NULL) fail("the root has a parent", root_);
+
+    for (;;) {
+        if (!done) {
+            if (node != NULL) {
+                if (++nodes > size_) fail("more nodes than size()", node);
+                if ((node->left != NULL && node->left->parent != node) ||
+                    (node->right != NULL && node->right->parent != node))
+                    fail("a child does not point back", node);
+                Frame f = { node, false, 0, NULL };
+                stack.push_back(f);
+                node = node->left;
+                continue;
+            }
+            measure = 0;    // an empty subtree
+            first = last = NULL;
+            done = true;
+        }
+        if (stack.empty()) break;
+        Frame& f = stack.back();
+        if (!f.right) {
+            if (last != NULL && !(last->key < f.node->key))
+                fail("keys out of order", f.node);
+            f.right = true;
+            f.left = measure;
+            f.first = (first != NULL) ? first : f.node;
+            node = f.node->right;
+            done = false;
+            continue;
+        }
+        if (first != NULL && !(f.node->key < first->key))
+            fail("keys out of order", f.node);
+        measure = Balance::audit(f.node, f.left, measure);
+        if (measure < 0) fail("breaks the balancing invariant", f.node);
+
+        if (f.node->state == AVLNode::DETACHED)
+            fail("a detached node in the tree", f.node);
+        if (f.node->dead()) ++dead;
+        if (f.node->state != AVLNode::LIVE) {
+            if (!listed(graveyard, f.node)) fail("not on the graveyard", f.node);
+            ++in_graveyard;
+        }
+        if (listing && !listed(inserted, f.node))
+            fail("not in the insertion list", f.node);
+        bytes += sizeof(AVLNode) + avl_key_bytes<Key>::of(f.node->key);
+
+        if (last == NULL) last = f.node;
+        first = f.first;
+        stack.pop_back();
+    }
+
+    if (nodes != size_) fail("fewer nodes than size()", (Ptr)NULL);
+    if (dead != tombstones_) fail("wrong count of tombstones", (Ptr)NULL);
+    if (in_graveyard + detached != graveyard.size())
+        fail("the graveyard lists nodes that are gone", (Ptr)NULL);
+    if (listing && inserted.size() != size_)
+        fail("the insertion list holds nodes that are gone", (Ptr)NULL);
+    if (bound_.on && bytes != bound_.bytes) fail("wrong byte count", (Ptr)NULL);
+    if (min_ != first) fail("wrong minimum", min_);
+    if (max_ != last) fail("wrong maximum", max_);
+}
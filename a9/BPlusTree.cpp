@@ -0,0 +1,433 @@
+// =============================================================================
+// BPlusTree.cpp
+// ~~~~~~~~~~~~~
+// description : the B+ tree; splits on the way up after an insertion,
+//               borrows or merges on the way up after a removal
+// =============================================================================
+
+#include "BPlusTree.h"
+
+// the scans count, rather than stop at the first key that fits; for
+// arithmetic keys the loop has no branch to mispredict and vectorizes
+template <typename Key, size_t NodeBytes>
+unsigned BPlusTree<Key, NodeBytes>::upper_slot(const Key* keys, unsigned count,
+                                               const Key& key)
+{
+    unsigned slot = 0;
+    for (unsigned i = 0; i < count; i++) slot += !(key < keys[i]);
+    return slot;
+}
+
+template <typename Key, size_t NodeBytes>
+unsigned BPlusTree<Key, NodeBytes>::lower_slot(const Key* keys, unsigned count,
+                                               const Key& key)
+{
+    unsigned slot = 0;
+    for (unsigned i = 0; i < count; i++) slot += keys[i] < key;
+    return slot;
+}
+
+template <typename Key, size_t NodeBytes>
+typename BPlusTree<Key, NodeBytes>::Leaf*
+BPlusTree<Key, NodeBytes>::descend(const Key& key, Inner** path,
+                                   unsigned* slot) const
+{
+    void* node = root_;
+    for (int d = 0; d + 1 < height_; d++) {
+        Inner* inner = static_cast<Inner*>(node);
+        unsigned i = upper_slot(inner->keys, inner->count, key);
+        if (path != NULL) {
+            path[d] = inner;
+            slot[d] = i;
+        }
+        node = inner->child[i];
+    }
+    return static_cast<Leaf*>(node);
+}
+
+template <typename Key, size_t NodeBytes>
+bool BPlusTree<Key, NodeBytes>::find(const Key& key) const
+{
+    if (root_ == NULL) return false;
+    const Leaf* leaf = descend(key, NULL, NULL);
+    unsigned i = lower_slot(leaf->keys, leaf->count, key);
+    return i < leaf->count && !(key < leaf->keys[i]);
+}
+
+/**
+ * -----------------------------------------------------------------------------
+ * a full leaf gives its upper half to a new leaf to its right, whose first
+ * key goes up as the separator; a full inner node does the same, except
+ * that its middle key moves up instead of being copied. A new root is
+ * only made when the old one splits, so all leaves stay at the same depth
+ * -----------------------------------------------------------------------------
+ */
+template <typename Key, size_t NodeBytes>
+bool BPlusTree<Key, NodeBytes>::insert(const Key& key)
+{
+    if (root_ == NULL) {
+        Leaf* leaf = new Leaf;
+        leaf->keys[0] = key;
+        leaf->count = 1;
+        root_ = leaf;
+        height_ = 1;
+        size_ = leaves_ = 1;
+        return true;
+    }
+
+    Inner* path[MAX_HEIGHT];
+    unsigned slot[MAX_HEIGHT];
+    Leaf* leaf = descend(key, path, slot);
+    unsigned pos = lower_slot(leaf->keys, leaf->count, key);
+    if (pos < leaf->count && !(key < leaf->keys[pos])) return false;
+    ++size_;
+
+    if (leaf->count < LEAF_KEYS) {
+        for (unsigned i = leaf->count; i > pos; i--)
+            leaf->keys[i] = leaf->keys[i-1];
+        leaf->keys[pos] = key;
+        ++leaf->count;
+        return true;
+    }
+
+    Leaf* right = new Leaf;
+    ++leaves_;
+    unsigned keep = (LEAF_KEYS + 1) / 2;  // of the LEAF_KEYS + 1 keys
+    // fill the right leaf from the top down, dropping key in on the way
+    unsigned from = leaf->count;
+    bool placed = false;
+    for (unsigned to = LEAF_KEYS + 1; to-- > keep; ) {
+        if (!placed && from == pos) {
+            right->keys[to - keep] = key;
+            placed = true;
+        } else {
+            right->keys[to - keep] = leaf->keys[--from];
+        }
+    }
+    right->count = LEAF_KEYS + 1 - keep;
+    leaf->count = from;
+    if (!placed) {
+        for (unsigned i = leaf->count; i > pos; i--)
+            leaf->keys[i] = leaf->keys[i-1];
+        leaf->keys[pos] = key;
+        ++leaf->count;
+    }
+    right->next = leaf->next;
+    right->prev = leaf;
+    if (leaf->next != NULL) leaf->next->prev = right;
+    leaf->next = right;
+
+    insert_above(path, slot, height_ - 2, right->keys[0], right);
+    return true;
+}
+
+template <typename Key, size_t NodeBytes>
+void BPlusTree<Key, NodeBytes>::insert_above(Inner** path, unsigned* slot,
+                                             int depth, Key sep, void* right)
+{
+    for (; depth >= 0; depth--) {
+        Inner* node = path[depth];
+        unsigned pos = slot[depth];
+        if (node->count < INNER_KEYS) {
+            for (unsigned i = node->count; i > pos; i--) {
+                node->keys[i] = node->keys[i-1];
+                node->child[i+1] = node->child[i];
+            }
+            node->keys[pos] = sep;
+            node->child[pos+1] = right;
+            ++node->count;
+            return;
+        }
+
+        // lay the INNER_KEYS + 1 keys out in order, then cut at the middle
+        Key keys[INNER_KEYS + 1];
+        void* child[INNER_KEYS + 2];
+        for (unsigned i = 0, j = 0; i <= INNER_KEYS; i++) {
+            if (i == pos) keys[i] = sep;
+            else keys[i] = node->keys[j++];
+        }
+        for (unsigned i = 0, j = 0; i <= INNER_KEYS + 1; i++) {
+            if (i == pos + 1) child[i] = right;
+            else child[i] = node->child[j++];
+        }
+        unsigned mid = (INNER_KEYS + 1) / 2;
+        Inner* sibling = new Inner;
+        ++inners_;
+        node->count = mid;
+        for (unsigned i = 0; i < mid; i++) node->keys[i] = keys[i];
+        for (unsigned i = 0; i <= mid; i++) node->child[i] = child[i];
+        sibling->count = INNER_KEYS - mid;
+        for (unsigned i = 0; i < sibling->count; i++)
+            sibling->keys[i] = keys[mid + 1 + i];
+        for (unsigned i = 0; i <= sibling->count; i++)
+            sibling->child[i] = child[mid + 1 + i];
+        sep = keys[mid];
+        right = sibling;
+    }
+
+    Inner* root = new Inner;
+    ++inners_;
+    root->count = 1;
+    root->keys[0] = sep;
+    root->child[0] = root_;
+    root->child[1] = right;
+    root_ = root;
+    ++height_;
+}
+
+/**
+ * -----------------------------------------------------------------------------
+ * a separator never has to change when the key it was copied from goes:
+ * it still lies between the two subtrees. A node left less than half full
+ * takes a key from a sibling that can spare one, or else is merged with a
+ * sibling, which takes a child out of the parent; the parent is checked in
+ * turn. A root left with a single child is replaced by it
+ * -----------------------------------------------------------------------------
+ */
+template <typename Key, size_t NodeBytes>
+bool BPlusTree<Key, NodeBytes>::remove(const Key& key)
+{
+    if (root_ == NULL) return false;
+    Inner* path[MAX_HEIGHT];
+    unsigned slot[MAX_HEIGHT];
+    Leaf* leaf = descend(key, path, slot);
+    unsigned pos = lower_slot(leaf->keys, leaf->count, key);
+    if (pos == leaf->count || key < leaf->keys[pos]) return false;
+
+    for (unsigned i = pos + 1; i < leaf->count; i++)
+        leaf->keys[i-1] = leaf->keys[i];
+    --leaf->count;
+    --size_;
+
+    if (height_ == 1) {
+        if (leaf->count == 0) clear();
+        return true;
+    }
+    if (leaf->count >= LEAF_MIN) return true;
+    fix_leaf(path[height_ - 2], slot[height_ - 2]);
+    for (int d = height_ - 2; d > 0 && path[d]->count < INNER_MIN; d--)
+        fix_inner(path[d-1], slot[d-1]);
+
+    Inner* root = static_cast<Inner*>(root_);
+    if (root->count == 0) {
+        root_ = root->child[0];
+        delete root;
+        --inners_;
+        --height_;
+    }
+    return true;
+}
+
+// the leaf on the right of a merge goes; the parent loses its separator
+template <typename Key, size_t NodeBytes>
+void BPlusTree<Key, NodeBytes>::fix_leaf(Inner* parent, unsigned slot)
+{
+    Leaf* leaf = static_cast<Leaf*>(parent->child[slot]);
+    Leaf* left = slot > 0 ? static_cast<Leaf*>(parent->child[slot-1]) : NULL;
+    Leaf* right = slot < parent->count
+                ? static_cast<Leaf*>(parent->child[slot+1]) : NULL;
+
+    if (left != NULL && left->count > LEAF_MIN) {
+        for (unsigned i = leaf->count; i > 0; i--)
+            leaf->keys[i] = leaf->keys[i-1];
+        leaf->keys[0] = left->keys[--left->count];
+        ++leaf->count;
+        parent->keys[slot-1] = leaf->keys[0];
+        return;
+    }
+    if (right != NULL && right->count > LEAF_MIN) {
+        leaf->keys[leaf->count++] = right->keys[0];
+        for (unsigned i = 1; i < right->count; i++)
+            right->keys[i-1] = right->keys[i];
+        --right->count;
+        parent->keys[slot] = right->keys[0];
+        return;
+    }
+
+    if (left != NULL) {   // merge leaf into left
+        right = leaf;
+        leaf = left;
+        --slot;
+    }
+    for (unsigned i = 0; i < right->count; i++)
+        leaf->keys[leaf->count++] = right->keys[i];
+    leaf->next = right->next;
+    if (right->next != NULL) right->next->prev = leaf;
+    delete right;
+    --leaves_;
+    for (unsigned i = slot + 1; i < parent->count; i++) {
+        parent->keys[i-1] = parent->keys[i];
+        parent->child[i] = parent->child[i+1];
+    }
+    --parent->count;
+}
+
+// as fix_leaf, except that keys rotate through the parent's separator
+template <typename Key, size_t NodeBytes>
+void BPlusTree<Key, NodeBytes>::fix_inner(Inner* parent, unsigned slot)
+{
+    Inner* node = static_cast<Inner*>(parent->child[slot]);
+    Inner* left = slot > 0 ? static_cast<Inner*>(parent->child[slot-1]) : NULL;
+    Inner* right = slot < parent->count
+                 ? static_cast<Inner*>(parent->child[slot+1]) : NULL;
+
+    if (left != NULL && left->count > INNER_MIN) {
+        node->child[node->count + 1] = node->child[node->count];
+        for (unsigned i = node->count; i > 0; i--) {
+            node->keys[i] = node->keys[i-1];
+            node->child[i] = node->child[i-1];
+        }
+        node->keys[0] = parent->keys[slot-1];
+        node->child[0] = left->child[left->count];
+        ++node->count;
+        parent->keys[slot-1] = left->keys[--left->count];
+        return;
+    }
+    if (right != NULL && right->count > INNER_MIN) {
+        node->keys[node->count] = parent->keys[slot];
+        node->child[++node->count] = right->child[0];
+        parent->keys[slot] = right->keys[0];
+        for (unsigned i = 1; i < right->count; i++) {
+            right->keys[i-1] = right->keys[i];
+            right->child[i-1] = right->child[i];
+        }
+        right->child[right->count - 1] = right->child[right->count];
+        --right->count;
+        return;
+    }
+
+    if (left != NULL) {   // merge node into left
+        right = node;
+        node = left;
+        --slot;
+    }
+    node->keys[node->count] = parent->keys[slot];
+    for (unsigned i = 0; i < right->count; i++)
+        node->keys[node->count + 1 + i] = right->keys[i];
+    for (unsigned i = 0; i <= right->count; i++)
+        node->child[node->count + 1 + i] = right->child[i];
+    node->count += right->count + 1;
+    delete right;
+    --inners_;
+    for (unsigned i = slot + 1; i < parent->count; i++) {
+        parent->keys[i-1] = parent->keys[i];
+        parent->child[i] = parent->child[i+1];
+    }
+    --parent->count;
+}
+
+/**
+ * -----------------------------------------------------------------------------
+ * the leaves are freed along their chain; the inner nodes level by level,
+ * each level being found by following the first children down, and walked
+ * through the child pointers of the level above
+ * -----------------------------------------------------------------------------
+ */
+template <typename Key, size_t NodeBytes>
+void BPlusTree<Key, NodeBytes>::clear()
+{
+    if (root_ == NULL) return;
+    Leaf* leaf = const_cast<Leaf*>(first_leaf());
+    while (leaf != NULL) {
+        Leaf* next = leaf->next;
+        delete leaf;
+        leaf = next;
+    }
+    // the inner levels, top down
+    std::vector<Inner*> level, below;
+    if (height_ > 1) level.push_back(static_cast<Inner*>(root_));
+    for (int d = 0; d + 1 < height_; d++) {
+        below.clear();
+        for (size_t i = 0; i < level.size(); i++) {
+            if (d + 2 < height_)
+                for (unsigned c = 0; c <= level[i]->count; c++)
+                    below.push_back(static_cast<Inner*>(level[i]->child[c]));
+            delete level[i];
+        }
+        level.swap(below);
+    }
+    root_ = NULL;
+    height_ = 0;
+    size_ = leaves_ = inners_ = 0;
+}
+
+template <typename Key, size_t NodeBytes>
+const typename BPlusTree<Key, NodeBytes>::Leaf*
+BPlusTree<Key, NodeBytes>::first_leaf() const
+{
+    void* node = root_;
+    for (int d = 0; d + 1 < height_; d++)
+        node = static_cast<Inner*>(node)->child[0];
+    return static_cast<const Leaf*>(node);
+}
+
+template <typename Key, size_t NodeBytes>
+const typename BPlusTree<Key, NodeBytes>::Leaf*
+BPlusTree<Key, NodeBytes>::last_leaf() const
+{
+    void* node = root_;
+    for (int d = 0; d + 1 < height_; d++) {
+        Inner* inner = static_cast<Inner*>(node);
+        node = inner->child[inner->count];
+    }
+    return static_cast<const Leaf*>(node);
+}
+
+template <typename Key, size_t NodeBytes>
+const Key& BPlusTree<Key, NodeBytes>::minimum() const
+{
+    if (root_ == NULL) throw std::runtime_error("minimum() on an empty tree");
+    return first_leaf()->keys[0];
+}
+
+template <typename Key, size_t NodeBytes>
+const Key& BPlusTree<Key, NodeBytes>::maximum() const
+{
+    if (root_ == NULL) throw std::runtime_error("maximum() on an empty tree");
+    const Leaf* leaf = last_leaf();
+    return leaf->keys[leaf->count - 1];
+}
+
+template <typename Key, size_t NodeBytes>
+template <typename Func>
+void BPlusTree<Key, NodeBytes>::for_each(Func f) const
+{
+    if (root_ == NULL) return;
+    for (const Leaf* leaf = first_leaf(); leaf != NULL; leaf = leaf->next)
+        for (unsigned i = 0; i < leaf->count; i++) f(leaf->keys[i]);
+}
+
+template <typename Key, size_t NodeBytes>
+template <typename Func>
+size_t BPlusTree<Key, NodeBytes>::for_range(const Key& lo, const Key& hi,
+                                            Func f) const
+{
+    size_t count = 0;
+    const_iterator it = lower_bound(lo);
+    for (; it != end() && !(hi < *it); ++it) {
+        f(*it);
+        ++count;
+    }
+    return count;
+}
+
+template <typename Key, size_t NodeBytes>
+typename BPlusTree<Key, NodeBytes>::const_iterator
+BPlusTree<Key, NodeBytes>::begin() const
+{
+    if (root_ == NULL) return end();
+    return const_iterator(first_leaf(), 0);
+}
+
+// the first key >= key may be in the next leaf, if key is beyond the leaf
+// it routes to
+template <typename Key, size_t NodeBytes>
+typename BPlusTree<Key, NodeBytes>::const_iterator
+BPlusTree<Key, NodeBytes>::lower_bound(const Key& key) const
+{
+    if (root_ == NULL) return end();
+    const Leaf* leaf = descend(key, NULL, NULL);
+    unsigned i = lower_slot(leaf->keys, leaf->count, key);
+    if (i < leaf->count) return const_iterator(leaf, i);
+    return const_iterator(leaf->next, 0);
+}
@@ -0,0 +1,195 @@
+// =============================================================================
+// BPlusTree.h
+// ~~~~~~~~~~~
+// description : a B+ tree whose nodes are a few cache lines each, with the
+//               insert/remove/find and traversal interface of AVLTree
+// =============================================================================
+#ifndef BPLUSTREE_H_
+#define BPLUSTREE_H_
+
+#include <cstddef>
+#include <iterator>
+#include <stdexcept>
+#include <vector>
+
+// -----------------------------------------------------------------------------
+// the keys live in the leaves, in order, and the leaves are linked both ways;
+// the inner nodes only hold separators to route a search. Every node is
+// NodeBytes long, aligned on a cache line, and holds as many keys as fit:
+// with the default 256 bytes and int keys that is 58 keys to a leaf and 20
+// to an inner node, so a million keys are 4 levels deep, where an AVL tree
+// is over 20. A search reads a few adjacent cache lines per level, scanning
+// them in order, which the prefetcher handles well.
+// + insert and remove return whether the tree changed, as AVLTree's do; a
+//   full node is split in two and a node less than half full borrows from
+//   a sibling or is merged with it, up the path to the root
+// + minimum and maximum are O(log n) and throw runtime_error on an empty
+//   tree
+// + for_each, for_range, and the iterators, go through the leaf chain;
+//   an iterator is invalidated by any insert or remove
+// Key needs a default constructor, for the unused slots of the nodes
+// -----------------------------------------------------------------------------
+template <typename Key, size_t NodeBytes = 256>
+class BPlusTree {
+    struct Leaf;
+public:
+    class const_iterator {
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef Key        value_type;
+        typedef ptrdiff_t  difference_type;
+        typedef const Key* pointer;
+        typedef const Key& reference;
+
+        const_iterator() : leaf_(NULL), pos_(0) {}
+        const Key& operator*() const  { return leaf_->keys[pos_]; }
+        const Key* operator->() const { return &leaf_->keys[pos_]; }
+        const_iterator& operator++() {
+            if (++pos_ == leaf_->count) {
+                leaf_ = leaf_->next;
+                pos_ = 0;
+            }
+            return *this;
+        }
+        const_iterator operator++(int) {
+            const_iterator old = *this;
+            ++*this;
+            return old;
+        }
+        bool operator==(const const_iterator& o) const {
+            return leaf_ == o.leaf_ && pos_ == o.pos_;
+        }
+        bool operator!=(const const_iterator& o) const {
+            return !(*this == o);
+        }
+
+    private:
+        friend class BPlusTree;
+        const_iterator(const Leaf* leaf, unsigned pos)
+        : leaf_(leaf), pos_(pos) {}
+        const Leaf* leaf_; // NULL at the end
+        unsigned    pos_;
+    };
+    typedef const_iterator iterator;
+
+    BPlusTree() : root_(NULL), height_(0), size_(0), leaves_(0), inners_(0) {}
+    ~BPlusTree() { clear(); }
+
+    // trees own their nodes; they can be moved but not copied
+    BPlusTree(BPlusTree&& other)
+    : root_(other.root_), height_(other.height_), size_(other.size_),
+      leaves_(other.leaves_), inners_(other.inners_) {
+        other.root_ = NULL;
+        other.height_ = 0;
+        other.size_ = other.leaves_ = other.inners_ = 0;
+    }
+    BPlusTree& operator=(BPlusTree&& other) {
+        if (this != &other) {
+            clear();
+            root_ = other.root_;     other.root_ = NULL;
+            height_ = other.height_; other.height_ = 0;
+            size_ = other.size_;     other.size_ = 0;
+            leaves_ = other.leaves_; other.leaves_ = 0;
+            inners_ = other.inners_; other.inners_ = 0;
+        }
+        return *this;
+    }
+
+    bool insert(const Key& key);
+    bool remove(const Key& key);
+    bool find(const Key& key) const;
+
+    const Key& minimum() const;
+    const Key& maximum() const;
+    void   clear();
+    size_t size() const  { return size_; }
+    bool   empty() const { return size_ == 0; }
+    int    height() const { return height_; }
+
+    // the memory taken by the nodes; a node takes more than NodeBytes if
+    // the minimum number of keys doesn't fit, and is rounded up to a
+    // whole number of cache lines
+    size_t bytes() const {
+        return leaves_ * sizeof(Leaf) + inners_ * sizeof(Inner);
+    }
+
+    // f(key) once per key in increasing order
+    template <typename Func>
+    void for_each(Func f) const;
+
+    // f(key) for lo <= key <= hi in increasing order; returns how many
+    template <typename Func>
+    size_t for_range(const Key& lo, const Key& hi, Func f) const;
+
+    const_iterator begin() const;
+    const_iterator end() const { return const_iterator(); }
+    // the first key >= key
+    const_iterator lower_bound(const Key& key) const;
+
+    // the keys that fit in a node, past its header; at least 4 to a leaf
+    // and 3 to an inner node, whatever NodeBytes says
+    static constexpr size_t LEAF_FIT =
+        (NodeBytes - 3 * sizeof(void*)) / sizeof(Key);
+    static constexpr size_t INNER_FIT =
+        (NodeBytes - 2 * sizeof(void*)) / (sizeof(Key) + sizeof(void*));
+    static constexpr size_t LEAF_KEYS = LEAF_FIT < 4 ? 4 : LEAF_FIT;
+    static constexpr size_t INNER_KEYS = INNER_FIT < 3 ? 3 : INNER_FIT;
+
+private:
+    static constexpr size_t LEAF_MIN = LEAF_KEYS / 2;
+    static constexpr size_t INNER_MIN = INNER_KEYS / 2;
+    static constexpr int MAX_HEIGHT = 64;
+
+    struct alignas(64) Leaf {
+        unsigned count;
+        Leaf* prev;
+        Leaf* next;
+        Key keys[LEAF_KEYS];
+        Leaf() : count(0), prev(NULL), next(NULL) {}
+    };
+
+    // child[i] holds the keys k with keys[i-1] <= k < keys[i]; the children
+    // are leaves on the last inner level, inner nodes above it
+    struct alignas(64) Inner {
+        unsigned count; // keys; there is one more child
+        Key keys[INNER_KEYS];
+        void* child[INNER_KEYS + 1];
+        Inner() : count(0) {}
+    };
+
+    // where a search for key goes: the first slot whose key is > key (the
+    // child to take in an inner node), or >= key (the lower bound in a
+    // leaf); a scan, the nodes being short
+    static unsigned upper_slot(const Key* keys, unsigned count,
+                               const Key& key);
+    static unsigned lower_slot(const Key* keys, unsigned count,
+                               const Key& key);
+
+    // the leaf where key belongs, and the way down to it
+    Leaf* descend(const Key& key, Inner** path, unsigned* slot) const;
+
+    // after a split below path[depth]: hang 'right' next to child slot,
+    // with sep as its separator, splitting upwards as needed
+    void insert_above(Inner** path, unsigned* slot, int depth,
+                      Key sep, void* right);
+
+    // the leaf (or inner node) at child slot of parent is under half full
+    void fix_leaf(Inner* parent, unsigned slot);
+    void fix_inner(Inner* parent, unsigned slot);
+
+    const Leaf* first_leaf() const;
+    const Leaf* last_leaf() const;
+
+    void* root_;    // a Leaf if height_ is 1, an Inner above that
+    int   height_;  // levels, leaves included; 0 when empty
+    size_t size_;
+    size_t leaves_;
+    size_t inners_;
+
+    BPlusTree(const BPlusTree&);
+    BPlusTree& operator=(const BPlusTree&);
+};
+
+#include "BPlusTree.cpp" // only done for template classes
+
+#endif // BPLUSTREE_H_
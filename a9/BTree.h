@@ -8,8 +8,11 @@
 #ifndef BTREE_H_
 #define BTREE_H_
 
+#include <cstddef>
+#include <exception>
 #include <iostream>
-#include <deque>
+#include <iterator>
+#include <vector>
 
 /*
  * -----------------------------------------------------------------------------
@@ -27,6 +30,249 @@ struct BTNode {
         : payload(item), left(l), right(r) {}
 };
 
+/*
+ * -----------------------------------------------------------------------------
+ * the traversal toolkit: the templates below work on any node type with
+ * left and right pointers, BTNode and AVLTree's nodes alike, and none of
+ * them allocates or recurses. The visitor f is one of
+ * + a callable taking a node pointer,
+ * + a callable taking the node's value (bt_value: payload, or key),
+ * + an output iterator, to which the values are written,
+ * tried in that order; it is taken by value and returned, advanced, as
+ * std::for_each and std::copy do.
+ * bt_inorder, bt_preorder and bt_postorder use Morris threading: the walk
+ * borrows the NULL right pointers of the leaves to find its way back up
+ * instead of a stack, so it needs O(1) space for a tree of any shape, and
+ * puts every pointer back by the time it returns. The tree must not be
+ * read by anybody else meanwhile, nor changed by f. If f throws, the walk
+ * goes on without calling it to restore the tree, and then rethrows.
+ * bt_levelorder goes through a ring buffer of the caller's, which only
+ * allocates when it grows past the widest level seen so far
+ * -----------------------------------------------------------------------------
+ */
+template <typename Node>
+auto bt_value(const Node* node) -> decltype((node->payload)) {
+    return node->payload;
+}
+
+template <typename Node>
+auto bt_value(const Node* node) -> decltype((node->key)) {
+    return node->key;
+}
+
+namespace bt_detail {
+    template <int N> struct rank : rank<N-1> {};
+    template <> struct rank<0> {};
+
+    template <typename F, typename Node>
+    auto emit(F& f, Node* node, rank<2>) -> decltype(f(node), void()) {
+        f(node);
+    }
+    template <typename F, typename Node>
+    auto emit(F& f, Node* node, rank<1>)
+        -> decltype(f(bt_value(node)), void()) {
+        f(bt_value(node));
+    }
+    template <typename F, typename Node>
+    void emit(F& f, Node* node, rank<0>) {
+        *f++ = bt_value(node);
+    }
+
+    // the visitor as the Morris walks call it: once f has thrown, nodes
+    // are no longer passed on, and finish() rethrows after the walk
+    template <typename F>
+    struct guarded {
+        F& f;
+        std::exception_ptr error;
+        explicit guarded(F& fn) : f(fn) {}
+        template <typename Node>
+        void operator()(Node* node) {
+            if (error) return;
+            try {
+                emit(f, node, rank<2>());
+            } catch (...) {
+                error = std::current_exception();
+            }
+        }
+        void finish() { if (error) std::rethrow_exception(error); }
+    };
+
+    // the rightmost node of the left subtree of cur, or the node whose
+    // right pointer has been threaded back to cur
+    template <typename Node>
+    Node* threaded_predecessor(Node* cur) {
+        Node* pred = cur->left;
+        while (pred->right != NULL && pred->right != cur) pred = pred->right;
+        return pred;
+    }
+
+    // flip the right pointers along the path from..to; the pointer out of
+    // 'to' is left for the caller
+    template <typename Node>
+    void reverse_path(Node* from, Node* to) {
+        if (from == to) return;
+        Node* x = from;
+        Node* y = from->right;
+        for (;;) {
+            Node* z = y->right;
+            y->right = x;
+            x = y;
+            y = z;
+            if (x == to) break;
+        }
+    }
+
+    // visit the right path from..to bottom up; to->right must end up NULL
+    template <typename Node, typename V>
+    void visit_path_reversed(Node* from, Node* to, V& visit) {
+        reverse_path(from, to);
+        for (Node* p = to; ; p = p->right) {
+            visit(p);
+            if (p == from) break;
+        }
+        reverse_path(to, from);
+        to->right = NULL;
+    }
+}
+
+/*
+ * -----------------------------------------------------------------------------
+ * the Morris walks; each thread from a predecessor back to cur is laid on
+ * the way down the left subtree and taken up on the way back
+ * -----------------------------------------------------------------------------
+ */
+template <typename Node, typename F>
+F bt_inorder(Node* root, F f) {
+    bt_detail::guarded<F> visit(f);
+    Node* cur = root;
+    while (cur != NULL) {
+        if (cur->left == NULL) {
+            visit(cur);
+            cur = cur->right;
+            continue;
+        }
+        Node* pred = bt_detail::threaded_predecessor(cur);
+        if (pred->right == NULL) {
+            pred->right = cur;
+            cur = cur->left;
+        } else {
+            pred->right = NULL;
+            visit(cur);
+            cur = cur->right;
+        }
+    }
+    visit.finish();
+    return f;
+}
+
+template <typename Node, typename F>
+F bt_preorder(Node* root, F f) {
+    bt_detail::guarded<F> visit(f);
+    Node* cur = root;
+    while (cur != NULL) {
+        if (cur->left == NULL) {
+            visit(cur);
+            cur = cur->right;
+            continue;
+        }
+        Node* pred = bt_detail::threaded_predecessor(cur);
+        if (pred->right == NULL) {
+            visit(cur);
+            pred->right = cur;
+            cur = cur->left;
+        } else {
+            pred->right = NULL;
+            cur = cur->right;
+        }
+    }
+    visit.finish();
+    return f;
+}
+
+// when the thread back to cur is taken up, the right path down from
+// cur->left is done, and it is visited bottom up; the right path down from
+// the root is the last one
+template <typename Node, typename F>
+F bt_postorder(Node* root, F f) {
+    bt_detail::guarded<F> visit(f);
+    Node* cur = root;
+    while (cur != NULL) {
+        if (cur->left == NULL) {
+            cur = cur->right;
+            continue;
+        }
+        Node* pred = bt_detail::threaded_predecessor(cur);
+        if (pred->right == NULL) {
+            pred->right = cur;
+            cur = cur->left;
+        } else {
+            bt_detail::visit_path_reversed(cur->left, pred, visit);
+            cur = cur->right;
+        }
+    }
+    if (root != NULL) {
+        Node* last = root;
+        while (last->right != NULL) last = last->right;
+        bt_detail::visit_path_reversed(root, last, visit);
+    }
+    visit.finish();
+    return f;
+}
+
+/*
+ * -----------------------------------------------------------------------------
+ * a FIFO of node pointers in a power-of-two ring; keep one around and pass
+ * it to every bt_levelorder so that the walks reuse its space
+ * -----------------------------------------------------------------------------
+ */
+template <typename Node>
+class bt_level_queue {
+public:
+    bt_level_queue() : head_(0), count_(0) {}
+
+    bool   empty() const    { return count_ == 0; }
+    size_t capacity() const { return ring_.size(); }
+    void   clear()          { head_ = count_ = 0; }
+
+    void push(Node* node) {
+        if (count_ == ring_.size()) grow();
+        ring_[(head_ + count_++) & (ring_.size() - 1)] = node;
+    }
+    Node* pop() {
+        Node* node = ring_[head_];
+        head_ = (head_ + 1) & (ring_.size() - 1);
+        --count_;
+        return node;
+    }
+
+private:
+    // unwrap into a ring twice the size
+    void grow() {
+        std::vector<Node*> bigger(ring_.empty() ? 16 : 2 * ring_.size());
+        for (size_t i = 0; i < count_; i++)
+            bigger[i] = ring_[(head_ + i) & (ring_.size() - 1)];
+        ring_.swap(bigger);
+        head_ = 0;
+    }
+
+    std::vector<Node*> ring_;
+    size_t head_;
+    size_t count_;
+};
+
+template <typename Node, typename F>
+F bt_levelorder(Node* root, F f, bt_level_queue<Node>& queue) {
+    queue.clear();
+    if (root != NULL) queue.push(root);
+    while (!queue.empty()) {
+        Node* cur = queue.pop();
+        if (cur->left != NULL) queue.push(cur->left);
+        if (cur->right != NULL) queue.push(cur->right);
+        bt_detail::emit(f, cur, bt_detail::rank<2>());
+    }
+    return f;
+}
+
 /*
  * -----------------------------------------------------------------------------
  * level-order traverse & print nodes
@@ -35,75 +281,71 @@ struct BTNode {
 template <typename T>
 void levelorder_print(BTNode<T>* root) {
     if (root != NULL) {
-        std::deque<BTNode<T>*> node_q;
-        node_q.push_front(root);
-        while (!node_q.empty()) {
-            BTNode<T>* cur = node_q[node_q.size()-1];
-            node_q.pop_back();
-            if (cur->left != NULL) node_q.push_front(cur->left);
-            if (cur->right != NULL) node_q.push_front(cur->right);
-            std::cout << cur->payload << " ";
-        }
+        bt_level_queue<BTNode<T> > queue;
+        bt_levelorder(root, std::ostream_iterator<T>(std::cout, " "), queue);
         std::cout << std::endl;
     }
 }
 
 /*
  * -----------------------------------------------------------------------------
- * recursive inorder traverse & print nodes
+ * inorder traverse & print nodes
  * -----------------------------------------------------------------------------
  */
 template <typename T>
 void inorder_print(BTNode<T>* root) {
-    if (root != NULL) {
-        inorder_print(root->left);
-        std::cout << root->payload << " ";
-        inorder_print(root->right);
-    }
+    bt_inorder(root, std::ostream_iterator<T>(std::cout, " "));
 }
 
 /*
  * -----------------------------------------------------------------------------
- * recursive postorder traverse & print nodes
+ * postorder traverse & print nodes
  * -----------------------------------------------------------------------------
  */
 template <typename T>
 void postorder_print(BTNode<T>* root) {
-    if (root != NULL) {
-        postorder_print(root->left);
-        postorder_print(root->right);
-        std::cout << root->payload << " ";
-    }
+    bt_postorder(root, std::ostream_iterator<T>(std::cout, " "));
 }
 
 /*
  * -----------------------------------------------------------------------------
  * free the memory used by all nodes in the tree started from root,
- * set root to NULL too
+ * set root to NULL too. Rotating right until the root has no left child
+ * leaves it with at most its right subtree, so it can go; O(n) rotations
+ * in all, no stack. Any node type with left and right will do; the nodes
+ * are deleted, or handed to free(node) for those that were not allocated
+ * one by one
  * -----------------------------------------------------------------------------
  */
-template <typename T>
-void clear_tree(BTNode<T>*& root) {
-    if (root != NULL) {
-        clear_tree(root->left);
-        clear_tree(root->right);
-        delete root;
-        root = NULL;
+template <typename Node, typename Free>
+void clear_tree(Node*& root, Free free) {
+    while (root != NULL) {
+        Node* next;
+        if (root->left != NULL) {
+            next = root->left;
+            root->left = next->right;
+            next->right = root;
+        } else {
+            next = root->right;
+            free(root);
+        }
+        root = next;
     }
 }
 
+template <typename Node>
+void clear_tree(Node*& root) {
+    clear_tree(root, [](Node* node) { delete node; });
+}
+
 /*
  * -----------------------------------------------------------------------------
- * recursive preorder traverse & print nodes
+ * preorder traverse & print nodes
  * -----------------------------------------------------------------------------
  */
 template <typename T>
 void preorder_print(BTNode<T>* root) {
-    if (root != NULL) {
-        std::cout << root->payload << " ";
-        preorder_print(root->left);
-        preorder_print(root->right);
-    }
+    bt_preorder(root, std::ostream_iterator<T>(std::cout, " "));
 }
 
 #endif
@@ -0,0 +1,80 @@
+// *****************************************************************************
+// Command.h
+// ~~~~~~~~~
+// description : the driver's commands: their codes, names and arities, and
+//               the switch that maps a command word to its code
+// *****************************************************************************
+#ifndef COMMAND_H_
+#define COMMAND_H_
+
+#include <cstddef>
+#include <string_view>
+
+// -----------------------------------------------------------------------------
+// the codes are part of the trace and binary framing formats (see Trace.h
+// and CommandReader.h), so new commands get new codes and old ones are
+// never renumbered
+// -----------------------------------------------------------------------------
+enum command_t {
+    CMD_NONE   = 0,
+    CMD_INSERT = 1,  // key
+    CMD_REMOVE = 2,  // key
+    CMD_FIND   = 3,  // key
+    CMD_RANGE  = 4,  // lo hi: the keys in [lo, hi]
+    CMD_COUNT  = 5,  // lo hi: how many keys in [lo, hi]
+    CMD_MIN    = 6,
+    CMD_MAX    = 7,
+    CMD_SIZE   = 8,
+    CMD_PRINT  = 9,  // draw the tree
+    CMD_EXIT   = 10, // also "quit" and "bye"
+    CMD_EXPORT = 11, // file: write the tree as SVG (*.svg) or Graphviz DOT
+    CMD_LAST   = CMD_EXPORT
+};
+
+// how many arguments the command takes
+inline size_t command_arity(command_t c)
+{
+    switch (c) {
+    case CMD_INSERT: case CMD_REMOVE: case CMD_FIND:
+    case CMD_EXPORT:                                 return 1;
+    case CMD_RANGE:  case CMD_COUNT:                 return 2;
+    default:                                         return 0;
+    }
+}
+
+inline const char* command_name(command_t c)
+{
+    static const char* names[] = {"", "insert", "remove", "find", "range",
+                                  "count", "min", "max", "size", "print",
+                                  "exit", "export"};
+    return (size_t(c) <= CMD_LAST) ? names[c] : "";
+}
+
+// -----------------------------------------------------------------------------
+// the code of a command word, CMD_NONE if there is no such command. The
+// length and the first letter pick at most one candidate, so this is one
+// switch and one comparison
+// -----------------------------------------------------------------------------
+inline command_t command_code(std::string_view w)
+{
+    command_t c = CMD_NONE;
+    if (w.empty()) return c;
+    switch (w.size() * 128 + (unsigned char)w[0]) {
+    case 3 * 128 + 'm': c = (w == "min") ? CMD_MIN : CMD_MAX; break;
+    case 3 * 128 + 'b': return (w == "bye") ? CMD_EXIT : CMD_NONE;
+    case 4 * 128 + 'f': c = CMD_FIND;   break;
+    case 4 * 128 + 's': c = CMD_SIZE;   break;
+    case 4 * 128 + 'e': c = CMD_EXIT;   break;
+    case 4 * 128 + 'q': return (w == "quit") ? CMD_EXIT : CMD_NONE;
+    case 5 * 128 + 'r': c = CMD_RANGE;  break;
+    case 5 * 128 + 'c': c = CMD_COUNT;  break;
+    case 5 * 128 + 'p': c = CMD_PRINT;  break;
+    case 6 * 128 + 'i': c = CMD_INSERT; break;
+    case 6 * 128 + 'r': c = CMD_REMOVE; break;
+    case 6 * 128 + 'e': c = CMD_EXPORT; break;
+    default: return CMD_NONE;
+    }
+    return (w == command_name(c)) ? c : CMD_NONE;
+}
+
+#endif // COMMAND_H_
@@ -0,0 +1,142 @@
+// *****************************************************************************
+// CommandReader.cpp
+// ~~~~~~~~~~~~~~~~~
+// description : implementation of the command reader
+// *****************************************************************************
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include <unistd.h>
+
+#include "CommandReader.h"
+
+using namespace std;
+
+namespace {
+    inline bool is_blank(char c) {
+        return c == ' ' || c == '\t' || c == '\r';
+    }
+}
+
+CommandReader::CommandReader(int fd, bool binary, size_t buffer)
+: fd_(fd), binary_(binary), buf_(buffer > 64 ? buffer : 64), begin_(0),
+  end_(0), eof_(false)
+{
+}
+
+bool CommandReader::fill()
+{
+    if (eof_) return false;
+    if (begin_ > 0) {
+        memmove(&buf_[0], &buf_[begin_], end_ - begin_);
+        end_ -= begin_;
+        begin_ = 0;
+    }
+    if (end_ == buf_.size()) buf_.resize(2 * buf_.size());
+    for (;;) {
+        ssize_t got = read(fd_, &buf_[end_], buf_.size() - end_);
+        if (got > 0) {
+            end_ += got;
+            return true;
+        }
+        if (got == 0) {
+            eof_ = true;
+            return false;
+        }
+        if (errno != EINTR)
+            throw runtime_error(string("read: ") + strerror(errno));
+    }
+}
+
+bool CommandReader::line_buffered() const
+{
+    size_t have = end_ - begin_;
+    if (!binary_) return memchr(&buf_[0] + begin_, '\n', have) != NULL;
+    if (have < 4) return false;
+    const unsigned char* p = (const unsigned char*)&buf_[begin_];
+    size_t n = p[0] | (p[1] << 8) | (p[2] << 16) | (size_t(p[3]) << 24);
+    return have - 4 >= n;
+}
+
+bool CommandReader::next(Command& cmd)
+{
+    return binary_ ? next_frame(cmd) : next_line(cmd);
+}
+
+/**
+ * -----------------------------------------------------------------------------
+ * find the end of the line (memchr), then split it in place; the last line
+ * may lack its newline. Nothing is copied unless the line straddles the end
+ * of the buffer, and then it is moved to the front once
+ * -----------------------------------------------------------------------------
+ */
+bool CommandReader::next_line(Command& cmd)
+{
+    for (;;) {
+        const char* data = &buf_[0];
+        const char* nl = (const char*)memchr(data + begin_, '\n', end_ - begin_);
+        if (nl == NULL && fill()) continue;
+        if (nl == NULL && begin_ == end_) return false;
+
+        size_t pos = begin_, stop = (nl != NULL) ? nl - data : end_;
+        begin_ = (nl != NULL) ? stop + 1 : end_;
+
+        string_view words[4];
+        size_t nwords = 0;
+        while (nwords < 4) {
+            while (pos < stop && is_blank(data[pos])) ++pos;
+            if (pos == stop) break;
+            size_t start = pos;
+            while (pos < stop && !is_blank(data[pos])) ++pos;
+            words[nwords++] = string_view(data + start, pos - start);
+        }
+        if (nwords == 0) continue;
+
+        cmd.word = words[0];
+        cmd.op = command_code(words[0]);
+        cmd.nargs = nwords - 1;
+        cmd.args[0] = words[1];
+        cmd.args[1] = words[2];
+        return true;
+    }
+}
+
+bool CommandReader::next_frame(Command& cmd)
+{
+    while (end_ - begin_ < 4) {
+        if (!fill()) {
+            if (begin_ == end_) return false;
+            throw runtime_error("input cut short in a frame header");
+        }
+    }
+    const unsigned char* p = (const unsigned char*)&buf_[begin_];
+    size_t n = p[0] | (p[1] << 8) | (p[2] << 16) | (size_t(p[3]) << 24);
+    if (n == 0) throw runtime_error("empty frame");
+    while (end_ - begin_ < 4 + n) {
+        if (!fill()) throw runtime_error("input cut short in a frame");
+    }
+
+    const char* data = &buf_[begin_ + 4];
+    size_t pos = 1;
+    cmd.op = (data[0] > 0 && data[0] <= CMD_LAST) ? command_t(data[0])
+                                                  : CMD_NONE;
+    cmd.word = string_view(cmd.op == CMD_NONE ? "?" : command_name(cmd.op));
+    cmd.nargs = 0;
+    while (pos < n) {
+        size_t len = 0;
+        for (int shift = 0; ; shift += 7) {
+            if (pos == n || shift > 28) throw runtime_error("bad frame");
+            unsigned char c = data[pos++];
+            len |= size_t(c & 0x7f) << shift;
+            if (!(c & 0x80)) break;
+        }
+        if (len > n - pos) throw runtime_error("bad frame");
+        if (cmd.nargs < 2) cmd.args[cmd.nargs] = string_view(data + pos, len);
+        if (cmd.nargs < 3) ++cmd.nargs;
+        pos += len;
+    }
+    begin_ += 4 + n;
+    return true;
+}
@@ -0,0 +1,71 @@
+// *****************************************************************************
+// CommandReader.h
+// ~~~~~~~~~~~~~~~
+// description : reads the driver's commands from a file descriptor through
+//               one large buffer, without copying: a command's arguments
+//               are views into the buffer
+// *****************************************************************************
+#ifndef COMMANDREADER_H_
+#define COMMANDREADER_H_
+
+#include <cstddef>
+#include <string_view>
+#include <vector>
+
+#include "Command.h"
+
+struct Command {
+    command_t        op;      // CMD_NONE: not a command, see word
+    std::string_view word;    // the command word as given (text input)
+    std::string_view args[2];
+    size_t           nargs;   // how many were given, up to 3 (too many)
+};
+
+// -----------------------------------------------------------------------------
+// two input formats
+// + text: one command per line, words separated by blanks, blank lines
+//   skipped. Lines may be of any length, the buffer grows to hold one
+// + binary: length-prefixed frames, for feeding the driver from programs:
+//     4 bytes  n, little endian, the length of the rest of the frame
+//     1 byte   the command code (command_t)
+//     then each argument as a varint length (7 bits a byte, low bits
+//     first, high bit set on all but the last byte) and its bytes
+//   so keys may hold any byte, blanks included
+// the views in a Command are valid until the next call to next()
+// -----------------------------------------------------------------------------
+class CommandReader {
+public:
+    enum { DEFAULT_BUFFER = 1 << 20 };
+
+    CommandReader(int fd, bool binary, size_t buffer = DEFAULT_BUFFER);
+
+    // -------------------------------------------------------------------------
+    // the next command; false at the end of the input. A malformed binary
+    // frame throws runtime_error, as does a read error
+    // -------------------------------------------------------------------------
+    bool next(Command& cmd);
+
+    // whether next() can return without reading, i.e. a whole text line or
+    // frame is in the buffer already; the driver only prompts when it is not
+    bool line_buffered() const;
+
+private:
+    CommandReader(const CommandReader&);
+    CommandReader& operator=(const CommandReader&);
+
+    // move the unread bytes to the front, grow the buffer if it's full, and
+    // read; false once the input is exhausted
+    bool fill();
+
+    bool next_line(Command& cmd);
+    bool next_frame(Command& cmd);
+
+    int               fd_;
+    bool              binary_;
+    std::vector<char> buf_;
+    size_t            begin_;  // buf_[begin_, end_) is unread
+    size_t            end_;
+    bool              eof_;
+};
+
+#endif // COMMANDREADER_H_
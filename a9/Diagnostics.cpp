@@ -0,0 +1,153 @@
+// *****************************************************************************
+// Diagnostics.cpp
+// ~~~~~~~~~~~~~~~
+// description : implementation of the diagnostics sink
+// *****************************************************************************
+#include "Diagnostics.h"
+#include "term_control.h"
+
+using namespace std;
+
+namespace {
+    struct KindInfo {
+        Diagnostics::Severity severity;
+        const char* before;  // the message is before + detail + after
+        const char* after;
+        const char* plural;  // for the counts
+    };
+
+    const KindInfo KIND_INFO[Diagnostics::KINDS] = {
+        { Diagnostics::NOTE, "The key ", " already exists",
+          "duplicate-key inserts" },
+        { Diagnostics::NOTE, "The key ", " does not exist",
+          "removes of missing keys" },
+        { Diagnostics::NOTE, "The tree is empty", "",
+          "min/max queries on an empty tree" },
+        { Diagnostics::WARNING, "Syntax: ", "",
+          "commands missing arguments" },
+        { Diagnostics::ERROR, "Unknown command ", "", "unknown commands" },
+        { Diagnostics::ERROR, "", "", "failed commands" },
+    };
+
+    // the headers of error_handling.cpp
+    const char* const HEADERS[] = { "-- Note --\n", "== Warning ==\n",
+                                    "** ERROR **\n" };
+    const term_colors_t COLORS[] = { MAGENTA, YELLOW, RED };
+}
+
+Diagnostics::Diagnostics(ostream& out, size_t buffer)
+: out_(out), capacity_(buffer), enabled_(true), threshold_(NOTE),
+  per_second_(0), burst_(0)
+{
+    buf_.reserve(capacity_);
+    for (int k = 0; k < KINDS; ++k) {
+        counts_[k] = shown_[k] = held_[k] = 0;
+        tokens_[k] = 0;
+    }
+}
+
+Diagnostics::~Diagnostics()
+{
+    flush();
+}
+
+void Diagnostics::set_rate_limit(double per_second, size_t burst)
+{
+    per_second_ = per_second;
+    burst_ = burst < 1 ? 1 : double(burst);
+    chrono::steady_clock::time_point now = chrono::steady_clock::now();
+    for (int k = 0; k < KINDS; ++k) {
+        tokens_[k] = burst_;
+        refilled_[k] = now;
+    }
+}
+
+// the clock is only read for a message that would be shown
+bool Diagnostics::admit(Kind kind)
+{
+    if (per_second_ <= 0) return true;
+    chrono::steady_clock::time_point now = chrono::steady_clock::now();
+    double secs = chrono::duration<double>(now - refilled_[kind]).count();
+    refilled_[kind] = now;
+    tokens_[kind] += secs * per_second_;
+    if (tokens_[kind] > burst_) tokens_[kind] = burst_;
+    if (tokens_[kind] < 1) return false;
+    tokens_[kind] -= 1;
+    return true;
+}
+
+void Diagnostics::report(Kind kind, string_view detail)
+{
+    if (!enabled_) return;
+    ++counts_[kind];
+    const KindInfo& info = KIND_INFO[kind];
+    if (info.severity < threshold_) return;
+    if (!admit(kind)) {
+        ++held_[kind];
+        return;
+    }
+
+    ++shown_[kind];
+    buf_ += term_cc(COLORS[info.severity]);
+    buf_ += HEADERS[info.severity];
+    buf_ += info.before;
+    buf_.append(detail.data(), detail.size());
+    buf_ += info.after;
+    if (held_[kind] > 0) {
+        buf_ += " (";
+        append_count(held_[kind]);
+        buf_ += " more ";
+        buf_ += info.plural;
+        buf_ += " not shown)";
+        held_[kind] = 0;
+    }
+    buf_ += '\n';
+    buf_ += term_cc();
+    if (buf_.size() >= capacity_) flush();
+}
+
+void Diagnostics::flush()
+{
+    if (buf_.empty()) return;
+    out_.write(buf_.data(), buf_.size());
+    out_.flush();
+    buf_.clear();
+}
+
+void Diagnostics::summarize()
+{
+    bool all_shown = true;
+    for (int k = 0; k < KINDS; ++k) all_shown &= (shown_[k] == counts_[k]);
+    if (!enabled_ || all_shown) {
+        flush();
+        return;
+    }
+    buf_ += term_cc(MAGENTA);
+    buf_ += "-- Summary --\n";
+    for (int k = 0; k < KINDS; ++k) {
+        if (counts_[k] == 0) continue;
+        append_count(counts_[k]);
+        buf_ += ' ';
+        buf_ += KIND_INFO[k].plural;
+        if (shown_[k] < counts_[k]) {
+            buf_ += ", ";
+            append_count(shown_[k]);
+            buf_ += " shown";
+        }
+        buf_ += '\n';
+    }
+    buf_ += term_cc();
+    flush();
+}
+
+void Diagnostics::append_count(uint64_t n)
+{
+    string digits = to_string(n);
+    size_t lead = digits.size() % 3;
+    if (lead == 0) lead = 3;
+    buf_.append(digits, 0, lead);
+    for (size_t i = lead; i < digits.size(); i += 3) {
+        buf_ += ',';
+        buf_.append(digits, i, 3);
+    }
+}
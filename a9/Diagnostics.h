@@ -0,0 +1,79 @@
+// *****************************************************************************
+// Diagnostics.h
+// ~~~~~~~~~~~~~
+// description : the driver's diagnostics: counted per kind, rate limited,
+//               buffered, and summed up at the end of a run
+// *****************************************************************************
+#ifndef DIAGNOSTICS_H_
+#define DIAGNOSTICS_H_
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <string_view>
+
+// -----------------------------------------------------------------------------
+// every report is counted under its kind; it is written out only if its
+// severity is at or above the threshold and its kind is within the rate
+// limit. A message is formatted straight into a buffer, in the colors of
+// error_handling.h, and the buffer goes to the stream when it fills up or
+// at flush(). Disabled, a report does nothing at all.
+// The rate limit is a token bucket per kind: 'burst' messages at once,
+// then 'per_second' of them. The next message of a kind that was held back
+// says how many were; summarize() writes how many of each kind there were
+// in all, if any were not shown
+// -----------------------------------------------------------------------------
+class Diagnostics {
+public:
+    enum Severity { NOTE, WARNING, ERROR, SILENT }; // SILENT: a threshold
+    enum Kind {
+        DUPLICATE_INSERT, // detail: the key
+        MISSING_REMOVE,   // detail: the key
+        EMPTY_TREE,
+        SYNTAX,           // detail: the usage of the command
+        UNKNOWN_COMMAND,  // detail: the command
+        COMMAND_FAILED,   // detail: why
+        KINDS
+    };
+
+    explicit Diagnostics(std::ostream& out, size_t buffer = 1 << 16);
+    ~Diagnostics(); // flushes
+
+    void set_enabled(bool on)      { enabled_ = on; }
+    void set_threshold(Severity s) { threshold_ = s; }
+    // per kind; per_second 0 lifts the limit
+    void set_rate_limit(double per_second, size_t burst);
+
+    bool enabled() const { return enabled_; }
+    void report(Kind kind, std::string_view detail = std::string_view());
+    void flush();
+    void summarize();
+
+    uint64_t count(Kind kind) const { return counts_[kind]; }
+    uint64_t shown(Kind kind) const { return shown_[kind]; }
+
+private:
+    bool admit(Kind kind); // takes a token
+    void append_count(uint64_t n); // with thousands separators
+
+    std::ostream& out_;
+    std::string   buf_;
+    size_t        capacity_;
+    bool          enabled_;
+    Severity      threshold_;
+    double        per_second_;
+    double        burst_;
+
+    uint64_t counts_[KINDS];
+    uint64_t shown_[KINDS];
+    uint64_t held_[KINDS];   // since the last one shown
+    double   tokens_[KINDS];
+    std::chrono::steady_clock::time_point refilled_[KINDS];
+
+    Diagnostics(const Diagnostics&);
+    Diagnostics& operator=(const Diagnostics&);
+};
+
+#endif // DIAGNOSTICS_H_
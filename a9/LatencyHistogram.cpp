@@ -0,0 +1,73 @@
+// *****************************************************************************
+// LatencyHistogram.cpp
+// ~~~~~~~~~~~~~~~~~~~~
+// description : implementation of the log-linear latency histogram
+// *****************************************************************************
+#include "LatencyHistogram.h"
+
+LatencyHistogram::LatencyHistogram()
+: counts_((64 - SUB_BITS + 1) * SUB_BUCKETS, 0), count_(0), total_(0), max_(0)
+{
+}
+
+/**
+ * -----------------------------------------------------------------------------
+ * a value with its top bit at position b >= SUB_BITS lands in group
+ * b - SUB_BITS + 1, at the offset given by the SUB_BITS bits below the top
+ * one; the values below SUB_BUCKETS form group 0, one bucket per value
+ * -----------------------------------------------------------------------------
+ */
+size_t LatencyHistogram::bucket_of(uint64_t v)
+{
+    if (v < uint64_t(SUB_BUCKETS)) return size_t(v);
+    int b = 63 - __builtin_clzll(v);
+    size_t group = b - SUB_BITS + 1;
+    size_t offset = size_t(v >> (b - SUB_BITS)) - SUB_BUCKETS;
+    return group * SUB_BUCKETS + offset;
+}
+
+uint64_t LatencyHistogram::upper_end(size_t bucket)
+{
+    size_t group = bucket / SUB_BUCKETS, offset = bucket % SUB_BUCKETS;
+    if (group == 0) return offset;
+    int shift = int(group) - 1;
+    return ((uint64_t(SUB_BUCKETS + offset + 1)) << shift) - 1;
+}
+
+void LatencyHistogram::record(uint64_t ns)
+{
+    ++counts_[bucket_of(ns)];
+    ++count_;
+    total_ += ns;
+    if (ns > max_) max_ = ns;
+}
+
+void LatencyHistogram::merge(const LatencyHistogram& other)
+{
+    for (size_t i = 0; i < counts_.size(); ++i) counts_[i] += other.counts_[i];
+    count_ += other.count_;
+    total_ += other.total_;
+    if (other.max_ > max_) max_ = other.max_;
+}
+
+void LatencyHistogram::clear()
+{
+    counts_.assign(counts_.size(), 0);
+    count_ = total_ = max_ = 0;
+}
+
+uint64_t LatencyHistogram::percentile(double q) const
+{
+    if (count_ == 0) return 0;
+    uint64_t rank = uint64_t(q * count_);
+    if (rank >= count_) rank = count_ - 1;
+    uint64_t seen = 0;
+    for (size_t i = 0; i < counts_.size(); ++i) {
+        seen += counts_[i];
+        if (seen > rank) {
+            uint64_t v = upper_end(i);
+            return v < max_ ? v : max_;
+        }
+    }
+    return max_;
+}
@@ -0,0 +1,53 @@
+// *****************************************************************************
+// LatencyHistogram.h
+// ~~~~~~~~~~~~~~~~~~
+// description : a log-linear histogram of latencies in nanoseconds, for
+//               percentiles over millions of samples in constant space
+// *****************************************************************************
+#ifndef LATENCYHISTOGRAM_H_
+#define LATENCYHISTOGRAM_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// -----------------------------------------------------------------------------
+// the buckets double in width every SUB_BUCKETS buckets: values below
+// SUB_BUCKETS get a bucket each, and above that a value shares its bucket
+// with the others that agree on the leading log2(SUB_BUCKETS) + 1 bits, so
+// a percentile is off by at most 1/SUB_BUCKETS (about 3%). 64-bit values
+// need 60 * 32 buckets, 15KB of counters
+// -----------------------------------------------------------------------------
+class LatencyHistogram {
+public:
+    enum { SUB_BITS = 5, SUB_BUCKETS = 1 << SUB_BITS };
+
+    LatencyHistogram();
+
+    void record(uint64_t ns);
+    void merge(const LatencyHistogram& other);
+    void clear();
+
+    uint64_t count() const { return count_; }
+    uint64_t total() const { return total_; } // sum of all samples
+    uint64_t max() const   { return max_; }
+    double   mean() const  { return count_ ? double(total_) / count_ : 0; }
+
+    // -------------------------------------------------------------------------
+    // the smallest recorded value v such that a fraction q of the samples
+    // are <= v, up to the bucket width (the upper end of the bucket is
+    // returned, clamped to max()); 0 when empty
+    // -------------------------------------------------------------------------
+    uint64_t percentile(double q) const;
+
+private:
+    static size_t   bucket_of(uint64_t v);
+    static uint64_t upper_end(size_t bucket);
+
+    std::vector<uint64_t> counts_;
+    uint64_t count_;
+    uint64_t total_;
+    uint64_t max_;
+};
+
+#endif // LATENCYHISTOGRAM_H_
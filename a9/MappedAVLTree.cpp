@@ -0,0 +1,571 @@
+// =============================================================================
+// MappedAVLTree.cpp
+// ~~~~~~~~~~~~~~~~~
+// description : the memory-mapped tree: the file, the transactions, and the
+//               path-copying AVL updates
+// =============================================================================
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "MappedAVLTree.h"
+
+namespace mapped_avl_detail {
+    const char MAGIC[8] = {'A', 'V', 'L', 'S', 'T', 'O', 'R', 'E'};
+
+    inline std::runtime_error sys_error(const std::string& what) {
+        return std::runtime_error(what + ": " + std::strerror(errno));
+    }
+}
+
+template <typename Key>
+MappedAVLTree<Key>::MappedAVLTree(const std::string& path, bool durable,
+                                  size_t extent, size_t reserve)
+: fd_(-1), base_(NULL), reserve_(reserve), extent_(extent), file_size_(0),
+  durable_(durable), autocommit_(true), root_(0), size_(0), free_head_(0),
+  free_count_(0), pool_(0), pool_used_(0), end_(HEADER_BYTES), seq_(0),
+  txn_(1), changed_(false), dirty_lo_(0), dirty_hi_(0)
+{
+    using mapped_avl_detail::sys_error;
+    if (extent_ < HEADER_BYTES) extent_ = HEADER_BYTES;
+    fd_ = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd_ < 0) throw sys_error(path);
+    struct stat st;
+    if (fstat(fd_, &st) != 0) {
+        close(fd_);
+        throw sys_error(path);
+    }
+    file_size_ = st.st_size;
+
+    // the whole reservation is mapped now, most of it past the end of the
+    // file; growing the file makes more of it usable without moving it
+    void* p = mmap(NULL, reserve_, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_NORESERVE, fd_, 0);
+    if (p == MAP_FAILED) {
+        close(fd_);
+        throw sys_error(path + ": mmap");
+    }
+    base_ = (char*)p;
+
+    try {
+        if (file_size_ == 0) {
+            create();
+            return;
+        }
+        const Header* h = header();
+        if (file_size_ < HEADER_BYTES || file_size_ > reserve_ ||
+            std::memcmp(h->magic, mapped_avl_detail::MAGIC, 8) != 0)
+            throw std::runtime_error(path + " is not a tree file");
+        if (h->version != VERSION || h->key_size != sizeof(Key) ||
+            h->node_size != sizeof(Node))
+            throw std::runtime_error(path + ": other version or key type");
+        const Slot* best = NULL;
+        for (int i = 0; i < 2; i++) {
+            const Slot& s = h->slots[i];
+            if (valid(s) && (best == NULL || s.seq > best->seq)) best = &s;
+        }
+        if (best == NULL) throw std::runtime_error(path + ": no valid root");
+        load(*best);
+    } catch (...) {
+        munmap(base_, reserve_);
+        close(fd_);
+        throw;
+    }
+}
+
+template <typename Key>
+MappedAVLTree<Key>::~MappedAVLTree()
+{
+    munmap(base_, reserve_);
+    close(fd_);
+}
+
+template <typename Key>
+uint64_t MappedAVLTree<Key>::checksum(const Slot& s)
+{
+    // FNV-1a over the fields
+    const unsigned char* p = (const unsigned char*)&s;
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i < offsetof(Slot, check); i++) {
+        h ^= p[i];
+        h *= 0x100000001b3ull;
+    }
+    return h;
+}
+
+template <typename Key>
+bool MappedAVLTree<Key>::valid(const Slot& s) const
+{
+    return s.seq > 0 && s.check == checksum(s) && s.end >= HEADER_BYTES &&
+           s.end <= file_size_ && s.root < s.end && s.free_head < s.end &&
+           s.pool < s.end && (s.free_count == 0 || s.free_head != 0);
+}
+
+template <typename Key>
+void MappedAVLTree<Key>::load(const Slot& s)
+{
+    root_ = s.root;
+    size_ = s.size;
+    free_head_  = s.free_head;
+    free_count_ = s.free_count;
+    pool_       = s.pool;
+    pool_used_  = s.pool_used;
+    end_  = s.end;
+    seq_  = s.seq;
+    txn_  = seq_ + 1;
+    changed_ = false;
+    dirty_lo_ = dirty_hi_ = 0;
+    retired_.clear();
+    spare_.clear();
+}
+
+template <typename Key>
+void MappedAVLTree<Key>::create()
+{
+    if (extent_ > reserve_ || ftruncate(fd_, extent_) != 0)
+        throw mapped_avl_detail::sys_error("ftruncate");
+    file_size_ = extent_;
+    Header* h = header();
+    std::memcpy(h->magic, mapped_avl_detail::MAGIC, 8);
+    h->version = VERSION;
+    h->key_size = sizeof(Key);
+    h->node_size = sizeof(Node);
+    Slot& s = h->slots[1]; // commit seq goes into slots[seq % 2]
+    s.seq = 1;
+    s.root = s.size = s.free_head = s.free_count = 0;
+    s.pool = s.pool_used = 0;
+    s.end = HEADER_BYTES;
+    s.check = checksum(s);
+    sync(0, HEADER_BYTES);
+    load(s);
+}
+
+// -----------------------------------------------------------------------------
+// the order is what makes a commit atomic
+// 1. the nodes given up by the transaction are listed in a new free record;
+//    once there are more free nodes than keys and no pool, the records are
+//    merged into a new pool
+// 2. everything written since the last commit goes to disk
+// 3. the older root slot is overwritten with the new tree, and synced; a
+//    torn write fails the checksum and the other slot stays the tree
+// the transaction only ever wrote nodes and records that the committed
+// tree does not use, so a crash before 3 is over leaves that tree intact
+// -----------------------------------------------------------------------------
+template <typename Key>
+void MappedAVLTree<Key>::commit()
+{
+    if (!changed_) return;
+    std::vector<uint64_t> offs;
+    offs.swap(retired_);
+    offs.insert(offs.end(), spare_.begin(), spare_.end());
+    spare_.clear();
+    if (!offs.empty()) {
+        free_head_ = write_record(offs, free_head_);
+        free_count_ += offs.size();
+    }
+    if (pool_ == 0 && free_count_ > size_) make_pool();
+    if (dirty_hi_ > dirty_lo_) sync(dirty_lo_, dirty_hi_);
+
+    Header* h = header();
+    Slot& s = h->slots[(seq_ + 1) % 2]; // not the committed one
+    s.seq = seq_ + 1;
+    s.root = root_;
+    s.size = size_;
+    s.free_head = free_head_;
+    s.free_count = free_count_;
+    s.pool = pool_;
+    s.pool_used = pool_used_;
+    s.end = end_;
+    s.check = checksum(s);
+    sync(0, HEADER_BYTES);
+
+    seq_ = s.seq;
+    txn_ = seq_ + 1;
+    changed_ = false;
+    dirty_lo_ = dirty_hi_ = 0;
+}
+
+template <typename Key>
+void MappedAVLTree<Key>::rollback()
+{
+    const Header* h = header();
+    load(h->slots[seq_ % 2]);
+}
+
+template <typename Key>
+void MappedAVLTree<Key>::sync(uint64_t from, uint64_t to)
+{
+    if (!durable_) return;
+    uint64_t page = uint64_t(sysconf(_SC_PAGESIZE));
+    from -= from % page;
+    if (msync(base_ + from, to - from, MS_SYNC) != 0)
+        throw mapped_avl_detail::sys_error("msync");
+}
+
+template <typename Key>
+void MappedAVLTree<Key>::touch(uint64_t off, size_t bytes)
+{
+    if (dirty_hi_ == dirty_lo_) {
+        dirty_lo_ = off;
+        dirty_hi_ = off + bytes;
+    } else {
+        dirty_lo_ = std::min(dirty_lo_, off);
+        dirty_hi_ = std::max<uint64_t>(dirty_hi_, off + bytes);
+    }
+}
+
+template <typename Key>
+uint64_t MappedAVLTree<Key>::allocate()
+{
+    uint64_t off;
+    if (!spare_.empty()) {
+        off = spare_.back();
+        spare_.pop_back();
+    } else if (pool_ != 0) {
+        const FreeRecord* r = record(pool_);
+        off = r->offs[pool_used_++];
+        if (pool_used_ == r->count) {
+            retire_record(pool_);
+            pool_ = pool_used_ = 0;
+        }
+    } else {
+        off = extend(1);
+    }
+    at(off)->txn = txn_;
+    touch(off, sizeof(Node));
+    changed_ = true;
+    return off;
+}
+
+template <typename Key>
+uint64_t MappedAVLTree<Key>::extend(size_t slots)
+{
+    uint64_t off = end_, end = end_ + slots * sizeof(Node);
+    if (end > file_size_) {
+        size_t grown = file_size_;
+        while (grown < end) grown += extent_;
+        if (grown > reserve_)
+            throw std::runtime_error("tree file is at its reserved size");
+        if (ftruncate(fd_, grown) != 0)
+            throw mapped_avl_detail::sys_error("ftruncate");
+        file_size_ = grown;
+    }
+    end_ = end;
+    return off;
+}
+
+template <typename Key>
+size_t MappedAVLTree<Key>::record_slots(size_t count)
+{
+    size_t bytes = offsetof(FreeRecord, offs) + count * sizeof(uint64_t);
+    return (bytes + sizeof(Node) - 1) / sizeof(Node);
+}
+
+// a record that has been used up is itself free once the commit is durable
+template <typename Key>
+void MappedAVLTree<Key>::retire_record(uint64_t off)
+{
+    size_t slots = record_slots(record(off)->count);
+    for (size_t i = 0; i < slots; i++)
+        retired_.push_back(off + i * sizeof(Node));
+}
+
+template <typename Key>
+uint64_t MappedAVLTree<Key>::write_record(std::vector<uint64_t>& offs,
+                                          uint64_t next)
+{
+    std::sort(offs.begin(), offs.end());
+    size_t slots = record_slots(offs.size());
+    uint64_t off = extend(slots);
+    FreeRecord* r = record(off);
+    r->next = next;
+    r->count = offs.size();
+    std::memcpy(r->offs, &offs[0], offs.size() * sizeof(uint64_t));
+    touch(off, slots * sizeof(Node));
+    return off;
+}
+
+// the records of the free list are free too once the pool is committed
+template <typename Key>
+void MappedAVLTree<Key>::make_pool()
+{
+    std::vector<uint64_t> offs;
+    offs.reserve(free_count_ + free_count_ / 4);
+    for (uint64_t off = free_head_; off != 0; off = record(off)->next) {
+        const FreeRecord* r = record(off);
+        offs.insert(offs.end(), r->offs, r->offs + r->count);
+        size_t slots = record_slots(r->count);
+        for (size_t i = 0; i < slots; i++)
+            offs.push_back(off + i * sizeof(Node));
+    }
+    pool_ = write_record(offs, 0);
+    pool_used_ = 0;
+    free_head_ = free_count_ = 0;
+}
+
+template <typename Key>
+uint64_t MappedAVLTree<Key>::writable(uint64_t off)
+{
+    if (at(off)->txn == txn_) return off;
+    uint64_t copy = allocate();
+    Node* c = at(copy);
+    const Node* n = at(off);
+    c->left = n->left;
+    c->right = n->right;
+    c->balance = n->balance;
+    c->key = n->key;
+    retired_.push_back(off);
+    return copy;
+}
+
+template <typename Key>
+void MappedAVLTree<Key>::release(uint64_t off)
+{
+    if (at(off)->txn != txn_) retired_.push_back(off);
+    else spare_.push_back(off);
+    changed_ = true;
+}
+
+template <typename Key>
+bool MappedAVLTree<Key>::insert(const Key& key)
+{
+    bool grew = false;
+    uint64_t root = insert_at(root_, key, grew);
+    if (root == 0) return false;
+    root_ = root;
+    ++size_;
+    if (autocommit_) commit();
+    return true;
+}
+
+template <typename Key>
+bool MappedAVLTree<Key>::remove(const Key& key)
+{
+    bool found = false, shrunk = false;
+    uint64_t root = remove_at(root_, key, found, shrunk);
+    if (!found) return false;
+    root_ = root;
+    --size_;
+    if (autocommit_) commit();
+    return true;
+}
+
+template <typename Key>
+bool MappedAVLTree<Key>::find(const Key& key) const
+{
+    uint64_t off = root_;
+    while (off != 0) {
+        const Node* n = at(off);
+        if (key < n->key) off = n->left;
+        else if (n->key < key) off = n->right;
+        else return true;
+    }
+    return false;
+}
+
+template <typename Key>
+const Key& MappedAVLTree<Key>::minimum() const
+{
+    if (root_ == 0) throw std::runtime_error("minimum() on an empty tree");
+    uint64_t off = root_;
+    while (at(off)->left != 0) off = at(off)->left;
+    return at(off)->key;
+}
+
+template <typename Key>
+const Key& MappedAVLTree<Key>::maximum() const
+{
+    if (root_ == 0) throw std::runtime_error("maximum() on an empty tree");
+    uint64_t off = root_;
+    while (at(off)->right != 0) off = at(off)->right;
+    return at(off)->key;
+}
+
+template <typename Key>
+int MappedAVLTree<Key>::height() const
+{
+    int h = 0;
+    for (uint64_t off = root_; off != 0; ++h) {
+        const Node* n = at(off);
+        off = (n->balance < 0) ? n->right : n->left;
+    }
+    return h;
+}
+
+template <typename Key>
+template <typename Func>
+void MappedAVLTree<Key>::for_each(Func f) const
+{
+    std::vector<uint64_t> stack;
+    uint64_t off = root_;
+    while (off != 0 || !stack.empty()) {
+        while (off != 0) {
+            stack.push_back(off);
+            off = at(off)->left;
+        }
+        off = stack.back();
+        stack.pop_back();
+        f(at(off)->key);
+        off = at(off)->right;
+    }
+}
+
+/**
+ * -----------------------------------------------------------------------------
+ * the updates return the new root of the subtree, which is off itself as
+ * long as nothing below changed or the node was already written by this
+ * transaction; a parent is only copied when a child's offset or height
+ * changed. insert_at returns 0 if the key is already there
+ * -----------------------------------------------------------------------------
+ */
+template <typename Key>
+uint64_t MappedAVLTree<Key>::insert_at(uint64_t off, const Key& key,
+                                       bool& grew)
+{
+    if (off == 0) {
+        uint64_t fresh = allocate();
+        Node* n = at(fresh);
+        n->left = n->right = 0;
+        n->balance = 0;
+        n->key = key;
+        grew = true;
+        return fresh;
+    }
+    const Node* n = at(off);
+    bool left_side = key < n->key;
+    if (!left_side && !(n->key < key)) return 0;
+
+    uint64_t old = left_side ? n->left : n->right;
+    uint64_t child = insert_at(old, key, grew);
+    if (child == 0) return 0;
+    if (child == old && !grew) return off;
+
+    off = writable(off);
+    Node* w = at(off);
+    (left_side ? w->left : w->right) = child;
+    if (grew) {
+        w->balance += left_side ? 1 : -1;
+        if (w->balance == 0) {
+            grew = false;
+        } else if (w->balance == 2 || w->balance == -2) {
+            off = rebalance(off);
+            grew = false;
+        }
+    }
+    return off;
+}
+
+template <typename Key>
+uint64_t MappedAVLTree<Key>::remove_at(uint64_t off, const Key& key,
+                                       bool& found, bool& shrunk)
+{
+    if (off == 0) return 0;
+    const Node* n = at(off);
+    if (key < n->key) {
+        uint64_t child = remove_at(n->left, key, found, shrunk);
+        return found ? after_removal(off, child, true, shrunk) : off;
+    }
+    if (n->key < key) {
+        uint64_t child = remove_at(n->right, key, found, shrunk);
+        return found ? after_removal(off, child, false, shrunk) : off;
+    }
+
+    found = true;
+    if (n->left == 0 || n->right == 0) {
+        uint64_t rest = (n->left != 0) ? n->left : n->right;
+        release(off);
+        shrunk = true;
+        return rest;
+    }
+    // two children: the predecessor's key takes this node's place, as in
+    // AVLTree::remove
+    Key pred;
+    uint64_t left = remove_max(n->left, pred, shrunk);
+    off = writable(off);
+    at(off)->key = pred;
+    return after_removal(off, left, true, shrunk);
+}
+
+template <typename Key>
+uint64_t MappedAVLTree<Key>::remove_max(uint64_t off, Key& max, bool& shrunk)
+{
+    const Node* n = at(off);
+    if (n->right == 0) {
+        max = n->key;
+        uint64_t rest = n->left;
+        release(off);
+        shrunk = true;
+        return rest;
+    }
+    uint64_t child = remove_max(n->right, max, shrunk);
+    return after_removal(off, child, false, shrunk);
+}
+
+template <typename Key>
+uint64_t MappedAVLTree<Key>::after_removal(uint64_t off, uint64_t child,
+                                           bool left_side, bool& shrunk)
+{
+    const Node* n = at(off);
+    if (child == (left_side ? n->left : n->right) && !shrunk) return off;
+
+    off = writable(off);
+    Node* w = at(off);
+    (left_side ? w->left : w->right) = child;
+    if (shrunk) {
+        w->balance += left_side ? -1 : 1;
+        if (w->balance == 1 || w->balance == -1) {
+            shrunk = false;
+        } else if (w->balance == 2 || w->balance == -2) {
+            off = rebalance(off);
+            shrunk = (at(off)->balance == 0);
+        }
+    }
+    return off;
+}
+
+template <typename Key>
+uint64_t MappedAVLTree<Key>::rebalance(uint64_t off)
+{
+    Node* n = at(off);
+    if (n->balance == 2) {
+        if (at(n->left)->balance < 0) n->left = rotate_left(writable(n->left));
+        return rotate_right(off);
+    }
+    if (at(n->right)->balance > 0) n->right = rotate_right(writable(n->right));
+    return rotate_left(off);
+}
+
+// -----------------------------------------------------------------------------
+// off is writable, its child is made so; the balance updates are the usual
+// ones for a rotation with arbitrary balance factors
+// -----------------------------------------------------------------------------
+template <typename Key>
+uint64_t MappedAVLTree<Key>::rotate_left(uint64_t off)
+{
+    Node* x = at(off);
+    uint64_t y_off = writable(x->right);
+    Node* y = at(y_off);
+    x->right = y->left;
+    y->left = off;
+    x->balance = x->balance + 1 - std::min(y->balance, 0);
+    y->balance = y->balance + 1 + std::max(x->balance, 0);
+    return y_off;
+}
+
+template <typename Key>
+uint64_t MappedAVLTree<Key>::rotate_right(uint64_t off)
+{
+    Node* y = at(off);
+    uint64_t x_off = writable(y->left);
+    Node* x = at(x_off);
+    y->left = x->right;
+    x->right = off;
+    y->balance = y->balance - 1 - std::max(x->balance, 0);
+    x->balance = x->balance - 1 + std::min(y->balance, 0);
+    return x_off;
+}
@@ -0,0 +1,222 @@
+// =============================================================================
+// MappedAVLTree.h
+// ~~~~~~~~~~~~~~~
+// description : an AVL tree whose nodes live in a memory-mapped file, linked
+//               by file offsets; it reopens without loading anything, and a
+//               crash leaves it as of its last commit
+// =============================================================================
+#ifndef MAPPEDAVLTREE_H_
+#define MAPPEDAVLTREE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+// -----------------------------------------------------------------------------
+// same insert/remove/find as AVLTree, with these differences
+// + the file is mapped once, at a fixed address with room for 'reserve'
+//   bytes, and grows by 'extent' bytes at a time, so the nodes never move.
+//   Opening the file is a handful of system calls however big the tree is;
+//   the pages of the paths that are touched are read in on demand
+// + updates are grouped into transactions. A transaction never changes a
+//   node of the last committed tree: the first time it changes a node it
+//   works on a copy (shadow paging), so an insertion or removal copies its
+//   path to the root, rotations included, and later changes in the same
+//   transaction find the copies and update them in place. commit() makes
+//   the new tree durable and then switches to its root by writing one of
+//   the two root slots in the file's header: whichever slot has the higher
+//   sequence number and a valid checksum is the tree, so a crash at any
+//   point leaves either the old or the new tree. By default every insert
+//   and remove commits; turn autocommit off to commit batches
+// + with durable set, commit() msyncs the nodes before the root slot and
+//   the root slot before it returns, which survives power loss; without it
+//   a commit survives the process being killed but not the machine
+// + the nodes a commit gives up are listed in a free record appended to
+//   the file; records are never written again, so the free list costs no
+//   writes to old pages and needs no care in a crash. Once the free nodes
+//   outnumber the keys, the records are merged into one pool, in address
+//   order, which allocation then sweeps through until it is used up: at
+//   least half the nodes around it are free, so a transaction dirties few
+//   pages. Otherwise new nodes go at the end, where commits write fastest
+// + no parent pointers, as a copied node would have to update its
+//   children; the paths are walked recursively, O(log n) deep
+// + Key must be trivially copyable, it is stored as is; the file records
+//   sizeof(Key) and refuses to open with another key type size
+// + AVL balancing only; no summaries, caches, batches or ranges
+// -----------------------------------------------------------------------------
+template <typename Key>
+class MappedAVLTree {
+public:
+    static const size_t DEFAULT_EXTENT  = size_t(64) << 20;
+    static const size_t DEFAULT_RESERVE = size_t(1) << 40;
+
+    // -------------------------------------------------------------------------
+    // open the tree in path, creating the file if it does not exist; throws
+    // runtime_error if it can't be opened or mapped, or is not such a tree.
+    // The destructor does not commit: what was not committed is lost, as it
+    // would be in a crash
+    // -------------------------------------------------------------------------
+    explicit MappedAVLTree(const std::string& path, bool durable = true,
+                           size_t extent = DEFAULT_EXTENT,
+                           size_t reserve = DEFAULT_RESERVE);
+    ~MappedAVLTree();
+
+    // the same meaning as in AVLTree; insert throws runtime_error when the
+    // file can't grow, and rollback() then drops the half-done update
+    bool insert(const Key& key);
+    bool remove(const Key& key);
+    bool find(const Key& key) const;
+
+    // O(log n); both throw runtime_error on an empty tree
+    const Key& minimum() const;
+    const Key& maximum() const;
+
+    size_t size() const  { return size_; }
+    bool   empty() const { return size_ == 0; }
+    int    height() const;
+
+    // f(key) for every key in increasing order
+    template <typename Func>
+    void for_each(Func f) const;
+
+    // -------------------------------------------------------------------------
+    // transactions: commit() makes the changes since the last commit durable
+    // (a no-op if there are none); rollback() drops them. With autocommit,
+    // the default, every successful insert and remove commits
+    // -------------------------------------------------------------------------
+    void commit();
+    void rollback();
+    void set_autocommit(bool on) { autocommit_ = on; }
+
+    size_t   file_size() const { return file_size_; }
+    uint64_t commits() const   { return seq_; } // the sequence number
+
+private:
+    static_assert(std::is_trivially_copyable<Key>::value,
+                  "a MappedAVLTree stores its keys as raw bytes");
+
+    // -------------------------------------------------------------------------
+    // the file: a header page, then nodes. Offsets are from the start of the
+    // file, 0 is the NULL offset (that's the header)
+    // -------------------------------------------------------------------------
+    enum { HEADER_BYTES = 4096, VERSION = 1 };
+
+    struct Node {
+        uint64_t left;
+        uint64_t right;
+        uint64_t txn;       // the transaction that wrote the node
+        int32_t  balance;   // height(left) - height(right)
+        Key      key;
+    };
+
+    // -------------------------------------------------------------------------
+    // a free record takes up whole node slots. The free nodes are those of
+    // all the records on the free list, and offs[pool_used, count) of the
+    // pool
+    // -------------------------------------------------------------------------
+    struct FreeRecord {
+        uint64_t next;
+        uint64_t count;
+        uint64_t offs[1];   // count of them, ascending
+    };
+
+    // one committed tree
+    struct Slot {
+        uint64_t seq;       // 0 for a slot never written
+        uint64_t root;
+        uint64_t size;
+        uint64_t free_head; // a FreeRecord
+        uint64_t free_count;
+        uint64_t pool;      // a FreeRecord, 0 when not reusing nodes
+        uint64_t pool_used;
+        uint64_t end;       // nodes are allocated below this
+        uint64_t check;     // of the fields above
+    };
+
+    struct Header {
+        char     magic[8];
+        uint32_t version;
+        uint32_t key_size;
+        uint64_t node_size;
+        Slot     slots[2];  // the one with the higher valid seq is the tree
+    };
+
+    Node*       at(uint64_t off)       { return (Node*)(base_ + off); }
+    const Node* at(uint64_t off) const { return (const Node*)(base_ + off); }
+    FreeRecord* record(uint64_t off) { return (FreeRecord*)(base_ + off); }
+    Header*     header() { return (Header*)base_; }
+
+    static uint64_t checksum(const Slot& s);
+    bool valid(const Slot& s) const;
+    void load(const Slot& s);  // make s the current tree
+    void create();             // write the header of an empty file
+
+    // -------------------------------------------------------------------------
+    // node management within a transaction
+    // + allocate takes a node this transaction gave up, or the next one in
+    //   the pool, or else one past the end
+    // + extend takes slots past the end, growing the file by extents
+    // + writable returns off itself if the transaction wrote the node, or
+    //   else a copy, and retires the original
+    // + release gives a node up: one the committed tree still uses is
+    //   retired until the commit, others are spare, free again at once
+    // + write_record lists offs in a new record ahead of next; make_pool
+    //   merges the free list into the pool
+    // -------------------------------------------------------------------------
+    uint64_t allocate();
+    uint64_t extend(size_t slots);
+    uint64_t writable(uint64_t off);
+    void     release(uint64_t off);
+    void     retire_record(uint64_t off);
+    uint64_t write_record(std::vector<uint64_t>& offs, uint64_t next);
+    void     make_pool();
+    static size_t record_slots(size_t count);
+    void     touch(uint64_t off, size_t bytes); // for the msync of commit()
+    void     sync(uint64_t from, uint64_t to);
+
+    // the recursive updates: each returns the new root of the subtree
+    uint64_t insert_at(uint64_t off, const Key& key, bool& grew);
+    uint64_t remove_at(uint64_t off, const Key& key, bool& found,
+                       bool& shrunk);
+    uint64_t remove_max(uint64_t off, Key& max, bool& shrunk);
+    uint64_t after_removal(uint64_t off, uint64_t child, bool left_side,
+                           bool& shrunk);
+    uint64_t rebalance(uint64_t off); // |balance| is 2, off is writable
+    uint64_t rotate_left(uint64_t off);
+    uint64_t rotate_right(uint64_t off);
+
+    int      fd_;
+    char*    base_;
+    size_t   reserve_;
+    size_t   extent_;
+    size_t   file_size_;
+    bool     durable_;
+    bool     autocommit_;
+
+    // the current tree; seq_ is the last commit, txn_ = seq_ + 1 the open
+    // transaction
+    uint64_t root_;
+    uint64_t size_;
+    uint64_t free_head_;
+    uint64_t free_count_;
+    uint64_t pool_;
+    uint64_t pool_used_;
+    uint64_t end_;
+    uint64_t seq_;
+    uint64_t txn_;
+    bool     changed_;
+    uint64_t dirty_lo_;    // bytes written since the last commit
+    uint64_t dirty_hi_;
+    std::vector<uint64_t> retired_; // still in the committed tree
+    std::vector<uint64_t> spare_;   // free, not yet on a record
+
+    MappedAVLTree(const MappedAVLTree&);
+    MappedAVLTree& operator=(const MappedAVLTree&);
+};
+
+#include "MappedAVLTree.cpp" // only done for template classes
+
+#endif // MAPPEDAVLTREE_H_
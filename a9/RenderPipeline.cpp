@@ -0,0 +1,97 @@
+// *****************************************************************************
+// RenderPipeline.cpp
+// ~~~~~~~~~~~~~~~~~~
+// description : implementation of the render pipeline
+// *****************************************************************************
+#include <iostream>
+
+#include "RenderPipeline.h"
+
+using namespace std;
+
+RenderPipeline::RenderPipeline(render_fn render)
+: render_(render), closing_(false)
+{
+    stats_.published = stats_.rendered = stats_.dropped = 0;
+    renderer_ = thread(&RenderPipeline::render_loop, this);
+}
+
+RenderPipeline::~RenderPipeline()
+{
+    close();
+}
+
+void RenderPipeline::publish(shared_ptr<const RenderFrame> frame)
+{
+    {
+        lock_guard<mutex> lk(mu_);
+        ++stats_.published;
+        if (!queue_.empty() && queue_.back().frame) {
+            queue_.back().frame = frame; // the old one was never drawn
+            ++stats_.dropped;
+            return;
+        }
+        Item item;
+        item.frame = frame;
+        queue_.push_back(item);
+    }
+    ready_.notify_one();
+}
+
+void RenderPipeline::write(string text)
+{
+    if (text.empty()) return;
+    {
+        lock_guard<mutex> lk(mu_);
+        if (!queue_.empty() && !queue_.back().frame) {
+            queue_.back().text += text;
+            return;
+        }
+        Item item;
+        item.text.swap(text);
+        queue_.push_back(item);
+    }
+    ready_.notify_one();
+}
+
+void RenderPipeline::close()
+{
+    {
+        lock_guard<mutex> lk(mu_);
+        if (closing_) return;
+        closing_ = true;
+    }
+    ready_.notify_one();
+    renderer_.join();
+}
+
+RenderPipeline::Stats RenderPipeline::stats() const
+{
+    lock_guard<mutex> lk(mu_);
+    return stats_;
+}
+
+// cout is flushed whenever the queue runs dry, not after every item
+void RenderPipeline::render_loop()
+{
+    unique_lock<mutex> lk(mu_);
+    for (;;) {
+        if (queue_.empty()) {
+            lk.unlock();
+            cout << flush;
+            lk.lock();
+            ready_.wait(lk, [this] { return !queue_.empty() || closing_; });
+            if (queue_.empty()) return;
+        }
+        Item item;
+        swap(item, queue_.front());
+        queue_.pop_front();
+        lk.unlock();
+
+        if (item.frame) render_(*item.frame);
+        else cout << item.text;
+
+        lk.lock();
+        if (item.frame) ++stats_.rendered;
+    }
+}
@@ -0,0 +1,77 @@
+// *****************************************************************************
+// RenderPipeline.h
+// ~~~~~~~~~~~~~~~~
+// description : draws the driver's tree on a thread of its own, so that
+//               commands do not wait for the terminal; frames nobody got to
+//               see are dropped
+// *****************************************************************************
+#ifndef RENDERPIPELINE_H_
+#define RENDERPIPELINE_H_
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// an immutable picture of the tree: enough to rebuild and draw its shape
+struct RenderFrame {
+    std::vector<std::string> preorder;
+    std::vector<std::string> inorder;
+};
+
+// -----------------------------------------------------------------------------
+// the thread that owns the pipeline publishes frames and writes text; the
+// renderer thread is the only one to touch cout until close(). Text is
+// printed in order and never dropped. A frame waits in the queue until the
+// renderer gets to it; when a newer one is published right behind it, with
+// no text in between, it is replaced, so a slow terminal sees the latest
+// tree rather than a backlog of old ones
+// -----------------------------------------------------------------------------
+class RenderPipeline {
+public:
+    typedef void (*render_fn)(const RenderFrame&);
+
+    struct Stats {
+        size_t published; // frames handed to publish()
+        size_t rendered;
+        size_t dropped;   // replaced before they were drawn
+    };
+
+    // render draws a frame to cout; it runs on the renderer thread
+    explicit RenderPipeline(render_fn render);
+    ~RenderPipeline();           // close()
+
+    void publish(std::shared_ptr<const RenderFrame> frame);
+    void write(std::string text);
+
+    // draw and print whatever is queued, then stop the renderer; the caller
+    // owns cout again afterwards
+    void close();
+
+    Stats stats() const;
+
+private:
+    struct Item {
+        std::string text;
+        std::shared_ptr<const RenderFrame> frame; // NULL for text
+    };
+
+    void render_loop();
+
+    render_fn                render_;
+    mutable std::mutex       mu_;
+    std::condition_variable  ready_;
+    std::deque<Item>         queue_;
+    Stats                    stats_;
+    bool                     closing_;
+    std::thread              renderer_;
+
+    RenderPipeline(const RenderPipeline&);
+    RenderPipeline& operator=(const RenderPipeline&);
+};
+
+#endif // RENDERPIPELINE_H_
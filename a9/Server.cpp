@@ -0,0 +1,344 @@
+// *****************************************************************************
+// Server.cpp
+// ~~~~~~~~~~
+// description : implementation of the UNIX socket server
+// *****************************************************************************
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "Server.h"
+
+using namespace std;
+
+namespace {
+    const size_t READ_CHUNK    = 64 * 1024;
+    const size_t READ_PER_TURN = 4 * READ_CHUNK; // per client, for fairness
+
+    string sys_error(const string& what) {
+        return what + ": " + strerror(errno);
+    }
+
+    bool is_blank(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+}
+
+AVLServer::AVLServer(AVLTree<string>& tree, const string& path)
+: tree_(tree), path_(path), listen_fd_(-1), epoll_fd_(-1)
+{
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path))
+        throw runtime_error("socket path too long: " + path);
+    memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+
+    struct stat st;
+    if (lstat(path.c_str(), &st) == 0) {
+        if (!S_ISSOCK(st.st_mode))
+            throw runtime_error(path + " exists and is not a socket");
+        unlink(path.c_str());
+    }
+
+    listen_fd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listen_fd_ < 0) throw runtime_error(sys_error("socket"));
+    if (bind(listen_fd_, (sockaddr*)&addr, sizeof(addr)) < 0 ||
+        listen(listen_fd_, SOMAXCONN) < 0) {
+        string msg = sys_error(path);
+        close(listen_fd_);
+        throw runtime_error(msg);
+    }
+
+    epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+    epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL; // the listening socket
+    if (epoll_fd_ < 0 || epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, listen_fd_, &ev)) {
+        string msg = sys_error("epoll");
+        close(listen_fd_);
+        if (epoll_fd_ >= 0) close(epoll_fd_);
+        unlink(path_.c_str());
+        throw runtime_error(msg);
+    }
+}
+
+AVLServer::~AVLServer()
+{
+    for (size_t i = 0; i < clients_.size(); ++i) {
+        close(clients_[i]->fd);
+        delete clients_[i];
+    }
+    close(epoll_fd_);
+    close(listen_fd_);
+    unlink(path_.c_str());
+}
+
+void AVLServer::run(volatile sig_atomic_t* stop)
+{
+    while (!*stop) turn(100);
+}
+
+/**
+ * -----------------------------------------------------------------------------
+ * a turn: react to what epoll reports, serve every complete request that
+ * came in, then try to send the responses right away; whatever does not fit
+ * in the socket is sent when epoll says there is room. Clients are closed at
+ * the end of a turn only, so no pointer in this turn's events dangles
+ * -----------------------------------------------------------------------------
+ */
+bool AVLServer::turn(int timeout_ms)
+{
+    epoll_event events[64];
+    int n = epoll_wait(epoll_fd_, events, 64, timeout_ms);
+    if (n < 0) {
+        if (errno == EINTR) return false;
+        throw runtime_error(sys_error("epoll_wait"));
+    }
+    for (int i = 0; i < n; ++i) {
+        Client* c = (Client*)events[i].data.ptr;
+        if (c == NULL) {
+            accept_clients();
+            continue;
+        }
+        if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+            read_client(c);
+        if (events[i].events & EPOLLOUT) write_client(c);
+    }
+
+    size_t served = stats_.turns;
+    serve();
+
+    size_t kept = 0;
+    for (size_t i = 0; i < clients_.size(); ++i) {
+        Client* c = clients_[i];
+        if (!c->closing && !c->out.empty()) write_client(c);
+        if (c->closing) {
+            close_client(c);
+        } else {
+            watch(c);
+            clients_[kept++] = c;
+        }
+    }
+    clients_.resize(kept);
+    return stats_.turns != served;
+}
+
+void AVLServer::accept_clients()
+{
+    for (;;) {
+        int fd = accept4(listen_fd_, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) return; // EAGAIN, or a client that gave up already
+        add_client(fd);
+    }
+}
+
+void AVLServer::adopt(int fd)
+{
+    int flags = fcntl(fd, F_GETFL);
+    if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+        string msg = sys_error("adopt");
+        close(fd);
+        throw runtime_error(msg);
+    }
+    if (!add_client(fd)) throw runtime_error("adopt: epoll won't watch it");
+}
+
+// false, with fd closed, if epoll won't watch it
+bool AVLServer::add_client(int fd)
+{
+    Client* c = new Client(fd);
+    epoll_event ev;
+    ev.events = c->events = EPOLLIN;
+    ev.data.ptr = c;
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        close(fd);
+        delete c;
+        return false;
+    }
+    clients_.push_back(c);
+    ++stats_.connections;
+    return true;
+}
+
+void AVLServer::read_client(Client* c)
+{
+    if (c->closing || c->out.size() >= OUTPUT_LIMIT) return;
+    for (size_t total = 0; total < READ_PER_TURN; ) {
+        size_t old = c->in.size();
+        c->in.resize(old + READ_CHUNK);
+        ssize_t got = read(c->fd, &c->in[old], READ_CHUNK);
+        c->in.resize(old + (got > 0 ? got : 0));
+        if (got > 0) {
+            total += got;
+        } else {
+            if (got == 0 || (errno != EAGAIN && errno != EINTR))
+                c->closing = true;
+            if (got == 0 || errno != EINTR) return;
+        }
+    }
+}
+
+// split the complete lines received since the last turn into requests
+void AVLServer::parse_lines(Client* c)
+{
+    const char* data = c->in.data();
+    size_t end = c->in.size();
+    while (c->parsed < end) {
+        const char* nl = (const char*)memchr(data + c->parsed, '\n',
+                                             end - c->parsed);
+        if (nl == NULL) {
+            if (end - c->parsed > OUTPUT_LIMIT) c->closing = true; // no line
+            return;
+        }
+        size_t pos = c->parsed, stop = nl - data;
+        c->parsed = stop + 1;
+
+        string_view words[4];
+        size_t nwords = 0;
+        while (pos < stop && nwords < 4) {
+            while (pos < stop && is_blank(data[pos])) ++pos;
+            if (pos == stop) break;
+            size_t start = pos;
+            while (pos < stop && !is_blank(data[pos])) ++pos;
+            words[nwords++] = string_view(data + start, pos - start);
+        }
+        if (nwords == 0) continue; // blank lines get no response
+
+        Request r;
+        r.client = c;
+        r.op = BAD;
+        if (words[0] == "insert" || words[0] == "remove" ||
+            words[0] == "find") {
+            if (nwords == 2) {
+                r.op = words[0] == "insert" ? INSERT
+                     : words[0] == "remove" ? REMOVE : FIND;
+            } else {
+                r.arg1 = "expected one key";
+            }
+        } else if (words[0] == "range") {
+            if (nwords == 3) r.op = RANGE;
+            else r.arg1 = "expected two keys";
+        } else {
+            r.arg1 = "unknown command";
+        }
+        if (r.op != BAD) {
+            r.arg1 = words[1];
+            r.arg2 = words[2];
+        }
+        requests_.push_back(r);
+    }
+}
+
+void AVLServer::serve()
+{
+    requests_.clear();
+    for (size_t i = 0; i < clients_.size(); ++i) parse_lines(clients_[i]);
+    if (!requests_.empty()) ++stats_.turns;
+
+    for (size_t i = 0; i < requests_.size(); ) {
+        size_t j = i + 1;
+        if (requests_[i].op == INSERT || requests_[i].op == REMOVE)
+            while (j < requests_.size() && requests_[j].op == requests_[i].op)
+                ++j;
+        serve_run(i, j);
+        i = j;
+    }
+    stats_.requests += requests_.size();
+
+    // the views into the input buffers are dead now
+    requests_.clear();
+    for (size_t i = 0; i < clients_.size(); ++i) {
+        Client* c = clients_[i];
+        c->in.erase(0, c->parsed);
+        c->parsed = 0;
+    }
+}
+
+// requests_[begin, end) are all the same op, and only one unless a mutation
+void AVLServer::serve_run(size_t begin, size_t end)
+{
+    Request& first = requests_[begin];
+    if (end - begin > 1) {
+        vector<string> keys(end - begin);
+        for (size_t i = begin; i < end; ++i)
+            keys[i - begin].assign(requests_[i].arg1);
+        vector<bool> done = (first.op == INSERT) ? tree_.insert_batch(keys)
+                                                 : tree_.erase_batch(keys);
+        for (size_t i = begin; i < end; ++i)
+            requests_[i].client->out += done[i - begin] ? "1\n" : "0\n";
+        ++stats_.batches;
+        stats_.batched += end - begin;
+        return;
+    }
+
+    string& out = first.client->out;
+    switch (first.op) {
+    case INSERT:
+        out += tree_.insert(string(first.arg1)) ? "1\n" : "0\n";
+        break;
+    case REMOVE:
+        out += tree_.remove(string(first.arg1)) ? "1\n" : "0\n";
+        break;
+    case FIND:
+        out += tree_.find(string(first.arg1)) ? "1\n" : "0\n";
+        break;
+    case RANGE: {
+        string keys;
+        size_t n = tree_.for_range(string(first.arg1), string(first.arg2),
+            [&keys](string_view k) { keys += ' '; keys.append(k); });
+        out += to_string(n);
+        out += keys;
+        out += '\n';
+        break;
+    }
+    case BAD:
+        out += "error ";
+        out.append(first.arg1);
+        out += '\n';
+        break;
+    }
+}
+
+void AVLServer::write_client(Client* c)
+{
+    size_t sent = 0;
+    while (sent < c->out.size()) {
+        ssize_t n = send(c->fd, c->out.data() + sent, c->out.size() - sent,
+                         MSG_NOSIGNAL);
+        if (n > 0) {
+            sent += n;
+        } else if (errno == EINTR) {
+            continue;
+        } else {
+            if (errno != EAGAIN) c->closing = true;
+            break;
+        }
+    }
+    c->out.erase(0, sent);
+}
+
+// read while there is room for the responses, write while there are some
+void AVLServer::watch(Client* c)
+{
+    unsigned want = (c->out.size() < OUTPUT_LIMIT ? EPOLLIN : 0) |
+                    (c->out.empty() ? 0 : EPOLLOUT);
+    if (want == c->events) return;
+    epoll_event ev;
+    ev.events = want;
+    ev.data.ptr = c;
+    epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, c->fd, &ev);
+    c->events = want;
+}
+
+void AVLServer::close_client(Client* c)
+{
+    epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, c->fd, NULL);
+    close(c->fd);
+    delete c;
+}
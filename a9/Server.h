@@ -0,0 +1,117 @@
+// *****************************************************************************
+// Server.h
+// ~~~~~~~~
+// description : serving one tree to many local clients over a UNIX domain
+//               socket, from a single-threaded epoll loop
+// *****************************************************************************
+#ifndef SERVER_H_
+#define SERVER_H_
+
+#include <csignal>
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "AVLTree.h"
+
+// -----------------------------------------------------------------------------
+// the protocol is line based, one request per line and one response line
+// per request, in order, so a client may send as many requests as it likes
+// before reading the responses:
+//   insert key    ->  1 if the key was inserted, 0 if it was there already
+//   remove key    ->  1 if the key was removed, 0 if it was not there
+//   find key      ->  1 or 0
+//   range lo hi   ->  n k1 ... kn, the keys lo <= k <= hi in order
+// anything else gets "error <reason>". Keys are whitespace-free words, as
+// in the driver.
+// Each turn of the loop reads whatever every ready client has sent, then
+// serves the complete lines of all of them, client by client; a run of
+// consecutive inserts (or removes) goes to the tree as one insert_batch
+// (erase_batch), which gives the same answers as one at a time. A client
+// whose responses pile up past OUTPUT_LIMIT is not read from until it
+// catches up, and one that sends a line longer than that is dropped
+// -----------------------------------------------------------------------------
+class AVLServer {
+public:
+    enum { OUTPUT_LIMIT = 1 << 20 };
+
+    struct Stats {
+        size_t connections; // accepted so far
+        size_t requests;
+        size_t batches;     // insert_batch/erase_batch calls
+        size_t batched;     // requests served by those
+        size_t turns;       // turns of the loop that served something
+        Stats() : connections(0), requests(0), batches(0), batched(0),
+                  turns(0) {}
+    };
+
+    // -------------------------------------------------------------------------
+    // listen on a socket at path; a stale socket left there is replaced, any
+    // other kind of file is not. Throws runtime_error on failure
+    // -------------------------------------------------------------------------
+    AVLServer(AVLTree<std::string>& tree, const std::string& path);
+    ~AVLServer();
+
+    // -------------------------------------------------------------------------
+    // serve until *stop becomes nonzero (from a signal handler, typically);
+    // the flag is looked at least every 100ms
+    // -------------------------------------------------------------------------
+    void run(volatile std::sig_atomic_t* stop);
+
+    // -------------------------------------------------------------------------
+    // one turn of that loop: wait up to timeout_ms for something to happen,
+    // then serve it. Returns whether a request was served
+    // -------------------------------------------------------------------------
+    bool turn(int timeout_ms);
+
+    // -------------------------------------------------------------------------
+    // serve fd, a connected stream socket (one end of a socketpair, say), as
+    // if the client had connected; the server owns it from now on
+    // -------------------------------------------------------------------------
+    void adopt(int fd);
+
+    const Stats& stats() const { return stats_; }
+
+private:
+    AVLServer(const AVLServer&);
+    AVLServer& operator=(const AVLServer&);
+
+    struct Client {
+        int         fd;
+        std::string in;       // received, not yet served
+        size_t      parsed;   // in[0, parsed) is split into requests
+        std::string out;      // responses not yet sent
+        unsigned    events;   // what epoll is watching for
+        bool        closing;  // the client hung up or failed
+        Client(int f) : fd(f), parsed(0), events(0), closing(false) {}
+    };
+
+    enum Op { INSERT, REMOVE, FIND, RANGE, BAD };
+
+    struct Request {
+        Client*          client;
+        Op               op;
+        std::string_view arg1, arg2; // into client->in; arg1 is the error
+    };
+
+    void accept_clients();
+    bool add_client(int fd);
+    void read_client(Client* c);
+    void parse_lines(Client* c);
+    void serve();
+    void serve_run(size_t begin, size_t end);
+    void write_client(Client* c);
+    void watch(Client* c);
+    void close_client(Client* c);
+
+    AVLTree<std::string>& tree_;
+    std::string           path_;
+    int                   listen_fd_;
+    int                   epoll_fd_;
+    std::vector<Client*>  clients_;
+    std::vector<Request>  requests_; // of the current turn
+    Stats                 stats_;
+};
+
+#endif // SERVER_H_
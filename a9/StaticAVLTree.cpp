@@ -0,0 +1,190 @@
+// =============================================================================
+// StaticAVLTree.cpp
+// ~~~~~~~~~~~~~~~~~
+// description : the fixed-capacity tree; all of it is constexpr, which in
+//               C++17 means every local is initialized where it is declared
+// =============================================================================
+
+#include "StaticAVLTree.h"
+
+template <typename Key, size_t N, typename Balance>
+constexpr StaticAVLTree<Key, N, Balance>::StaticAVLTree()
+: nodes_(), root_(NULL), free_(nodes_), size_(0)
+{
+    for (size_t i = 0; i + 1 < N; i++) nodes_[i].right = &nodes_[i+1];
+}
+
+template <typename Key, size_t N, typename Balance>
+constexpr StaticAVLTree<Key, N, Balance>::StaticAVLTree(
+    std::initializer_list<Key> keys)
+: nodes_(), root_(NULL), free_(nodes_), size_(0)
+{
+    for (size_t i = 0; i + 1 < N; i++) nodes_[i].right = &nodes_[i+1];
+    for (const Key* k = keys.begin(); k != keys.end(); ++k) insert(*k);
+}
+
+template <typename Key, size_t N, typename Balance>
+constexpr StaticAVLTree<Key, N, Balance>::StaticAVLTree(
+    const StaticAVLTree& other)
+: nodes_(), root_(NULL), free_(NULL), size_(0)
+{
+    copy_from(other);
+}
+
+template <typename Key, size_t N, typename Balance>
+constexpr StaticAVLTree<Key, N, Balance>&
+StaticAVLTree<Key, N, Balance>::operator=(const StaticAVLTree& other)
+{
+    if (this != &other) copy_from(other);
+    return *this;
+}
+
+/**
+ * -----------------------------------------------------------------------------
+ * slot i of this tree takes the place of slot i of other, so every link is
+ * moved by the distance between the two arrays; the free list comes along
+ * -----------------------------------------------------------------------------
+ */
+template <typename Key, size_t N, typename Balance>
+constexpr void StaticAVLTree<Key, N, Balance>::copy_from(
+    const StaticAVLTree& other)
+{
+    const AVLNode* base = other.nodes_;
+    for (size_t i = 0; i < N; i++) {
+        const AVLNode& from = other.nodes_[i];
+        AVLNode& to = nodes_[i];
+        to.balance = from.balance;
+        to.key     = from.key;
+        to.left    = from.left   ? &nodes_[from.left - base]   : NULL;
+        to.right   = from.right  ? &nodes_[from.right - base]  : NULL;
+        to.parent  = from.parent ? &nodes_[from.parent - base] : NULL;
+    }
+    root_ = other.root_ ? &nodes_[other.root_ - base] : NULL;
+    free_ = other.free_ ? &nodes_[other.free_ - base] : NULL;
+    size_ = other.size_;
+}
+
+template <typename Key, size_t N, typename Balance>
+constexpr typename StaticAVLTree<Key, N, Balance>::AVLNode*
+StaticAVLTree<Key, N, Balance>::search(const Key& key) const
+{
+    AVLNode* node = root_;
+    while (node != NULL && !(node->key == key))
+        node = (node->key < key) ? node->right : node->left;
+    return node;
+}
+
+template <typename Key, size_t N, typename Balance>
+constexpr bool StaticAVLTree<Key, N, Balance>::insert(const Key& key)
+{
+    AVLNode* p = NULL;
+    bool go_right = false;
+    for (AVLNode* node = root_; node != NULL; ) {
+        if (node->key == key) return false;
+        p = node;
+        go_right = node->key < key;
+        node = go_right ? node->right : node->left;
+    }
+    if (free_ == NULL) return false;
+
+    AVLNode* node = free_;
+    free_ = node->right;
+    node->balance = AVLNode::BALANCED;
+    node->key     = key;
+    node->left    = node->right = NULL;
+    node->parent  = p;
+    if (p == NULL) root_ = node;
+    else if (go_right) p->right = node;
+    else p->left = node;
+    ++size_;
+
+    Balance::after_insert(*this, node);
+    return true;
+}
+
+/**
+ * -----------------------------------------------------------------------------
+ * unlike AVLTree, a node with two children takes its predecessor's key and
+ * the predecessor's slot is the one that goes; nothing outside the tree
+ * holds on to the nodes so moving keys is fine here
+ * -----------------------------------------------------------------------------
+ */
+template <typename Key, size_t N, typename Balance>
+constexpr bool StaticAVLTree<Key, N, Balance>::remove(const Key& key)
+{
+    AVLNode* node = search(key);
+    if (node == NULL) return false;
+    if (node->left != NULL && node->right != NULL) {
+        AVLNode* pred = node->left;
+        while (pred->right != NULL) pred = pred->right;
+        node->key = pred->key;
+        node = pred;
+    }
+
+    // node has at most one child now, splice it out
+    AVLNode* child = (node->left != NULL) ? node->left : node->right;
+    AVLNode* par = node->parent;
+    bool left_side = (par != NULL) && (par->left == node);
+    if (child != NULL) child->parent = par;
+    if (par == NULL) root_ = child;
+    else if (left_side) par->left = child;
+    else par->right = child;
+    --size_;
+    Balance::after_unlink(*this, par, left_side, node);
+
+    node->left = node->parent = NULL;
+    node->right = free_;
+    free_ = node;
+    return true;
+}
+
+template <typename Key, size_t N, typename Balance>
+constexpr const Key& StaticAVLTree<Key, N, Balance>::minimum() const
+{
+    if (root_ == NULL) throw std::runtime_error("minimum() on an empty tree");
+    const AVLNode* node = root_;
+    while (node->left != NULL) node = node->left;
+    return node->key;
+}
+
+template <typename Key, size_t N, typename Balance>
+constexpr const Key& StaticAVLTree<Key, N, Balance>::maximum() const
+{
+    if (root_ == NULL) throw std::runtime_error("maximum() on an empty tree");
+    const AVLNode* node = root_;
+    while (node->right != NULL) node = node->right;
+    return node->key;
+}
+
+template <typename Key, size_t N, typename Balance>
+constexpr void StaticAVLTree<Key, N, Balance>::clear()
+{
+    for (size_t i = 0; i < N; i++) {
+        nodes_[i].left = nodes_[i].parent = NULL;
+        nodes_[i].right = (i + 1 < N) ? &nodes_[i+1] : NULL;
+    }
+    root_ = NULL;
+    free_ = nodes_;
+    size_ = 0;
+}
+
+template <typename Key, size_t N, typename Balance>
+template <typename Func>
+constexpr void StaticAVLTree<Key, N, Balance>::for_each(Func f) const
+{
+    const AVLNode* node = root_;
+    if (node == NULL) return;
+    while (node->left != NULL) node = node->left;
+    for (;;) {
+        f(node->key);
+        if (node->right != NULL) {
+            node = node->right;
+            while (node->left != NULL) node = node->left;
+        } else {
+            while (node->parent != NULL && node->parent->right == node)
+                node = node->parent;
+            if (node->parent == NULL) return;
+            node = node->parent;
+        }
+    }
+}
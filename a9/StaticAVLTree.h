@@ -0,0 +1,113 @@
+// =============================================================================
+// StaticAVLTree.h
+// ~~~~~~~~~~~~~~~
+// description : a fixed-capacity AVL tree that never touches the heap; all N
+//               nodes live in an array inside the tree object
+// =============================================================================
+#ifndef STATICAVLTREE_H_
+#define STATICAVLTREE_H_
+
+#include <cstddef>
+#include <initializer_list>
+#include <stdexcept>
+
+#include "AVLbalance.h"
+
+// -----------------------------------------------------------------------------
+// same insert/remove/find as AVLTree, with these differences
+// + the unused slots form a free list threaded through their right pointers;
+//   insert takes a slot from it and remove puts one back, O(1) each
+// + when all N slots are in use, insert fails: it returns false and full()
+//   is true. It never allocates
+// + everything but height() is constexpr, so a tree can be built at compile
+//   time and kept as a lookup table:
+//       constexpr StaticAVLTree<int, 8> primes{2, 3, 5, 7, 11, 13, 17, 19};
+//       static_assert(primes.find(13) && !primes.find(15), "");
+//   Key must then be a literal type. The nodes point at each other, so a
+//   constexpr tree must be built in place by its own constructor, and have
+//   static storage duration; GCC does not accept one that is returned from
+//   a constexpr function, as that goes through the copy constructor
+// + the rotations and the fix-ups are AVLTree's, see AVLbalance.h, and the
+//   other balancing policies work here too
+// + no summaries, extremes cache, batches or range operations
+// -----------------------------------------------------------------------------
+template <typename Key, size_t N, typename Balance = avl_balance>
+class StaticAVLTree {
+    friend Balance;
+public:
+    constexpr StaticAVLTree();
+
+    // insert the keys in turn; those that don't fit are dropped
+    constexpr StaticAVLTree(std::initializer_list<Key> keys);
+
+    // a copy relocates the links into its own array; this is also what
+    // returning a tree from a constexpr function does
+    constexpr StaticAVLTree(const StaticAVLTree& other);
+    constexpr StaticAVLTree& operator=(const StaticAVLTree& other);
+
+    // -----------------------------------------------------------------------
+    // insert returns true if a new node was created, false if the key is
+    // already in the tree or if the tree is full (then full() is true)
+    // -----------------------------------------------------------------------
+    constexpr bool insert(const Key& key);
+
+    // remove returns true if a node was removed, false if there's no such key
+    constexpr bool remove(const Key& key);
+
+    constexpr bool find(const Key& key) const { return search(key) != NULL; }
+
+    // O(log n); both throw runtime_error on an empty tree
+    constexpr const Key& minimum() const;
+    constexpr const Key& maximum() const;
+
+    constexpr void   clear();
+    constexpr size_t size() const     { return size_; }
+    constexpr size_t capacity() const { return N; }
+    constexpr bool   empty() const    { return size_ == 0; }
+    constexpr bool   full() const     { return free_ == NULL; }
+
+    // f(key) for every key in increasing order, without recursion
+    template <typename Func>
+    constexpr void for_each(Func f) const;
+
+    int height() const { return Balance::height(root_); }
+
+private:
+    static_assert(N > 0, "a StaticAVLTree needs room for at least one key");
+
+    // the same node as AVLTree's, minus the summary
+    struct AVLNode {
+        enum { LEFT_HEAVY = 1, BALANCED = 0, RIGHT_HEAVY = -1};
+        int balance;
+        Key key;
+        AVLNode* left;
+        AVLNode* right;  // the next free slot while on the free list
+        AVLNode* parent;
+
+        constexpr AVLNode()
+        : balance(BALANCED), key(), left(NULL), right(NULL), parent(NULL) {}
+    };
+
+    // the node holding key, NULL if none
+    constexpr AVLNode* search(const Key& key) const;
+
+    // the policies' handles on the tree, see AVLbalance.h
+    constexpr void left_rotate(AVLNode*& node) {
+        avl_link_left_rotate(root_, node);
+    }
+    constexpr void right_rotate(AVLNode*& node) {
+        avl_link_right_rotate(root_, node);
+    }
+
+    // copy other's keys, balance fields and links into this tree
+    constexpr void copy_from(const StaticAVLTree& other);
+
+    AVLNode  nodes_[N];
+    AVLNode* root_;
+    AVLNode* free_;  // head of the free list, NULL iff full
+    size_t   size_;
+};
+
+#include "StaticAVLTree.cpp" // only done for template classes
+
+#endif // STATICAVLTREE_H_
@@ -0,0 +1,91 @@
+// *****************************************************************************
+// StringArena.cpp
+// ~~~~~~~~~~~~~~~
+// description : implementation of the chunked string arena
+// *****************************************************************************
+#include <cstring>
+#include <utility>
+
+#include "StringArena.h"
+
+StringArena::StringArena(size_t chunk_size)
+: chunk_size_(chunk_size > 0 ? chunk_size : size_t(DEFAULT_CHUNK)),
+  cur_(NULL), left_(0), live_(0), dead_(0), reserved_(0)
+{
+}
+
+StringArena::~StringArena()
+{
+    clear();
+}
+
+void StringArena::swap(StringArena& other)
+{
+    chunks_.swap(other.chunks_);
+    std::swap(chunk_size_, other.chunk_size_);
+    std::swap(cur_, other.cur_);
+    std::swap(left_, other.left_);
+    std::swap(live_, other.live_);
+    std::swap(dead_, other.dead_);
+    std::swap(reserved_, other.reserved_);
+}
+
+/**
+ * -----------------------------------------------------------------------------
+ * a large string gets its own chunk, slotted in *before* the current one so
+ * the free space at the end of the current chunk is not given up
+ * -----------------------------------------------------------------------------
+ */
+char* StringArena::allocate(size_t n)
+{
+    if (n > chunk_size_ / 4) {
+        char* own = new char[n];
+        chunks_.insert(chunks_.empty() ? chunks_.end() : chunks_.end() - 1,
+                       own);
+        reserved_ += n;
+        return own;
+    }
+    if (n > left_) {
+        cur_ = new char[chunk_size_];
+        left_ = chunk_size_;
+        chunks_.push_back(cur_);
+        reserved_ += chunk_size_;
+    }
+    char* p = cur_;
+    cur_  += n;
+    left_ -= n;
+    return p;
+}
+
+std::string_view StringArena::store(std::string_view s)
+{
+    char* p = allocate(s.size());
+    if (!s.empty()) std::memcpy(p, s.data(), s.size());
+    live_ += s.size();
+    return std::string_view(p, s.size());
+}
+
+void StringArena::release(std::string_view s)
+{
+    live_ -= s.size();
+    dead_ += s.size();
+}
+
+void StringArena::unstore(std::string_view s)
+{
+    if (s.data() + s.size() == cur_) {
+        cur_  -= s.size();
+        left_ += s.size();
+        live_ -= s.size();
+        return;
+    }
+    release(s);
+}
+
+void StringArena::clear()
+{
+    for (size_t i = 0; i < chunks_.size(); ++i) delete[] chunks_[i];
+    chunks_.clear();
+    cur_ = NULL;
+    left_ = live_ = dead_ = reserved_ = 0;
+}
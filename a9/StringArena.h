@@ -0,0 +1,68 @@
+// *****************************************************************************
+// StringArena.h
+// ~~~~~~~~~~~~~
+// description : a chunked byte arena for string keys; strings are appended to
+//               large chunks and handed out as string_views, which stay valid
+//               until the arena is cleared or destroyed
+// *****************************************************************************
+#ifndef STRINGARENA_H_
+#define STRINGARENA_H_
+
+#include <cstddef>
+#include <string_view>
+#include <vector>
+
+class StringArena {
+public:
+    enum { DEFAULT_CHUNK = 64 * 1024 };
+
+    // -------------------------------------------------------------------------
+    // chunk_size is the size of each chunk; a string longer than a quarter
+    // chunk gets a chunk of its own
+    // -------------------------------------------------------------------------
+    explicit StringArena(size_t chunk_size = DEFAULT_CHUNK);
+    ~StringArena();
+
+    // an arena owns its chunks; it can be swapped but not copied
+    void swap(StringArena& other);
+
+    // -------------------------------------------------------------------------
+    // store copies s into the arena and returns a view of the copy. release
+    // tells the arena that the copy s is no longer used; the bytes are not
+    // reused, they only count as dead until the owner rebuilds the arena
+    // (see AVLStringTree::compact)
+    // -------------------------------------------------------------------------
+    std::string_view store(std::string_view s);
+    void release(std::string_view s);
+
+    // -------------------------------------------------------------------------
+    // take back the view just returned by store, when it turned out not to
+    // be needed after all; the bytes are reused if nothing was stored since
+    // -------------------------------------------------------------------------
+    void unstore(std::string_view s);
+
+    // drop every chunk at once; all views handed out become dangling
+    void clear();
+
+    size_t chunk_size() const     { return chunk_size_; }
+    size_t live_bytes() const     { return live_; }     // referenced
+    size_t dead_bytes() const     { return dead_; }     // released
+    size_t reserved_bytes() const { return reserved_; } // all chunks
+
+private:
+    StringArena(const StringArena&);
+    StringArena& operator=(const StringArena&);
+
+    // room for n more bytes, possibly in a new chunk
+    char* allocate(size_t n);
+
+    std::vector<char*> chunks_;
+    size_t chunk_size_;
+    char*  cur_;       // free space in the current chunk
+    size_t left_;      // bytes left at cur_
+    size_t live_;
+    size_t dead_;
+    size_t reserved_;
+};
+
+#endif // STRINGARENA_H_
@@ -0,0 +1,87 @@
+// *****************************************************************************
+// ThreadPool.cpp
+// ~~~~~~~~~~~~~~
+// description : implementation of the work-stealing thread pool
+// *****************************************************************************
+#include "ThreadPool.h"
+
+ThreadPool::ThreadPool(size_t nthreads) : queued_(0), stop_(false)
+{
+    if (nthreads == 0) nthreads = std::thread::hardware_concurrency();
+    if (nthreads == 0) nthreads = 1;
+    for (size_t q = 0; q < nthreads; ++q) queues_.push_back(new Queue);
+    for (size_t q = 1; q < nthreads; ++q)
+        workers_.push_back(std::thread(&ThreadPool::worker_loop, this, q));
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lk(sleep_mu_);
+        stop_ = true;
+    }
+    wake_.notify_all();
+    for (size_t i = 0; i < workers_.size(); ++i) workers_[i].join();
+    for (size_t q = 0; q < queues_.size(); ++q) delete queues_[q];
+}
+
+ThreadPool& ThreadPool::shared()
+{
+    static ThreadPool pool;
+    return pool;
+}
+
+void ThreadPool::push(size_t q, Task t)
+{
+    {
+        std::lock_guard<std::mutex> lk(queues_[q]->mu);
+        queues_[q]->tasks.push_back(t);
+    }
+    queued_.fetch_add(1, std::memory_order_release);
+    std::lock_guard<std::mutex> lk(sleep_mu_); // no lost wake-ups
+    wake_.notify_one();
+}
+
+/**
+ * -----------------------------------------------------------------------------
+ * the owner takes from the front of its own queue (the order in which the
+ * indices were dealt), a thief takes from the back of a victim's queue so the
+ * two rarely fight over the same end
+ * -----------------------------------------------------------------------------
+ */
+bool ThreadPool::pop_or_steal(size_t q, Task& t)
+{
+    if (queued_.load(std::memory_order_acquire) == 0) return false;
+    size_t nq = queues_.size();
+    for (size_t k = 0; k < nq; ++k) {
+        Queue* victim = queues_[(q + k) % nq];
+        std::lock_guard<std::mutex> lk(victim->mu);
+        if (victim->tasks.empty()) continue;
+        if (k == 0) {
+            t = victim->tasks.front();
+            victim->tasks.pop_front();
+        } else {
+            t = victim->tasks.back();
+            victim->tasks.pop_back();
+        }
+        queued_.fetch_sub(1, std::memory_order_relaxed);
+        return true;
+    }
+    return false;
+}
+
+void ThreadPool::worker_loop(size_t q)
+{
+    Task t;
+    for (;;) {
+        if (pop_or_steal(q, t)) {
+            t();
+            continue;
+        }
+        std::unique_lock<std::mutex> lk(sleep_mu_);
+        wake_.wait(lk, [this]() {
+            return stop_ || queued_.load(std::memory_order_acquire) != 0;
+        });
+        if (stop_) return;
+    }
+}
@@ -0,0 +1,110 @@
+// *****************************************************************************
+// ThreadPool.h
+// ~~~~~~~~~~~~
+// description : a small work-stealing thread pool used by the parallel
+//               algorithms over AVLTree
+// *****************************************************************************
+#ifndef THREADPOOL_H_
+#define THREADPOOL_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ThreadPool {
+public:
+    // -------------------------------------------------------------------------
+    // nthreads is the total number of threads doing work, *including* the
+    // thread that calls parallel_for; 0 means one per hardware thread
+    // -------------------------------------------------------------------------
+    explicit ThreadPool(size_t nthreads = 0);
+    ~ThreadPool();
+
+    size_t size() const { return queues_.size(); }
+
+    // -------------------------------------------------------------------------
+    // run f(0), f(1), ..., f(n-1) on the pool and block until all are done.
+    // Indices are dealt out in contiguous runs, one run per queue; an idle
+    // thread steals from the cold end of somebody else's queue. The calling
+    // thread works on queue 0 while it waits, so nested calls are fine.
+    // The first exception thrown by a task is re-thrown here.
+    // -------------------------------------------------------------------------
+    template <typename Func>
+    void parallel_for(size_t n, Func f);
+
+    // the process-wide pool, created on first use
+    static ThreadPool& shared();
+
+private:
+    typedef std::function<void()> Task;
+
+    struct Queue {
+        std::mutex mu;
+        std::deque<Task> tasks;
+    };
+
+    struct Batch {
+        std::atomic<size_t> pending;
+        std::mutex mu;
+        std::exception_ptr error;
+        Batch(size_t n) : pending(n) {}
+    };
+
+    void push(size_t q, Task t);
+    bool pop_or_steal(size_t q, Task& t);
+    void worker_loop(size_t q);
+
+    std::vector<Queue*> queues_;      // queues_[0] belongs to the caller
+    std::vector<std::thread> workers_;
+    std::atomic<size_t> queued_;      // total tasks sitting in the queues
+    std::mutex sleep_mu_;
+    std::condition_variable wake_;
+    bool stop_;
+
+    ThreadPool(const ThreadPool&);
+    ThreadPool& operator=(const ThreadPool&);
+};
+
+template <typename Func>
+void ThreadPool::parallel_for(size_t n, Func f)
+{
+    if (n == 0) return;
+    if (n == 1 || size() == 1) {
+        for (size_t i = 0; i < n; ++i) f(i);
+        return;
+    }
+
+    Batch batch(n);
+    size_t nq = size();
+    for (size_t q = 0; q < nq; ++q) {
+        size_t lo = q * n / nq, hi = (q + 1) * n / nq;
+        for (size_t i = lo; i < hi; ++i) {
+            push(q, [&batch, &f, i]() {
+                try {
+                    f(i);
+                } catch (...) {
+                    std::lock_guard<std::mutex> lk(batch.mu);
+                    if (!batch.error) batch.error = std::current_exception();
+                }
+                batch.pending.fetch_sub(1, std::memory_order_release);
+            });
+        }
+    }
+
+    // help out until our batch is drained; we may end up running tasks from
+    // an enclosing batch too, which is harmless
+    Task t;
+    while (batch.pending.load(std::memory_order_acquire) != 0) {
+        if (pop_or_steal(0, t)) t();
+        else std::this_thread::yield();
+    }
+    if (batch.error) std::rethrow_exception(batch.error);
+}
+
+#endif // THREADPOOL_H_
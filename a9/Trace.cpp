@@ -0,0 +1,98 @@
+// *****************************************************************************
+// Trace.cpp
+// ~~~~~~~~~
+// description : implementation of the trace writer and reader
+// *****************************************************************************
+#include <stdexcept>
+
+#include "Trace.h"
+
+using namespace std;
+
+namespace {
+    const char   MAGIC[8] = {'A', 'V', 'L', 'T', 'R', 'A', 'C', 'E'};
+    const char   VERSION  = 1;
+
+    void put_varint(ofstream& out, uint64_t v) {
+        char buf[10];
+        size_t n = 0;
+        while (v >= 0x80) {
+            buf[n++] = char((v & 0x7f) | 0x80);
+            v >>= 7;
+        }
+        buf[n++] = char(v);
+        out.write(buf, n);
+    }
+
+    // false on a clean end of file before the first byte
+    bool get_varint(ifstream& in, uint64_t& v) {
+        v = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            int c = in.get();
+            if (c == EOF) {
+                if (shift == 0) return false;
+                throw runtime_error("trace cut short");
+            }
+            v |= uint64_t(c & 0x7f) << shift;
+            if (!(c & 0x80)) return true;
+        }
+        throw runtime_error("bad varint in trace");
+    }
+}
+
+TraceWriter::TraceWriter(const string& path)
+: out_(path.c_str(), ios::binary | ios::trunc),
+  start_(chrono::steady_clock::now()), last_us_(0), records_(0)
+{
+    if (!out_) throw runtime_error("cannot create trace file " + path);
+    out_.write(MAGIC, sizeof(MAGIC));
+    out_.put(VERSION);
+}
+
+// flushed per record so that a session which is killed keeps its trace
+void TraceWriter::record(command_t op, const string_view* args)
+{
+    uint64_t now = chrono::duration_cast<chrono::microseconds>(
+        chrono::steady_clock::now() - start_).count();
+    put_varint(out_, now - last_us_);
+    out_.put(char(op));
+    for (size_t i = 0; i < command_arity(op); ++i) {
+        put_varint(out_, args[i].size());
+        out_.write(args[i].data(), args[i].size());
+    }
+    out_.flush();
+    last_us_ = now;
+    ++records_;
+}
+
+TraceReader::TraceReader(const string& path)
+: in_(path.c_str(), ios::binary), time_us_(0)
+{
+    if (!in_) throw runtime_error("cannot open trace file " + path);
+    char magic[sizeof(MAGIC)];
+    in_.read(magic, sizeof(magic));
+    if (!in_ || string(magic, sizeof(magic)) != string(MAGIC, sizeof(MAGIC)))
+        throw runtime_error(path + " is not a trace file");
+    if (in_.get() != VERSION)
+        throw runtime_error(path + ": unsupported trace version");
+}
+
+bool TraceReader::next(TraceRecord& rec)
+{
+    uint64_t delta, len;
+    if (!get_varint(in_, delta)) return false;
+    int op = in_.get();
+    if (op == EOF) throw runtime_error("trace cut short");
+    if (op <= CMD_NONE || op > CMD_LAST)
+        throw runtime_error("unknown command in trace");
+    rec.op = command_t(op);
+    for (size_t i = 0; i < command_arity(rec.op); ++i) {
+        if (!get_varint(in_, len)) throw runtime_error("trace cut short");
+        rec.args[i].resize(len);
+        if (len > 0) in_.read(&rec.args[i][0], len);
+        if (!in_) throw runtime_error("trace cut short");
+    }
+    time_us_ += delta;
+    rec.time_us = time_us_;
+    return true;
+}
@@ -0,0 +1,68 @@
+// *****************************************************************************
+// Trace.h
+// ~~~~~~~
+// description : recording the driver's commands to a compact binary trace
+//               and reading them back, for replaying a session offline
+// *****************************************************************************
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <string_view>
+
+#include "Command.h"
+
+struct TraceRecord {
+    uint64_t    time_us; // since the recording started
+    command_t   op;
+    std::string args[2]; // command_arity(op) of them
+};
+
+// -----------------------------------------------------------------------------
+// the file is an 8-byte magic and a version byte, then one record after the
+// other:
+//   varint  microseconds since the previous record
+//   byte    the command code, see Command.h
+//   for each of the command's arguments: varint length, then the bytes
+// where a varint is 7 bits per byte, low bits first, the high bit set on
+// all bytes but the last. A command typed a few seconds after the last one
+// with a 10-byte key costs 14 bytes
+// -----------------------------------------------------------------------------
+class TraceWriter {
+public:
+    // throws runtime_error if the file can't be created
+    explicit TraceWriter(const std::string& path);
+
+    // stamp the command with the time since the writer was created; args
+    // holds command_arity(op) arguments
+    void record(command_t op, const std::string_view* args);
+
+    size_t records() const { return records_; }
+
+private:
+    std::ofstream out_;
+    std::chrono::steady_clock::time_point start_;
+    uint64_t last_us_;
+    size_t   records_;
+};
+
+class TraceReader {
+public:
+    // throws runtime_error if the file can't be read or is not a trace
+    explicit TraceReader(const std::string& path);
+
+    // the next record; false at the end of the trace. A record cut short
+    // (the recording was killed mid-write) or of an unknown command throws
+    // runtime_error
+    bool next(TraceRecord& rec);
+
+private:
+    std::ifstream in_;
+    uint64_t time_us_;
+};
+
+#endif // TRACE_H_
@@ -0,0 +1,2183 @@
+// ============================================================================
+// avlcheck.cpp
+// ~~~~~~~~~~~~
+// description : randomized self-checks: each suite drives a structure with
+//               random operations next to a std::set of the same keys and
+//               compares every answer with it; the AVLTrees are also
+//               validated (see AVLTree::validate) after every step
+// usage       : avlcheck [suite] [rounds] [seed]
+//               with no suite given, or "all", every suite is run; exits
+//               with 1 at the first failed check
+// ****************************************************************************
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iterator>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <random>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "AVLTree.h"
+#include "AVLstring.h"
+#include "BPlusTree.h"
+#include "BTree.h"
+#include "CommandReader.h"
+#include "Diagnostics.h"
+#include "MappedAVLTree.h"
+#include "RenderPipeline.h"
+#include "Server.h"
+#include "StaticAVLTree.h"
+#include "Trace.h"
+
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace std;
+
+typedef void (*suite_t)(size_t);
+
+// -----------------------------------------------------------------------------
+// a few helpers
+// -----------------------------------------------------------------------------
+#define CHECK(cond)                                                         \
+    do {                                                                    \
+        if (!(cond))                                                        \
+            throw runtime_error(string("avlcheck.cpp:") +                   \
+                                to_string(__LINE__) + ": " #cond);          \
+    } while (0)
+
+static mt19937 gen;
+
+static int random_int(int n) { return int(gen() % unsigned(n)); }
+
+static vector<int> random_batch(size_t n, int range)
+{
+    vector<int> keys(n);
+    for (size_t i = 0; i < n; i++) keys[i] = random_int(range);
+    return keys;
+}
+
+// the keys of a tree with for_each, in order, against the reference
+template <typename Tree, typename Key>
+static void same_keys(Tree& tree, const set<Key>& ref)
+{
+    vector<Key> keys;
+    tree.for_each([&keys](const auto& key) { keys.push_back(Key(key)); });
+    CHECK(tree.size() == ref.size());
+    CHECK(keys.size() == ref.size());
+    CHECK(equal(keys.begin(), keys.end(), ref.begin()));
+}
+
+// what a batch update must return: the keys taken one by one, in batch order
+static vector<bool> expected_insert(set<int>& ref, const vector<int>& keys)
+{
+    vector<bool> result(keys.size());
+    for (size_t i = 0; i < keys.size(); i++)
+        result[i] = ref.insert(keys[i]).second;
+    return result;
+}
+
+static vector<bool> expected_erase(set<int>& ref, const vector<int>& keys)
+{
+    vector<bool> result(keys.size());
+    for (size_t i = 0; i < keys.size(); i++)
+        result[i] = ref.erase(keys[i]) == 1;
+    return result;
+}
+
+static size_t erase_between(set<int>& ref, int lo, int hi)
+{
+    size_t n = 0;
+    for (set<int>::iterator it = ref.lower_bound(lo);
+         it != ref.end() && *it <= hi; n++)
+        it = ref.erase(it);
+    return n;
+}
+
+// a batch size: a few keys, a few lockstep groups, or as many as the tree
+// holds and more, for the rebuild
+static size_t batch_size(size_t tree_size)
+{
+    switch (random_int(3)) {
+    case 0:  return random_int(6);
+    case 1:  return random_int(3 * AVL_FIND_GROUP);
+    default: return random_int(2 * tree_size + 10);
+    }
+}
+
+// -----------------------------------------------------------------------------
+// insert, remove, find and the extremes under each balancing policy, the
+// tree validated after each
+// -----------------------------------------------------------------------------
+template <typename Balance>
+static void updates(size_t rounds)
+{
+    for (size_t r = 0; r < rounds; r++) {
+        AVLTree<int, avl_no_summary<int>, Balance> tree;
+        set<int> ref;
+        int range = 1 + random_int(2000);
+        for (int op = 0; op < 1000; op++) {
+            int key = random_int(range);
+            switch (random_int(8)) {
+            case 0: case 1: case 2:
+                CHECK(tree.insert(key) == ref.insert(key).second);
+                break;
+            case 3: case 4:
+                CHECK(tree.remove(key) == (ref.erase(key) == 1));
+                break;
+            case 5:
+                CHECK(tree.find(key) == (ref.count(key) == 1));
+                break;
+            case 6:
+                if (ref.empty()) break;
+                CHECK(tree.pop_min() == *ref.begin());
+                ref.erase(ref.begin());
+                break;
+            default:
+                if (ref.empty()) break;
+                CHECK(tree.pop_max() == *ref.rbegin());
+                ref.erase(prev(ref.end()));
+                break;
+            }
+            tree.validate();
+            CHECK(tree.size() == ref.size());
+            if (!ref.empty()) {
+                CHECK(tree.minimum() == *ref.begin());
+                CHECK(tree.maximum() == *ref.rbegin());
+            }
+        }
+        same_keys(tree, ref);
+    }
+}
+
+static void check_updates(size_t rounds)
+{
+    updates<avl_balance>(rounds);
+    updates<rb_balance>(rounds);
+    updates<wavl_balance>(rounds);
+}
+
+// -----------------------------------------------------------------------------
+// insert_batch and erase_batch, on both of their paths, between single
+// updates, under each balancing policy, with lazy deletion every other round
+// -----------------------------------------------------------------------------
+template <typename Balance>
+static void batches(size_t rounds)
+{
+    for (size_t r = 0; r < rounds; r++) {
+        AVLTree<int, avl_no_summary<int>, Balance> tree;
+        set<int> ref;
+        if (r % 2 == 1) tree.set_lazy_delete(true, 0.5, r % 4 == 1 ? 2 : 0);
+        int range = 1 + random_int(5000);
+        for (int op = 0; op < 150; op++) {
+            vector<int> keys = random_batch(batch_size(ref.size()), range);
+            int key = random_int(range);
+            switch (random_int(5)) {
+            case 0: case 1:
+                CHECK(tree.insert_batch(keys) == expected_insert(ref, keys));
+                break;
+            case 2:
+                CHECK(tree.erase_batch(keys) == expected_erase(ref, keys));
+                break;
+            case 3:
+                CHECK(tree.insert(key) == ref.insert(key).second);
+                break;
+            default:
+                CHECK(tree.remove(key) == (ref.erase(key) == 1));
+                break;
+            }
+            tree.validate();
+        }
+        same_keys(tree, ref);
+    }
+}
+
+static void check_batch(size_t rounds)
+{
+    batches<avl_balance>(rounds);
+    batches<rb_balance>(rounds);
+    batches<wavl_balance>(rounds);
+}
+
+// -----------------------------------------------------------------------------
+// the branchless descent, which no key takes by default: the same updates on
+// an int that opts into it, compared with the reference set
+// -----------------------------------------------------------------------------
+struct BranchlessInt {
+    int v;
+    BranchlessInt(int x = 0) : v(x) {}
+    bool operator<(const BranchlessInt& o) const  { return v < o.v; }
+    bool operator>(const BranchlessInt& o) const  { return v > o.v; }
+    bool operator==(const BranchlessInt& o) const { return v == o.v; }
+    bool operator!=(const BranchlessInt& o) const { return v != o.v; }
+};
+ostream& operator<<(ostream& os, const BranchlessInt& k) { return os << k.v; }
+
+template <>
+struct avl_key_traits<BranchlessInt> {
+    typedef avl_branchless_search search_tag;
+};
+
+static void check_branchless(size_t rounds)
+{
+    for (size_t r = 0; r < rounds; r++) {
+        AVLTree<BranchlessInt> tree;
+        set<int> ref;
+        int range = 1 + random_int(2000);
+        for (int op = 0; op < 1000; op++) {
+            int key = random_int(range);
+            switch (random_int(3)) {
+            case 0:
+                CHECK(tree.insert(key) == ref.insert(key).second);
+                break;
+            case 1:
+                CHECK(tree.remove(key) == (ref.erase(key) == 1));
+                break;
+            default:
+                CHECK(tree.find(key) == (ref.count(key) == 1));
+                break;
+            }
+            tree.validate();
+        }
+        vector<int> keys;
+        tree.for_each([&keys](const BranchlessInt& key) {
+            keys.push_back(key.v);
+        });
+        CHECK(keys == vector<int>(ref.begin(), ref.end()));
+    }
+}
+
+// -----------------------------------------------------------------------------
+// erase_range, extract_range, for_range and the sum aggregate, between
+// single updates, with lazy deletion every other round; split and join for
+// AVL, one unlink at a time for the others
+// -----------------------------------------------------------------------------
+template <typename Balance>
+static void ranges(size_t rounds)
+{
+    typedef AVLTree<int, avl_sum_summary<int, long long>, Balance> Tree;
+    for (size_t r = 0; r < rounds; r++) {
+        Tree tree;
+        set<int> ref;
+        if (r % 2 == 1) tree.set_lazy_delete(true, 0.5, 2);
+        int range = 100 + random_int(5000);
+        tree.insert_batch(random_batch(range / 2, range));
+        tree.for_each([&ref](const int& key) { ref.insert(key); });
+        for (int op = 0; op < 300; op++) {
+            int lo = random_int(range), hi = lo + random_int(range / 10 + 1);
+            long long sum = 0;
+            vector<int> seen;
+            switch (random_int(6)) {
+            case 0:
+                CHECK(tree.erase_range(lo, hi) == erase_between(ref, lo, hi));
+                break;
+            case 1: {
+                Tree out = tree.extract_range(lo, hi);
+                set<int> part(ref.lower_bound(lo), ref.upper_bound(hi));
+                erase_between(ref, lo, hi);
+                out.validate();
+                same_keys(out, part);
+                break;
+            }
+            case 2:
+                CHECK(tree.for_range(lo, hi, [&seen](const int& key) {
+                    seen.push_back(key);
+                }) == seen.size());
+                CHECK(seen == vector<int>(ref.lower_bound(lo),
+                                          ref.upper_bound(hi)));
+                break;
+            case 3:
+                for (set<int>::iterator it = ref.lower_bound(lo);
+                     it != ref.end() && *it <= hi; ++it)
+                    sum += *it;
+                CHECK(tree.aggregate(lo, hi) == sum);
+                break;
+            case 4: {
+                int key = random_int(range);
+                CHECK(tree.insert(key) == ref.insert(key).second);
+                break;
+            }
+            default: {
+                int key = random_int(range);
+                CHECK(tree.remove(key) == (ref.erase(key) == 1));
+                break;
+            }
+            }
+            tree.validate();
+            CHECK(tree.total() == accumulate(ref.begin(), ref.end(), 0LL));
+        }
+        same_keys(tree, ref);
+    }
+}
+
+static void check_range(size_t rounds)
+{
+    ranges<avl_balance>(rounds);
+    ranges<rb_balance>(rounds);
+    ranges<wavl_balance>(rounds);
+}
+
+// -----------------------------------------------------------------------------
+// parallel_for_each and parallel_reduce against the serial for_each, on trees
+// of every size from empty up, so that the cuts fall everywhere; the reduce
+// concatenates, which only gives the keys in order if the pieces are folded
+// left to right
+// -----------------------------------------------------------------------------
+static void check_parallel(size_t rounds)
+{
+    ThreadPool pool(4);
+    for (size_t r = 0; r < rounds; r++) {
+        AVLTree<int> tree;
+        set<int> ref;
+        int range = 1 + random_int(100000);
+        for (int step = 0; step < 40; step++) {
+            vector<int> keys = random_batch(random_int(2 * step * step + 2), range);
+            tree.insert_batch(keys);
+            ref.insert(keys.begin(), keys.end());
+
+            mutex lock;
+            vector<int> seen;
+            tree.parallel_for_each([&](int key) {
+                lock_guard<mutex> guard(lock);
+                seen.push_back(key);
+            }, pool);
+            sort(seen.begin(), seen.end());
+            CHECK(seen.size() == ref.size());
+            CHECK(equal(seen.begin(), seen.end(), ref.begin()));
+
+            long long sum = tree.parallel_reduce(0LL,
+                [](int key) { return (long long)key; },
+                [](long long a, long long b) { return a + b; }, pool);
+            CHECK(sum == accumulate(ref.begin(), ref.end(), 0LL));
+
+            vector<int> in_order = tree.parallel_reduce(vector<int>(),
+                [](int key) { return vector<int>(1, key); },
+                [](vector<int> a, const vector<int>& b) {
+                    a.insert(a.end(), b.begin(), b.end());
+                    return a;
+                }, pool);
+            CHECK(in_order.size() == ref.size());
+            CHECK(equal(in_order.begin(), in_order.end(), ref.begin()));
+        }
+    }
+}
+
+// -----------------------------------------------------------------------------
+// AVLStringTree, with compactions by hand and by ratio, and the settings it
+// forwards to its tree; the tree is validated after every step, a compaction
+// included, which moves the nodes into one block
+// -----------------------------------------------------------------------------
+static string random_string(int range)
+{
+    return "key" + to_string(random_int(range)) + string(random_int(20), 'x');
+}
+
+static void check_string(size_t rounds)
+{
+    for (size_t r = 0; r < rounds; r++) {
+        AVLStringTree<> tree(1024);
+        set<string> ref;
+        if (r % 4 == 1) tree.enable_find_cache(32);
+        if (r % 4 == 2) tree.enable_bloom_filter(8);
+        if (r % 4 == 3) tree.set_relayout_interval(300);
+        tree.set_compact_ratio(r % 3 == 0 ? 0.5 : 0);
+        int range = 50 + random_int(2000);
+        for (int op = 0; op < 1500; op++) {
+            string key = random_string(range);
+            vector<string> words;
+            vector<string_view> views;
+            switch (random_int(8)) {
+            case 0: case 1: case 2:
+                CHECK(tree.insert(key) == ref.insert(key).second);
+                break;
+            case 3: case 4:
+                CHECK(tree.remove(key) == (ref.erase(key) == 1));
+                break;
+            case 5:
+                CHECK(tree.find(key) == (ref.count(key) == 1));
+                break;
+            case 6:
+                for (int i = random_int(100); i > 0; i--)
+                    words.push_back(random_string(range));
+                views.assign(words.begin(), words.end());
+                if (random_int(2) == 0) {
+                    vector<bool> got = tree.insert_batch(views);
+                    for (size_t i = 0; i < words.size(); i++)
+                        CHECK(got[i] == ref.insert(words[i]).second);
+                } else {
+                    vector<bool> got = tree.erase_batch(views);
+                    for (size_t i = 0; i < words.size(); i++)
+                        CHECK(got[i] == (ref.erase(words[i]) == 1));
+                }
+                break;
+            default:
+                if (random_int(10) == 0) tree.compact();
+                break;
+            }
+            tree.tree().validate();
+        }
+        same_keys(tree, ref);
+        string lo = random_string(range), hi = random_string(range);
+        if (hi < lo) swap(lo, hi);
+        vector<string> seen;
+        tree.for_range(lo, hi, [&seen](string_view key) {
+            seen.push_back(string(key));
+        });
+        CHECK(seen == vector<string>(ref.lower_bound(lo), ref.upper_bound(hi)));
+        tree.clear();
+        CHECK(tree.empty() && tree.arena().reserved_bytes() == 0);
+    }
+}
+
+// -----------------------------------------------------------------------------
+// StaticAVLTree: a lookup table built at compile time, then random updates
+// on a small tree that fills up, against the reference set, under each
+// balancing policy; copies must come out equal and independent
+// -----------------------------------------------------------------------------
+constexpr StaticAVLTree<int, 8> primes{19, 2, 17, 3, 13, 5, 11, 7, 23};
+static_assert(primes.size() == 8 && primes.full(), "23 does not fit");
+static_assert(primes.find(13) && !primes.find(15) && !primes.find(23), "");
+static_assert(primes.minimum() == 2 && primes.maximum() == 19, "");
+
+template <typename Tree>
+static void same_static_keys(const Tree& tree, const set<int>& ref)
+{
+    vector<int> keys;
+    tree.for_each([&keys](const int& key) { keys.push_back(key); });
+    CHECK(tree.size() == ref.size() && tree.empty() == ref.empty());
+    CHECK(keys == vector<int>(ref.begin(), ref.end()));
+}
+
+template <typename Balance>
+static void statics(size_t rounds)
+{
+    const size_t N = 100;
+    typedef StaticAVLTree<int, N, Balance> Tree;
+    for (size_t r = 0; r < rounds; r++) {
+        Tree tree;
+        set<int> ref;
+        int range = 50 + random_int(200);
+        for (int op = 0; op < 3000; op++) {
+            int key = random_int(range);
+            switch (random_int(6)) {
+            case 0: case 1: case 2:
+                if (ref.size() == N && ref.count(key) == 0) {
+                    CHECK(tree.full() && !tree.insert(key));
+                    break;
+                }
+                CHECK(tree.insert(key) == ref.insert(key).second);
+                break;
+            case 3:
+                CHECK(tree.remove(key) == (ref.erase(key) == 1));
+                break;
+            case 4:
+                CHECK(tree.find(key) == (ref.count(key) == 1));
+                break;
+            default:
+                if (random_int(20) == 0) {
+                    Tree copy(tree);
+                    same_static_keys(copy, ref);
+                    copy.insert(range);
+                    copy.clear();
+                    CHECK(copy.empty() && !copy.full());
+                }
+                break;
+            }
+            CHECK(tree.full() == (ref.size() == N));
+            CHECK(tree.height() <= 2 * int(log2(ref.size() + 1)) + 1);
+            if (!ref.empty()) {
+                CHECK(tree.minimum() == *ref.begin());
+                CHECK(tree.maximum() == *ref.rbegin());
+            }
+        }
+        same_static_keys(tree, ref);
+        Tree other;
+        other = tree;
+        tree.clear();
+        same_static_keys(other, ref);
+        same_static_keys(tree, set<int>());
+    }
+}
+
+static void check_static(size_t rounds)
+{
+    statics<avl_balance>(rounds);
+    statics<rb_balance>(rounds);
+    statics<wavl_balance>(rounds);
+}
+
+// -----------------------------------------------------------------------------
+// the find cache must drop a key whenever its node goes, however it goes:
+// remove, a tombstone, pop_min/pop_max, the batches, the ranges (split),
+// relayout, compaction and clear. The keys are drawn from a small range and
+// looked up after every step, so that most of them are cached when they go
+// -----------------------------------------------------------------------------
+static void check_cache(size_t rounds)
+{
+    for (size_t r = 0; r < rounds; r++) {
+        AVLTree<int> tree;
+        set<int> ref;
+        tree.enable_find_cache(16 << (r % 3));
+        if (r % 2 == 1) tree.set_lazy_delete(true, 0.5, r % 4 == 1 ? 1 : 0);
+        int range = 20 + random_int(100);
+        for (int op = 0; op < 2000; op++) {
+            int key = random_int(range), hi = key + random_int(range / 4);
+            vector<int> keys = random_batch(random_int(10), range);
+            switch (random_int(12)) {
+            case 0: case 1: case 2:
+                CHECK(tree.insert(key) == ref.insert(key).second);
+                break;
+            case 3: case 4:
+                CHECK(tree.remove(key) == (ref.erase(key) == 1));
+                break;
+            case 5:
+                if (ref.empty()) break;
+                if (random_int(2) == 0) {
+                    CHECK(tree.pop_min() == *ref.begin());
+                    ref.erase(ref.begin());
+                } else {
+                    CHECK(tree.pop_max() == *ref.rbegin());
+                    ref.erase(prev(ref.end()));
+                }
+                break;
+            case 6:
+                CHECK(tree.insert_batch(keys) == expected_insert(ref, keys));
+                break;
+            case 7:
+                CHECK(tree.erase_batch(keys) == expected_erase(ref, keys));
+                break;
+            case 8:
+                if (random_int(2) == 0) {
+                    CHECK(tree.erase_range(key, hi) ==
+                          erase_between(ref, key, hi));
+                } else {
+                    AVLTree<int> out = tree.extract_range(key, hi);
+                    erase_between(ref, key, hi);
+                }
+                break;
+            case 9:
+                if (random_int(2) == 0) tree.relayout();
+                else tree.compact(random_int(3));
+                break;
+            case 10:
+                if (random_int(20) != 0) break;
+                tree.clear();
+                ref.clear();
+                break;
+            default:
+                break;
+            }
+            for (int k = 0; k < range; k += 1 + random_int(3))
+                CHECK(tree.find(k) == (ref.count(k) == 1));
+            tree.validate();
+        }
+        same_keys(tree, ref);
+        CHECK(tree.find_cache_stats().hits > 0);
+        CHECK(tree.find_cache_stats().invalidations > 0);
+    }
+}
+
+// -----------------------------------------------------------------------------
+// the Bloom filter: no false negatives, whatever fed it (insert, a revived
+// tombstone, either batch path, ingest) and however often it was rebuilt, by
+// hand or on drift,
+// the trees growing well past what it was sized for so that it drifts; then
+// the false positive rate, of the filter on its own and in front of a tree
+// -----------------------------------------------------------------------------
+static void check_bloom(size_t rounds)
+{
+    for (size_t r = 0; r < rounds; r++) {
+        AVLTree<int> tree;
+        set<int> ref;
+        tree.enable_bloom_filter(4 + random_int(8));
+        if (r % 2 == 1) tree.set_lazy_delete(true, 0.5, 1);
+        size_t drifts = 0;  // rebuilds of the filters replaced by hand
+        int range = 20000;
+        for (int op = 0; op < 300; op++) {
+            int key = random_int(range);
+            vector<int> keys = random_batch(batch_size(ref.size()), range);
+            switch (random_int(7)) {
+            case 0: case 1:
+                for (size_t i = 0; i < keys.size(); i++)
+                    CHECK(tree.insert(keys[i]) == ref.insert(keys[i]).second);
+                break;
+            case 2:
+                CHECK(tree.insert_batch(keys) == expected_insert(ref, keys));
+                break;
+            case 3:
+                CHECK(tree.erase_batch(keys) == expected_erase(ref, keys));
+                break;
+            case 4: {
+                avl_ingest_buffers<int> buffers(2);
+                for (size_t i = 0; i < keys.size(); i++)
+                    buffers.add(i % 2, keys[i]);
+                size_t before = ref.size();
+                ref.insert(keys.begin(), keys.end());
+                CHECK(tree.ingest(buffers) == ref.size() - before);
+                break;
+            }
+            case 5:
+                // rebuilt from the live keys: the tombstones' keys are out
+                // of it, until they are revived
+                drifts += tree.bloom_filter_stats().rebuilds;
+                tree.enable_bloom_filter(4 + random_int(8));
+                break;
+            default:
+                for (int i = 0; i < 20; i++, key = random_int(range))
+                    CHECK(tree.remove(key) == (ref.erase(key) == 1));
+                break;
+            }
+            // the keys that are there, and a few that are not to drive the
+            // drift detection
+            for (set<int>::iterator it = ref.begin(); it != ref.end(); ++it)
+                CHECK(tree.find(*it));
+            for (int i = 0; i < 200; i++) {
+                key = random_int(range);
+                CHECK(tree.find(key) == (ref.count(key) == 1));
+            }
+        }
+        vector<bool> got;
+        vector<int> all(ref.begin(), ref.end());
+        tree.find_batch(all, got);
+        CHECK(find(got.begin(), got.end(), false) == got.end());
+        CHECK(drifts + tree.bloom_filter_stats().rebuilds > 0);
+        CHECK(tree.bloom_filter_stats().skips > 0);
+    }
+
+    // 10 bits per key is sized for about 1%; blocking costs a little
+    const size_t n = 50000;
+    avl_bloom_filter filter(10);
+    filter.reset(n);
+    for (size_t i = 0; i < n; i++) filter.add(avl_bloom_filter::hash(int(i)));
+    size_t positives = 0;
+    for (size_t i = n; i < 11 * n; i++)
+        positives += filter.may_contain(avl_bloom_filter::hash(int(i)));
+    double rate = double(positives) / double(10 * n);
+    CHECK(rate > 0.002 && rate < 0.02);
+    CHECK(!filter.drifted());
+
+    AVLTree<int> tree;
+    for (size_t i = 0; i < n; i++) tree.insert(int(2 * i));
+    tree.enable_bloom_filter(10);
+    for (size_t i = 0; i < 10 * n; i++) CHECK(!tree.find(int(2 * i + 1)));
+    CHECK(tree.bloom_filter_stats().observed_fpr() < 0.02);
+}
+
+// -----------------------------------------------------------------------------
+// lazy deletion mixed with everything that works around the tombstones:
+// compaction by hand and on the way, revivals, the extremes, batches,
+// ranges, ingest, relayout, the find cache and the Bloom filter; and the
+// extremes, which must not step over the same tombstones twice
+// -----------------------------------------------------------------------------
+template <typename Balance>
+static void tombstones(size_t rounds)
+{
+    typedef AVLTree<int, avl_no_summary<int>, Balance> Tree;
+    for (size_t r = 0; r < rounds; r++) {
+        Tree tree;
+        set<int> ref;
+        tree.set_lazy_delete(true, 0.5, r % 2 == 0 ? 2 : 0);
+        if (r % 4 == 1) tree.enable_find_cache(64);
+        if (r % 4 == 2) tree.set_relayout_interval(700);
+        if (r % 4 == 3) tree.enable_bloom_filter(10);
+        const int range = 2000;
+        for (int op = 0; op < 3000; op++) {
+            int key = random_int(range), lo = key, hi = key + 30;
+            switch (random_int(24)) {
+            case 0: case 1: case 2: case 3: case 4: case 5:
+                CHECK(tree.insert(key) == ref.insert(key).second);
+                break;
+            case 6: case 7: case 8: case 9: case 10: case 11:
+                CHECK(tree.remove(key) == (ref.erase(key) == 1));
+                break;
+            case 12: case 13:
+                CHECK(tree.find(key) == (ref.count(key) == 1));
+                break;
+            case 14:
+                tree.compact(random_int(5));
+                break;
+            case 15:
+                if (ref.empty()) break;
+                CHECK(tree.pop_min() == *ref.begin());
+                ref.erase(ref.begin());
+                break;
+            case 16:
+                if (ref.empty()) break;
+                CHECK(tree.pop_max() == *ref.rbegin());
+                ref.erase(prev(ref.end()));
+                break;
+            case 17:
+                CHECK(tree.erase_range(lo, hi) == erase_between(ref, lo, hi));
+                break;
+            case 18: {
+                Tree out = tree.extract_range(lo, hi);
+                set<int> part(ref.lower_bound(lo), ref.upper_bound(hi));
+                erase_between(ref, lo, hi);
+                out.validate();
+                same_keys(out, part);
+                break;
+            }
+            case 19: {
+                vector<int> keys = random_batch(batch_size(ref.size()), range);
+                CHECK(tree.insert_batch(keys) == expected_insert(ref, keys));
+                break;
+            }
+            case 20: {
+                vector<int> keys = random_batch(batch_size(ref.size()), range);
+                CHECK(tree.erase_batch(keys) == expected_erase(ref, keys));
+                break;
+            }
+            case 21: {
+                if (random_int(20) != 0) break;
+                avl_ingest_buffers<int> buffers(3);
+                for (int i = 0; i < 300; i++) {
+                    int k = random_int(range);
+                    buffers.add(i % 3, k);
+                    ref.insert(k);
+                }
+                tree.ingest(buffers);
+                break;
+            }
+            case 22:
+                if (random_int(50) == 0) tree.relayout();
+                break;
+            default:
+                if (random_int(200) != 0) break;
+                tree.clear();
+                ref.clear();
+                break;
+            }
+            tree.validate();
+            CHECK(tree.size() == ref.size());
+            if (!ref.empty()) {
+                CHECK(tree.minimum() == *ref.begin());
+                CHECK(tree.maximum() == *ref.rbegin());
+            }
+        }
+        same_keys(tree, ref);
+
+        // the smallest keys buried: minimum() unlinks them for good, once
+        tree.compact();
+        vector<int> low(ref.begin(), ref.end());
+        low.resize(min<size_t>(low.size(), 50));
+        for (size_t i = 0; i + 1 < low.size(); i++) {
+            CHECK(tree.remove(low[i]));
+            ref.erase(low[i]);
+        }
+        if (!low.empty()) {
+            CHECK(tree.minimum() == low.back());
+            CHECK(tree.tombstones() == 0);
+            tree.validate();
+        }
+
+        tree.set_lazy_delete(false);
+        CHECK(tree.tombstones() == 0);
+        tree.validate();
+        same_keys(tree, ref);
+    }
+}
+
+static void check_lazy(size_t rounds)
+{
+    tombstones<avl_balance>(rounds);
+    tombstones<rb_balance>(rounds);
+    tombstones<wavl_balance>(rounds);
+}
+
+// -----------------------------------------------------------------------------
+// a fresh file to write to, in the temporary directory
+// -----------------------------------------------------------------------------
+static string temp_file()
+{
+    char path[] = "/tmp/avlcheck.XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) throw runtime_error("cannot create a temporary file");
+    close(fd);
+    return path;
+}
+
+// -----------------------------------------------------------------------------
+// a trace reads back as it was recorded: the commands, their arguments
+// (empty ones, binary ones and ones long enough for a multi-byte varint
+// length) and times that never go back. Then the same trace cut short at
+// every byte past the header: the reader must stop cleanly at a record
+// boundary and throw anywhere else
+// -----------------------------------------------------------------------------
+static void check_trace(size_t rounds)
+{
+    for (size_t r = 0; r < rounds; r++) {
+        string path = temp_file();
+        vector<TraceRecord> recorded;
+        vector<size_t> ends;    // the file size after each record
+        {
+            TraceWriter writer(path);
+            size_t n = 1 + random_int(200);
+            for (size_t i = 0; i < n; i++) {
+                TraceRecord rec;
+                rec.op = command_t(1 + random_int(CMD_LAST));
+                string_view args[2];
+                for (size_t a = 0; a < command_arity(rec.op); a++) {
+                    size_t len = (random_int(8) == 0) ? 128 + random_int(300)
+                                                      : random_int(12);
+                    for (size_t c = 0; c < len; c++)
+                        rec.args[a] += char(random_int(256));
+                    args[a] = rec.args[a];
+                }
+                writer.record(rec.op, args);
+                recorded.push_back(rec);
+                ifstream in(path.c_str(), ios::binary | ios::ate);
+                ends.push_back(size_t(in.tellg()));
+            }
+            CHECK(writer.records() == n);
+        }
+
+        TraceReader reader(path);
+        TraceRecord rec;
+        uint64_t time_us = 0;
+        for (size_t i = 0; i < recorded.size(); i++) {
+            CHECK(reader.next(rec));
+            CHECK(rec.op == recorded[i].op);
+            for (size_t a = 0; a < command_arity(rec.op); a++)
+                CHECK(rec.args[a] == recorded[i].args[a]);
+            CHECK(rec.time_us >= time_us);
+            time_us = rec.time_us;
+        }
+        CHECK(!reader.next(rec));
+
+        // downwards, as each cut is made on what the last one left
+        size_t header = 9;
+        for (size_t cut = ends.back(); cut-- > header; cut -= random_int(7)) {
+            CHECK(truncate(path.c_str(), off_t(cut)) == 0);
+            TraceReader cut_reader(path);
+            size_t whole = upper_bound(ends.begin(), ends.end(), cut) -
+                           ends.begin();
+            size_t read = 0;
+            bool threw = false;
+            try {
+                while (cut_reader.next(rec)) ++read;
+            } catch (const runtime_error&) {
+                threw = true;
+            }
+            CHECK(read == whole);
+            CHECK(threw == (cut != (whole == 0 ? header : ends[whole - 1])));
+        }
+        unlink(path.c_str());
+    }
+}
+
+// -----------------------------------------------------------------------------
+// the server, talking to one end of a socketpair: each turn sends a mixed
+// lot of requests, with runs of inserts and of removes that go to the tree
+// as batches, bad and blank lines, and often a last line cut short that the
+// next turn completes; all of it must be served in one turn of the loop,
+// and the responses must be what the requests give one at a time
+// -----------------------------------------------------------------------------
+static void drain(int fd, string& got)
+{
+    char buf[4096];
+    ssize_t n;
+    while ((n = recv(fd, buf, sizeof(buf), MSG_DONTWAIT)) > 0)
+        got.append(buf, n);
+}
+
+static void check_server(size_t rounds)
+{
+    for (size_t r = 0; r < rounds; r++) {
+        string path = temp_file();
+        unlink(path.c_str());
+        AVLTree<string> tree;
+        set<string> ref;
+        AVLServer server(tree, path);
+        int fds[2];
+        CHECK(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) == 0);
+        server.adopt(fds[0]);
+        int client = fds[1];
+
+        string pending, got, expected;
+        int range = 20 + random_int(200), op = 0;
+        size_t requests = 0;
+        for (int turn = 0; turn < 40; turn++) {
+            string sent = pending;
+            size_t n = 2 + random_int(200), first = requests;
+            for (size_t i = 0; i < n || requests < first + 2; i++) {
+                if (random_int(4) == 0) op = random_int(6);
+                string key = random_string(range), hi = random_string(range);
+                if (hi < key) swap(key, hi);
+                switch (op) {
+                case 0:
+                    sent += "insert " + key + "\n";
+                    expected += ref.insert(key).second ? "1\n" : "0\n";
+                    break;
+                case 1:
+                    sent += "remove\t" + key + "\r\n";
+                    expected += ref.erase(key) ? "1\n" : "0\n";
+                    break;
+                case 2:
+                    sent += "find " + key + "\n";
+                    expected += ref.count(key) ? "1\n" : "0\n";
+                    break;
+                case 3: {
+                    sent += "range " + key + "  " + hi + "\n";
+                    set<string>::iterator it = ref.lower_bound(key),
+                                          end = ref.upper_bound(hi);
+                    string keys;
+                    size_t count = 0;
+                    for (; it != end; ++it, ++count) keys += " " + *it;
+                    expected += to_string(count) + keys + "\n";
+                    break;
+                }
+                case 4:
+                    if (random_int(2) == 0) {
+                        sent += "insert\n";
+                        expected += "error expected one key\n";
+                    } else {
+                        sent += "lookup " + key + "\n";
+                        expected += "error unknown command\n";
+                    }
+                    break;
+                default:
+                    sent += (random_int(2) == 0) ? "\n" : " \t \n";
+                    continue;
+                }
+                ++requests;
+            }
+            // the last line is kept back in part, at times
+            size_t cut = sent.size();
+            if (random_int(3) == 0) {
+                size_t start = sent.rfind('\n', sent.size() - 2) + 1;
+                cut = start + random_int(int(sent.size() - start));
+            }
+            pending = sent.substr(cut);
+            CHECK(write(client, sent.data(), cut) == ssize_t(cut));
+
+            size_t turns = server.stats().turns;
+            CHECK(server.turn(1000));
+            CHECK(server.stats().turns == turns + 1);
+            drain(client, got);
+        }
+        CHECK(write(client, pending.data(), pending.size()) ==
+              ssize_t(pending.size()));
+        for (int tries = 0; got.size() < expected.size() && tries < 100;
+             tries++) {
+            server.turn(10);
+            drain(client, got);
+        }
+        CHECK(got == expected);
+        CHECK(server.stats().requests == requests);
+        CHECK(server.stats().batches > 0);
+        CHECK(server.stats().batched > server.stats().batches);
+        tree.validate();
+        same_keys(tree, ref);
+
+        CHECK(server.stats().connections == 1);
+        close(client);
+    }
+}
+
+// -----------------------------------------------------------------------------
+// the command reader, in both formats, on a pipe that is fed in pieces of
+// random size, each written once the reader has taken the last one, so that
+// lines, frame headers, varints and arguments are split across reads; the
+// buffer starts small so that it has to grow for the long arguments. A
+// binary input cut short must give its whole frames, then throw
+// -----------------------------------------------------------------------------
+struct SentCommand {
+    command_t op;
+    string    word;
+    string    args[3];
+    size_t    nargs;
+};
+
+static string random_word(bool binary)
+{
+    string w;
+    size_t len = (random_int(10) == 0) ? 100 + random_int(300)
+                                       : 1 + random_int(10);
+    for (size_t i = 0; i < len; i++)
+        w += binary ? char(random_int(256)) : char('!' + random_int(94));
+    return w;
+}
+
+static void put_varint(string& out, size_t v)
+{
+    for (; v >= 0x80; v >>= 7) out += char((v & 0x7f) | 0x80);
+    out += char(v);
+}
+
+// writes data to fd in pieces, each once the pipe is empty again
+static void feed(int fd, int read_fd, const string& data, vector<size_t> cuts)
+{
+    size_t pos = 0;
+    for (size_t i = 0; i <= cuts.size(); i++) {
+        size_t end = (i < cuts.size()) ? cuts[i] : data.size();
+        for (; pos < end; ) {
+            ssize_t n = write(fd, data.data() + pos, end - pos);
+            if (n <= 0) break;
+            pos += n;
+        }
+        int unread = 1;
+        while (ioctl(read_fd, FIONREAD, &unread) == 0 && unread > 0)
+            this_thread::yield();
+    }
+    close(fd);
+}
+
+static void check_reader(size_t rounds)
+{
+    for (size_t r = 0; r < 2 * rounds; r++) {
+        bool binary = (r % 2 == 1), cut_short = binary && random_int(2) == 0;
+        vector<SentCommand> sent(1 + random_int(300));
+        string input;
+        size_t last_frame = 0;
+        for (size_t i = 0; i < sent.size(); i++) {
+            SentCommand& c = sent[i];
+            c.op = command_t(1 + random_int(CMD_LAST));
+            c.nargs = (random_int(5) == 0) ? random_int(4)
+                                           : command_arity(c.op);
+            for (size_t a = 0; a < c.nargs; a++) c.args[a] = random_word(binary);
+            if (binary) {
+                c.word = command_name(c.op);
+                if (random_int(10) == 0) {
+                    c.op = CMD_NONE;
+                    c.word = "?";
+                }
+                string frame(1, char(c.op == CMD_NONE ? CMD_LAST + 1 : c.op));
+                for (size_t a = 0; a < c.nargs; a++) {
+                    put_varint(frame, c.args[a].size());
+                    frame += c.args[a];
+                }
+                for (int b = 0; b < 4; b++) input += char(frame.size() >> 8 * b);
+                input += frame;
+                last_frame = 4 + frame.size();
+                continue;
+            }
+            c.word = command_name(c.op);
+            if (random_int(10) == 0) {
+                c.word = random_word(false);
+                c.op = command_code(c.word);
+            }
+            if (random_int(5) == 0) input += (random_int(2) == 0) ? "\n" : " \t\n";
+            input += string(random_int(3), ' ') + c.word;
+            for (size_t a = 0; a < c.nargs; a++)
+                input += (random_int(2) == 0 ? " " : " \t ") + c.args[a];
+            if (i + 1 < sent.size() || random_int(2) == 0)
+                input += (random_int(4) == 0) ? "\r\n" : "\n";
+        }
+        if (cut_short) input.resize(input.size() - 1 - random_int(last_frame - 1));
+
+        vector<size_t> cuts;
+        for (size_t pos = random_int(20); pos < input.size();
+             pos += 1 + random_int(random_int(2) == 0 ? 8 : 500))
+            cuts.push_back(pos);
+        int fds[2];
+        CHECK(pipe(fds) == 0);
+        thread writer(feed, fds[1], fds[0], cref(input), cuts);
+
+        CommandReader reader(fds[0], binary, 64);
+        Command cmd;
+        size_t got = 0;
+        bool threw = false;
+        try {
+            for (; reader.next(cmd); got++) {
+                CHECK(got < sent.size());
+                const SentCommand& c = sent[got];
+                CHECK(cmd.op == c.op && cmd.word == c.word);
+                CHECK(cmd.nargs == c.nargs);
+                for (size_t a = 0; a < min<size_t>(c.nargs, 2); a++)
+                    CHECK(cmd.args[a] == c.args[a]);
+            }
+        } catch (const runtime_error&) {
+            threw = true;
+        }
+        writer.join();
+        close(fds[0]);
+        CHECK(threw == cut_short);
+        CHECK(got == (cut_short ? sent.size() - 1 : sent.size()));
+        CHECK(!reader.line_buffered());
+    }
+}
+
+// -----------------------------------------------------------------------------
+// the render pipeline, with its renderer held up in the middle of a frame
+// while frames and text pile up behind it: a frame published right behind
+// another one replaces it, text is merged and never dropped, and once the
+// renderer is let go cout gets everything in order. The frames are drawn
+// as [n], into a string that stands in for cout
+// -----------------------------------------------------------------------------
+static mutex              render_mu;
+static condition_variable render_cv;
+static bool               render_held, render_waiting;
+
+static void draw_marker(const RenderFrame& frame)
+{
+    unique_lock<mutex> lk(render_mu);
+    render_waiting = true;
+    render_cv.notify_all();
+    render_cv.wait(lk, [] { return !render_held; });
+    cout << "[" << frame.preorder[0] << "]";
+}
+
+static shared_ptr<const RenderFrame> marker(int n)
+{
+    shared_ptr<RenderFrame> frame(new RenderFrame);
+    frame->preorder.push_back(to_string(n));
+    return frame;
+}
+
+static void check_render(size_t rounds)
+{
+    for (size_t r = 0; r < 5 * rounds; r++) {
+        vector<string> queued;  // what the queue should hold, frames as [n]
+        size_t published = 1;
+        ostringstream out;
+        streambuf* old = cout.rdbuf(out.rdbuf());
+        RenderPipeline::Stats stats;
+        {
+            RenderPipeline pipeline(&draw_marker);
+            {
+                unique_lock<mutex> lk(render_mu);
+                render_held = true;
+                render_waiting = false;
+            }
+            pipeline.publish(marker(0));
+            {
+                unique_lock<mutex> lk(render_mu);
+                render_cv.wait(lk, [] { return render_waiting; });
+            }
+
+            int n = random_int(100);
+            for (int i = 1; i <= n; i++) {
+                if (random_int(3) == 0) {
+                    string text(random_int(4), char('a' + random_int(26)));
+                    pipeline.write(text);
+                    if (text.empty()) continue;
+                    if (!queued.empty() && queued.back()[0] != '[')
+                        queued.back() += text;
+                    else
+                        queued.push_back(text);
+                } else {
+                    pipeline.publish(marker(i));
+                    ++published;
+                    string frame = "[" + to_string(i) + "]";
+                    if (!queued.empty() && queued.back()[0] == '[')
+                        queued.back() = frame;
+                    else
+                        queued.push_back(frame);
+                }
+            }
+            {
+                unique_lock<mutex> lk(render_mu);
+                render_held = false;
+            }
+            render_cv.notify_all();
+            pipeline.close();
+            stats = pipeline.stats();
+        }
+        cout.rdbuf(old);
+
+        string expected = "[0]";
+        size_t frames = 1;
+        for (size_t i = 0; i < queued.size(); i++) {
+            expected += queued[i];
+            if (queued[i][0] == '[') ++frames;
+        }
+        CHECK(out.str() == expected);
+        CHECK(stats.published == published);
+        CHECK(stats.rendered == frames);
+        CHECK(stats.dropped == published - frames);
+    }
+}
+
+// -----------------------------------------------------------------------------
+// the diagnostics: random reports of random kinds, with a random threshold,
+// burst and buffer, against a model of what is counted, shown and held
+// back. The rate is set so low that no token comes back during a round,
+// except in the last check, which waits for one and looks for the note of
+// how many were held back. Each message carries "@kind@" as its detail so
+// that the output can be counted per kind
+// -----------------------------------------------------------------------------
+static const Diagnostics::Severity SEVERITY[Diagnostics::KINDS] = {
+    Diagnostics::NOTE, Diagnostics::NOTE, Diagnostics::NOTE,
+    Diagnostics::WARNING, Diagnostics::ERROR, Diagnostics::ERROR
+};
+static const char* const PLURAL[Diagnostics::KINDS] = {
+    "duplicate-key inserts", "removes of missing keys",
+    "min/max queries on an empty tree", "commands missing arguments",
+    "unknown commands", "failed commands"
+};
+
+static size_t occurrences(const string& text, const string& what)
+{
+    size_t n = 0;
+    for (size_t pos = text.find(what); pos != string::npos;
+         pos = text.find(what, pos + 1))
+        ++n;
+    return n;
+}
+
+static string with_commas(uint64_t n)
+{
+    string digits = to_string(n), s;
+    for (size_t i = 0; i < digits.size(); i++) {
+        if (i > 0 && (digits.size() - i) % 3 == 0) s += ',';
+        s += digits[i];
+    }
+    return s;
+}
+
+static void check_diagnostics(size_t rounds)
+{
+    for (size_t r = 0; r < rounds; r++) {
+        ostringstream out;
+        Diagnostics diag(out, 64 + random_int(4096));
+        Diagnostics::Severity threshold = Diagnostics::Severity(random_int(4));
+        size_t burst = (r % 2 == 0) ? 1 + random_int(50) : 0;
+        diag.set_threshold(threshold);
+        if (burst > 0) diag.set_rate_limit(1e-6, burst);
+
+        uint64_t counts[Diagnostics::KINDS] = {}, shown[Diagnostics::KINDS] = {};
+        bool enabled = true;
+        int n = random_int(3000);
+        for (int i = 0; i < n; i++) {
+            if (random_int(500) == 0) {
+                enabled = !enabled;
+                diag.set_enabled(enabled);
+            }
+            int k = (random_int(2) == 0) ? 0 : random_int(Diagnostics::KINDS);
+            diag.report(Diagnostics::Kind(k), "@" + to_string(k) + "@");
+            if (enabled) {
+                ++counts[k];
+                if (SEVERITY[k] >= threshold && (burst == 0 || shown[k] < burst))
+                    ++shown[k];
+            }
+            CHECK(diag.count(Diagnostics::Kind(k)) == counts[k]);
+            CHECK(diag.shown(Diagnostics::Kind(k)) == shown[k]);
+            // buffered: out only gets whole messages, and none too many
+            CHECK(occurrences(out.str(), "@" + to_string(k) + "@") <= shown[k]);
+        }
+        diag.set_enabled(true);
+        diag.flush();
+        string text = out.str();
+        bool all_shown = true;
+        for (int k = 0; k < Diagnostics::KINDS; k++) {
+            CHECK(occurrences(text, "@" + to_string(k) + "@") == shown[k]);
+            all_shown &= (shown[k] == counts[k]);
+        }
+        CHECK(occurrences(text, "not shown") == 0);
+
+        diag.summarize();
+        string summary = out.str().substr(text.size());
+        CHECK(summary.empty() == all_shown);
+        for (int k = 0; k < Diagnostics::KINDS && !all_shown; k++) {
+            Diagnostics::Kind kind = Diagnostics::Kind(k);
+            string line = "\n" + with_commas(counts[k]) + " " + PLURAL[k];
+            size_t at = summary.find(line);
+            CHECK((at != string::npos) == (counts[k] > 0));
+            if (counts[k] == 0) continue;
+            size_t end = summary.find('\n', at + 1);
+            bool partly = summary.substr(at, end - at).find(", " +
+                with_commas(shown[k]) + " shown") != string::npos;
+            CHECK(partly == (diag.shown(kind) < diag.count(kind)));
+        }
+    }
+
+    // a token comes back after 1/per_second; the message it lets through
+    // says how many were held back in the meantime
+    ostringstream out;
+    Diagnostics diag(out);
+    diag.set_rate_limit(20, 2);
+    for (int i = 0; i < 7; i++) diag.report(Diagnostics::MISSING_REMOVE, "k");
+    CHECK(diag.shown(Diagnostics::MISSING_REMOVE) == 2);
+    this_thread::sleep_for(chrono::milliseconds(60));
+    diag.report(Diagnostics::MISSING_REMOVE, "k");
+    diag.flush();
+    CHECK(diag.shown(Diagnostics::MISSING_REMOVE) == 3);
+    CHECK(occurrences(out.str(), "(5 more removes of missing keys not shown)")
+          == 1);
+}
+
+// -----------------------------------------------------------------------------
+// the DOT and SVG exports, byte for byte against a recursive reference. The
+// reference rebuilds the shape from preorder_sequence() and
+// inorder_sequence(), which give each node as key(balance), with a ~ for a
+// tombstone, and writes each node after its subtrees, as the exports do.
+// The trees hold tombstones half of the time and grow big enough to fill
+// the export buffer several times; the string keys need escaping
+// -----------------------------------------------------------------------------
+struct ShapeNode {
+    string key, balance;
+    bool   dead;
+    size_t depth, size;
+    long   left, right;   // ranks, -1 for none
+};
+
+// the subtree of pre[pre_at, ...) whose keys are in ranks [lo, hi); returns
+// the rank of its root
+static long rebuild(const vector<string>& pre, size_t& pre_at,
+                    const map<string, size_t>& rank_of, size_t lo, size_t hi,
+                    size_t depth, vector<ShapeNode>& nodes)
+{
+    if (lo == hi) return -1;
+    const string& s = pre[pre_at++];
+    size_t open = s.rfind('(');
+    size_t rank = rank_of.find(s.substr(0, open))->second;
+    CHECK(lo <= rank && rank < hi);
+    ShapeNode& n = nodes[rank];
+    n.key = s.substr(0, open);
+    n.dead = (s[s.size() - 1] == '~');
+    n.balance = s.substr(open + 1, s.size() - open - (n.dead ? 3 : 2));
+    n.depth = depth;
+    n.size = hi - lo;
+    n.left = rebuild(pre, pre_at, rank_of, lo, rank, depth + 1, nodes);
+    n.right = rebuild(pre, pre_at, rank_of, rank + 1, hi, depth + 1, nodes);
+    return long(rank);
+}
+
+static string dot_escaped(const string& key)
+{
+    string s;
+    for (size_t i = 0; i < key.size(); i++) {
+        if (key[i] == '"' || key[i] == '\\') s += '\\';
+        if (key[i] == '\n') s += "\\n";
+        else s += key[i];
+    }
+    return s;
+}
+
+static string svg_escaped(const string& key)
+{
+    string s;
+    for (size_t i = 0; i < key.size(); i++) {
+        switch (key[i]) {
+        case '<': s += "&lt;";   break;
+        case '>': s += "&gt;";   break;
+        case '&': s += "&amp;";  break;
+        case '"': s += "&quot;"; break;
+        default:  s += key[i];
+        }
+    }
+    return s;
+}
+
+static void dot_reference(const vector<ShapeNode>& nodes, long rank,
+                          bool sizes, string& out)
+{
+    if (rank < 0) return;
+    const ShapeNode& n = nodes[rank];
+    dot_reference(nodes, n.left, sizes, out);
+    dot_reference(nodes, n.right, sizes, out);
+    string r = to_string(rank);
+    out += "  n" + r + " [label=\"" + dot_escaped(n.key) + "\\nb=" + n.balance;
+    if (sizes) out += " n=" + to_string(n.size);
+    out += "\"";
+    if (n.dead) out += ", style=dashed";
+    out += "];\n";
+    if (n.left < 0 && n.right < 0) return;
+    long kids[2] = {n.left, n.right};
+    for (int i = 0; i < 2; i++) {
+        string side = (i == 0) ? "l" : "r";
+        if (kids[i] >= 0)
+            out += "  n" + r + " -> n" + to_string(kids[i]) + ";\n";
+        else
+            out += "  n" + r + " -> n" + r + side + " [style=invis];\n  n" +
+                   r + side + " [style=invis];\n";
+    }
+}
+
+static void svg_reference(const vector<ShapeNode>& nodes, long rank,
+                          bool sizes, string& out)
+{
+    const long DX = 40, DY = 56, R = 15, MARGIN = 24;
+    if (rank < 0) return;
+    const ShapeNode& n = nodes[rank];
+    svg_reference(nodes, n.left, sizes, out);
+    svg_reference(nodes, n.right, sizes, out);
+    long x = MARGIN + rank * DX, y = MARGIN + long(n.depth) * DY;
+    long kids[2] = {n.left, n.right};
+    for (int i = 0; i < 2; i++) {
+        if (kids[i] < 0) continue;
+        double dx = double(MARGIN + kids[i] * DX - x), dy = DY;
+        double len = sqrt(dx * dx + dy * dy);
+        long ox = lround(dx * R / len), oy = lround(dy * R / len);
+        out += "<line x1=\"" + to_string(x + ox) + "\" y1=\"" +
+               to_string(y + oy) + "\" x2=\"" +
+               to_string(MARGIN + kids[i] * DX - ox) + "\" y2=\"" +
+               to_string(y + DY - oy) + "\"/>\n";
+    }
+    out += "<g><title>" + svg_escaped(n.key) + ": balance " + n.balance;
+    if (sizes) out += ", size " + to_string(n.size);
+    out += "</title><circle cx=\"" + to_string(x) + "\" cy=\"" + to_string(y) +
+           "\" r=\"" + to_string(R) + "\"";
+    if (n.dead) out += " class=\"dead\"";
+    out += "/><text x=\"" + to_string(x) + "\" y=\"" + to_string(y + 3) +
+           "\">" + svg_escaped(n.key) + "</text><text class=\"b\" x=\"" +
+           to_string(x) + "\" y=\"" + to_string(y + R + 9) + "\">" + n.balance;
+    if (sizes) out += "/" + to_string(n.size);
+    out += "</text></g>\n";
+}
+
+template <typename Tree>
+static void same_exports(Tree& tree)
+{
+    vector<string> pre = tree.preorder_sequence();
+    vector<string> in = tree.inorder_sequence();
+    map<string, size_t> rank_of;
+    for (size_t i = 0; i < in.size(); i++)
+        rank_of[in[i].substr(0, in[i].rfind('('))] = i;
+    CHECK(rank_of.size() == in.size() && pre.size() == in.size());
+    vector<ShapeNode> nodes(in.size());
+    size_t pre_at = 0, rows = 0;
+    long root = rebuild(pre, pre_at, rank_of, 0, in.size(), 0, nodes);
+    for (size_t i = 0; i < nodes.size(); i++)
+        rows = max(rows, nodes[i].depth + 1);
+
+    bool sizes = (random_int(2) == 0);
+    string dot = "digraph avl {\n  graph [ordering=out];\n"
+                 "  node [shape=ellipse, fontname=\"monospace\"];\n";
+    dot_reference(nodes, root, sizes, dot);
+    dot += "}\n";
+    ostringstream dot_out;
+    tree.export_dot(dot_out, sizes);
+    CHECK(dot_out.str() == dot);
+
+    long width = 48 + long(in.empty() ? 0 : in.size() - 1) * 40;
+    long height = 48 + long(rows > 0 ? rows - 1 : 0) * 56 + 15;
+    string svg = "<svg xmlns=\"http://www.w3.org/2000/svg\" width=\"" +
+                 to_string(width) + "\" height=\"" + to_string(height) +
+                 "\">\n<style>"
+                 "circle{fill:#fff;stroke:#000}"
+                 "circle.dead{stroke-dasharray:3 2}"
+                 "circle.bad{stroke:red;stroke-width:2}"
+                 "line{stroke:#888}"
+                 "text{font:10px monospace;text-anchor:middle}"
+                 "text.b{font-size:8px;fill:#666}</style>\n";
+    svg_reference(nodes, root, sizes, svg);
+    svg += "</svg>\n";
+    ostringstream svg_out;
+    tree.export_svg(svg_out, sizes);
+    CHECK(svg_out.str() == svg);
+}
+
+template <typename Balance>
+static void exports(size_t rounds)
+{
+    for (size_t r = 0; r < rounds; r++) {
+        AVLTree<int, avl_no_summary<int>, Balance> tree;
+        if (r % 2 == 1) tree.set_lazy_delete(true, 0.5);
+        int range = 10 + random_int(8000);
+        same_exports(tree);
+        for (int step = 0; step < 8; step++) {
+            for (int i = random_int(range / 2); i > 0; i--) {
+                if (random_int(3) == 0) tree.remove(random_int(range));
+                else tree.insert(random_int(range) - range / 2);
+            }
+            same_exports(tree);
+        }
+    }
+
+    const char* odd = "\"\\<>&\n x";
+    AVLTree<string, avl_no_summary<string>, Balance> tree;
+    for (size_t i = 0; i < 300; i++) {
+        string key;
+        for (int c = random_int(6); c >= 0; c--) key += odd[random_int(9)];
+        tree.insert(key);
+    }
+    same_exports(tree);
+}
+
+static void check_export(size_t rounds)
+{
+    exports<avl_balance>(rounds);
+    exports<rb_balance>(rounds);
+    exports<wavl_balance>(rounds);
+}
+
+// -----------------------------------------------------------------------------
+// MappedAVLTree in a scratch file: transactions that are committed or
+// rolled back, sessions that end with changes never committed, and a
+// reopen that must find the last commit
+// -----------------------------------------------------------------------------
+static void check_mapped(size_t rounds)
+{
+    string path = temp_file();
+    const size_t extent = size_t(1) << 20, reserve = size_t(1) << 28;
+    for (size_t r = 0; r < rounds; r++) {
+        unlink(path.c_str());
+        set<int> committed;
+        int range = 10 + random_int(3000);
+        for (int session = 0; session < 3; session++) {
+            MappedAVLTree<int> tree(path, false, extent, reserve);
+            same_keys(tree, committed);
+            tree.set_autocommit(session == 0);
+            set<int> ref = committed;
+            for (int op = 0; op < 800; op++) {
+                int key = random_int(range);
+                switch (random_int(10)) {
+                case 0: case 1: case 2: case 3:
+                    CHECK(tree.insert(key) == ref.insert(key).second);
+                    break;
+                case 4: case 5: case 6:
+                    CHECK(tree.remove(key) == (ref.erase(key) == 1));
+                    break;
+                case 7:
+                    CHECK(tree.find(key) == (ref.count(key) == 1));
+                    break;
+                case 8:
+                    tree.commit();
+                    committed = ref;
+                    break;
+                default:
+                    tree.rollback();
+                    ref = committed;
+                    break;
+                }
+                if (session == 0) committed = ref;
+                if (!ref.empty()) {
+                    CHECK(tree.minimum() == *ref.begin());
+                    CHECK(tree.maximum() == *ref.rbegin());
+                }
+            }
+            same_keys(tree, ref);
+        }
+        MappedAVLTree<int> tree(path, false, extent, reserve);
+        same_keys(tree, committed);
+    }
+    unlink(path.c_str());
+}
+
+// -----------------------------------------------------------------------------
+// ingest from buffers filled by threads of their own, into a tree that
+// already holds keys; every other round the tree deletes lazily, and the
+// keys removed before each pass leave tombstones for ingest to revive or
+// leave out
+// -----------------------------------------------------------------------------
+static void check_ingest(size_t rounds)
+{
+    for (size_t r = 0; r < rounds; r++) {
+        AVLTree<int> tree;
+        set<int> ref;
+        if (r % 2 == 1) tree.set_lazy_delete(true, 0.9);
+        int range = 100 + random_int(100000);
+        vector<int> keys = random_batch(random_int(20000), range);
+        CHECK(tree.insert_batch(keys) == expected_insert(ref, keys));
+        for (int pass = 0; pass < 3; pass++) {
+            keys = random_batch(random_int(5000), range);
+            CHECK(tree.erase_batch(keys) == expected_erase(ref, keys));
+            size_t nthreads = 1 + random_int(6);
+            avl_ingest_buffers<int> buffers(nthreads);
+            vector<vector<int> > parts(nthreads);
+            for (size_t t = 0; t < nthreads; t++)
+                parts[t] = random_batch(random_int(10000), range);
+            vector<thread> producers;
+            for (size_t t = 0; t < nthreads; t++)
+                producers.push_back(thread([&buffers, &parts, t]() {
+                    for (size_t i = 0; i < parts[t].size(); i++)
+                        buffers.add(t, parts[t][i]);
+                }));
+            for (size_t t = 0; t < nthreads; t++) producers[t].join();
+
+            size_t before = ref.size();
+            for (size_t t = 0; t < nthreads; t++)
+                ref.insert(parts[t].begin(), parts[t].end());
+            CHECK(tree.ingest(buffers) == ref.size() - before);
+            CHECK(buffers.size() == 0);
+            tree.validate();
+            same_keys(tree, ref);
+        }
+    }
+}
+
+// -----------------------------------------------------------------------------
+// the traversal toolkit of BTree.h on BTNode trees of random shape, lopsided
+// and degenerate ones included: each walk, with each kind of visitor, gives
+// what a recursive walk gives, and leaves every pointer as it was; so does
+// a walk whose visitor throws halfway, which must then rethrow. clear_tree
+// must hand every node to free exactly once
+// -----------------------------------------------------------------------------
+typedef BTNode<int> IntNode;
+
+// n nodes, numbered from next in preorder; lean is the odds out of 8 that
+// a node's nodes go to one side only
+static IntNode* random_shape(size_t n, int& next, int lean)
+{
+    if (n == 0) return NULL;
+    IntNode* node = new IntNode(next++);
+    size_t left = random_int(int(n));
+    if (random_int(8) < lean) left = (random_int(2) == 0) ? 0 : n - 1;
+    node->left = random_shape(left, next, lean);
+    node->right = random_shape(n - 1 - left, next, lean);
+    return node;
+}
+
+static void walk_reference(IntNode* node, size_t depth, vector<int>& pre,
+                           vector<int>& in, vector<int>& post,
+                           vector<vector<int> >& levels)
+{
+    if (node == NULL) return;
+    if (levels.size() == depth) levels.push_back(vector<int>());
+    levels[depth].push_back(node->payload);
+    pre.push_back(node->payload);
+    walk_reference(node->left, depth + 1, pre, in, post, levels);
+    in.push_back(node->payload);
+    walk_reference(node->right, depth + 1, pre, in, post, levels);
+    post.push_back(node->payload);
+}
+
+// the tree's pointers, in preorder
+static void snapshot(IntNode* node, vector<IntNode*>& v)
+{
+    if (node == NULL) return;
+    v.push_back(node);
+    v.push_back(node->left);
+    v.push_back(node->right);
+    snapshot(node->left, v);
+    snapshot(node->right, v);
+}
+
+struct StopAt {
+    size_t left;
+    vector<int>* seen;
+    void operator()(int value) {
+        if (left-- == 0) throw runtime_error("stop");
+        seen->push_back(value);
+    }
+};
+
+// the same walk three ways, and once stopped by a throw after 'stop' nodes
+template <typename Walk>
+static void same_walk(IntNode* root, Walk walk, const vector<int>& expected,
+                      const vector<IntNode*>& shape)
+{
+    vector<int> by_node, by_value, by_iterator, seen;
+    walk(root, [&by_node](IntNode* node) { by_node.push_back(node->payload); });
+    walk(root, [&by_value](int value) { by_value.push_back(value); });
+    walk(root, back_inserter(by_iterator));
+    CHECK(by_node == expected && by_value == expected &&
+          by_iterator == expected);
+
+    StopAt stop = { size_t(random_int(int(expected.size()) + 1)), &seen };
+    bool threw = false;
+    try {
+        walk(root, stop);
+    } catch (const runtime_error&) {
+        threw = true;
+    }
+    CHECK(threw == (stop.left < expected.size()));
+    CHECK(equal(seen.begin(), seen.end(), expected.begin()));
+
+    vector<IntNode*> after;
+    snapshot(root, after);
+    CHECK(after == shape);
+}
+
+static void check_traversal(size_t rounds)
+{
+    bt_level_queue<IntNode> queue;
+    for (size_t r = 0; r < 5 * rounds; r++) {
+        int next = 0;
+        size_t n = (r % 5 == 0) ? random_int(3) : random_int(1500);
+        IntNode* root = random_shape(n, next, random_int(9));
+        vector<int> pre, in, post, level;
+        vector<vector<int> > levels;
+        walk_reference(root, 0, pre, in, post, levels);
+        for (size_t d = 0; d < levels.size(); d++)
+            level.insert(level.end(), levels[d].begin(), levels[d].end());
+        vector<IntNode*> shape;
+        snapshot(root, shape);
+
+        same_walk(root, [](IntNode* t, auto f) { return bt_inorder(t, f); },
+                  in, shape);
+        same_walk(root, [](IntNode* t, auto f) { return bt_preorder(t, f); },
+                  pre, shape);
+        same_walk(root, [](IntNode* t, auto f) { return bt_postorder(t, f); },
+                  post, shape);
+        same_walk(root, [&queue](IntNode* t, auto f) {
+                      return bt_levelorder(t, f, queue);
+                  }, level, shape);
+
+        // the queue keeps its space; a walk no wider than the last needs
+        // no more of it
+        size_t capacity = queue.capacity();
+        bt_levelorder(root, [](IntNode*) {}, queue);
+        CHECK(queue.capacity() == capacity);
+
+        set<IntNode*> freed;
+        clear_tree(root, [&freed](IntNode* node) {
+            CHECK(freed.insert(node).second);
+            delete node;
+        });
+        CHECK(root == NULL && freed.size() == n);
+    }
+}
+
+// -----------------------------------------------------------------------------
+// bounded mode against a model of it: what is evicted is the smallest key,
+// the largest, or the one inserted longest ago, a batch joining in key order
+// and evicting once it is in. With lazy deletion on as well, only the bound
+// and the invariants are checked. Only the trees with avl_insertion_order
+// may evict the oldest key, and their nodes are two pointers bigger
+// -----------------------------------------------------------------------------
+struct BoundedModel {
+    set<int> keys;
+    map<int, long> when;    // key -> its insertion
+    map<long, int> order;   // insertion -> key
+    long clock;
+    size_t capacity;
+    avl_evict_policy policy;
+    size_t evictions;
+
+    BoundedModel(size_t cap, avl_evict_policy p)
+    : clock(0), capacity(cap), policy(p), evictions(0) {}
+
+    bool insert(int key) {
+        if (!keys.insert(key).second) return false;
+        when[key] = clock;
+        order[clock++] = key;
+        return true;
+    }
+    bool remove(int key) {
+        if (keys.erase(key) == 0) return false;
+        order.erase(when[key]);
+        when.erase(key);
+        return true;
+    }
+    void evict() {
+        while (keys.size() > capacity) {
+            if (policy == AVL_EVICT_MIN) remove(*keys.begin());
+            else if (policy == AVL_EVICT_MAX) remove(*keys.rbegin());
+            else remove(order.begin()->second);
+            ++evictions;
+        }
+    }
+};
+
+typedef AVLTree<int, avl_no_summary<int>, avl_balance,
+                avl_insertion_order> OrderedIntTree;
+
+template <typename Tree>
+static void bounded(avl_evict_policy policy)
+{
+    Tree tree;
+    size_t capacity = 1 + random_int(300);
+    int range = 10 + random_int(3000);
+    BoundedModel model(capacity, policy);
+    tree.set_capacity(capacity, 0, policy);
+    for (int op = 0; op < 1500; op++) {
+        int key = random_int(range);
+        switch (random_int(6)) {
+        case 0: case 1:
+            CHECK(tree.insert(key) == model.insert(key));
+            model.evict();
+            break;
+        case 2:
+            CHECK(tree.remove(key) == model.remove(key));
+            break;
+        case 3: {
+            vector<int> keys = random_batch(random_int(100), range);
+            vector<bool> want(keys.size());
+            set<int> fresh;
+            for (size_t i = 0; i < keys.size(); i++)
+                want[i] = !model.keys.count(keys[i]) &&
+                          fresh.insert(keys[i]).second;
+            for (set<int>::iterator it = fresh.begin(); it != fresh.end(); ++it)
+                model.insert(*it);
+            model.evict();
+            CHECK(tree.insert_batch(keys) == want);
+            break;
+        }
+        case 4: {
+            vector<int> keys = random_batch(random_int(100), range);
+            vector<bool> want(keys.size());
+            for (size_t i = 0; i < keys.size(); i++)
+                want[i] = model.remove(keys[i]);
+            CHECK(tree.erase_batch(keys) == want);
+            break;
+        }
+        default: {
+            int hi = key + random_int(50);
+            vector<int> gone(model.keys.lower_bound(key),
+                             model.keys.upper_bound(hi));
+            for (size_t i = 0; i < gone.size(); i++) model.remove(gone[i]);
+            CHECK(tree.erase_range(key, hi) == gone.size());
+            break;
+        }
+        }
+        tree.validate();
+        CHECK(tree.bound_stats().nodes <= capacity);
+        CHECK(tree.bound_stats().evictions == model.evictions);
+        same_keys(tree, model.keys);
+    }
+
+    // tombstones count as nodes and are compacted before a live key goes
+    Tree lazy;
+    lazy.set_lazy_delete(true, 0.5, 0);
+    lazy.set_capacity(capacity, 0, policy);
+    for (int op = 0; op < 3000; op++) {
+        int key = random_int(1000);
+        if (random_int(2) == 0) lazy.insert(key);
+        else lazy.remove(key);
+        lazy.validate();
+        CHECK(lazy.bound_stats().nodes <= capacity);
+    }
+    lazy.set_capacity(0);
+    lazy.validate();
+}
+
+static void check_bounded(size_t rounds)
+{
+    for (size_t r = 0; r < rounds; r++) {
+        bounded<AVLTree<int> >(AVL_EVICT_MIN);
+        bounded<AVLTree<int> >(AVL_EVICT_MAX);
+        bounded<OrderedIntTree>(AVL_EVICT_MIN);
+        bounded<OrderedIntTree>(AVL_EVICT_OLDEST);
+
+        bool threw = false;
+        AVLTree<int> plain;
+        try {
+            plain.set_capacity(10, 0, AVL_EVICT_OLDEST);
+        } catch (const runtime_error&) {
+            threw = true;
+        }
+        CHECK(threw && plain.bound_stats().evictions == 0);
+
+        // the same keys, with and without the insertion order
+        OrderedIntTree ordered;
+        plain.set_capacity(1000);
+        ordered.set_capacity(1000);
+        for (int i = 0; i < 500; i++) {
+            int key = random_int(2000);
+            CHECK(plain.insert(key) == ordered.insert(key));
+        }
+        CHECK(ordered.bound_stats().bytes - plain.bound_stats().bytes ==
+              2 * sizeof(void*) * plain.size());
+    }
+}
+
+// -----------------------------------------------------------------------------
+// the van Emde Boas relayout, by hand and on an interval, with the tree
+// updated in between: nodes leave the block one at a time, in batches and
+// in ranges, or as tombstones; right after a relayout every node is in the
+// block. A bounded tree that evicts its oldest keys is relaid out as well,
+// since its insertion order has to follow the nodes into the block
+// -----------------------------------------------------------------------------
+template <typename Balance>
+static void relayouts(size_t rounds)
+{
+    for (size_t r = 0; r < rounds; r++) {
+        AVLTree<int, avl_no_summary<int>, Balance> tree;
+        set<int> ref;
+        if (r % 2 == 1) tree.set_relayout_interval(500);
+        if (r % 3 == 2) tree.set_lazy_delete(true, 0.5);
+        int range = 100 + random_int(5000);
+        for (int op = 0; op < 2000; op++) {
+            int key = random_int(range);
+            vector<int> keys = random_batch(batch_size(ref.size()), range);
+            switch (random_int(12)) {
+            case 0: case 1: case 2: case 3:
+                CHECK(tree.insert(key) == ref.insert(key).second);
+                break;
+            case 4: case 5:
+                CHECK(tree.remove(key) == (ref.erase(key) == 1));
+                break;
+            case 6: case 7:
+                CHECK(tree.find(key) == (ref.count(key) == 1));
+                break;
+            case 8:
+                CHECK(tree.insert_batch(keys) == expected_insert(ref, keys));
+                break;
+            case 9:
+                CHECK(tree.erase_batch(keys) == expected_erase(ref, keys));
+                break;
+            case 10: {
+                int hi = key + random_int(range / 20 + 1);
+                CHECK(tree.erase_range(key, hi) == erase_between(ref, key, hi));
+                break;
+            }
+            default:
+                if (random_int(10) == 0) {
+                    tree.relayout();
+                    CHECK(tree.block_nodes() == ref.size());
+                }
+                break;
+            }
+            tree.validate();
+            // a tombstone dropped from the tree keeps its slot until the
+            // graveyard is compacted
+            if (r % 3 != 2) CHECK(tree.block_nodes() <= ref.size());
+        }
+        same_keys(tree, ref);
+    }
+
+    OrderedIntTree bounded;
+    BoundedModel model(200, AVL_EVICT_OLDEST);
+    bounded.set_capacity(200);
+    for (int op = 0; op < 3000; op++) {
+        int key = random_int(1000);
+        if (random_int(3) == 0) {
+            CHECK(bounded.remove(key) == model.remove(key));
+        } else {
+            CHECK(bounded.insert(key) == model.insert(key));
+            model.evict();
+        }
+        if (random_int(50) == 0) bounded.relayout();
+        bounded.validate();
+        same_keys(bounded, model.keys);
+    }
+}
+
+static void check_relayout(size_t rounds)
+{
+    relayouts<avl_balance>(rounds);
+    relayouts<rb_balance>(rounds);
+    relayouts<wavl_balance>(rounds);
+}
+
+// -----------------------------------------------------------------------------
+// BPlusTree with the default nodes and with the smallest, so that splits,
+// borrows and merges happen a few keys apart; halfway through, the tree is
+// moved to another, and once more by assignment. Then string keys, which
+// the nodes copy around as they split and merge
+// -----------------------------------------------------------------------------
+template <typename Tree>
+static void bplus(size_t rounds)
+{
+    for (size_t r = 0; r < rounds; r++) {
+        Tree tree;
+        set<int> ref;
+        int range = 10 + random_int(5000);
+        for (int op = 0; op < 3000; op++) {
+            int key = random_int(range), hi = key + random_int(100);
+            vector<int> seen;
+            switch (random_int(8)) {
+            case 0: case 1: case 2:
+                CHECK(tree.insert(key) == ref.insert(key).second);
+                break;
+            case 3: case 4:
+                CHECK(tree.remove(key) == (ref.erase(key) == 1));
+                break;
+            case 5:
+                CHECK(tree.find(key) == (ref.count(key) == 1));
+                break;
+            case 6:
+                CHECK(tree.for_range(key, hi, [&seen](const int& k) {
+                    seen.push_back(k);
+                }) == seen.size());
+                CHECK(seen == vector<int>(ref.lower_bound(key),
+                                          ref.upper_bound(hi)));
+                break;
+            default: {
+                typename Tree::const_iterator it = tree.lower_bound(key);
+                set<int>::iterator want = ref.lower_bound(key);
+                for (int i = 0; i < 5 && want != ref.end(); i++, ++it, ++want)
+                    CHECK(it != tree.end() && *it == *want);
+                if (want == ref.end()) CHECK(it == tree.end());
+                break;
+            }
+            }
+            CHECK(tree.size() == ref.size());
+            if (!ref.empty()) {
+                CHECK(tree.minimum() == *ref.begin());
+                CHECK(tree.maximum() == *ref.rbegin());
+            }
+        }
+        same_keys(tree, ref);
+        CHECK(vector<int>(tree.begin(), tree.end()) ==
+              vector<int>(ref.begin(), ref.end()));
+
+        Tree moved(std::move(tree));
+        CHECK(tree.empty() && tree.begin() == tree.end());
+        tree = std::move(moved);
+        CHECK(moved.empty() && tree.size() == ref.size());
+        same_keys(tree, ref);
+
+        tree.clear();
+        CHECK(tree.empty() && tree.begin() == tree.end() && tree.bytes() == 0);
+        bool threw = false;
+        try {
+            tree.minimum();
+        } catch (const runtime_error&) {
+            threw = true;
+        }
+        CHECK(threw);
+    }
+}
+
+static void check_bplus(size_t rounds)
+{
+    bplus<BPlusTree<int> >(rounds);
+    bplus<BPlusTree<int, 32> >(rounds);
+
+    for (size_t r = 0; r < rounds; r++) {
+        BPlusTree<string, 128> tree;
+        set<string> ref;
+        int range = 10 + random_int(2000);
+        for (int op = 0; op < 3000; op++) {
+            string key = random_string(range);
+            switch (random_int(4)) {
+            case 0: case 1:
+                CHECK(tree.insert(key) == ref.insert(key).second);
+                break;
+            case 2:
+                CHECK(tree.remove(key) == (ref.erase(key) == 1));
+                break;
+            default:
+                CHECK(tree.find(key) == (ref.count(key) == 1));
+                break;
+            }
+        }
+        same_keys(tree, ref);
+    }
+}
+
+// -----------------------------------------------------------------------------
+// batched lookups against single ones: batches a key short of a lockstep
+// group, a whole one and a key over, empty and single ones, sorted or not and
+// with repeated keys, on trees with tombstones, a find cache or a Bloom
+// filter in the way, then on string keys
+// -----------------------------------------------------------------------------
+static size_t lookup_size(size_t tree_size)
+{
+    static const size_t edges[] = { 0, 1, AVL_FIND_GROUP - 1, AVL_FIND_GROUP,
+                                    AVL_FIND_GROUP + 1, 2 * AVL_FIND_GROUP,
+                                    2 * AVL_FIND_GROUP + 1 };
+    if (random_int(2) == 0) return edges[random_int(7)];
+    return batch_size(tree_size);
+}
+
+template <typename Key>
+static void same_lookups(AVLTree<Key>& tree, const set<Key>& ref,
+                         const vector<Key>& keys)
+{
+    vector<bool> got;
+    tree.find_batch(keys, got);
+    CHECK(got.size() == keys.size());
+    for (size_t i = 0; i < keys.size(); i++) {
+        CHECK(got[i] == (ref.count(keys[i]) == 1));
+        CHECK(got[i] == tree.find(keys[i]));
+    }
+}
+
+static void check_lookups(size_t rounds)
+{
+    for (size_t r = 0; r < rounds; r++) {
+        AVLTree<int> tree;
+        set<int> ref;
+        if (r % 4 == 1) tree.set_lazy_delete(true, 0.5);
+        if (r % 4 == 2) tree.enable_find_cache(64);
+        if (r % 4 == 3) tree.enable_bloom_filter(r % 8 == 3 ? 2 : 10);
+        int range = 1 + random_int(5000);
+        for (int op = 0; op < 300; op++) {
+            vector<int> keys = random_batch(lookup_size(ref.size()), range);
+            switch (random_int(5)) {
+            case 0:
+                CHECK(tree.insert_batch(keys) == expected_insert(ref, keys));
+                break;
+            case 1:
+                CHECK(tree.erase_batch(keys) == expected_erase(ref, keys));
+                break;
+            case 2: {
+                int key = random_int(range);
+                CHECK(tree.remove(key) == (ref.erase(key) == 1));
+                break;
+            }
+            default:
+                if (random_int(2) == 0) sort(keys.begin(), keys.end());
+                same_lookups(tree, ref, keys);
+                break;
+            }
+            tree.validate();
+        }
+        same_keys(tree, ref);
+    }
+
+    for (size_t r = 0; r < rounds; r++) {
+        AVLTree<string> tree;
+        set<string> ref;
+        if (r % 2 == 1) tree.enable_bloom_filter();
+        int range = 10 + random_int(2000);
+        for (int op = 0; op < 100; op++) {
+            vector<string> keys(lookup_size(ref.size()));
+            for (size_t i = 0; i < keys.size(); i++)
+                keys[i] = random_string(range);
+            if (random_int(3) == 0) {
+                for (size_t i = 0; i < keys.size(); i++)
+                    CHECK(tree.insert(keys[i]) == ref.insert(keys[i]).second);
+            } else {
+                if (random_int(2) == 0) sort(keys.begin(), keys.end());
+                same_lookups(tree, ref, keys);
+            }
+        }
+        tree.validate();
+        same_keys(tree, ref);
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    map<string, suite_t> suites;
+    suites["updates"]  = &check_updates;
+    suites["batch"]    = &check_batch;
+    suites["ingest"]   = &check_ingest;
+    suites["lazy"]     = &check_lazy;
+    suites["lookups"]  = &check_lookups;
+    suites["mapped"]   = &check_mapped;
+    suites["bloom"]    = &check_bloom;
+    suites["bounded"]  = &check_bounded;
+    suites["bplus"]    = &check_bplus;
+    suites["branchless"] = &check_branchless;
+    suites["cache"]    = &check_cache;
+    suites["diagnostics"] = &check_diagnostics;
+    suites["export"]   = &check_export;
+    suites["parallel"] = &check_parallel;
+    suites["range"]    = &check_range;
+    suites["reader"]   = &check_reader;
+    suites["relayout"] = &check_relayout;
+    suites["render"]   = &check_render;
+    suites["server"]   = &check_server;
+    suites["static"]   = &check_static;
+    suites["string"]   = &check_string;
+    suites["trace"]    = &check_trace;
+    suites["traversal"] = &check_traversal;
+
+    string which = (argc > 1) ? argv[1] : "all";
+    size_t rounds = (argc > 2) ? strtoul(argv[2], NULL, 10) : 4;
+    unsigned seed = (argc > 3) ? strtoul(argv[3], NULL, 10) : 12345;
+    if (which != "all" && suites.find(which) == suites.end()) {
+        cerr << "unknown suite " << which << "; one of all";
+        for (map<string, suite_t>::iterator it = suites.begin();
+             it != suites.end(); ++it)
+            cerr << " " << it->first;
+        cerr << endl;
+        return 2;
+    }
+
+    for (map<string, suite_t>::iterator it = suites.begin();
+         it != suites.end(); ++it) {
+        if (which != "all" && which != it->first) continue;
+        cout << "  " << left << setw(12) << it->first << flush;
+        gen.seed(seed);
+        try {
+            it->second(rounds);
+        } catch (const exception& e) {
+            cout << "FAILED" << endl << "    " << e.what()
+                 << " (seed " << seed << ")" << endl;
+            return 1;
+        }
+        cout << "ok" << endl;
+    }
+    return 0;
+}
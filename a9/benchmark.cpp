@@ -0,0 +1,986 @@
+// ============================================================================
+// benchmark.cpp
+// ~~~~~~~~~~~~~
+// description : micro-benchmarks for the AVL tree
+// usage       : avlbench [workload] [n]
+//               with no workload given, every workload is run
+// ****************************************************************************
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <malloc.h>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <queue>
+#include <random>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "AVLTree.h"
+#include "AVLstring.h"
+#include "BPlusTree.h"
+#include "MappedAVLTree.h"
+#include "StaticAVLTree.h"
+#include "ThreadPool.h"
+
+using namespace std;
+
+typedef void (*workload_t)(size_t);
+
+// -----------------------------------------------------------------------------
+// a few helpers
+// -----------------------------------------------------------------------------
+static double seconds_since(chrono::steady_clock::time_point start)
+{
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+static vector<int> random_keys(size_t n, unsigned seed = 12345)
+{
+    mt19937 gen(seed);
+    vector<int> keys(n);
+    for (size_t i = 0; i < n; i++) keys[i] = int(gen() & 0x7fffffff);
+    return keys;
+}
+
+static void report(const string& what, size_t ops, double secs)
+{
+    cout << "  " << left << setw(36) << what << right
+         << setw(10) << fixed << setprecision(3) << secs * 1e3 << " ms"
+         << setw(12) << setprecision(2) << ops / secs / 1e6 << " Mops/s"
+         << endl;
+}
+
+// -----------------------------------------------------------------------------
+// sum of a projected value, sequential in-order walk vs parallel_reduce on
+// pools of increasing size
+// -----------------------------------------------------------------------------
+static void bench_parallel(size_t n)
+{
+    cout << "parallel_reduce over " << n << " keys" << endl;
+    AVLTree<int> tree;
+    vector<int> keys = random_keys(n);
+    for (size_t i = 0; i < n; i++) tree.insert(keys[i]);
+
+    auto project = [](int k) { return (long long)(k % 1000); };
+    auto plus = [](long long a, long long b) { return a + b; };
+
+    ThreadPool single(1);
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    long long expect = tree.parallel_reduce(0LL, project, plus, single);
+    double base = seconds_since(start);
+    report("1 thread", n, base);
+
+    size_t hw = thread::hardware_concurrency();
+    for (size_t t = 2; t <= hw; t *= 2) {
+        ThreadPool pool(t);
+        start = chrono::steady_clock::now();
+        long long got = tree.parallel_reduce(0LL, project, plus, pool);
+        double secs = seconds_since(start);
+        ostringstream oss;
+        oss << t << " threads (x" << setprecision(2) << fixed
+            << base / secs << ")";
+        report(oss.str(), n, secs);
+        if (got != expect) cout << "  ** MISMATCH **" << endl;
+    }
+}
+
+// -----------------------------------------------------------------------------
+// apply batches of random keys to a tree of n keys, one insert/remove call
+// per key vs insert_batch/erase_batch
+// -----------------------------------------------------------------------------
+static void bench_batch(size_t n)
+{
+    const size_t sizes[] = { 10000, 100000 };
+    for (size_t s = 0; s < sizeof(sizes)/sizeof(sizes[0]); s++) {
+        size_t k = sizes[s];
+        cout << "batches of " << k << " keys into " << n << " keys" << endl;
+        vector<int> base = random_keys(n);
+        vector<int> batch = random_keys(k, 777);
+
+        AVLTree<int> looped, batched;
+        batched.insert_batch(base);
+        looped.insert_batch(base);
+
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        for (size_t i = 0; i < k; i++) looped.insert(batch[i]);
+        double loop_secs = seconds_since(start);
+        report("insert loop", k, loop_secs);
+
+        start = chrono::steady_clock::now();
+        batched.insert_batch(batch);
+        double batch_secs = seconds_since(start);
+        ostringstream oss;
+        oss << "insert_batch (x" << fixed << setprecision(2)
+            << loop_secs / batch_secs << ")";
+        report(oss.str(), k, batch_secs);
+
+        start = chrono::steady_clock::now();
+        for (size_t i = 0; i < k; i++) looped.remove(batch[i]);
+        loop_secs = seconds_since(start);
+        report("remove loop", k, loop_secs);
+
+        start = chrono::steady_clock::now();
+        batched.erase_batch(batch);
+        batch_secs = seconds_since(start);
+        oss.str("");
+        oss << "erase_batch (x" << fixed << setprecision(2)
+            << loop_secs / batch_secs << ")";
+        report(oss.str(), k, batch_secs);
+    }
+}
+
+// -----------------------------------------------------------------------------
+// the tree as an ordered work queue: fill with n keys, then n rounds of
+// peek + pop the minimum + push a later key, then drain. Compared against a
+// binary heap and std::set doing the same
+// -----------------------------------------------------------------------------
+static void bench_pq(size_t n)
+{
+    cout << "work queue of " << n << " keys" << endl;
+    vector<int> keys = random_keys(n);
+    vector<int> incr = random_keys(n, 4242);
+    long long check[3] = { 0, 0, 0 };
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    {
+        priority_queue<int, vector<int>, greater<int> > pq;
+        for (size_t i = 0; i < n; i++) pq.push(keys[i]);
+        for (size_t i = 0; i < n; i++) {
+            int k = pq.top(); pq.pop();
+            check[0] += k;
+            pq.push(k + 1 + incr[i] % 1000);
+        }
+        while (!pq.empty()) { check[0] += pq.top(); pq.pop(); }
+    }
+    report("std::priority_queue", 3 * n, seconds_since(start));
+
+    // the heap keeps duplicates, the tree and the set do not; keep the keys
+    // distinct by construction so all three do the same work
+    start = chrono::steady_clock::now();
+    {
+        set<long long> s;
+        for (size_t i = 0; i < n; i++) s.insert((long long)keys[i] * n + i);
+        for (size_t i = 0; i < n; i++) {
+            long long k = *s.begin(); s.erase(s.begin());
+            check[1] += k;
+            s.insert(k + (long long)(1 + incr[i] % 1000) * n);
+        }
+        while (!s.empty()) { check[1] += *s.begin(); s.erase(s.begin()); }
+    }
+    report("std::set", 3 * n, seconds_since(start));
+
+    start = chrono::steady_clock::now();
+    {
+        AVLTree<long long> t;
+        for (size_t i = 0; i < n; i++) t.insert((long long)keys[i] * n + i);
+        for (size_t i = 0; i < n; i++) {
+            long long k = t.minimum();
+            t.pop_min();
+            check[2] += k;
+            t.insert(k + (long long)(1 + incr[i] % 1000) * n);
+        }
+        while (!t.empty()) check[2] += t.pop_min();
+    }
+    report("AVLTree minimum/pop_min", 3 * n, seconds_since(start));
+    if (check[1] != check[2]) cout << "  ** MISMATCH **" << endl;
+}
+
+// -----------------------------------------------------------------------------
+// an int that opts into the branchless search path, for comparison with the
+// generic path that plain ints get
+// -----------------------------------------------------------------------------
+struct BranchlessInt {
+    int v;
+    BranchlessInt(int x = 0) : v(x) {}
+    bool operator<(const BranchlessInt& o) const  { return v < o.v; }
+    bool operator>(const BranchlessInt& o) const  { return v > o.v; }
+    bool operator==(const BranchlessInt& o) const { return v == o.v; }
+    bool operator!=(const BranchlessInt& o) const { return v != o.v; }
+};
+ostream& operator<<(ostream& os, const BranchlessInt& k) { return os << k.v; }
+
+template <>
+struct avl_key_traits<BranchlessInt> {
+    typedef avl_branchless_search search_tag;
+};
+
+template <typename K>
+static double time_lookups(AVLTree<K>& tree, const vector<int>& probes)
+{
+    size_t found = 0;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for (size_t i = 0; i < probes.size(); i++)
+        found += tree.find(K(probes[i]));
+    double secs = seconds_since(start);
+    if (found == size_t(-1)) cout << found; // keep the loop alive
+    return secs;
+}
+
+// -----------------------------------------------------------------------------
+// random lookups (half hits, half misses), generic vs branchless search
+// -----------------------------------------------------------------------------
+static void bench_search(size_t n)
+{
+    cout << "random lookups in " << n << " int keys" << endl;
+    vector<int> keys = random_keys(n);
+    vector<int> misses = random_keys(n, 99);
+    vector<int> probes(n);
+    mt19937 gen(5);
+    for (size_t i = 0; i < n; i++)
+        probes[i] = (gen() & 1) ? keys[gen() % n] : misses[i];
+
+    AVLTree<int> generic;
+    AVLTree<BranchlessInt> branchless;
+    for (size_t i = 0; i < n; i++) {
+        generic.insert(keys[i]);
+        branchless.insert(BranchlessInt(keys[i]));
+    }
+    // alternated, the best of five each, as single runs out of cache vary
+    // by more than the difference
+    double g = 1e30, b = 1e30;
+    for (int round = 0; round < 5; round++) {
+        g = min(g, time_lookups(generic, probes));
+        b = min(b, time_lookups(branchless, probes));
+    }
+    report("generic search", n, g);
+    ostringstream oss;
+    oss << "branchless search (x" << fixed << setprecision(2) << g / b << ")";
+    report(oss.str(), n, b);
+}
+
+// -----------------------------------------------------------------------------
+// one balancing policy on three phases: random insertions, a mixed phase of
+// lookups, insertions and removals, then random removals. Reported per phase:
+// throughput, rotations per update and the height at the end of the phase
+// -----------------------------------------------------------------------------
+template <typename Balance>
+static void bench_one_policy(const string& name, const vector<int>& keys,
+                             const vector<int>& probes)
+{
+    size_t n = keys.size();
+    AVLTree<int, avl_no_summary<int>, Balance> tree;
+    size_t found = 0;
+    cout << " " << name << endl;
+
+    size_t rot = tree.rotations();
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for (size_t i = 0; i < n; i++) tree.insert(keys[i]);
+    double secs = seconds_since(start);
+    ostringstream oss;
+    oss << "insert   " << fixed << setprecision(2)
+        << double(tree.rotations() - rot) / n << " rot/op, height "
+        << tree.height();
+    report(oss.str(), n, secs);
+
+    // every other operation is a lookup, the rest alternate between
+    // removing a key that is there and putting it back
+    rot = tree.rotations();
+    start = chrono::steady_clock::now();
+    for (size_t i = 0; i < n; i++) {
+        if (i % 2 == 0) found += tree.find(probes[i]);
+        else if (i % 4 == 1) tree.remove(keys[i]);
+        else tree.insert(keys[i - 2]);
+    }
+    secs = seconds_since(start);
+    oss.str("");
+    oss << "mixed    " << fixed << setprecision(2)
+        << double(tree.rotations() - rot) / (n / 2) << " rot/op, height "
+        << tree.height();
+    report(oss.str(), n, secs);
+
+    // remove the first half, in random order
+    rot = tree.rotations();
+    start = chrono::steady_clock::now();
+    for (size_t i = 0; i < n / 2; i++) tree.remove(keys[i]);
+    secs = seconds_since(start);
+    oss.str("");
+    oss << "remove   " << fixed << setprecision(2)
+        << double(tree.rotations() - rot) / (n / 2) << " rot/op, height "
+        << tree.height();
+    report(oss.str(), n / 2, secs);
+    if (found == size_t(-1)) cout << found; // keep the lookups alive
+}
+
+static void bench_policy(size_t n)
+{
+    cout << "balancing policies on " << n << " random int keys" << endl;
+    vector<int> keys = random_keys(n);
+    vector<int> probes = random_keys(n, 77);
+    for (size_t i = 0; i < n; i += 2) probes[i] = keys[probes[i] % n];
+
+    bench_one_policy<avl_balance>("AVL", keys, probes);
+    bench_one_policy<rb_balance>("red-black", keys, probes);
+    bench_one_policy<wavl_balance>("WAVL", keys, probes);
+}
+
+// -----------------------------------------------------------------------------
+// heap bytes in use, from the allocator's own bookkeeping (glibc only)
+// -----------------------------------------------------------------------------
+static size_t heap_in_use()
+{
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+    return mallinfo2().uordblks;
+#else
+    return 0;
+#endif
+}
+
+static vector<string> random_strings(size_t n, unsigned seed = 12345)
+{
+    // 8 to 40 characters, so about half of them fit std::string's
+    // small-string buffer and half need a heap block of their own
+    mt19937 gen(seed);
+    vector<string> keys(n);
+    for (size_t i = 0; i < n; i++) {
+        keys[i].resize(8 + gen() % 33);
+        for (size_t j = 0; j < keys[i].size(); j++)
+            keys[i][j] = char('a' + gen() % 26);
+    }
+    return keys;
+}
+
+template <typename Tree>
+static void bench_one_string_tree(const string& name, Tree& tree,
+                                  const vector<string>& keys)
+{
+    size_t n = keys.size();
+    cout << " " << name << endl;
+    size_t before = heap_in_use();
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for (size_t i = 0; i < n; i++) tree.insert(keys[i]);
+    report("insert", n, seconds_since(start));
+    size_t bytes = heap_in_use() - before;
+    if (bytes > 0)
+        cout << "  heap: " << bytes / n << " bytes/key" << endl;
+
+    size_t found = 0;
+    start = chrono::steady_clock::now();
+    for (size_t i = 0; i < n; i++) found += tree.find(keys[(i * 7919) % n]);
+    report("find", n, seconds_since(start));
+
+    start = chrono::steady_clock::now();
+    for (size_t i = 0; i < n / 2; i++) tree.remove(keys[i]);
+    report("remove half", n / 2, seconds_since(start));
+
+    start = chrono::steady_clock::now();
+    tree.clear();
+    report("clear", n / 2, seconds_since(start));
+    if (found == size_t(-1)) cout << found;
+}
+
+// -----------------------------------------------------------------------------
+// string keys: std::string in every node vs keys in a StringArena
+// -----------------------------------------------------------------------------
+static void bench_strings(size_t n)
+{
+    cout << "string keys, " << n << " random keys of 8-40 characters" << endl;
+    vector<string> keys = random_strings(n);
+    {
+        AVLTree<string> tree;
+        bench_one_string_tree("AVLTree<string>", tree, keys);
+    }
+    {
+        AVLStringTree<> tree;
+        bench_one_string_tree("AVLStringTree", tree, keys);
+        cout << "  compactions during remove: " << tree.compactions() << endl;
+    }
+}
+
+// -----------------------------------------------------------------------------
+// the same random insert/find/remove rounds on a heap-allocated AVLTree and on
+// a StaticAVLTree; the static tree's capacity caps n
+// -----------------------------------------------------------------------------
+template <typename Tree>
+static void bench_rounds(const string& name, Tree& tree,
+                         const vector<int>& keys)
+{
+    size_t n = keys.size(), found = 0;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for (int round = 0; round < 10; round++) {
+        for (size_t i = 0; i < n; i++) tree.insert(keys[i]);
+        for (size_t i = 0; i < n; i++) found += tree.find(keys[(i * 7919) % n]);
+        for (size_t i = 0; i < n; i++) tree.remove(keys[i]);
+    }
+    report(name, 30 * n, seconds_since(start));
+    if (found == size_t(-1)) cout << found;
+}
+
+static void bench_static(size_t n)
+{
+    const size_t CAP = 1 << 16;
+    static StaticAVLTree<int, CAP> fixed; // 2.5MB, keep it off the stack
+    n = min(n, CAP);
+    cout << "10 rounds of insert/find/remove of " << n << " keys" << endl;
+    vector<int> keys = random_keys(n);
+    AVLTree<int> heap;
+    bench_rounds("AVLTree", heap, keys);
+    bench_rounds("StaticAVLTree", fixed, keys);
+}
+
+// -----------------------------------------------------------------------------
+// n draws from a Zipf distribution over ranks 0..m-1: rank r comes up with
+// probability proportional to 1 / (r+1)^s
+// -----------------------------------------------------------------------------
+static vector<size_t> zipf_ranks(size_t n, size_t m, double s, unsigned seed)
+{
+    vector<double> cdf(m);
+    double total = 0;
+    for (size_t r = 0; r < m; r++) {
+        total += 1.0 / pow(double(r + 1), s);
+        cdf[r] = total;
+    }
+    mt19937 gen(seed);
+    uniform_real_distribution<double> u(0, total);
+    vector<size_t> ranks(n);
+    for (size_t i = 0; i < n; i++)
+        ranks[i] = lower_bound(cdf.begin(), cdf.end(), u(gen)) - cdf.begin();
+    return ranks;
+}
+
+// -----------------------------------------------------------------------------
+// Zipf-skewed lookups (all hits) with and without the front cache; the rank
+// to key mapping is random so hot keys are spread all over the tree
+// -----------------------------------------------------------------------------
+static void bench_zipf(size_t n)
+{
+    cout << "Zipf lookups in " << n << " int keys" << endl;
+    vector<int> keys = random_keys(n);
+    AVLTree<int> tree;
+    for (size_t i = 0; i < n; i++) tree.insert(keys[i]);
+
+    const double skews[] = {0.6, 0.8, 1.0, 1.2, 1.5};
+    const size_t cache_sizes[] = {1024, 16384};
+    for (size_t k = 0; k < sizeof(skews) / sizeof(skews[0]); k++) {
+        vector<size_t> ranks = zipf_ranks(n, n, skews[k], 7);
+        vector<int> probes(n);
+        for (size_t i = 0; i < n; i++) probes[i] = keys[ranks[i]];
+        cout << " s = " << fixed << setprecision(1) << skews[k] << endl;
+
+        tree.disable_find_cache();
+        size_t found = 0;
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        for (size_t i = 0; i < n; i++) found += tree.find(probes[i]);
+        double base = seconds_since(start);
+        report("no cache", n, base);
+
+        for (size_t c = 0; c < 2; c++) {
+            tree.enable_find_cache(cache_sizes[c]);
+            start = chrono::steady_clock::now();
+            for (size_t i = 0; i < n; i++) found += tree.find(probes[i]);
+            double secs = seconds_since(start);
+            avl_cache_stats st = tree.find_cache_stats();
+            ostringstream oss;
+            oss << cache_sizes[c] << " entries, " << fixed << setprecision(1)
+                << 100.0 * st.hits / (st.hits + st.misses) << "% hits (x"
+                << setprecision(2) << base / secs << ")";
+            report(oss.str(), n, secs);
+        }
+        if (found == size_t(-1)) cout << found;
+    }
+}
+
+// -----------------------------------------------------------------------------
+// lookups with a growing share of absent keys, without the Bloom filter and
+// with it at a few sizes; then a round of churn (half the keys replaced) to
+// show the filter rebuilding itself and the false positive rate holding
+// -----------------------------------------------------------------------------
+static void bench_bloom(size_t n)
+{
+    cout << "Bloom-filtered lookups in " << n << " int keys" << endl;
+    vector<int> keys = random_keys(n);
+    vector<int> absent = random_keys(n, 777); // odd, the keys are made even
+    for (size_t i = 0; i < n; i++) { keys[i] &= ~1; absent[i] |= 1; }
+    AVLTree<int> tree;
+    for (size_t i = 0; i < n; i++) tree.insert(keys[i]);
+
+    const double miss_shares[] = {0.0, 0.5, 0.9, 0.99};
+    const double bits_per_key[] = {8, 10, 16};
+    mt19937 gen(99);
+    for (size_t m = 0; m < sizeof(miss_shares) / sizeof(miss_shares[0]); m++) {
+        bernoulli_distribution miss(miss_shares[m]);
+        vector<int> probes(n);
+        for (size_t i = 0; i < n; i++)
+            probes[i] = miss(gen) ? absent[gen() % n] : keys[gen() % n];
+        cout << " " << fixed << setprecision(0) << 100 * miss_shares[m]
+             << "% misses" << endl;
+
+        tree.disable_bloom_filter();
+        size_t found = 0;
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        for (size_t i = 0; i < n; i++) found += tree.find(probes[i]);
+        double base = seconds_since(start);
+        report("no filter", n, base);
+
+        for (size_t b = 0; b < 3; b++) {
+            tree.enable_bloom_filter(bits_per_key[b]);
+            start = chrono::steady_clock::now();
+            for (size_t i = 0; i < n; i++) found += tree.find(probes[i]);
+            double secs = seconds_since(start);
+            avl_bloom_stats st = tree.bloom_filter_stats();
+            ostringstream oss;
+            oss << fixed << setprecision(0) << bits_per_key[b]
+                << " bits/key, fpr "
+                << setprecision(2) << 100 * st.observed_fpr() << "% (x"
+                << base / secs << ")";
+            report(oss.str(), n, secs);
+        }
+        if (found == size_t(-1)) cout << found;
+    }
+
+    // churn: replace half the keys in a few steps, half of each step's
+    // lookups going to keys removed so far
+    tree.enable_bloom_filter(10);
+    avl_bloom_stats before = tree.bloom_filter_stats();
+    vector<int> fresh = random_keys(n / 2, 4242);
+    size_t found = 0;
+    const size_t STEPS = 8, step = n / 2 / STEPS;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for (size_t s = 0; s < STEPS; s++) {
+        for (size_t i = s * step; i < (s + 1) * step; i++) {
+            tree.remove(keys[i]);
+            tree.insert(fresh[i] & ~1);
+        }
+        for (size_t i = s * step; i < (s + 1) * step; i++) {
+            found += tree.find(keys[gen() % ((s + 1) * step)]);
+            found += tree.find(absent[i]);
+        }
+    }
+    double secs = seconds_since(start);
+    avl_bloom_stats st = tree.bloom_filter_stats();
+    ostringstream oss;
+    oss << "churn, " << st.rebuilds - before.rebuilds << " rebuilds, fpr "
+        << fixed << setprecision(2)
+        << 100.0 * (st.false_positives - before.false_positives)
+           / (st.skips - before.skips + st.false_positives
+              - before.false_positives) << "%";
+    report(oss.str(), 4 * STEPS * step, secs);
+    cout << "  estimated fpr now " << setprecision(2)
+         << 100 * st.estimated_fpr << "%, " << st.bits / 8 / 1024
+         << " KB" << endl;
+    if (found == size_t(-1)) cout << found;
+}
+
+// -----------------------------------------------------------------------------
+// bursts of removals, each followed by as many insertions of fresh keys and
+// some idle time, with every removal timed on its own: eager removal, lazy
+// removal with compaction on the mutations, and lazy removal with the
+// compaction done in the idle time. The last column counts the idle-time
+// compaction too. Out of cache a removal is mostly the misses on the way
+// down, which are the same for all three, so it is run again on a tree that
+// fits in cache, where the unlink, rebalancing and free lazy removal saves
+// are most of the work
+// -----------------------------------------------------------------------------
+static void bench_lazy_in(size_t n, size_t bursts)
+{
+    const size_t BURST = 4096;
+    cout << bursts << " bursts of " << BURST << " removals in " << n
+         << " int keys" << endl;
+    vector<int> keys = random_keys(n + bursts * BURST);
+
+    const char* names[] = {"eager", "lazy, compact on mutation",
+                           "lazy, compact when idle"};
+    for (int mode = 0; mode < 3; mode++) {
+        AVLTree<int> tree;
+        for (size_t i = 0; i < n; i++) tree.insert(keys[i]);
+        if (mode == 1) tree.set_lazy_delete(true, 0.25, 2);
+        if (mode == 2) tree.set_lazy_delete(true);
+
+        mt19937 gen(31);
+        vector<double> lat;
+        lat.reserve(bursts * BURST);
+        size_t next = n;
+        double idle = 0;
+        chrono::steady_clock::time_point all = chrono::steady_clock::now();
+        for (size_t b = 0; b < bursts; b++) {
+            for (size_t i = 0; i < BURST; i++) {
+                int key = keys[gen() % next];
+                chrono::steady_clock::time_point start
+                    = chrono::steady_clock::now();
+                tree.remove(key);
+                lat.push_back(seconds_since(start));
+            }
+            for (size_t i = 0; i < BURST; i++) tree.insert(keys[next++]);
+            if (mode == 2) {
+                chrono::steady_clock::time_point start
+                    = chrono::steady_clock::now();
+                tree.compact();
+                idle += seconds_since(start);
+            }
+        }
+        double secs = seconds_since(all);
+
+        sort(lat.begin(), lat.end());
+        ostringstream oss;
+        oss << names[mode] << ": p50 " << fixed << setprecision(0)
+            << lat[lat.size() / 2] * 1e9 << " ns, p99 "
+            << lat[lat.size() * 99 / 100] * 1e9 << " ns, p99.9 "
+            << lat[lat.size() * 999 / 1000] * 1e9 << " ns";
+        cout << "  " << oss.str() << endl;
+        ostringstream total;
+        total << "  total, " << tree.tombstones() << " tombstones left";
+        if (mode == 2)
+            total << ", " << fixed << setprecision(1) << idle * 1e3
+                  << " ms idle";
+        report(total.str(), 2 * bursts * BURST, secs);
+    }
+}
+
+static void bench_lazy(size_t n)
+{
+    const size_t BURST = 4096, IN_CACHE = 32768;
+    bench_lazy_in(n, max<size_t>(n / BURST / 4, 1));
+    if (n > IN_CACHE) bench_lazy_in(IN_CACHE, 8);
+}
+
+// -----------------------------------------------------------------------------
+// the streaming exports of a tree of n int keys, written to a stream that
+// only counts the bytes
+// -----------------------------------------------------------------------------
+struct counting_buf : streambuf {
+    size_t bytes = 0;
+    streamsize xsputn(const char*, streamsize n) { bytes += n; return n; }
+    int overflow(int c) { ++bytes; return c; }
+};
+
+static void bench_export(size_t n)
+{
+    cout << "exports of " << n << " int keys" << endl;
+    vector<int> keys = random_keys(n);
+    AVLTree<int> tree;
+    for (size_t i = 0; i < n; i++) tree.insert(keys[i]);
+
+    for (int svg = 0; svg < 2; svg++) {
+        counting_buf counter;
+        ostream out(&counter);
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        if (svg) tree.export_svg(out, true);
+        else tree.export_dot(out, true);
+        ostringstream oss;
+        oss << (svg ? "svg, " : "dot, ") << counter.bytes / 1000000 << " MB";
+        report(oss.str(), tree.size(), seconds_since(start));
+    }
+}
+
+// -----------------------------------------------------------------------------
+// the memory-mapped tree: building it in transactions of 1000 keys, reopening
+// it, lookups, and transactions of a single key, each synced to disk
+// -----------------------------------------------------------------------------
+static void bench_mapped(size_t n)
+{
+    const char* path = "/tmp/avlbench-mapped.avl";
+    const size_t BATCH = 1000, SINGLES = 1000;
+    cout << "memory-mapped tree of " << n << " int keys in " << path << endl;
+    vector<int> keys = random_keys(n + SINGLES);
+    unlink(path);
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    {
+        MappedAVLTree<int> tree(path);
+        tree.set_autocommit(false);
+        for (size_t i = 0; i < n; i++) {
+            tree.insert(keys[i]);
+            if ((i + 1) % BATCH == 0) tree.commit();
+        }
+        tree.commit();
+    }
+    report("insert, commit every 1000", n, seconds_since(start));
+
+    start = chrono::steady_clock::now();
+    MappedAVLTree<int> tree(path);
+    double open_secs = seconds_since(start);
+    ostringstream oss;
+    oss << "reopen, " << tree.size() << " keys, " << tree.file_size() / 1000000
+        << " MB";
+    report(oss.str(), 1, open_secs);
+
+    mt19937 gen(7);
+    size_t found = 0;
+    start = chrono::steady_clock::now();
+    for (size_t i = 0; i < n; i++) found += tree.find(keys[gen() % n]);
+    report("find", n, seconds_since(start));
+
+    start = chrono::steady_clock::now();
+    for (size_t i = 0; i < SINGLES; i++) tree.insert(keys[n + i]);
+    report("insert, commit every key", SINGLES, seconds_since(start));
+
+    AVLTree<int> heap;
+    start = chrono::steady_clock::now();
+    for (size_t i = 0; i < n; i++) heap.insert(keys[i]);
+    report("AVLTree insert, for comparison", n, seconds_since(start));
+    if (found != n) cout << "  ** only " << found << " keys found" << endl;
+    unlink(path);
+}
+
+// -----------------------------------------------------------------------------
+// loading n keys from t threads: every thread inserting into one tree under
+// a mutex, vs every thread filling its own buffer and one ingest at the end
+// -----------------------------------------------------------------------------
+static void bench_ingest(size_t n)
+{
+    cout << "loading " << n << " keys from several threads" << endl;
+    vector<int> keys = random_keys(n);
+    size_t hw = thread::hardware_concurrency();
+    for (size_t t = 1; t <= max(hw, size_t(2)); t *= 2) {
+        ThreadPool pool(t);
+        AVLTree<int> shared;
+        mutex mu;
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        pool.parallel_for(t, [&](size_t th) {
+            for (size_t i = th * n / t; i < (th + 1) * n / t; i++) {
+                lock_guard<mutex> lk(mu);
+                shared.insert(keys[i]);
+            }
+        });
+        double locked = seconds_since(start);
+        ostringstream oss;
+        oss << t << " threads, shared tree";
+        report(oss.str(), n, locked);
+
+        AVLTree<int> tree;
+        avl_ingest_buffers<int> buffers(t);
+        start = chrono::steady_clock::now();
+        pool.parallel_for(t, [&](size_t th) {
+            for (size_t i = th * n / t; i < (th + 1) * n / t; i++)
+                buffers.add(th, keys[i]);
+        });
+        tree.ingest(buffers, pool);
+        double secs = seconds_since(start);
+        oss.str("");
+        oss << t << " threads, ingest (x" << fixed << setprecision(2)
+            << locked / secs << ")";
+        report(oss.str(), n, secs);
+        if (tree.size() != shared.size()) cout << "  ** MISMATCH **" << endl;
+    }
+}
+
+// -----------------------------------------------------------------------------
+// a tree bounded to n/10 nodes taking n random inserts, under each eviction
+// policy, vs the same inserts unbounded; the high-water marks show how far
+// past the bound the tree ever went. Only the tree that evicts the oldest
+// keys keeps the insertion order, so its nodes are bigger
+// -----------------------------------------------------------------------------
+template <typename Tree>
+static void bounded_inserts(const vector<int>& keys, size_t cap, int policy)
+{
+    const char* names[] = { "min", "max", "oldest" };
+    Tree tree;
+    if (policy >= 0) tree.set_capacity(cap, 0, avl_evict_policy(policy));
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for (size_t i = 0; i < keys.size(); i++) tree.insert(keys[i]);
+    double secs = seconds_since(start);
+    ostringstream oss;
+    if (policy < 0) {
+        oss << "unbounded, " << tree.size() << " keys";
+    } else {
+        avl_bound_stats stats = tree.bound_stats();
+        oss << names[policy] << ": " << stats.evictions << " out, "
+            << stats.peak_bytes / 1000 << " KB peak";
+    }
+    report(oss.str(), keys.size(), secs);
+}
+
+static void bench_bounded(size_t n)
+{
+    typedef AVLTree<int, avl_no_summary<int>, avl_balance,
+                    avl_insertion_order> OrderedTree;
+    size_t cap = n / 10 + 1;
+    cout << "inserting " << n << " keys, bounded to " << cap << " nodes"
+         << endl;
+    vector<int> keys = random_keys(n);
+    bounded_inserts<AVLTree<int> >(keys, cap, -1);
+    bounded_inserts<AVLTree<int> >(keys, cap, AVL_EVICT_MIN);
+    bounded_inserts<AVLTree<int> >(keys, cap, AVL_EVICT_MAX);
+    bounded_inserts<OrderedTree>(keys, cap, AVL_EVICT_OLDEST);
+}
+
+// -----------------------------------------------------------------------------
+// random lookups in a tree built by random insertions, so that its nodes are
+// in insertion order, then after relayout into van Emde Boas order, and
+// again once a tenth of the keys have been replaced; the tree should be
+// bigger than the last-level cache to show anything
+// -----------------------------------------------------------------------------
+static void bench_layout(size_t n)
+{
+    cout << "random lookups in " << n << " int keys, before and after "
+         << "relayout" << endl;
+    vector<int> keys = random_keys(n);
+    vector<int> probes(n);
+    mt19937 gen(5);
+    for (size_t i = 0; i < n; i++) probes[i] = keys[gen() % n];
+
+    AVLTree<int> tree;
+    for (size_t i = 0; i < n; i++) tree.insert(keys[i]);
+    double before = time_lookups(tree, probes);
+    report("insertion order", n, before);
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    tree.relayout();
+    report("relayout", n, seconds_since(start));
+    double after = time_lookups(tree, probes);
+    ostringstream oss;
+    oss << "van Emde Boas order (x" << fixed << setprecision(2)
+        << before / after << ")";
+    report(oss.str(), n, after);
+
+    vector<int> fresh = random_keys(n / 10, 99);
+    for (size_t i = 0; i < fresh.size(); i++) {
+        tree.remove(keys[i]);
+        tree.insert(fresh[i]);
+    }
+    oss.str("");
+    oss << fresh.size() << " replaced, " << tree.block_nodes()
+        << " in block";
+    report(oss.str(), n, time_lookups(tree, probes));
+}
+
+// -----------------------------------------------------------------------------
+// one ordered index through random insertions, lookups (half of them
+// misses), a full scan, short range scans and random removals; it only
+// needs the interface AVLTree and BPlusTree have in common
+// -----------------------------------------------------------------------------
+template <typename Tree>
+static void bench_one_index(const string& name, const vector<int>& keys,
+                            const vector<int>& probes)
+{
+    size_t n = keys.size(), found = 0;
+    long long sum = 0;
+    Tree tree;
+    cout << " " << name << endl;
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for (size_t i = 0; i < n; i++) tree.insert(keys[i]);
+    report("insert", n, seconds_since(start));
+
+    start = chrono::steady_clock::now();
+    for (size_t i = 0; i < n; i++) found += tree.find(probes[i]);
+    report("find", n, seconds_since(start));
+
+    start = chrono::steady_clock::now();
+    tree.for_each([&sum](int key) { sum += key; });
+    report("full scan", n, seconds_since(start));
+
+    size_t ranges = n / 100 + 1, in_range = 0;
+    start = chrono::steady_clock::now();
+    for (size_t i = 0; i < ranges; i++)
+        in_range += tree.for_range(probes[i], probes[i] + (1 << 16),
+                                   [&sum](int key) { sum += key; });
+    ostringstream oss;
+    oss << ranges << " range scans, " << in_range / ranges << " keys each";
+    report(oss.str(), ranges, seconds_since(start));
+
+    start = chrono::steady_clock::now();
+    for (size_t i = 0; i < n; i++) tree.remove(keys[i]);
+    report("remove", n, seconds_since(start));
+    if (found == size_t(-1) || sum == 42) cout << found << sum;
+}
+
+// -----------------------------------------------------------------------------
+// AVLTree against B+ trees of nodes of 2, 4 and 8 cache lines
+// -----------------------------------------------------------------------------
+static void bench_bplus(size_t n)
+{
+    cout << "ordered indexes of " << n << " int keys" << endl;
+    vector<int> keys = random_keys(n);
+    vector<int> misses = random_keys(n, 99);
+    vector<int> probes(n);
+    mt19937 gen(5);
+    for (size_t i = 0; i < n; i++)
+        probes[i] = (gen() & 1) ? keys[gen() % n] : misses[i];
+
+    bench_one_index<AVLTree<int> >("AVL", keys, probes);
+    bench_one_index<BPlusTree<int, 128> >("B+ 128-byte nodes", keys, probes);
+    bench_one_index<BPlusTree<int, 256> >("B+ 256-byte nodes", keys, probes);
+    bench_one_index<BPlusTree<int, 512> >("B+ 512-byte nodes", keys, probes);
+}
+
+// -----------------------------------------------------------------------------
+// random lookups (half hits, half misses) one find at a time, then through
+// find_batch in batches of increasing size
+// -----------------------------------------------------------------------------
+static void bench_find_batch(size_t n)
+{
+    cout << "random lookups in " << n << " int keys, by batch size" << endl;
+    vector<int> keys = random_keys(n);
+    vector<int> misses = random_keys(n, 99);
+    vector<int> probes(n);
+    mt19937 gen(5);
+    for (size_t i = 0; i < n; i++)
+        probes[i] = (gen() & 1) ? keys[gen() % n] : misses[i];
+
+    AVLTree<int> tree;
+    for (size_t i = 0; i < n; i++) tree.insert(keys[i]);
+    size_t single_found = 0;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for (size_t i = 0; i < n; i++) single_found += tree.find(probes[i]);
+    double single = seconds_since(start);
+    report("find", n, single);
+
+    vector<int> batch;
+    vector<bool> results;
+    for (size_t size = 4; size <= 256; size *= 2) {
+        size_t found = 0;
+        start = chrono::steady_clock::now();
+        for (size_t i = 0; i < n; i += size) {
+            batch.assign(probes.begin() + i,
+                         probes.begin() + min(n, i + size));
+            tree.find_batch(batch, results);
+            for (size_t j = 0; j < results.size(); j++) found += results[j];
+        }
+        double secs = seconds_since(start);
+        ostringstream oss;
+        oss << "find_batch of " << size << " (x" << fixed << setprecision(2)
+            << single / secs << ")";
+        report(oss.str(), n, secs);
+        if (found != single_found) cout << "  ** MISMATCH **" << endl;
+    }
+}
+
+/**
+ * -----------------------------------------------------------------------------
+ * main body
+ * -----------------------------------------------------------------------------
+ */
+int main(int argc, char** argv)
+{
+    map<string, workload_t> workloads;
+    workloads["parallel"] = &bench_parallel;
+    workloads["batch"]    = &bench_batch;
+    workloads["pq"]       = &bench_pq;
+    workloads["search"]   = &bench_search;
+    workloads["policy"]   = &bench_policy;
+    workloads["strings"]  = &bench_strings;
+    workloads["static"]   = &bench_static;
+    workloads["zipf"]     = &bench_zipf;
+    workloads["bloom"]    = &bench_bloom;
+    workloads["lazy"]     = &bench_lazy;
+    workloads["export"]   = &bench_export;
+    workloads["mapped"]   = &bench_mapped;
+    workloads["ingest"]   = &bench_ingest;
+    workloads["bounded"]  = &bench_bounded;
+    workloads["layout"]   = &bench_layout;
+    workloads["bplus"]    = &bench_bplus;
+    workloads["findbatch"] = &bench_find_batch;
+
+    size_t n = 1000000;
+    if (argc > 2) n = strtoul(argv[2], NULL, 10);
+
+    if (argc > 1) {
+        if (workloads.find(argv[1]) == workloads.end()) {
+            cerr << "Unknown workload " << argv[1] << endl;
+            return 1;
+        }
+        workloads[argv[1]](n);
+    } else {
+        map<string, workload_t>::iterator it;
+        for (it = workloads.begin(); it != workloads.end(); ++it)
+            it->second(n);
+    }
+    return 0;
+}
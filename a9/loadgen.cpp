@@ -0,0 +1,209 @@
+// ============================================================================
+// loadgen.cpp
+// ~~~~~~~~~~~
+// description : load generator for the driver's server mode (avltest -serve)
+// usage       : avlload socket [-c connections] [-n requests] [-d depth]
+//                              [-k keys] [-mix insert,remove,find,range]
+//               every connection runs in its own thread and keeps up to
+//               'depth' requests in flight; -n is per connection. The mix
+//               is in percent, 25,25,40,10 by default
+// ****************************************************************************
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "LatencyHistogram.h"
+
+using namespace std;
+
+struct Options {
+    string path;
+    size_t connections, requests, depth, keys;
+    unsigned mix[4]; // insert, remove, find, range, cumulative
+    Options() : connections(4), requests(100000), depth(16), keys(100000) {
+        mix[0] = 25; mix[1] = 50; mix[2] = 90; mix[3] = 100;
+    }
+};
+
+struct Result {
+    LatencyHistogram latency;
+    size_t errors;
+    string failure; // why the connection gave up, if it did
+    Result() : errors(0) {}
+};
+
+static int connect_to(const string& path)
+{
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path))
+        throw runtime_error("socket path too long: " + path);
+    memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || connect(fd, (sockaddr*)&addr, sizeof(addr)) < 0) {
+        string msg = path + ": " + strerror(errno);
+        if (fd >= 0) close(fd);
+        throw runtime_error(msg);
+    }
+    return fd;
+}
+
+static void append_key(string& out, size_t k)
+{
+    char buf[24];
+    snprintf(buf, sizeof(buf), "k%09zu", k);
+    out += buf;
+}
+
+// -----------------------------------------------------------------------------
+// one connection: top the pipeline up to 'depth' requests, send them in one
+// write, then take in whatever responses have arrived. A request's latency
+// runs from the moment it was queued for sending to its response line
+// -----------------------------------------------------------------------------
+static void drive(const Options& opt, unsigned seed, Result& res)
+{
+    typedef chrono::steady_clock clock;
+    int fd = connect_to(opt.path);
+    mt19937 gen(seed);
+    deque<clock::time_point> in_flight;
+    string out, in;
+    size_t issued = 0, done = 0;
+    char buf[64 * 1024];
+
+    while (done < opt.requests) {
+        out.clear();
+        while (issued < opt.requests && in_flight.size() < opt.depth) {
+            unsigned what = gen() % 100;
+            size_t key = gen() % opt.keys;
+            if (what < opt.mix[0]) out += "insert ";
+            else if (what < opt.mix[1]) out += "remove ";
+            else if (what < opt.mix[2]) out += "find ";
+            else out += "range ";
+            append_key(out, key);
+            if (what >= opt.mix[2]) {
+                out += ' ';
+                append_key(out, key + 100);
+            }
+            out += '\n';
+            in_flight.push_back(clock::now());
+            ++issued;
+        }
+        for (size_t sent = 0; sent < out.size(); ) {
+            ssize_t n = write(fd, out.data() + sent, out.size() - sent);
+            if (n <= 0) {
+                res.failure = string("write: ") + strerror(errno);
+                close(fd);
+                return;
+            }
+            sent += n;
+        }
+
+        ssize_t got = read(fd, buf, sizeof(buf));
+        if (got <= 0) {
+            res.failure = got == 0 ? "server hung up" : strerror(errno);
+            close(fd);
+            return;
+        }
+        in.append(buf, got);
+        size_t start = 0;
+        for (;;) {
+            size_t nl = in.find('\n', start);
+            if (nl == string::npos) break;
+            clock::time_point now = clock::now();
+            res.latency.record(chrono::duration_cast<chrono::nanoseconds>(
+                now - in_flight.front()).count());
+            in_flight.pop_front();
+            if (in.compare(start, 5, "error") == 0) ++res.errors;
+            ++done;
+            start = nl + 1;
+        }
+        in.erase(0, start);
+    }
+    close(fd);
+}
+
+static void usage()
+{
+    cerr << "Usage: avlload socket [-c connections] [-n requests] [-d depth]"
+            " [-k keys] [-mix insert,remove,find,range]" << endl;
+    exit(1);
+}
+
+int main(int argc, char** argv)
+{
+    Options opt;
+    if (argc < 2) usage();
+    opt.path = argv[1];
+    for (int i = 2; i < argc; i++) {
+        string arg = argv[i];
+        if (i + 1 >= argc) usage();
+        const char* val = argv[++i];
+        if (arg == "-c") opt.connections = strtoul(val, NULL, 10);
+        else if (arg == "-n") opt.requests = strtoul(val, NULL, 10);
+        else if (arg == "-d") opt.depth = strtoul(val, NULL, 10);
+        else if (arg == "-k") opt.keys = strtoul(val, NULL, 10);
+        else if (arg == "-mix") {
+            unsigned m[4];
+            if (sscanf(val, "%u,%u,%u,%u", &m[0], &m[1], &m[2], &m[3]) != 4 ||
+                m[0] + m[1] + m[2] + m[3] != 100)
+                usage();
+            opt.mix[0] = m[0];
+            for (int j = 1; j < 4; j++) opt.mix[j] = opt.mix[j-1] + m[j];
+        }
+        else usage();
+    }
+    if (opt.connections == 0 || opt.depth == 0 || opt.keys == 0) usage();
+
+    vector<Result> results(opt.connections);
+    vector<thread> threads;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for (size_t c = 0; c < opt.connections; ++c) {
+        threads.push_back(thread([&opt, &results, c]() {
+            try {
+                drive(opt, unsigned(c + 1), results[c]);
+            } catch (runtime_error& e) {
+                results[c].failure = e.what();
+            }
+        }));
+    }
+    for (size_t c = 0; c < threads.size(); ++c) threads[c].join();
+    double secs = chrono::duration<double>(
+        chrono::steady_clock::now() - start).count();
+
+    LatencyHistogram all;
+    size_t errors = 0;
+    for (size_t c = 0; c < results.size(); ++c) {
+        all.merge(results[c].latency);
+        errors += results[c].errors;
+        if (!results[c].failure.empty())
+            cerr << "connection " << c << ": " << results[c].failure << endl;
+    }
+
+    cout << opt.connections << " connections x " << opt.requests
+         << " requests, pipeline depth " << opt.depth << endl;
+    cout << all.count() << " responses in " << fixed << setprecision(3)
+         << secs * 1e3 << " ms, " << setprecision(0) << all.count() / secs
+         << " requests/s, " << errors << " errors" << endl;
+    cout << "latency (us): p50 " << setprecision(1)
+         << all.percentile(0.50) / 1e3 << ", p90 "
+         << all.percentile(0.90) / 1e3 << ", p99 "
+         << all.percentile(0.99) / 1e3 << ", p999 "
+         << all.percentile(0.999) / 1e3 << ", max " << all.max() / 1e3
+         << endl;
+    return 0;
+}
@@ -4,14 +4,27 @@
 // Hung Q. ngo
 // -interface to test AVL tree functions
 // ****************************************************************************
+#include <chrono>
+#include <csignal>
+#include <fstream>
+#include <iomanip>
 #include <iostream>
-#include <map>
+#include <memory>
 #include <sstream>
 #include <cstdlib>
 #include <stdexcept>
+#include <thread>
+
+#include <unistd.h>
 
 #include "BTree.h"
 #include "AVLTree.h"
+#include "CommandReader.h"
+#include "Diagnostics.h"
+#include "LatencyHistogram.h"
+#include "RenderPipeline.h"
+#include "Server.h"
+#include "Trace.h"
 #include "error_handling.h"
 #include "term_control.h"
 
@@ -19,23 +32,91 @@ using namespace std;
 
 extern const string usage_msg;
 AVLTree<string> avltree;     // test this data structure
+bool quiet = false;          // -quiet: only the answers to queries
+Diagnostics diagnostics(cerr); // flushed before each prompt
 
-typedef void (*cmd_t)(string);
+// -----------------------------------------------------------------------------
+// -render async|batch: trees are drawn by the pipeline's thread, from a
+// snapshot published after every change, or after the last change of each
+// batch of commands that arrived together; NULL draws them in line
+// -----------------------------------------------------------------------------
+RenderPipeline* pipeline = NULL;
+bool per_batch = false;
+bool tree_changed = false;   // since the last frame, with per_batch
 
 // -----------------------------------------------------------------------------
 // insert a key into the avltree
 // -----------------------------------------------------------------------------
-void insert_key(string); // insert a new key into the AVL tree
+void insert_key(string_view); // insert a new key into the AVL tree
 
 // -----------------------------------------------------------------------------
 // remove a key from avltree
 // -----------------------------------------------------------------------------
-void remove_key(string); // remove a key from the AVL tree
+void remove_key(string_view); // remove a key from the AVL tree
+
+// -----------------------------------------------------------------------------
+// run one command that has its arguments; insert and remove show the tree
+// unless quiet, the queries write their answers to out
+// -----------------------------------------------------------------------------
+void run_command(const Command& cmd, ostream& out);
 
 // -----------------------------------------------------------------------------
 // couple of helper functions
 // -----------------------------------------------------------------------------
-void prompt() { cout << term_cc(BLUE) << "> " << term_cc() << flush; }
+void prompt(ostream& out)
+{
+    out << term_cc(BLUE) << "> " << term_cc() << flush;
+}
+void print_tree();
+void draw_frame(const RenderFrame& frame);
+void show_tree();            // print it, or publish a frame of it
+void publish_tree();
+
+// -----------------------------------------------------------------------------
+// write the tree to a file, as SVG if the name ends in .svg and as Graphviz
+// DOT otherwise, with the subtree sizes; throws runtime_error if the file
+// can't be written
+// -----------------------------------------------------------------------------
+void export_tree(const string& path);
+
+const string options_msg =
+    "Usage: avltest [-record file] [-binary] [-quiet] [-render mode]\n"
+    "               [-diag mode]\n"
+    "       avltest -replay file [-paced] [-every n]\n"
+    "       avltest -serve socket\n"
+    "  -record  also write every command to a binary trace\n"
+    "  -binary  read length-prefixed frames instead of text lines, see\n"
+    "           CommandReader.h for the format\n"
+    "  -quiet   no banner, prompts, notes or trees after insert and remove\n"
+    "  -diag    all: show notes, warnings and errors, at most 100 of a kind\n"
+    "           at once and 10 a second after that, and count them all\n"
+    "           (default)\n"
+    "           summary: show none, only how many of each kind at the end\n"
+    "           off: neither show nor count them\n"
+    "  -render  sync: draw the tree before reading the next command (default)\n"
+    "           async: draw it on another thread, skipping trees that are\n"
+    "           out of date by the time the terminal is ready for them\n"
+    "           batch: as async, one tree per batch of buffered commands\n"
+    "  -replay  run a trace's commands on the tree, without printing it,\n"
+    "           and report the latency of each kind of command\n"
+    "  -paced   keep the recorded time between commands (default: none)\n"
+    "  -every   report the height of the tree every n commands (10000)\n"
+    "  -serve   serve the tree on a UNIX socket until interrupted, see\n"
+    "           Server.h for the protocol";
+
+// -----------------------------------------------------------------------------
+// replay a trace recorded with -record: the commands run against avltree as
+// fast as possible, or paced to the recorded timestamps; then a latency
+// histogram per kind of command is printed. With pacing the time waited is
+// not part of the latencies, and the worst lag behind the recorded schedule
+// is reported
+// -----------------------------------------------------------------------------
+void replay_trace(const string& path, bool paced, size_t every);
+
+// -----------------------------------------------------------------------------
+// serve avltree on a UNIX socket until SIGINT or SIGTERM
+// -----------------------------------------------------------------------------
+void serve_tree(const string& path);
 
 // -----------------------------------------------------------------------------
 // recursively construct a tree from a preorder vector and an inorder vector
@@ -56,80 +137,378 @@ void symmetric_print(BTNode<string>* tree);
  * main body
  * -----------------------------------------------------------------------------
  */
-int main() {
-    string line;
-    map<string,cmd_t> cmd_map;
-    cmd_map["insert"] = &insert_key;
-    cmd_map["remove"] = &remove_key;
-
-    cout << term_cc(YELLOW) << usage_msg << endl;
-
-    while (cin) {
-        prompt(); 
-        getline(cin, line);
-        istringstream iss(line);
-        string cmd, key;
-        iss >> cmd;
-        if (cmd == "") continue;
-        if (cmd == "exit" || cmd == "quit" || cmd == "bye") {
-            exit(0);
+int main(int argc, char** argv) {
+    string record_path, replay_path, serve_path;
+    bool paced = false, binary = false, async = false;
+    string diag_mode = "all";
+    size_t every = 10000;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "-record" && i + 1 < argc) {
+            record_path = argv[++i];
+        } else if (arg == "-replay" && i + 1 < argc) {
+            replay_path = argv[++i];
+        } else if (arg == "-serve" && i + 1 < argc) {
+            serve_path = argv[++i];
+        } else if (arg == "-paced") {
+            paced = true;
+        } else if (arg == "-binary") {
+            binary = true;
+        } else if (arg == "-quiet") {
+            quiet = true;
+        } else if (arg == "-render" && i + 1 < argc) {
+            string mode = argv[++i];
+            if (mode != "sync" && mode != "async" && mode != "batch")
+                error_quit(options_msg);
+            async = (mode != "sync");
+            per_batch = (mode == "batch");
+        } else if (arg == "-diag" && i + 1 < argc) {
+            diag_mode = argv[++i];
+            if (diag_mode != "all" && diag_mode != "summary" &&
+                diag_mode != "off")
+                error_quit(options_msg);
+        } else if (arg == "-every" && i + 1 < argc) {
+            every = strtoul(argv[++i], NULL, 10);
+            if (every == 0) every = 1;
+        } else {
+            error_quit(options_msg);
         }
-        if (cmd == "" || iss.eof()) {
-            note("Syntax: insert/remove key");
+    }
+    if (!replay_path.empty() || !serve_path.empty()) {
+        try {
+            if (!replay_path.empty()) replay_trace(replay_path, paced, every);
+            else serve_tree(serve_path);
+        } catch (runtime_error &e) {
+            error_quit(e.what());
+        }
+        return 0;
+    }
+
+    // quiet hides the notes; their counts only go out when asked for
+    diagnostics.set_enabled(diag_mode != "off");
+    diagnostics.set_rate_limit(10, 100);
+    if (quiet) diagnostics.set_threshold(Diagnostics::WARNING);
+    if (diag_mode == "summary") diagnostics.set_threshold(Diagnostics::SILENT);
+
+    TraceWriter* trace = NULL;
+    if (!record_path.empty()) {
+        try {
+            trace = new TraceWriter(record_path);
+        } catch (runtime_error &e) {
+            error_quit(e.what());
+        }
+    }
+
+    // answers go out through cout's buffer, flushed before each prompt and
+    // by cerr (which is tied to cout) before each error. With a pipeline
+    // they are collected per command and handed to the renderer, and cerr
+    // lets go of cout, which belongs to the renderer's thread
+    ios::sync_with_stdio(false);
+    if (!quiet) cout << term_cc(YELLOW) << usage_msg << term_cc() << endl;
+    ostringstream answers;
+    LatencyHistogram mutations; // with a pipeline: insert and remove, in ns
+    if (async) {
+        cerr.tie(NULL);
+        pipeline = new RenderPipeline(&draw_frame);
+    }
+    ostream& out = (pipeline != NULL) ? answers : cout;
+
+    // prompt only someone typing: not for piped input, nor for lines that
+    // were read along with the previous one
+    bool interactive = !quiet && !binary && isatty(0);
+    CommandReader reader(0, binary);
+    Command cmd;
+    auto hand_over = [&]() {
+        if (pipeline == NULL || answers.tellp() == 0) return;
+        pipeline->write(answers.str());
+        answers.str("");
+    };
+    for (;;) {
+        bool will_block = !reader.line_buffered();
+        hand_over();
+        if (tree_changed && will_block) publish_tree();
+        if (will_block) diagnostics.flush();
+        if (interactive && will_block) prompt(out);
+        hand_over();
+        try {
+            if (!reader.next(cmd)) break;
+        } catch (runtime_error &e) {
+            diagnostics.flush();
+            error_quit(e.what());
+        }
+        if (cmd.op == CMD_EXIT) break;
+        if (cmd.op == CMD_NONE) {
+            diagnostics.report(Diagnostics::UNKNOWN_COMMAND, cmd.word);
             continue;
         }
-        iss >> key;
-        if (key == "") {
-            note("Syntax: insert/remove key");
+        size_t arity = command_arity(cmd.op);
+        if (cmd.nargs < arity) {
+            diagnostics.report(Diagnostics::SYNTAX,
+                               string(command_name(cmd.op))
+                               + (arity == 1 ? " key" : " lo hi"));
             continue;
         }
 
-        if (cmd_map.find(cmd) != cmd_map.end()) {
-            try {
-                cmd_map[cmd](key);
-            } catch (runtime_error &e) {
-                error_return(e.what());
-            }
-        } else {
-            error_return("Unknown command");
+        if (trace != NULL && cmd.op != CMD_PRINT && cmd.op != CMD_EXPORT)
+            trace->record(cmd.op, cmd.args);
+        chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+        try {
+            run_command(cmd, out);
+        } catch (runtime_error &e) {
+            diagnostics.report(Diagnostics::COMMAND_FAILED, e.what());
+        }
+        if (pipeline != NULL && (cmd.op == CMD_INSERT || cmd.op == CMD_REMOVE))
+            mutations.record(chrono::duration_cast<chrono::nanoseconds>(
+                chrono::steady_clock::now() - t0).count());
+    }
+    hand_over();
+    if (tree_changed) publish_tree();
+    if (pipeline != NULL) {
+        pipeline->close();
+        RenderPipeline::Stats st = pipeline->stats();
+        if (st.published > 0) {
+            cout << "rendered " << st.rendered << " of " << st.published
+                 << " frames, dropped " << st.dropped << " (" << fixed
+                 << setprecision(1) << 100.0 * st.dropped / st.published
+                 << "%); insert/remove p50 " << mutations.percentile(0.50)
+                 << " ns, p99 " << mutations.percentile(0.99) << " ns"
+                 << endl;
         }
+        delete pipeline;
+        pipeline = NULL;
     }
+    cout << flush;
+    if (!quiet || diag_mode == "summary") diagnostics.summarize();
+    else diagnostics.flush();
+    delete trace;
     return 0;
 }
 
-void insert_key(string key) 
+void run_command(const Command& cmd, ostream& out)
+{
+    switch (cmd.op) {
+    case CMD_INSERT:
+        insert_key(cmd.args[0]);
+        break;
+    case CMD_REMOVE:
+        remove_key(cmd.args[0]);
+        break;
+    case CMD_FIND:
+        out << (avltree.find(string(cmd.args[0])) ? "found" : "not found")
+            << '\n';
+        break;
+    case CMD_RANGE: {
+        bool first = true;
+        avltree.for_range(string(cmd.args[0]), string(cmd.args[1]),
+                          [&](string_view key) {
+            if (!first) out << ' ';
+            out << key;
+            first = false;
+        });
+        out << '\n';
+        break;
+    }
+    case CMD_COUNT:
+        out << avltree.for_range(string(cmd.args[0]), string(cmd.args[1]),
+                                 [](string_view) { }) << '\n';
+        break;
+    case CMD_MIN:
+    case CMD_MAX:
+        if (avltree.empty()) {
+            diagnostics.report(Diagnostics::EMPTY_TREE);
+            break;
+        }
+        out << (cmd.op == CMD_MIN ? avltree.minimum() : avltree.maximum())
+             << '\n';
+        break;
+    case CMD_SIZE:
+        out << avltree.size() << '\n';
+        break;
+    case CMD_PRINT:
+        if (pipeline == NULL) print_tree();
+        else publish_tree();
+        break;
+    case CMD_EXPORT:
+        export_tree(string(cmd.args[0]));
+        out << "exported " << avltree.size() << " keys to " << cmd.args[0]
+            << '\n';
+        break;
+    default:
+        break;
+    }
+}
+
+volatile sig_atomic_t stop_serving = 0;
+extern "C" void on_stop_signal(int) { stop_serving = 1; }
+
+void serve_tree(const string& path)
+{
+    AVLServer server(avltree, path);
+    signal(SIGINT, on_stop_signal);
+    signal(SIGTERM, on_stop_signal);
+    cout << "serving on " << path << ", interrupt to stop" << endl;
+    server.run(&stop_serving);
+
+    const AVLServer::Stats& st = server.stats();
+    cout << st.requests << " requests from " << st.connections
+         << " connections in " << st.turns << " turns; " << st.batched
+         << " of them in " << st.batches << " batches; " << avltree.size()
+         << " keys" << endl;
+}
+
+void replay_trace(const string& path, bool paced, size_t every)
+{
+    LatencyHistogram hist[CMD_LAST + 1];
+    size_t succeeded[CMD_LAST + 1] = {0};
+    size_t count = 0;
+    chrono::steady_clock::duration max_lag(0);
+    vector<string_view> keys; // what a range query collects
+
+    TraceReader reader(path);
+    TraceRecord rec;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    while (reader.next(rec)) {
+        if (paced) {
+            chrono::steady_clock::time_point due
+                = start + chrono::microseconds(rec.time_us);
+            chrono::steady_clock::time_point now = chrono::steady_clock::now();
+            if (now < due) this_thread::sleep_until(due);
+            else if (now - due > max_lag) max_lag = now - due;
+        }
+
+        // ok: the key was inserted, removed or found, the range was not
+        // empty, the tree had a minimum or maximum
+        chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+        bool ok = true;
+        switch (rec.op) {
+        case CMD_INSERT: ok = avltree.insert(string(rec.args[0])); break;
+        case CMD_REMOVE: ok = avltree.remove(string(rec.args[0])); break;
+        case CMD_FIND:   ok = avltree.find(string(rec.args[0]));   break;
+        case CMD_RANGE:
+            keys.clear();
+            ok = avltree.for_range(string(rec.args[0]), string(rec.args[1]),
+                [&](string_view key) { keys.push_back(key); }) > 0;
+            break;
+        case CMD_COUNT:
+            ok = avltree.for_range(string(rec.args[0]), string(rec.args[1]),
+                                   [](string_view) { }) > 0;
+            break;
+        case CMD_MIN:
+            if ((ok = !avltree.empty())) avltree.minimum();
+            break;
+        case CMD_MAX:
+            if ((ok = !avltree.empty())) avltree.maximum();
+            break;
+        default: // size; print, export and exit are not recorded
+            break;
+        }
+        hist[rec.op].record(chrono::duration_cast<chrono::nanoseconds>(
+            chrono::steady_clock::now() - t0).count());
+        succeeded[rec.op] += ok;
+
+        if (++count % every == 0) {
+            cout << "after " << setw(10) << count << " commands: height "
+                 << avltree.height() << ", " << avltree.size()
+                 << " keys" << endl;
+        }
+    }
+    double secs = chrono::duration<double>(
+        chrono::steady_clock::now() - start).count();
+
+    cout << "replayed " << count << " commands in " << fixed
+         << setprecision(3) << secs * 1e3 << " ms";
+    if (secs > 0) cout << ", " << setprecision(0) << count / secs << " ops/s";
+    cout << "; final height " << avltree.height() << ", "
+         << avltree.size() << " keys" << endl;
+    if (paced) {
+        cout << "worst lag behind the recorded pacing "
+             << chrono::duration_cast<chrono::microseconds>(max_lag).count()
+             << " us" << endl;
+    }
+
+    // throughput is per unit of time spent in the command itself
+    cout << left << setw(8) << "command" << right << setw(10) << "count"
+         << setw(10) << "ok" << setw(12) << "ops/s" << setw(9) << "p50"
+         << setw(9) << "p90" << setw(9) << "p99" << setw(9) << "p999"
+         << setw(9) << "max" << "  (ns)" << endl;
+    for (size_t op = 1; op <= CMD_LAST; ++op) {
+        const LatencyHistogram& h = hist[op];
+        if (h.count() == 0) continue;
+        cout << left << setw(8) << command_name(command_t(op)) << right
+             << setw(10) << h.count() << setw(10) << succeeded[op]
+             << setw(12) << setprecision(0)
+             << (h.total() > 0 ? h.count() * 1e9 / h.total() : 0.0)
+             << setw(9) << h.percentile(0.50) << setw(9) << h.percentile(0.90)
+             << setw(9) << h.percentile(0.99) << setw(9) << h.percentile(0.999)
+             << setw(9) << h.max() << endl;
+    }
+}
+
+void print_tree()
+{
+    RenderFrame frame;
+    frame.preorder = avltree.preorder_sequence();
+    frame.inorder = avltree.inorder_sequence();
+    draw_frame(frame);
+}
+
+void draw_frame(const RenderFrame& frame)
+{
+    const vector<string>& povec = frame.preorder;
+    const vector<string>& iovec = frame.inorder;
+    BTNode<string>* tree = construct_tree(povec, 0, iovec, 0, iovec.size());
+    cout << term_cc(CYAN); 
+    symmetric_print(tree);
+    cout << endl << term_cc();
+    clear_tree(tree);
+}
+
+void export_tree(const string& path)
+{
+    ofstream file(path.c_str(), ios::binary | ios::trunc);
+    if (!file) throw runtime_error("cannot create " + path);
+    bool svg = path.size() >= 4 &&
+               path.compare(path.size() - 4, 4, ".svg") == 0;
+    if (svg) avltree.export_svg(file, true);
+    else avltree.export_dot(file, true);
+    file.close();
+    if (!file) throw runtime_error("error writing " + path);
+}
+
+void show_tree()
+{
+    if (pipeline == NULL) print_tree();
+    else if (per_batch) tree_changed = true;
+    else publish_tree();
+}
+
+// the snapshot is the only cost of drawing left to the command itself
+void publish_tree()
+{
+    shared_ptr<RenderFrame> frame = make_shared<RenderFrame>();
+    frame->preorder = avltree.preorder_sequence();
+    frame->inorder = avltree.inorder_sequence();
+    pipeline->publish(frame);
+    tree_changed = false;
+}
+
+void insert_key(string_view key) 
 {
-    if (!avltree.insert(key)) {
-        ostringstream oss;
-        oss << "The key " << key << " already exists";
-        note(oss.str());
+    if (!avltree.insert(string(key))) {
+        diagnostics.report(Diagnostics::DUPLICATE_INSERT, key);
         return;
-    } else {
-        vector<string> povec = avltree.preorder_sequence();
-        vector<string> iovec = avltree.inorder_sequence();
-        BTNode<string>* tree = construct_tree(povec, 0, iovec, 0, iovec.size());
-        cout << term_cc(CYAN); 
-        symmetric_print(tree);
-        cout << endl << term_cc();
-        clear_tree(tree);
+    } else if (!quiet) {
+        show_tree();
     }
 }
 
-void remove_key(string key) 
+void remove_key(string_view key) 
 {
-    if (!avltree.remove(key)) {
-        ostringstream oss;
-        oss << "The key " << key << " does not exist";
-        note(oss.str());
+    if (!avltree.remove(string(key))) {
+        diagnostics.report(Diagnostics::MISSING_REMOVE, key);
         return;
-    } else {
-        vector<string> povec = avltree.preorder_sequence();
-        vector<string> iovec = avltree.inorder_sequence();
-        BTNode<string>* tree = construct_tree(povec, 0, iovec, 0, iovec.size());
-        cout << term_cc(CYAN); 
-        symmetric_print(tree);
-        cout << endl << term_cc();
-        clear_tree(tree);
+    } else if (!quiet) {
+        show_tree();
     }
 }
 